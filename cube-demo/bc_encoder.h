@@ -0,0 +1,383 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Block compression of RGBA8 images to BC1 and BC7.
+//
+// Both encoders fit a line through the colors of each 4x4 block (the
+// principal axis of their covariance, by power iteration), put the
+// endpoints at the extreme projections onto it and give each texel the
+// index nearest its own projection.  Projecting all 16 texels takes four
+// pmaddwd with SSE2 (part of x86-64); the rest is per block.
+//
+//  - bc1: the four-color mode, 8 bytes per block.  Alpha is dropped.
+//  - bc7: mode 6 only, 16 bytes per block: one subset, RGBA endpoints of
+//    7 bits plus a shared low bit each, and 16 interpolation steps.  The
+//    endpoints are refitted to the chosen indices by least squares once,
+//    and kept if that lowers the error.
+//
+// Rows of blocks go to several threads.  Blocks past the right or bottom
+// edge repeat the last column or row.
+
+#ifndef BC_ENCODER_H
+#define BC_ENCODER_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define BC_ENCODER_SSE2 1
+#include <emmintrin.h>
+#endif
+
+enum class bc_format { bc1, bc7 };
+
+static inline uint32_t bc_block_bytes(bc_format format) { return format == bc_format::bc1 ? 8 : 16; }
+
+// The 16 texels of block (bx, by), RGBA, row by row
+static inline void bc_load_block(uint8_t const *rgba, size_t pitch, uint32_t width, uint32_t height, uint32_t bx, uint32_t by,
+                                 uint8_t block[64]) {
+    for (uint32_t y = 0; y < 4; y++) {
+        uint8_t const *row = rgba + std::min(4 * by + y, height - 1) * pitch;
+        for (uint32_t x = 0; x < 4; x++) {
+            memcpy(block + 16 * y + 4 * x, row + 4 * std::min(4 * bx + x, width - 1), 4);
+        }
+    }
+}
+
+// dots[i] = texel i . axis, with axis components within [-255, 255]
+static inline void bc_project(uint8_t const block[64], int32_t const axis[4], int32_t dots[16]) {
+#if defined(BC_ENCODER_SSE2)
+    __m128i const zero = _mm_setzero_si128();
+    __m128i const a = _mm_setr_epi16((int16_t)axis[0], (int16_t)axis[1], (int16_t)axis[2], (int16_t)axis[3], (int16_t)axis[0],
+                                     (int16_t)axis[1], (int16_t)axis[2], (int16_t)axis[3]);
+    for (int i = 0; i < 4; i++) {
+        // Each pmaddwd leaves r*ar + g*ag and b*ab + a*aa for two texels
+        __m128i const p = _mm_loadu_si128((__m128i const *)(block + 16 * i));
+        __m128 const lo = _mm_castsi128_ps(_mm_madd_epi16(_mm_unpacklo_epi8(p, zero), a));
+        __m128 const hi = _mm_castsi128_ps(_mm_madd_epi16(_mm_unpackhi_epi8(p, zero), a));
+        __m128i const even = _mm_castps_si128(_mm_shuffle_ps(lo, hi, _MM_SHUFFLE(2, 0, 2, 0)));
+        __m128i const odd = _mm_castps_si128(_mm_shuffle_ps(lo, hi, _MM_SHUFFLE(3, 1, 3, 1)));
+        _mm_storeu_si128((__m128i *)(dots + 4 * i), _mm_add_epi32(even, odd));
+    }
+#else
+    for (int i = 0; i < 16; i++) {
+        uint8_t const *p = block + 4 * i;
+        dots[i] = p[0] * axis[0] + p[1] * axis[1] + p[2] * axis[2] + p[3] * axis[3];
+    }
+#endif
+}
+
+// Endpoints of the line through the first `channels` channels of the
+// block, ordered by projection and clamped to [0, 255]
+static inline void bc_fit_line(uint8_t const block[64], int channels, float lo[4], float hi[4]) {
+    float mean[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+    for (int i = 0; i < 16; i++) {
+        for (int c = 0; c < channels; c++) {
+            mean[c] += block[4 * i + c] * (1.0f / 16.0f);
+        }
+    }
+
+    float cov[4][4] = {};
+    for (int i = 0; i < 16; i++) {
+        float d[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+        for (int c = 0; c < channels; c++) {
+            d[c] = block[4 * i + c] - mean[c];
+        }
+        for (int r = 0; r < 4; r++) {
+            for (int c = 0; c < 4; c++) {
+                cov[r][c] += d[r] * d[c];
+            }
+        }
+    }
+
+    // Power iteration from the diagonal, which is never orthogonal to the
+    // principal axis unless the block is flat
+    float v[4] = {1.0f, 1.0f, 1.0f, channels == 4 ? 1.0f : 0.0f};
+    for (int iteration = 0; iteration < 8; iteration++) {
+        float w[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+        float largest = 0.0f;
+        for (int r = 0; r < 4; r++) {
+            for (int c = 0; c < 4; c++) {
+                w[r] += cov[r][c] * v[c];
+            }
+            largest = std::max(largest, std::fabs(w[r]));
+        }
+        if (largest < 1e-6f) {
+            break;
+        }
+        for (int c = 0; c < 4; c++) {
+            v[c] = w[c] / largest;
+        }
+    }
+
+    int32_t axis[4] = {0, 0, 0, 0};
+    for (int c = 0; c < channels; c++) {
+        axis[c] = (int32_t)std::lround(v[c] * 255.0f);
+    }
+    int32_t const axis_length2 = axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2] + axis[3] * axis[3];
+
+    int32_t dots[16];
+    bc_project(block, axis, dots);
+    int32_t const dmin = *std::min_element(dots, dots + 16);
+    int32_t const dmax = *std::max_element(dots, dots + 16);
+
+    float const dmean = mean[0] * axis[0] + mean[1] * axis[1] + mean[2] * axis[2] + mean[3] * axis[3];
+    float const tmin = axis_length2 ? (dmin - dmean) / axis_length2 : 0.0f;
+    float const tmax = axis_length2 ? (dmax - dmean) / axis_length2 : 0.0f;
+    for (int c = 0; c < 4; c++) {
+        lo[c] = std::min(std::max(mean[c] + tmin * axis[c], 0.0f), 255.0f);
+        hi[c] = std::min(std::max(mean[c] + tmax * axis[c], 0.0f), 255.0f);
+    }
+}
+
+static inline uint16_t bc1_pack_565(float const color[3]) {
+    uint32_t const r = (uint32_t)std::lround(color[0] * (31.0f / 255.0f));
+    uint32_t const g = (uint32_t)std::lround(color[1] * (63.0f / 255.0f));
+    uint32_t const b = (uint32_t)std::lround(color[2] * (31.0f / 255.0f));
+    return (uint16_t)((r << 11) | (g << 5) | b);
+}
+
+static inline void bc1_unpack_565(uint16_t packed, int32_t color[4]) {
+    uint32_t const r = packed >> 11, g = (packed >> 5) & 63, b = packed & 31;
+    color[0] = (int32_t)((r << 3) | (r >> 2));
+    color[1] = (int32_t)((g << 2) | (g >> 4));
+    color[2] = (int32_t)((b << 3) | (b >> 2));
+    color[3] = 0;
+}
+
+static inline void bc1_encode_block(uint8_t const block[64], uint8_t out[8]) {
+    float lo[4], hi[4];
+    bc_fit_line(block, 3, lo, hi);
+
+    // The four-color mode needs c0 > c1
+    uint16_t c0 = bc1_pack_565(hi);
+    uint16_t c1 = bc1_pack_565(lo);
+    if (c0 < c1) {
+        std::swap(c0, c1);
+    }
+
+    uint32_t indices = 0;
+    if (c0 != c1) {
+        int32_t e0[4], e1[4];
+        bc1_unpack_565(c0, e0);
+        bc1_unpack_565(c1, e1);
+        int32_t const axis[4] = {e0[0] - e1[0], e0[1] - e1[1], e0[2] - e1[2], 0};
+        int32_t const base = e1[0] * axis[0] + e1[1] * axis[1] + e1[2] * axis[2];
+        int32_t const length2 = axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2];
+
+        int32_t dots[16];
+        bc_project(block, axis, dots);
+
+        // Steps from c1 (0) to c0 (3), and the index of each
+        static uint32_t const step_index[4] = {1, 3, 2, 0};
+        for (int i = 0; i < 16; i++) {
+            int32_t const step = (int32_t)std::floor(3.0f * (dots[i] - base) / length2 + 0.5f);
+            indices |= step_index[std::min(std::max(step, 0), 3)] << (2 * i);
+        }
+    }
+
+    memcpy(out, &c0, 2);
+    memcpy(out + 2, &c1, 2);
+    memcpy(out + 4, &indices, 4);
+}
+
+static uint32_t const BC7_WEIGHTS[16] = {0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64};
+
+// A mode 6 endpoint: 7 bits per channel and the low bit they share
+struct bc7_endpoint {
+    uint32_t q[4];
+    uint32_t p;
+
+    int32_t value(int c) const { return (int32_t)((q[c] << 1) | p); }
+};
+
+static inline bc7_endpoint bc7_quantize(float const color[4]) {
+    bc7_endpoint best = {};
+    float best_error = 1e30f;
+    for (uint32_t p = 0; p < 2; p++) {
+        bc7_endpoint e;
+        e.p = p;
+        float error = 0.0f;
+        for (int c = 0; c < 4; c++) {
+            e.q[c] = (uint32_t)std::min(std::max(std::lround((color[c] - p) * 0.5f), 0l), 127l);
+            float const d = e.value(c) - color[c];
+            error += d * d;
+        }
+        if (error < best_error) {
+            best = e;
+            best_error = error;
+        }
+    }
+    return best;
+}
+
+// Picks the index of every texel for endpoints e0 and e1, and returns the
+// squared error of the result
+static inline uint32_t bc7_choose_indices(uint8_t const block[64], bc7_endpoint const &e0, bc7_endpoint const &e1,
+                                          uint32_t indices[16]) {
+    int32_t a[4], b[4], axis[4];
+    int32_t base = 0, length2 = 0;
+    for (int c = 0; c < 4; c++) {
+        a[c] = e0.value(c);
+        b[c] = e1.value(c);
+        axis[c] = b[c] - a[c];
+        base += a[c] * axis[c];
+        length2 += axis[c] * axis[c];
+    }
+
+    int32_t dots[16];
+    bc_project(block, axis, dots);
+
+    uint32_t error = 0;
+    for (int i = 0; i < 16; i++) {
+        int32_t const guess = length2 ? (int32_t)std::floor(15.0f * (dots[i] - base) / length2 + 0.5f) : 0;
+        int32_t const first = std::min(std::max(guess - 1, 0), 15);
+        int32_t const last = std::min(std::max(guess + 1, 0), 15);
+
+        // The weights are not quite uniform, so check the neighbours
+        uint32_t best_error = UINT32_MAX;
+        for (int32_t index = first; index <= last; index++) {
+            uint32_t const w = BC7_WEIGHTS[index];
+            uint32_t e = 0;
+            for (int c = 0; c < 4; c++) {
+                int32_t const d = (int32_t)((a[c] * (64 - w) + b[c] * w + 32) >> 6) - block[4 * i + c];
+                e += (uint32_t)(d * d);
+            }
+            if (e < best_error) {
+                best_error = e;
+                indices[i] = (uint32_t)index;
+            }
+        }
+        error += best_error;
+    }
+    return error;
+}
+
+// Least squares endpoints for fixed indices; false if they are degenerate
+static inline bool bc7_refit(uint8_t const block[64], uint32_t const indices[16], float lo[4], float hi[4]) {
+    float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+    float x[4] = {0.0f, 0.0f, 0.0f, 0.0f}, y[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+    for (int i = 0; i < 16; i++) {
+        float const w = BC7_WEIGHTS[indices[i]] / 64.0f;
+        aa += (1.0f - w) * (1.0f - w);
+        ab += (1.0f - w) * w;
+        bb += w * w;
+        for (int c = 0; c < 4; c++) {
+            x[c] += (1.0f - w) * block[4 * i + c];
+            y[c] += w * block[4 * i + c];
+        }
+    }
+
+    float const det = aa * bb - ab * ab;
+    if (std::fabs(det) < 1e-6f) {
+        return false;
+    }
+    for (int c = 0; c < 4; c++) {
+        lo[c] = std::min(std::max((bb * x[c] - ab * y[c]) / det, 0.0f), 255.0f);
+        hi[c] = std::min(std::max((aa * y[c] - ab * x[c]) / det, 0.0f), 255.0f);
+    }
+    return true;
+}
+
+static inline void bc7_encode_block(uint8_t const block[64], uint8_t out[16]) {
+    float lo[4], hi[4];
+    bc_fit_line(block, 4, lo, hi);
+
+    bc7_endpoint e0 = bc7_quantize(lo);
+    bc7_endpoint e1 = bc7_quantize(hi);
+    uint32_t indices[16];
+    uint32_t const error = bc7_choose_indices(block, e0, e1, indices);
+
+    if (error && bc7_refit(block, indices, lo, hi)) {
+        bc7_endpoint const r0 = bc7_quantize(lo);
+        bc7_endpoint const r1 = bc7_quantize(hi);
+        uint32_t refit_indices[16];
+        if (bc7_choose_indices(block, r0, r1, refit_indices) < error) {
+            e0 = r0;
+            e1 = r1;
+            memcpy(indices, refit_indices, sizeof(indices));
+        }
+    }
+
+    // The first index is stored without its top bit, which must be 0
+    if (indices[0] & 8) {
+        std::swap(e0, e1);
+        for (auto &index : indices) {
+            index = 15 - index;
+        }
+    }
+
+    uint64_t bits[2] = {0, 0};
+    uint32_t position = 0;
+    auto const put = [&](uint64_t value, uint32_t count) {
+        for (uint32_t i = 0; i < count; i++, position++) {
+            bits[position >> 6] |= ((value >> i) & 1) << (position & 63);
+        }
+    };
+    put(1 << 6, 7);
+    for (int c = 0; c < 4; c++) {
+        put(e0.q[c], 7);
+        put(e1.q[c], 7);
+    }
+    put(e0.p, 1);
+    put(e1.p, 1);
+    put(indices[0], 3);
+    for (int i = 1; i < 16; i++) {
+        put(indices[i], 4);
+    }
+    memcpy(out, bits, 16);
+}
+
+static inline void bc_encode_rows(bc_format format, uint8_t const *rgba, size_t pitch, uint32_t width, uint32_t height, uint8_t *dst,
+                                  uint32_t first, uint32_t end) {
+    uint32_t const blocks_x = (width + 3) / 4;
+    uint32_t const block_bytes = bc_block_bytes(format);
+    uint8_t block[64];
+    for (uint32_t by = first; by < end; by++) {
+        uint8_t *out = dst + (size_t)by * blocks_x * block_bytes;
+        for (uint32_t bx = 0; bx < blocks_x; bx++, out += block_bytes) {
+            bc_load_block(rgba, pitch, width, height, bx, by, block);
+            if (format == bc_format::bc1) {
+                bc1_encode_block(block, out);
+            } else {
+                bc7_encode_block(block, out);
+            }
+        }
+    }
+}
+
+// Encodes a width x height RGBA8 image, rows pitch bytes apart, into dst,
+// which takes ceil(width / 4) * ceil(height / 4) blocks in row order
+static inline void bc_encode(bc_format format, uint8_t const *rgba, size_t pitch, uint32_t width, uint32_t height, uint8_t *dst,
+                             uint32_t max_threads) {
+    uint32_t const block_rows = (height + 3) / 4;
+    uint32_t const bands = std::max(1u, std::min(max_threads, block_rows));
+
+    std::vector<std::thread> threads;
+    for (uint32_t band = 1; band < bands; band++) {
+        uint32_t const first = (uint32_t)((uint64_t)block_rows * band / bands);
+        uint32_t const end = (uint32_t)((uint64_t)block_rows * (band + 1) / bands);
+        threads.emplace_back(bc_encode_rows, format, rgba, pitch, width, height, dst, first, end);
+    }
+    bc_encode_rows(format, rgba, pitch, width, height, dst, 0, block_rows / bands);
+    for (auto &thread : threads) {
+        thread.join();
+    }
+}
+
+#endif  // BC_ENCODER_H
@@ -0,0 +1,212 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// One descriptor set for every draw, built on VK_EXT_descriptor_indexing.
+//
+// The set holds two storage buffers and a large array of combined image
+// samplers; shaders pick what they need with indices from push constants, so
+// a frame binds the set once per command buffer however many objects,
+// materials or textures it draws.  Buffers are written once, before the set
+// is first bound.
+//
+// Textures go into free slots of the array.  The array is update-after-bind,
+// partially bound and may be updated while pending, which allows writing a
+// slot that no frame in flight reads without waiting for those frames.  A
+// slot that still may be read is never rewritten: remove_texture() takes the
+// last frame that uses it and reclaim() frees it once that frame completes.
+//
+// Not thread safe.  The device needs the extension, runtimeDescriptorArray,
+// descriptorBindingPartiallyBound, descriptorBindingSampledImageUpdateAfterBind
+// and descriptorBindingUpdateUnusedWhilePending.  Include vulkan.hpp (with
+// VULKAN_HPP_NO_EXCEPTIONS) before this header.
+
+#ifndef BINDLESS_TABLE_H
+#define BINDLESS_TABLE_H
+
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+class bindless_table {
+   public:
+    // Binding numbers, as declared by the shaders
+    static uint32_t const OBJECTS = 0;    // Storage buffer, vertex stage
+    static uint32_t const MATERIALS = 1;  // Storage buffer, fragment stage
+    static uint32_t const TEXTURES = 2;   // sampler2D[capacity], fragment stage
+
+    static uint32_t const NO_SLOT = UINT32_MAX;
+
+    ~bindless_table() { destroy(); }
+
+    bool init(vk::Device device, uint32_t capacity) {
+        this->device = device;
+        texture_capacity = capacity;
+
+        vk::DescriptorSetLayoutBinding const bindings[3] = {
+            vk::DescriptorSetLayoutBinding()
+                .setBinding(OBJECTS)
+                .setDescriptorType(vk::DescriptorType::eStorageBuffer)
+                .setDescriptorCount(1)
+                .setStageFlags(vk::ShaderStageFlagBits::eVertex),
+            vk::DescriptorSetLayoutBinding()
+                .setBinding(MATERIALS)
+                .setDescriptorType(vk::DescriptorType::eStorageBuffer)
+                .setDescriptorCount(1)
+                .setStageFlags(vk::ShaderStageFlagBits::eFragment),
+            vk::DescriptorSetLayoutBinding()
+                .setBinding(TEXTURES)
+                .setDescriptorType(vk::DescriptorType::eCombinedImageSampler)
+                .setDescriptorCount(capacity)
+                .setStageFlags(vk::ShaderStageFlagBits::eFragment)};
+
+        // Only the texture array changes after the set is bound
+        vk::DescriptorBindingFlagsEXT const binding_flags[3] = {
+            vk::DescriptorBindingFlagsEXT(), vk::DescriptorBindingFlagsEXT(),
+            vk::DescriptorBindingFlagBitsEXT::eUpdateAfterBind | vk::DescriptorBindingFlagBitsEXT::ePartiallyBound |
+                vk::DescriptorBindingFlagBitsEXT::eUpdateUnusedWhilePending};
+        auto const flags_info =
+            vk::DescriptorSetLayoutBindingFlagsCreateInfoEXT().setBindingCount(3).setPBindingFlags(binding_flags);
+
+        auto const layout_info = vk::DescriptorSetLayoutCreateInfo()
+                                     .setPNext(&flags_info)
+                                     .setFlags(vk::DescriptorSetLayoutCreateFlagBits::eUpdateAfterBindPoolEXT)
+                                     .setBindingCount(3)
+                                     .setPBindings(bindings);
+        auto result = device.createDescriptorSetLayout(&layout_info, nullptr, &set_layout);
+        if (!check(result, "vkCreateDescriptorSetLayout")) {
+            return false;
+        }
+
+        vk::DescriptorPoolSize const pool_sizes[2] = {
+            vk::DescriptorPoolSize().setType(vk::DescriptorType::eStorageBuffer).setDescriptorCount(2),
+            vk::DescriptorPoolSize().setType(vk::DescriptorType::eCombinedImageSampler).setDescriptorCount(capacity)};
+        auto const pool_info = vk::DescriptorPoolCreateInfo()
+                                   .setFlags(vk::DescriptorPoolCreateFlagBits::eUpdateAfterBindEXT)
+                                   .setMaxSets(1)
+                                   .setPoolSizeCount(2)
+                                   .setPPoolSizes(pool_sizes);
+        result = device.createDescriptorPool(&pool_info, nullptr, &pool);
+        if (!check(result, "vkCreateDescriptorPool")) {
+            return false;
+        }
+
+        auto const alloc_info =
+            vk::DescriptorSetAllocateInfo().setDescriptorPool(pool).setDescriptorSetCount(1).setPSetLayouts(&set_layout);
+        result = device.allocateDescriptorSets(&alloc_info, &descriptor_set);
+        if (!check(result, "vkAllocateDescriptorSets")) {
+            return false;
+        }
+
+        // Handed out lowest first
+        free_slots.clear();
+        for (uint32_t slot = capacity; slot > 0; slot--) {
+            free_slots.push_back(slot - 1);
+        }
+        return true;
+    }
+
+    void destroy() {
+        if (!device) {
+            return;
+        }
+        device.destroyDescriptorPool(pool, nullptr);
+        device.destroyDescriptorSetLayout(set_layout, nullptr);
+        pool = vk::DescriptorPool();
+        set_layout = vk::DescriptorSetLayout();
+        descriptor_set = vk::DescriptorSet();
+        free_slots.clear();
+        retired_slots.clear();
+        device = vk::Device();
+    }
+
+    // Only before the set is first bound
+    void set_buffer(uint32_t binding, vk::Buffer buffer) {
+        auto const buffer_info = vk::DescriptorBufferInfo().setBuffer(buffer).setOffset(0).setRange(VK_WHOLE_SIZE);
+        auto const write = vk::WriteDescriptorSet()
+                               .setDstSet(descriptor_set)
+                               .setDstBinding(binding)
+                               .setDescriptorCount(1)
+                               .setDescriptorType(vk::DescriptorType::eStorageBuffer)
+                               .setPBufferInfo(&buffer_info);
+        device.updateDescriptorSets(1, &write, 0, nullptr);
+        writes++;
+    }
+
+    // The slot the texture went into, NO_SLOT when every slot is taken
+    uint32_t add_texture(vk::Sampler sampler, vk::ImageView view, vk::ImageLayout layout) {
+        if (free_slots.empty()) {
+            return NO_SLOT;
+        }
+        uint32_t const slot = free_slots.back();
+        free_slots.pop_back();
+
+        auto const image_info = vk::DescriptorImageInfo().setSampler(sampler).setImageView(view).setImageLayout(layout);
+        auto const write = vk::WriteDescriptorSet()
+                               .setDstSet(descriptor_set)
+                               .setDstBinding(TEXTURES)
+                               .setDstArrayElement(slot)
+                               .setDescriptorCount(1)
+                               .setDescriptorType(vk::DescriptorType::eCombinedImageSampler)
+                               .setPImageInfo(&image_info);
+        device.updateDescriptorSets(1, &write, 0, nullptr);
+        writes++;
+        return slot;
+    }
+
+    // The slot is reused once last_frame has completed
+    void remove_texture(uint32_t slot, uint64_t last_frame) { retired_slots.push_back({slot, last_frame}); }
+
+    void reclaim(uint64_t completed_frame) {
+        for (size_t i = 0; i < retired_slots.size();) {
+            if (retired_slots[i].last_frame > completed_frame) {
+                i++;
+                continue;
+            }
+            free_slots.push_back(retired_slots[i].slot);
+            retired_slots[i] = retired_slots.back();
+            retired_slots.pop_back();
+        }
+    }
+
+    vk::DescriptorSetLayout layout() const { return set_layout; }
+    vk::DescriptorSet set() const { return descriptor_set; }
+    uint32_t capacity() const { return texture_capacity; }
+    uint32_t textures_in_use() const { return texture_capacity - (uint32_t)free_slots.size(); }
+    uint32_t descriptor_writes() const { return writes; }
+
+   private:
+    struct retired_slot {
+        uint32_t slot;
+        uint64_t last_frame;
+    };
+
+    static bool check(vk::Result result, char const *what) {
+        if (result != vk::Result::eSuccess) {
+            fprintf(stderr, "%s failed for the bindless descriptors: %s\n", what, vk::to_string(result).c_str());
+            return false;
+        }
+        return true;
+    }
+
+    vk::Device device;
+    vk::DescriptorSetLayout set_layout;
+    vk::DescriptorPool pool;
+    vk::DescriptorSet descriptor_set;
+    uint32_t texture_capacity = 0;
+    std::vector<uint32_t> free_slots;
+    std::vector<retired_slot> retired_slots;
+    uint32_t writes = 0;
+};
+
+#endif  // BINDLESS_TABLE_H
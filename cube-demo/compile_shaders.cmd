@@ -0,0 +1,7 @@
+C:\VulkanSDK\1.1.73.0\Bin\glslangValidator.exe -V -o cube_instanced.vert.spv cube_instanced.vert
+C:\VulkanSDK\1.1.73.0\Bin\glslangValidator.exe -V -o cube_mesh.vert.spv cube_mesh.vert
+C:\VulkanSDK\1.1.73.0\Bin\glslangValidator.exe -V -o cube_cull.comp.spv cube_cull.comp
+C:\VulkanSDK\1.1.73.0\Bin\glslangValidator.exe -V -o cube_depth_reduce.comp.spv cube_depth_reduce.comp
+C:\VulkanSDK\1.1.73.0\Bin\glslangValidator.exe -V -o cube_bindless.vert.spv cube_bindless.vert
+C:\VulkanSDK\1.1.73.0\Bin\glslangValidator.exe -V -o cube_mesh_bindless.vert.spv cube_mesh_bindless.vert
+C:\VulkanSDK\1.1.73.0\Bin\glslangValidator.exe -V -o cube_bindless.frag.spv cube_bindless.frag
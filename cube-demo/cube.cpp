@@ -18,8 +18,10 @@
  * Author: Jeremy Hayes <jeremy@lunarg.com>
  */
 
+#ifdef _WIN32
 #include <windows.h>
 #define VK_USE_PLATFORM_WIN32_KHR
+#endif
 
 #if defined(VK_USE_PLATFORM_XLIB_KHR) || defined(VK_USE_PLATFORM_XCB_KHR)
 #include <X11/Xutil.h>
@@ -27,13 +29,20 @@
 #include <linux/input.h>
 #endif
 
+#include <algorithm>
 #include <cassert>
+#include <chrono>
 #include <cinttypes>
+#include <cstddef>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 #include <csignal>
 #include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
 
 #if defined(VK_USE_PLATFORM_MIR_KHR)
 #warning "Cubepp does not have code for Mir at this time"
@@ -45,6 +54,19 @@
 #include <vulkan/vk_sdk_platform.h>
 
 #include "linmath.h"
+#include "batch_transform.h"
+#include "device_allocator.h"
+#include "job_system.h"
+#include "texture_streamer.h"
+#include "frame_scheduler.h"
+#include "pipeline_registry.h"
+#include "shader_library.h"
+#include "bindless_table.h"
+#include "ppm_decoder.h"
+#include "ktx2.h"
+#include "mesh_loader.h"
+#include "vertex_quantize.h"
+#include "trace.h"
 
 #ifndef NDEBUG
 #define VERIFY(x) assert(x)
@@ -57,8 +79,8 @@
 #define APP_NAME_STR_LEN 80
 #endif
 
-// Allow a maximum of two outstanding presentation operations.
-#define FRAME_LAG 2
+// Frames in flight are at most this; --frame_lag picks how many, 2 by default
+#define MAX_FRAME_LAG frame_scheduler::MAX_FRAMES
 
 #define ARRAY_SIZE(a) (sizeof(a) / sizeof(a[0]))
 
@@ -83,14 +105,60 @@ struct texture_object {
     vk::Image image;
     vk::ImageLayout imageLayout{vk::ImageLayout::eUndefined};
 
-    vk::MemoryAllocateInfo mem_alloc;
-    vk::DeviceMemory mem;
+    device_allocation alloc;
     vk::ImageView view;
 
     int32_t tex_width{0};
     int32_t tex_height{0};
+    uint32_t mip_levels{1};
+    vk::Format format{vk::Format::eR8G8B8A8Unorm};
+};
+
+// CPU time spent in each phase of Demo::draw, in milliseconds, plus the GPU
+// time between the first and last command of the frame.
+struct frame_timing {
+    double fence_wait;
+    double acquire;
+    double update;
+    double record;
+    double submit;
+    double present;
+    double cpu_total;
+    double gpu;  // Negative until the frame's timestamp queries are resolved
+};
+
+typedef std::chrono::steady_clock bench_clock;
+
+static double elapsed_ms(bench_clock::time_point const &from, bench_clock::time_point const &to) {
+    return std::chrono::duration<double, std::milli>(to - from).count();
+}
+
+static uint64_t fnv1a_64(void const *data, size_t size, uint64_t hash = 14695981039346656037ull) {
+    uint8_t const *bytes = (uint8_t const *)data;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+// Header written in front of the vkGetPipelineCacheData blob.  The blob's own
+// header has no driver version, so without this a driver update would hand
+// the new driver a cache built by the old one.
+struct pipeline_cache_file_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t vendor_id;
+    uint32_t device_id;
+    uint32_t driver_version;
+    uint8_t uuid[VK_UUID_SIZE];
+    uint64_t data_size;
+    uint64_t data_hash;
 };
 
+static uint32_t const pipeline_cache_magic = 0x50434255;  // "UBCP"
+static uint32_t const pipeline_cache_version = 1;
+
 static char const *const tex_files[] = {"lunarg.ppm"};
 
 static int validation_error = 0;
@@ -107,8 +175,70 @@ struct vktexcube_vs_uniform {
     float mvp[4][4];
     float position[12 * 3][4];
     float attr[12 * 3][4];
+    float vp[4][4];  // Only read by cube_instanced.vert
+
+    // Only read by cube_cull.comp
+    float frustum[6][4];
+    float cull[4];  // Instance count, depth pyramid enabled, pyramid width and height
+};
+
+// Push constants of the --bindless shaders, set before every draw
+struct bindless_draw {
+    uint32_t object;    // First vec4 of the object's arena entry
+    uint32_t material;  // Index into the materials buffer
+    uint32_t texture;   // Slot in the bindless texture array
 };
 
+// Where one cube of the scene sits; the spinning model matrix is applied on top
+struct object_placement {
+    float x, y, z;
+    float scale;
+};
+
+// Gribb/Hartmann: the planes of Vulkan's clip volume (-w <= x, y <= w and
+// 0 <= z <= w) pulled back through VP, normalized so that they give distances
+static void frustum_planes(mat4x4 VP, float planes[6][4]) {
+    for (int i = 0; i < 6; i++) {
+        int const axis = i / 2;
+        float const sign = (i & 1) ? -1.0f : 1.0f;
+        for (int c = 0; c < 4; c++) {
+            // Rows of the column-major VP
+            float const w = VP[c][3];
+            float const v = VP[c][axis];
+            planes[i][c] = (axis == 2 && sign > 0.0f) ? v : w + sign * v;
+        }
+
+        float const length = sqrtf(planes[i][0] * planes[i][0] + planes[i][1] * planes[i][1] + planes[i][2] * planes[i][2]);
+        for (int c = 0; c < 4; c++) {
+            planes[i][c] /= length;
+        }
+    }
+}
+
+// Packs count cubes into a grid that occupies roughly the space of the single cube
+static void grid_placements(uint32_t count, std::vector<object_placement> &placements) {
+    placements.resize(count);
+
+    if (count == 1) {
+        placements[0] = {0.0f, 0.0f, 0.0f, 1.0f};
+        return;
+    }
+
+    uint32_t side = 1;
+    while (side * side * side < count) {
+        side++;
+    }
+
+    float const spacing = 4.0f / side;
+    float const origin = -0.5f * spacing * (side - 1);
+    for (uint32_t i = 0; i < count; i++) {
+        placements[i].x = origin + spacing * (i % side);
+        placements[i].y = origin + spacing * ((i / side) % side);
+        placements[i].z = origin + spacing * (i / (side * side));
+        placements[i].scale = 0.35f * spacing;
+    }
+}
+
 //--------------------------------------------------------------------------------------
 // Mesh and VertexFormat Data
 //--------------------------------------------------------------------------------------
@@ -204,13 +334,10 @@ static const float g_uv_buffer_data[] = {
 
 typedef struct {
     vk::Image image;
-    vk::CommandBuffer cmd;
     vk::CommandBuffer graphics_to_present_cmd;
     vk::ImageView view;
-    vk::Buffer uniform_buffer;
-    vk::DeviceMemory uniform_memory;
     vk::Framebuffer framebuffer;
-    vk::DescriptorSet descriptor_set;
+    device_allocation image_alloc;  // Only owned by us for headless offscreen images
 } SwapchainImageResources;
 
 struct Demo {
@@ -221,34 +348,79 @@ struct Demo {
     void create_device();
     void destroy_texture_image(texture_object *);
     void draw();
+    void draw_headless();
     void draw_build_cmd(vk::CommandBuffer);
+    void record_objects(vk::CommandBuffer, uint32_t, uint32_t);
+    void record_worker_slice(uint32_t, uint32_t);
+    void prepare_worker_recording();
+    void destroy_worker_recording();
+    void benchmark_recording();
+    uint32_t frame_command_buffers(vk::CommandBuffer *);
+    void record_frame_timing(frame_timing const &);
+    void resolve_gpu_timestamps(uint32_t);
+    void write_gpu_trace();
+    void prepare_timestamp_queries();
+    void destroy_timestamp_queries();
+    void write_benchmark_report();
+    void begin_init_cmd();
     void flush_init_cmd();
+    void release_init_cmd(bool);
     void init(int, char **);
     void init_connection();
     void init_vk();
+    void init_vk_headless();
     void init_vk_swapchain();
     void prepare();
     void prepare_buffers();
+    void prepare_offscreen_buffers();
+    void prepare_present_cmds();
     void prepare_cube_data_buffers();
+    void prepare_object_placements();
+    void destroy_uniform_arena();
+    void prepare_instance_buffers();
+    void prepare_culling();
+    void prepare_culling_sets();
+    void prepare_depth_pyramid();
+    void destroy_culling();
+    void record_culling(vk::CommandBuffer);
+    void record_depth_pyramid(vk::CommandBuffer);
+    vk::Pipeline create_compute_pipeline(char const *, vk::PipelineLayout);
+    void destroy_instance_buffers();
+    void prepare_mesh_buffers();
+    void destroy_mesh_buffers();
     void prepare_depth();
     void prepare_descriptor_layout();
     void prepare_descriptor_pool();
     void prepare_descriptor_set();
+    void write_descriptor_set(vk::DescriptorSet);
+    bool query_timeline_support();
+    bool query_bindless_support();
+    void prepare_bindless_descriptors();
+    void destroy_bindless_descriptors();
+    void prepare_frame_sync();
     void prepare_framebuffers();
-    vk::ShaderModule prepare_shader_module(const uint32_t *, size_t);
     vk::ShaderModule prepare_vs();
     vk::ShaderModule prepare_fs();
     void prepare_pipeline();
+    void reload_shaders();
+    void prepare_pipeline_cache();
+    bool load_pipeline_cache_data(std::vector<uint8_t> &);
+    void save_pipeline_cache();
     void prepare_render_pass();
-    void prepare_texture_image(const char *, texture_object *, vk::ImageTiling, vk::ImageUsageFlags, vk::MemoryPropertyFlags);
+    void prepare_placeholder_texture(texture_object *);
     void prepare_textures();
+    void update_streamed_textures();
+    void destroy_texture_streaming();
+    void pick_transfer_queue_family();
 
     void resize();
+    void destroy_retired_surfaces(bool);
+    void run_headless();
     void set_image_layout(vk::Image, vk::ImageAspectFlags, vk::ImageLayout, vk::ImageLayout, vk::AccessFlags,
                           vk::PipelineStageFlags, vk::PipelineStageFlags);
     void update_data_buffer();
-    bool loadTexture(const char *, uint8_t *, vk::SubresourceLayout *, int32_t *, int32_t *);
-    bool memory_type_from_properties(uint32_t, vk::MemoryPropertyFlags, uint32_t *);
+    bool loadTexture(const char *, texture_streamer::reserver const &);
+    void write_frame_ppm(char const *);
 
 #if defined(VK_USE_PLATFORM_WIN32_KHR)
     void run();
@@ -303,23 +475,58 @@ struct Demo {
 
     vk::SurfaceKHR surface;
     bool prepared;
-    bool use_staging_buffer;
     bool use_xlib;
     bool separate_present_queue;
+    bool headless;
+    char const *readback_file;
+    uint32_t last_frame_image;
+
+    // Frame-time benchmark (--benchmark)
+    char const *benchmark_file;
+    uint32_t benchmark_warmup;
+    std::vector<frame_timing> frame_timings;
+    vk::QueryPool timestamp_pool;
+    bool timestamps_supported;
+    vk::CommandBuffer timestamp_begin_cmds[MAX_FRAME_LAG];
+    vk::CommandBuffer timestamp_end_cmds[MAX_FRAME_LAG];
+    uint32_t timestamp_frame[MAX_FRAME_LAG];  // Index into frame_timings awaiting GPU results, or UINT32_MAX
+
+    // Chrome trace (--trace); frame timings and GPU timestamps are collected for it too
+    char const *trace_file;
+    uint64_t frame_submit_ns[MAX_FRAME_LAG];  // Trace clock at the slot's submission
+    struct gpu_trace_frame {
+        int64_t begin_ns;  // Device clock, unwrapped
+        int64_t end_ns;
+        uint64_t submit_ns;
+    };
+    std::vector<gpu_trace_frame> gpu_trace_frames;  // Moved to the trace clock at exit, when the offset is final
+    uint64_t gpu_trace_ticks;                       // Last begin timestamp, unwrapped
+
+    // Pipeline cache persisted between runs, and what it bought us
+    char const *pipeline_cache_file;
+    char const *pipeline_cache_status;
+    bench_clock::time_point start_time;
+    double pipeline_create_ms;
+    double startup_ms;  // Negative until the first frame has been submitted
 
     vk::Instance inst;
     vk::PhysicalDevice gpu;
     vk::Device device;
     vk::Queue graphics_queue;
     vk::Queue present_queue;
+    vk::Queue transfer_queue;  // The graphics queue unless the device has a transfer-only family
     uint32_t graphics_queue_family_index;
     uint32_t present_queue_family_index;
-    vk::Semaphore image_acquired_semaphores[FRAME_LAG];
-    vk::Semaphore draw_complete_semaphores[FRAME_LAG];
-    vk::Semaphore image_ownership_semaphores[FRAME_LAG];
+    uint32_t transfer_queue_family_index;
+    bool separate_transfer_queue;
+    vk::Semaphore image_acquired_semaphores[MAX_FRAME_LAG];
+    vk::Semaphore draw_complete_semaphores[MAX_FRAME_LAG];
+    vk::Semaphore image_ownership_semaphores[MAX_FRAME_LAG];
     vk::PhysicalDeviceProperties gpu_props;
     std::unique_ptr<vk::QueueFamilyProperties[]> queue_props;
     vk::PhysicalDeviceMemoryProperties memory_properties;
+    device_allocator allocator;
+    bool allocator_stats;
 
     uint32_t enabled_extension_count;
     uint32_t enabled_layer_count;
@@ -335,8 +542,11 @@ struct Demo {
     vk::SwapchainKHR swapchain;
     std::unique_ptr<SwapchainImageResources[]> swapchain_image_resources;
     vk::PresentModeKHR presentMode;
-    vk::Fence fences[FRAME_LAG];
-    uint32_t frame_index;
+    frame_scheduler frames;
+    uint32_t frame_lag;     // Frames in flight, from 1 to MAX_FRAME_LAG
+    bool timeline_frames;   // Pace them with a timeline semaphore where available
+    bool timeline_enabled;  // VK_KHR_timeline_semaphore is enabled on the device
+    uint32_t frame_index;   // Slot of the frame being prepared
 
     vk::CommandPool cmd_pool;
     vk::CommandPool present_cmd_pool;
@@ -344,28 +554,180 @@ struct Demo {
     struct {
         vk::Format format;
         vk::Image image;
-        vk::MemoryAllocateInfo mem_alloc;
-        vk::DeviceMemory mem;
+        device_allocation alloc;
         vk::ImageView view;
     } depth;
 
+    // What a resize replaced: the old swapchain (passed on as oldSwapchain),
+    // its views, framebuffers and ownership commands, the depth buffer and
+    // the depth pyramid.  The frames in flight still render with them, so
+    // they are destroyed once their last frame is reached rather than at once.
+    struct retired_surface {
+        vk::SwapchainKHR swapchain;
+        std::unique_ptr<SwapchainImageResources[]> images;
+        uint32_t image_count;
+        vk::Image depth_image;
+        device_allocation depth_alloc;
+        vk::ImageView depth_view;
+        vk::Image pyramid;
+        device_allocation pyramid_alloc;
+        vk::ImageView pyramid_view;
+        std::vector<vk::ImageView> level_views;
+        vk::Sampler pyramid_sampler;
+        vk::DescriptorPool culling_desc_pool;
+        uint64_t last_frame;  // The last frame that uses it
+    };
+    std::vector<retired_surface> retired_surfaces;
+
     static int32_t const texture_count = 1;
     texture_object textures[texture_count];
-    texture_object staging_texture;
 
+    // Textures stream in on the transfer queue (texture_streamer.h) while
+    // frames render; until then each slot holds a 1x1 placeholder.  Arrivals
+    // are swapped in by writing the spare descriptor set, once no frame in
+    // flight still uses it, and binding that instead.
+    texture_streamer streamer;
+    std::vector<streamed_texture> arrived_textures;
+    std::vector<vk::Semaphore> arrived_waits;
+    std::vector<vk::Semaphore> texture_waits[MAX_FRAME_LAG];  // Waited on by the slot's last submission
+    struct retired_texture {
+        texture_object texture;
+        uint64_t last_frame;  // The last frame that samples it
+    };
+    std::vector<retired_texture> retired_textures;
+    uint64_t spare_desc_set_last_frame;
+    std::vector<vk::Semaphore> submit_waits;
+    std::vector<vk::PipelineStageFlags> submit_wait_stages;
+    bench_clock::time_point texture_request_time;
+    double texture_resident_ms;  // Negative until every texture has arrived
+    uint32_t textures_pending;
+
+    // One persistently mapped uniform buffer for all frames in flight.  Frame
+    // slot f, object o lives at f * frame_stride + o * object_stride and is
+    // selected with a dynamic offset, so the hot path never maps memory.
     struct {
         vk::Buffer buf;
-        vk::MemoryAllocateInfo mem_alloc;
-        vk::DeviceMemory mem;
-        vk::DescriptorBufferInfo buffer_info;
+        device_allocation alloc;
+        vk::DeviceSize object_stride;
+        vk::DeviceSize frame_stride;
     } uniform_data;
 
+    uint32_t object_count;
+    std::vector<object_placement> objects;
+
+    // The objects as structure-of-arrays inputs for batch_transform, which
+    // writes every MVP straight into the frame's arena slot
+    // (--transform_kernel, --transform_benchmark).
+    std::vector<float> object_soa;
+    transform_soa object_transforms;
+    transform_kernel transform_kernel_choice;
+    bool transform_benchmark;
+
+    // PPM decoding (ppm_decoder.h): the kernel, and --decode_benchmark's file
+    ppm_kernel ppm_kernel_choice;
+    char const *decode_benchmark_file;
+
+    // Streamed textures get full mip chains unless --no_mips; --camera_distance
+    // scales the eye's distance so the cubes can be viewed minified
+    bool texture_mips;
+    float camera_distance;
+
+    // --texture: a PPM, or a KTX2 of RGBA8 or BCn levels made by texconv
+    char const *texture_file;
+
+    // Re-recorded every frame, one per frame slot, so they are only reused
+    // once the scheduler says the GPU is done with the slot's last frame.
+    vk::CommandBuffer draw_cmds[MAX_FRAME_LAG];
+
+    // Multi-threaded recording (--threads).  The objects are split into one
+    // slice per thread; each slice is recorded into a secondary command
+    // buffer from its own per-frame pool and executed from draw_cmds.
+    uint32_t record_threads;
+    uint32_t active_record_threads;  // Differs from record_threads only during --record_sweep
+    bool record_sweep;
+    job_system jobs;
+    std::vector<vk::CommandPool> worker_pools[MAX_FRAME_LAG];
+    std::vector<vk::CommandBuffer> worker_cmds[MAX_FRAME_LAG];
+    std::vector<std::pair<uint32_t, double>> record_sweep_ms;  // Thread count, mean recording time
+
+    // GPU-driven instancing (--instances).  Per-instance placements live in a
+    // storage buffer and the draw parameters in an indirect buffer, so a
+    // frame is one draw call whatever the instance count.
+    uint32_t instance_count;  // 0 when objects are drawn one by one
+    struct {
+        vk::Buffer placements;
+        device_allocation placements_alloc;
+        vk::Buffer indirect;
+        device_allocation indirect_alloc;
+    } instancing;
+
+    // An indexed mesh from a file (--mesh) drawn in place of the cube, welded
+    // and reordered for the vertex cache on load
+    char const *mesh_file;  // Null for the cube
+    bool quantize;          // Upload packed_vertex (vertex_quantize.h) instead of mesh_vertex
+    bool quantize_benchmark;
+    struct {
+        vk::Buffer vertices;
+        device_allocation vertices_alloc;
+        vk::Buffer indices;
+        device_allocation indices_alloc;
+        uint32_t index_count;
+        vk::DeviceSize vertex_bytes;
+        mesh_stats stats;
+    } mesh;
+
+    // Compute culling of the instances (--cull, --hiz).  A compute pass tests
+    // every placement and appends the survivors to visible, counting them
+    // into the indirect draw.  With --hiz the depth buffer is max-reduced into
+    // a pyramid after each frame, and the next frame also drops instances
+    // hidden behind it.
+    bool cull;
+    bool hiz;
+    struct {
+        vk::Buffer visible;
+        device_allocation visible_alloc;
+
+        vk::DescriptorSetLayout desc_layout;
+        vk::PipelineLayout pipeline_layout;
+        vk::Pipeline pipeline;
+        vk::DescriptorPool desc_pool;
+        vk::DescriptorSet desc_set;
+
+        // 1x1 and never written without --hiz, the cull shader still binds it
+        vk::Image pyramid;
+        device_allocation pyramid_alloc;
+        vk::ImageView pyramid_view;              // All levels, read by the cull pass
+        std::vector<vk::ImageView> level_views;  // One per level, written by the reduce pass
+        uint32_t pyramid_width;
+        uint32_t pyramid_height;
+        uint32_t pyramid_levels;
+        vk::Sampler sampler;
+
+        vk::DescriptorSetLayout reduce_desc_layout;
+        vk::PipelineLayout reduce_pipeline_layout;
+        vk::Pipeline reduce_pipeline;
+        std::vector<vk::DescriptorSet> reduce_sets;  // Level i reads level i - 1, level 0 reads the depth buffer
+    } culling;
+
     vk::CommandBuffer cmd;  // Buffer for initialization commands
+    vk::Fence init_fence;   // Signals when cmd has executed and can be freed
     vk::PipelineLayout pipeline_layout;
     vk::DescriptorSetLayout desc_layout;
     vk::PipelineCache pipelineCache;
     vk::RenderPass render_pass;
-    vk::Pipeline pipeline;
+    vk::Pipeline pipeline;  // What the frame being recorded draws with
+
+    // Graphics pipeline variants, compiled off the main thread.  A variant
+    // that is still compiling is drawn with the fill pipeline instead.
+    pipeline_registry pipelines;
+    uint64_t fill_pipeline_key;
+    uint64_t wireframe_pipeline_key;  // Same as fill_pipeline_key without fillModeNonSolid
+    bool wireframe_supported;
+    bool wireframe;
+
+    // SPIR-V modules by content; --hot_reload watches the files for edits
+    shader_library shaders;
+    bool hot_reload;
 
     mat4x4 projection_matrix;
     mat4x4 view_matrix;
@@ -380,6 +742,24 @@ struct Demo {
 
     vk::DescriptorPool desc_pool;
     vk::DescriptorSet desc_set;
+    vk::DescriptorSet spare_desc_set;
+
+    // Descriptor indexing (--bindless) replaces the sets above with one set
+    // bound once per command buffer (bindless_table.h).  Each draw pushes the
+    // index of its arena entry, its material and its texture's slot, so the
+    // arena is read as a storage buffer instead of through dynamic offsets.
+    // Streamed textures go into a free slot instead of the spare set.
+    // --materials spreads that many materials, each a tint over one of the
+    // textures, across the objects.
+    bool bindless;
+    uint32_t bindless_capacity;  // Texture slots, within the device's update-after-bind limits
+    bindless_table bindless_descriptors;
+    uint32_t texture_slots[texture_count];
+    uint32_t material_count;
+    struct {
+        vk::Buffer buf;
+        device_allocation alloc;
+    } materials;
 
     std::unique_ptr<vk::Framebuffer[]> framebuffers;
 
@@ -455,6 +835,9 @@ static void keyboard_handle_key(void *data, struct wl_keyboard *keyboard, uint32
         case KEY_SPACE:  // space bar
             demo->pause = !demo->pause;
             break;
+        case KEY_W:  // w
+            demo->wireframe = !demo->wireframe;
+            break;
     }
 }
 
@@ -537,19 +920,65 @@ Demo::Demo()
 #elif defined(VK_USE_PLATFORM_MIR_KHR)
 #endif
       prepared{false},
-      use_staging_buffer{false},
       use_xlib{false},
+      headless{false},
+      readback_file{nullptr},
+      last_frame_image{0},
+      benchmark_file{nullptr},
+      benchmark_warmup{10},
+      timestamps_supported{false},
+      trace_file{nullptr},
+      gpu_trace_ticks{0},
+      pipeline_cache_file{"cube_pipeline_cache.bin"},
+      pipeline_cache_status{"disabled"},
+      pipeline_create_ms{0.0},
+      startup_ms{-1.0},
       graphics_queue_family_index{0},
       present_queue_family_index{0},
+      transfer_queue_family_index{0},
+      separate_transfer_queue{false},
+      allocator_stats{false},
       enabled_extension_count{0},
       enabled_layer_count{0},
       width{0},
       height{0},
       swapchainImageCount{0},
+      frame_lag{2},
+      timeline_frames{true},
+      timeline_enabled{false},
       frame_index{0},
+      spare_desc_set_last_frame{0},
+      texture_resident_ms{-1.0},
+      textures_pending{0},
+      object_count{1},
+      object_transforms{},
+      transform_kernel_choice{transform_best_kernel()},
+      transform_benchmark{false},
+      ppm_kernel_choice{ppm_best_kernel()},
+      decode_benchmark_file{nullptr},
+      texture_mips{true},
+      camera_distance{1.0f},
+      texture_file{tex_files[0]},
+      record_threads{1},
+      active_record_threads{1},
+      record_sweep{false},
+      instance_count{0},
+      mesh_file{nullptr},
+      quantize{false},
+      quantize_benchmark{false},
+      cull{false},
+      hiz{false},
+      fill_pipeline_key{0},
+      wireframe_pipeline_key{0},
+      wireframe_supported{false},
+      wireframe{false},
+      hot_reload{false},
       spin_angle{0.0f},
       spin_increment{0.0f},
       pause{false},
+      bindless{false},
+      bindless_capacity{0},
+      material_count{1},
       quit{false},
       curFrame{0},
       frameCount{0},
@@ -564,6 +993,10 @@ Demo::Demo()
     memset(projection_matrix, 0, sizeof(projection_matrix));
     memset(view_matrix, 0, sizeof(view_matrix));
     memset(model_matrix, 0, sizeof(model_matrix));
+    for (uint32_t i = 0; i < MAX_FRAME_LAG; i++) {
+        timestamp_frame[i] = UINT32_MAX;
+        frame_submit_ns[i] = 0;
+    }
 }
 
 void Demo::build_image_ownership_cmd(uint32_t const &i) {
@@ -612,10 +1045,11 @@ void Demo::cleanup() {
     prepared = false;
     device.waitIdle();
 
-    // Wait for fences from present operations
-    for (uint32_t i = 0; i < FRAME_LAG; i++) {
-        device.waitForFences(1, &fences[i], VK_TRUE, UINT64_MAX);
-        device.destroyFence(fences[i], nullptr);
+    // The device is idle, so every frame is done
+    frames.wait(frames.submitted());
+    frames.destroy();
+    for (uint32_t i = 0; i < frame_lag; i++) {
+        resolve_gpu_timestamps(i);
         device.destroySemaphore(image_acquired_semaphores[i], nullptr);
         device.destroySemaphore(draw_complete_semaphores[i], nullptr);
         if (separate_present_queue) {
@@ -623,43 +1057,75 @@ void Demo::cleanup() {
         }
     }
 
+    if (benchmark_file) {
+        write_benchmark_report();
+    }
+    destroy_timestamp_queries();
+
     for (uint32_t i = 0; i < swapchainImageCount; i++) {
         device.destroyFramebuffer(swapchain_image_resources[i].framebuffer, nullptr);
     }
     device.destroyDescriptorPool(desc_pool, nullptr);
 
-    device.destroyPipeline(pipeline, nullptr);
+    pipelines.stop();
+    shaders.destroy();
+    save_pipeline_cache();
     device.destroyPipelineCache(pipelineCache, nullptr);
     device.destroyRenderPass(render_pass, nullptr);
     device.destroyPipelineLayout(pipeline_layout, nullptr);
     device.destroyDescriptorSetLayout(desc_layout, nullptr);
+    destroy_bindless_descriptors();
 
+    release_init_cmd(true);
+    destroy_texture_streaming();
     for (uint32_t i = 0; i < texture_count; i++) {
         device.destroyImageView(textures[i].view, nullptr);
         device.destroyImage(textures[i].image, nullptr);
-        device.freeMemory(textures[i].mem, nullptr);
+        allocator.free(&textures[i].alloc);
         device.destroySampler(textures[i].sampler, nullptr);
     }
-    device.destroySwapchainKHR(swapchain, nullptr);
+    if (!headless) {
+        device.destroySwapchainKHR(swapchain, nullptr);
+    }
+    destroy_retired_surfaces(true);
 
     device.destroyImageView(depth.view, nullptr);
     device.destroyImage(depth.image, nullptr);
-    device.freeMemory(depth.mem, nullptr);
+    allocator.free(&depth.alloc);
 
     for (uint32_t i = 0; i < swapchainImageCount; i++) {
         device.destroyImageView(swapchain_image_resources[i].view, nullptr);
-        device.freeCommandBuffers(cmd_pool, 1, &swapchain_image_resources[i].cmd);
-        device.destroyBuffer(swapchain_image_resources[i].uniform_buffer, nullptr);
-        device.freeMemory(swapchain_image_resources[i].uniform_memory, nullptr);
+        if (headless) {
+            device.destroyImage(swapchain_image_resources[i].image, nullptr);
+            allocator.free(&swapchain_image_resources[i].image_alloc);
+        }
     }
 
+    device.freeCommandBuffers(cmd_pool, frame_lag, draw_cmds);
+    destroy_worker_recording();
+    jobs.stop();
+    destroy_uniform_arena();
+    destroy_instance_buffers();
+    destroy_mesh_buffers();
+    destroy_culling();
+
     device.destroyCommandPool(cmd_pool, nullptr);
 
     if (separate_present_queue) {
         device.destroyCommandPool(present_cmd_pool, nullptr);
     }
     device.waitIdle();
+    if (allocator_stats) {
+        allocator.print_stats(stdout);
+    }
+    allocator.destroy();
     device.destroy(nullptr);
+
+    if (headless) {
+        inst.destroy(nullptr);
+        return;
+    }
+
     inst.destroySurfaceKHR(surface, nullptr);
 
 #if defined(VK_USE_PLATFORM_XLIB_KHR)
@@ -683,12 +1149,23 @@ void Demo::cleanup() {
 #endif
 
     inst.destroy(nullptr);
+
+    // The worker and loader threads are idle by now
+    write_gpu_trace();
+    if (trace_file && trace_write(trace_file)) {
+        printf("Trace written to %s\n", trace_file);
+    }
 }
 
 void Demo::create_device() {
+    TRACE_ZONE("create_device");
     float const priorities[1] = {0.0};
 
-    vk::DeviceQueueCreateInfo queues[2];
+    // The wireframe pipeline variant needs it, the bindless shaders index a sampler array
+    auto const features =
+        vk::PhysicalDeviceFeatures().setFillModeNonSolid(wireframe_supported).setShaderSampledImageArrayDynamicIndexing(bindless);
+
+    vk::DeviceQueueCreateInfo queues[3];
     queues[0].setQueueFamilyIndex(graphics_queue_family_index);
     queues[0].setQueueCount(1);
     queues[0].setPQueuePriorities(priorities);
@@ -700,7 +1177,7 @@ void Demo::create_device() {
                           .setPpEnabledLayerNames(nullptr)
                           .setEnabledExtensionCount(enabled_extension_count)
                           .setPpEnabledExtensionNames((const char *const *)extension_names)
-                          .setPEnabledFeatures(nullptr);
+                          .setPEnabledFeatures(&features);
 
     if (separate_present_queue) {
         queues[1].setQueueFamilyIndex(present_queue_family_index);
@@ -709,55 +1186,137 @@ void Demo::create_device() {
         deviceInfo.setQueueCreateInfoCount(2);
     }
 
+    if (separate_transfer_queue && transfer_queue_family_index != present_queue_family_index) {
+        uint32_t const index = deviceInfo.queueCreateInfoCount;
+        queues[index].setQueueFamilyIndex(transfer_queue_family_index);
+        queues[index].setQueueCount(1);
+        queues[index].setPQueuePriorities(priorities);
+        deviceInfo.setQueueCreateInfoCount(index + 1);
+    }
+
+#ifdef VK_KHR_timeline_semaphore
+    // query_timeline_support() checked the feature; it still has to be enabled
+    VkPhysicalDeviceTimelineSemaphoreFeaturesKHR timeline_features = {};
+    timeline_features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES_KHR;
+    timeline_features.timelineSemaphore = VK_TRUE;
+    if (timeline_enabled) {
+        deviceInfo.setPNext(&timeline_features);
+    }
+#endif
+
+#ifdef VK_EXT_descriptor_indexing
+    // Only what bindless_table needs; query_bindless_support() checked it
+    VkPhysicalDeviceDescriptorIndexingFeaturesEXT indexing_features = {};
+    indexing_features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
+    indexing_features.runtimeDescriptorArray = VK_TRUE;
+    indexing_features.descriptorBindingPartiallyBound = VK_TRUE;
+    indexing_features.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+    indexing_features.descriptorBindingUpdateUnusedWhilePending = VK_TRUE;
+    if (bindless) {
+        indexing_features.pNext = (void *)deviceInfo.pNext;
+        deviceInfo.setPNext(&indexing_features);
+    }
+#endif
+
     auto result = gpu.createDevice(&deviceInfo, nullptr, &device);
     VERIFY(result == vk::Result::eSuccess);
+
+    if (!shaders.init(device, hot_reload)) {
+        fprintf(stderr, "Shader hot reload is not available here, --hot_reload ignored\n");
+        hot_reload = false;
+    }
 }
 
 void Demo::destroy_texture_image(texture_object *tex_objs) {
     // clean up staging resources
-    device.freeMemory(tex_objs->mem, nullptr);
     device.destroyImage(tex_objs->image, nullptr);
+    allocator.free(&tex_objs->alloc);
 }
 
 void Demo::draw() {
-    // Ensure no more than FRAME_LAG renderings are outstanding
-    device.waitForFences(1, &fences[frame_index], VK_TRUE, UINT64_MAX);
-    device.resetFences(1, &fences[frame_index]);
+    if (headless) {
+        draw_headless();
+        return;
+    }
+
+    TRACE_ZONE("frame");
+    frame_timing timing = {};
+    auto const t_start = bench_clock::now();
+
+    // Ensure no more than frame_lag renderings are outstanding
+    {
+        TRACE_ZONE("frame wait");
+        frame_index = frames.begin_frame();
+    }
+    resolve_gpu_timestamps(frame_index);
+    release_init_cmd(false);
+    update_streamed_textures();
+    reload_shaders();
+    destroy_retired_surfaces(false);
+
+    auto const t_fence = bench_clock::now();
 
     vk::Result result;
-    do {
-        result =
-            device.acquireNextImageKHR(swapchain, UINT64_MAX, image_acquired_semaphores[frame_index], vk::Fence(), &current_buffer);
-        if (result == vk::Result::eErrorOutOfDateKHR) {
-            // demo->swapchain is out of date (e.g. the window was resized) and
-            // must be recreated:
-            resize();
-        } else if (result == vk::Result::eSuboptimalKHR) {
-            // swapchain is not as optimal as it could be, but the platform's
-            // presentation engine will still present the image correctly.
-            break;
-        } else {
-            VERIFY(result == vk::Result::eSuccess);
-        }
-    } while (result != vk::Result::eSuccess);
+    {
+        TRACE_ZONE("acquire");
+        do {
+            result = device.acquireNextImageKHR(swapchain, UINT64_MAX, image_acquired_semaphores[frame_index], vk::Fence(),
+                                                &current_buffer);
+            if (result == vk::Result::eErrorOutOfDateKHR) {
+                // demo->swapchain is out of date (e.g. the window was resized) and
+                // must be recreated:
+                resize();
+            } else if (result == vk::Result::eSuboptimalKHR) {
+                // swapchain is not as optimal as it could be, but the platform's
+                // presentation engine will still present the image correctly.
+                break;
+            } else {
+                VERIFY(result == vk::Result::eSuccess);
+            }
+        } while (result != vk::Result::eSuccess);
+    }
+
+    auto const t_acquire = bench_clock::now();
 
     update_data_buffer();
 
+    auto const t_update = bench_clock::now();
+
+    draw_build_cmd(draw_cmds[frame_index]);
+
+    auto const t_record = bench_clock::now();
+
     // Wait for the image acquired semaphore to be signaled to ensure
     // that the image won't be rendered to until the presentation
     // engine has fully released ownership to the application, and it is
     // okay to render to the image.
+    vk::CommandBuffer frame_cmds[3];
+    uint32_t const frame_cmd_count = frame_command_buffers(frame_cmds);
+
+    // Textures swapped in this frame also wait for their uploads
     vk::PipelineStageFlags const pipe_stage_flags = vk::PipelineStageFlagBits::eColorAttachmentOutput;
+    submit_waits.assign(1, image_acquired_semaphores[frame_index]);
+    submit_wait_stages.assign(1, pipe_stage_flags);
+    submit_waits.insert(submit_waits.end(), texture_waits[frame_index].begin(), texture_waits[frame_index].end());
+    submit_wait_stages.resize(submit_waits.size(), vk::PipelineStageFlagBits::eFragmentShader);
+
     auto const submit_info = vk::SubmitInfo()
-                                 .setPWaitDstStageMask(&pipe_stage_flags)
-                                 .setWaitSemaphoreCount(1)
-                                 .setPWaitSemaphores(&image_acquired_semaphores[frame_index])
-                                 .setCommandBufferCount(1)
-                                 .setPCommandBuffers(&swapchain_image_resources[current_buffer].cmd)
+                                 .setPWaitDstStageMask(submit_wait_stages.data())
+                                 .setWaitSemaphoreCount((uint32_t)submit_waits.size())
+                                 .setPWaitSemaphores(submit_waits.data())
+                                 .setCommandBufferCount(frame_cmd_count)
+                                 .setPCommandBuffers(frame_cmds)
                                  .setSignalSemaphoreCount(1)
                                  .setPSignalSemaphores(&draw_complete_semaphores[frame_index]);
 
-    result = graphics_queue.submit(1, &submit_info, fences[frame_index]);
+    // The frame is marked done by its last submission, so that once it has
+    // completed the ownership transfer is done with the swapchain image too
+    frame_submit_ns[frame_index] = TRACE_NOW();
+    if (separate_present_queue) {
+        result = graphics_queue.submit(1, &submit_info, vk::Fence());
+    } else {
+        result = frames.submit(graphics_queue, submit_info);
+    }
     VERIFY(result == vk::Result::eSuccess);
 
     if (separate_present_queue) {
@@ -774,10 +1333,12 @@ void Demo::draw() {
                                              .setSignalSemaphoreCount(1)
                                              .setPSignalSemaphores(&image_ownership_semaphores[frame_index]);
 
-        result = present_queue.submit(1, &present_submit_info, vk::Fence());
+        result = frames.submit(present_queue, present_submit_info);
         VERIFY(result == vk::Result::eSuccess);
     }
 
+    auto const t_submit = bench_clock::now();
+
     // If we are using separate queues we have to wait for image ownership,
     // otherwise wait for draw complete
     auto const presentInfo = vk::PresentInfoKHR()
@@ -788,9 +1349,22 @@ void Demo::draw() {
                                  .setPSwapchains(&swapchain)
                                  .setPImageIndices(&current_buffer);
 
-    result = present_queue.presentKHR(&presentInfo);
-    frame_index += 1;
-    frame_index %= FRAME_LAG;
+    {
+        TRACE_ZONE("present");
+        result = present_queue.presentKHR(&presentInfo);
+    }
+
+    auto const t_present = bench_clock::now();
+
+    timing.fence_wait = elapsed_ms(t_start, t_fence);
+    timing.acquire = elapsed_ms(t_fence, t_acquire);
+    timing.update = elapsed_ms(t_acquire, t_update);
+    timing.record = elapsed_ms(t_update, t_record);
+    timing.submit = elapsed_ms(t_record, t_submit);
+    timing.present = elapsed_ms(t_submit, t_present);
+    timing.cpu_total = elapsed_ms(t_start, t_present);
+    record_frame_timing(timing);
+
     if (result == vk::Result::eErrorOutOfDateKHR) {
         // swapchain is out of date (e.g. the window was resized) and
         // must be recreated:
@@ -803,8 +1377,75 @@ void Demo::draw() {
     }
 }
 
+void Demo::draw_headless() {
+    TRACE_ZONE("frame");
+    frame_timing timing = {};
+    auto const t_start = bench_clock::now();
+
+    // Ensure no more than frame_lag renderings are outstanding
+    {
+        TRACE_ZONE("frame wait");
+        frame_index = frames.begin_frame();
+    }
+    resolve_gpu_timestamps(frame_index);
+    release_init_cmd(false);
+    update_streamed_textures();
+    reload_shaders();
+
+    auto const t_fence = bench_clock::now();
+
+    // There is one offscreen image per frame slot, so the wait above also
+    // guarantees that nothing is still rendering to this image.
+    current_buffer = frame_index;
+
+    update_data_buffer();
+
+    auto const t_update = bench_clock::now();
+
+    draw_build_cmd(draw_cmds[frame_index]);
+
+    auto const t_record = bench_clock::now();
+
+    // Nothing to acquire or present: frames are paced only by the scheduler,
+    vk::CommandBuffer frame_cmds[3];
+    uint32_t const frame_cmd_count = frame_command_buffers(frame_cmds);
+
+    // except for textures swapped in this frame, which wait for their uploads
+    submit_waits.assign(texture_waits[frame_index].begin(), texture_waits[frame_index].end());
+    submit_wait_stages.assign(submit_waits.size(), vk::PipelineStageFlagBits::eFragmentShader);
+
+    auto const submit_info = vk::SubmitInfo()
+                                 .setWaitSemaphoreCount((uint32_t)submit_waits.size())
+                                 .setPWaitSemaphores(submit_waits.data())
+                                 .setPWaitDstStageMask(submit_wait_stages.data())
+                                 .setCommandBufferCount(frame_cmd_count)
+                                 .setPCommandBuffers(frame_cmds);
+
+    frame_submit_ns[frame_index] = TRACE_NOW();
+    auto result = frames.submit(graphics_queue, submit_info);
+    VERIFY(result == vk::Result::eSuccess);
+
+    auto const t_submit = bench_clock::now();
+
+    timing.fence_wait = elapsed_ms(t_start, t_fence);
+    timing.update = elapsed_ms(t_fence, t_update);
+    timing.record = elapsed_ms(t_update, t_record);
+    timing.submit = elapsed_ms(t_record, t_submit);
+    timing.cpu_total = elapsed_ms(t_start, t_submit);
+    record_frame_timing(timing);
+
+    last_frame_image = current_buffer;
+}
+
 void Demo::draw_build_cmd(vk::CommandBuffer commandBuffer) {
-    auto const commandInfo = vk::CommandBufferBeginInfo().setFlags(vk::CommandBufferUsageFlagBits::eSimultaneousUse);
+    TRACE_ZONE("draw_build_cmd");
+    // While neither is ready, e.g. both are being rebuilt after a shader
+    // reload, the previous frame's pipeline is kept
+    vk::Pipeline const ready = pipelines.get(wireframe ? wireframe_pipeline_key : fill_pipeline_key, fill_pipeline_key);
+    if (ready) {
+        pipeline = ready;
+    }
+    auto const commandInfo = vk::CommandBufferBeginInfo().setFlags(vk::CommandBufferUsageFlagBits::eOneTimeSubmit);
 
     vk::ClearValue const clearValues[2] = {vk::ClearColorValue(std::array<float, 4>({{0.2f, 0.2f, 0.2f, 0.2f}})),
                                            vk::ClearDepthStencilValue(1.0f, 0u)};
@@ -819,22 +1460,32 @@ void Demo::draw_build_cmd(vk::CommandBuffer commandBuffer) {
     auto result = commandBuffer.begin(&commandInfo);
     VERIFY(result == vk::Result::eSuccess);
 
-    commandBuffer.beginRenderPass(&passInfo, vk::SubpassContents::eInline);
-    commandBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics, pipeline);
-    commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, pipeline_layout, 0, 1,
-                                     &swapchain_image_resources[current_buffer].descriptor_set, 0, nullptr);
+    // A single indirect draw gains nothing from being split
+    uint32_t const slices = instance_count ? 1 : std::min(active_record_threads, object_count);
 
-    auto const viewport =
-        vk::Viewport().setWidth((float)width).setHeight((float)height).setMinDepth((float)0.0f).setMaxDepth((float)1.0f);
-    commandBuffer.setViewport(0, 1, &viewport);
+    if (cull) {
+        record_culling(commandBuffer);
+    }
 
-    vk::Rect2D const scissor(vk::Offset2D(0, 0), vk::Extent2D(width, height));
-    commandBuffer.setScissor(0, 1, &scissor);
-    commandBuffer.draw(12 * 3, 1, 0, 0);
+    if (slices <= 1) {
+        commandBuffer.beginRenderPass(&passInfo, vk::SubpassContents::eInline);
+        record_objects(commandBuffer, 0, object_count);
+    } else {
+        // The secondaries only reference the framebuffer, so they can be
+        // recorded before the render pass begins on this thread
+        jobs.run(slices, [this, slices](uint32_t slice) { record_worker_slice(slice, slices); });
+
+        commandBuffer.beginRenderPass(&passInfo, vk::SubpassContents::eSecondaryCommandBuffers);
+        commandBuffer.executeCommands(slices, worker_cmds[frame_index].data());
+    }
     // Note that ending the renderpass changes the image's layout from
     // COLOR_ATTACHMENT_OPTIMAL to PRESENT_SRC_KHR
     commandBuffer.endRenderPass();
 
+    if (hiz) {
+        record_depth_pyramid(commandBuffer);
+    }
+
     if (separate_present_queue) {
         // We have to transfer ownership from the graphics queue family to
         // the
@@ -864,12 +1515,212 @@ void Demo::draw_build_cmd(vk::CommandBuffer commandBuffer) {
     VERIFY(result == vk::Result::eSuccess);
 }
 
+void Demo::record_objects(vk::CommandBuffer commandBuffer, uint32_t first, uint32_t count) {
+    commandBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics, pipeline);
+
+    auto const viewport =
+        vk::Viewport().setWidth((float)width).setHeight((float)height).setMinDepth((float)0.0f).setMaxDepth((float)1.0f);
+    commandBuffer.setViewport(0, 1, &viewport);
+
+    vk::Rect2D const scissor(vk::Offset2D(0, 0), vk::Extent2D(width, height));
+    commandBuffer.setScissor(0, 1, &scissor);
+
+    if (instance_count) {
+        uint32_t const dynamic_offset = (uint32_t)(frame_index * uniform_data.frame_stride);
+        commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, pipeline_layout, 0, 1, &desc_set, 1, &dynamic_offset);
+        commandBuffer.drawIndirect(instancing.indirect, 0, 1, sizeof(vk::DrawIndirectCommand));
+        return;
+    }
+
+    if (mesh_file) {
+        vk::DeviceSize const offset = 0;
+        commandBuffer.bindVertexBuffers(0, 1, &mesh.vertices, &offset);
+        commandBuffer.bindIndexBuffer(mesh.indices, 0, vk::IndexType::eUint32);
+    }
+
+    // Bindless: bound once here, the draws only push indices
+    if (bindless) {
+        auto const set = bindless_descriptors.set();
+        commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, pipeline_layout, 0, 1, &set, 0, nullptr);
+    }
+
+    // Each object's uniforms are picked out of this frame's arena slot
+    for (uint32_t i = first; i < first + count; i++) {
+        vk::DeviceSize const offset = frame_index * uniform_data.frame_stride + i * uniform_data.object_stride;
+        if (bindless) {
+            uint32_t const material = i % material_count;
+            bindless_draw const draw = {(uint32_t)(offset / 16), material, texture_slots[material % texture_count]};
+            commandBuffer.pushConstants(pipeline_layout, vk::ShaderStageFlagBits::eVertex | vk::ShaderStageFlagBits::eFragment, 0,
+                                        sizeof(draw), &draw);
+        } else {
+            uint32_t const dynamic_offset = (uint32_t)offset;
+            commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, pipeline_layout, 0, 1, &desc_set, 1,
+                                             &dynamic_offset);
+        }
+        if (mesh_file) {
+            commandBuffer.drawIndexed(mesh.index_count, 1, 0, 0, 0);
+        } else {
+            commandBuffer.draw(12 * 3, 1, 0, 0);
+        }
+    }
+}
+
+// Runs on a worker thread.  Slice s only ever touches worker_pools[f][s] and
+// the buffer allocated from it, and the slot's previous frame has already
+// completed, so resetting the whole pool needs no further synchronization.
+void Demo::record_worker_slice(uint32_t slice, uint32_t slice_count) {
+    TRACE_ZONE("record_worker_slice");
+    uint32_t const first = (uint32_t)((uint64_t)object_count * slice / slice_count);
+    uint32_t const end = (uint32_t)((uint64_t)object_count * (slice + 1) / slice_count);
+
+    auto result = device.resetCommandPool(worker_pools[frame_index][slice], vk::CommandPoolResetFlags());
+    VERIFY(result == vk::Result::eSuccess);
+
+    auto const inheritance = vk::CommandBufferInheritanceInfo()
+                                 .setRenderPass(render_pass)
+                                 .setSubpass(0)
+                                 .setFramebuffer(swapchain_image_resources[current_buffer].framebuffer);
+
+    auto const begin_info =
+        vk::CommandBufferBeginInfo()
+            .setFlags(vk::CommandBufferUsageFlagBits::eOneTimeSubmit | vk::CommandBufferUsageFlagBits::eRenderPassContinue)
+            .setPInheritanceInfo(&inheritance);
+
+    auto const commandBuffer = worker_cmds[frame_index][slice];
+    result = commandBuffer.begin(&begin_info);
+    VERIFY(result == vk::Result::eSuccess);
+
+    record_objects(commandBuffer, first, end - first);
+
+    result = commandBuffer.end();
+    VERIFY(result == vk::Result::eSuccess);
+}
+
+void Demo::prepare_worker_recording() {
+    TRACE_ZONE("prepare_worker_recording");
+    // A sweep without --threads goes up to one thread per core
+    if (record_sweep && record_threads == 1) {
+        record_threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    active_record_threads = record_threads;
+    if (record_threads <= 1) {
+        return;
+    }
+
+    // The workers survive resizes, only the pools are recreated
+    if (jobs.thread_count() != record_threads) {
+        jobs.start(record_threads - 1);
+    }
+
+    auto const pool_info = vk::CommandPoolCreateInfo()
+                               .setFlags(vk::CommandPoolCreateFlagBits::eTransient)
+                               .setQueueFamilyIndex(graphics_queue_family_index);
+
+    for (uint32_t f = 0; f < frame_lag; f++) {
+        worker_pools[f].resize(record_threads);
+        worker_cmds[f].resize(record_threads);
+
+        for (uint32_t t = 0; t < record_threads; t++) {
+            auto result = device.createCommandPool(&pool_info, nullptr, &worker_pools[f][t]);
+            VERIFY(result == vk::Result::eSuccess);
+
+            auto const cmd_info = vk::CommandBufferAllocateInfo()
+                                      .setCommandPool(worker_pools[f][t])
+                                      .setLevel(vk::CommandBufferLevel::eSecondary)
+                                      .setCommandBufferCount(1);
+
+            result = device.allocateCommandBuffers(&cmd_info, &worker_cmds[f][t]);
+            VERIFY(result == vk::Result::eSuccess);
+        }
+    }
+}
+
+void Demo::destroy_worker_recording() {
+    // Destroying a pool frees its command buffers
+    for (uint32_t f = 0; f < frame_lag; f++) {
+        for (auto &pool : worker_pools[f]) {
+            device.destroyCommandPool(pool, nullptr);
+        }
+        worker_pools[f].clear();
+        worker_cmds[f].clear();
+    }
+}
+
+// Records the same frame over and over with 1, 2, 4, ... up to
+// record_threads threads and reports the mean CPU time per frame.  Nothing
+// is submitted, so it runs before the first frame while the GPU is idle.
+void Demo::benchmark_recording() {
+    uint32_t const iterations = 100;
+    double single_thread_ms = 0.0;
+
+    printf("Command recording, %" PRIu32 " objects, %" PRIu32 " iterations:\n", object_count, iterations);
+    printf("  %-8s %10s %8s\n", "threads", "mean (ms)", "speedup");
+
+    for (uint32_t threads = 1;; threads = std::min(threads * 2, record_threads)) {
+        active_record_threads = threads;
+
+        // The first pass grows the pools to their steady-state size
+        draw_build_cmd(draw_cmds[frame_index]);
+
+        auto const start = bench_clock::now();
+        for (uint32_t i = 0; i < iterations; i++) {
+            draw_build_cmd(draw_cmds[frame_index]);
+        }
+        double const mean = elapsed_ms(start, bench_clock::now()) / iterations;
+
+        if (threads == 1) {
+            single_thread_ms = mean;
+        }
+        printf("  %-8" PRIu32 " %10.4f %7.2fx\n", threads, mean, single_thread_ms / mean);
+        record_sweep_ms.push_back(std::make_pair(threads, mean));
+
+        if (threads >= record_threads) {
+            break;
+        }
+    }
+
+    active_record_threads = record_threads;
+}
+
+uint32_t Demo::frame_command_buffers(vk::CommandBuffer *cmds) {
+    if (!timestamp_pool) {
+        cmds[0] = draw_cmds[frame_index];
+        return 1;
+    }
+
+    // When timing the GPU, bracket the frame with the timestamp writes of its
+    // frame slot.  A timestamp waits for all earlier commands in submission
+    // order, so the pair covers the whole frame.
+    cmds[0] = timestamp_begin_cmds[frame_index];
+    cmds[1] = draw_cmds[frame_index];
+    cmds[2] = timestamp_end_cmds[frame_index];
+    return 3;
+}
+
+// Starts a command buffer for one-off setup commands, such as layout
+// transitions and clears; flush_init_cmd submits it
+void Demo::begin_init_cmd() {
+    // A previous one has normally long executed; resize() may come soon
+    // enough after startup that it has not
+    release_init_cmd(true);
+
+    auto const cmd_info =
+        vk::CommandBufferAllocateInfo().setCommandPool(cmd_pool).setLevel(vk::CommandBufferLevel::ePrimary).setCommandBufferCount(1);
+
+    auto result = device.allocateCommandBuffers(&cmd_info, &cmd);
+    VERIFY(result == vk::Result::eSuccess);
+
+    auto const cmd_buf_info = vk::CommandBufferBeginInfo().setPInheritanceInfo(nullptr);
+
+    result = cmd.begin(&cmd_buf_info);
+    VERIFY(result == vk::Result::eSuccess);
+}
+
+// Submits the initialization commands without waiting for them: frames go
+// to the same queue afterwards, so they are ordered behind them anyway.
+// The command buffer is freed by release_init_cmd once it has executed.
 void Demo::flush_init_cmd() {
-    // TODO: hmm.
-    // This function could get called twice if the texture uses a staging
-    // buffer
-    // In that case the second call should be ignored
-    if (!cmd) {
+    if (!cmd || init_fence) {
         return;
     }
 
@@ -877,26 +1728,37 @@ void Demo::flush_init_cmd() {
     VERIFY(result == vk::Result::eSuccess);
 
     auto const fenceInfo = vk::FenceCreateInfo();
-    vk::Fence fence;
-    result = device.createFence(&fenceInfo, nullptr, &fence);
+    result = device.createFence(&fenceInfo, nullptr, &init_fence);
     VERIFY(result == vk::Result::eSuccess);
 
-    vk::CommandBuffer const commandBuffers[] = {cmd};
-    auto const submitInfo = vk::SubmitInfo().setCommandBufferCount(1).setPCommandBuffers(commandBuffers);
+    auto const submitInfo = vk::SubmitInfo().setCommandBufferCount(1).setPCommandBuffers(&cmd);
 
-    result = graphics_queue.submit(1, &submitInfo, fence);
+    result = graphics_queue.submit(1, &submitInfo, init_fence);
     VERIFY(result == vk::Result::eSuccess);
+}
 
-    result = device.waitForFences(1, &fence, VK_TRUE, UINT64_MAX);
-    VERIFY(result == vk::Result::eSuccess);
+void Demo::release_init_cmd(bool wait) {
+    if (!init_fence) {
+        return;
+    }
 
-    device.freeCommandBuffers(cmd_pool, 1, commandBuffers);
-    device.destroyFence(fence, nullptr);
+    if (wait) {
+        device.waitForFences(1, &init_fence, VK_TRUE, UINT64_MAX);
+    } else if (device.getFenceStatus(init_fence) != vk::Result::eSuccess) {
+        return;
+    }
 
+    device.freeCommandBuffers(cmd_pool, 1, &cmd);
+    device.destroyFence(init_fence, nullptr);
     cmd = vk::CommandBuffer();
+    init_fence = vk::Fence();
 }
 
 void Demo::init(int argc, char **argv) {
+    TRACE_THREAD("main");
+    TRACE_ZONE("init");
+    start_time = bench_clock::now();
+
     vec3 eye = {0.0f, 3.0f, 5.0f};
     vec3 origin = {0, 0, 0};
     vec3 up = {0.0f, 1.0f, 0.0};
@@ -906,8 +1768,8 @@ void Demo::init(int argc, char **argv) {
     use_xlib = false;
 
     for (int i = 1; i < argc; i++) {
+        // Textures always go through the staging ring now; accepted for compatibility
         if (strcmp(argv[i], "--use_staging") == 0) {
-            use_staging_buffer = true;
             continue;
         }
         if ((strcmp(argv[i], "--present_mode") == 0) && (i < argc - 1)) {
@@ -936,39 +1798,231 @@ void Demo::init(int argc, char **argv) {
             suppress_popups = true;
             continue;
         }
+        if (strcmp(argv[i], "--headless") == 0) {
+            headless = true;
+            continue;
+        }
+        if ((strcmp(argv[i], "--readback") == 0) && (i < argc - 1)) {
+            readback_file = argv[i + 1];
+            i++;
+            continue;
+        }
+        if ((strcmp(argv[i], "--benchmark") == 0) && (i < argc - 1)) {
+            benchmark_file = argv[i + 1];
+            i++;
+            continue;
+        }
+        if ((strcmp(argv[i], "--pipeline_cache") == 0) && (i < argc - 1)) {
+            pipeline_cache_file = argv[i + 1];
+            i++;
+            continue;
+        }
+        if (strcmp(argv[i], "--no_pipeline_cache") == 0) {
+            pipeline_cache_file = nullptr;
+            continue;
+        }
+        if (strcmp(argv[i], "--threads") == 0 && i < argc - 1 && sscanf(argv[i + 1], "%" SCNu32, &record_threads) == 1) {
+            // 0 picks one recording thread per core
+            if (record_threads == 0) {
+                record_threads = std::max(1u, std::thread::hardware_concurrency());
+            }
+            i++;
+            continue;
+        }
+        if (strcmp(argv[i], "--instances") == 0 && i < argc - 1 && sscanf(argv[i + 1], "%" SCNu32, &instance_count) == 1) {
+            i++;
+            continue;
+        }
+        if (strcmp(argv[i], "--cull") == 0) {
+            cull = true;
+            continue;
+        }
+        if (strcmp(argv[i], "--hiz") == 0) {
+            cull = true;
+            hiz = true;
+            continue;
+        }
+        if (strcmp(argv[i], "--record_sweep") == 0) {
+            record_sweep = true;
+            continue;
+        }
+        if (strcmp(argv[i], "--transform_kernel") == 0 && i < argc - 1) {
+            transform_kernel const kernels[] = {transform_kernel::scalar, transform_kernel::sse2, transform_kernel::avx2};
+            bool found = false;
+            for (auto kernel : kernels) {
+                if (strcmp(argv[i + 1], transform_kernel_name(kernel)) == 0 && transform_kernel_supported(kernel)) {
+                    transform_kernel_choice = kernel;
+                    found = true;
+                }
+            }
+            if (found) {
+                i++;
+                continue;
+            }
+        }
+        if (strcmp(argv[i], "--decode_benchmark") == 0 && i < argc - 1) {
+            decode_benchmark_file = argv[i + 1];
+            i++;
+            continue;
+        }
+        if (strcmp(argv[i], "--texture") == 0 && i < argc - 1) {
+            texture_file = argv[i + 1];
+            i++;
+            continue;
+        }
+        if (strcmp(argv[i], "--no_mips") == 0) {
+            texture_mips = false;
+            continue;
+        }
+        if (strcmp(argv[i], "--camera_distance") == 0 && i < argc - 1 && sscanf(argv[i + 1], "%f", &camera_distance) == 1 &&
+            camera_distance > 0.0f) {
+            i++;
+            continue;
+        }
+        if (strcmp(argv[i], "--transform_benchmark") == 0) {
+            transform_benchmark = true;
+            continue;
+        }
+        if (strcmp(argv[i], "--allocator_stats") == 0) {
+            allocator_stats = true;
+            continue;
+        }
+        if (strcmp(argv[i], "--objects") == 0 && i < argc - 1 && sscanf(argv[i + 1], "%" SCNu32, &object_count) == 1 &&
+            object_count > 0) {
+            i++;
+            continue;
+        }
+        if (strcmp(argv[i], "--benchmark_warmup") == 0 && i < argc - 1 &&
+            sscanf(argv[i + 1], "%" SCNu32, &benchmark_warmup) == 1) {
+            i++;
+            continue;
+        }
+        if (strcmp(argv[i], "--frame_lag") == 0 && i < argc - 1 && sscanf(argv[i + 1], "%" SCNu32, &frame_lag) == 1 &&
+            frame_lag >= 1 && frame_lag <= MAX_FRAME_LAG) {
+            i++;
+            continue;
+        }
+        if (strcmp(argv[i], "--no_timeline") == 0) {
+            timeline_frames = false;
+            continue;
+        }
+        if (strcmp(argv[i], "--wireframe") == 0) {
+            wireframe = true;
+            continue;
+        }
+        if (strcmp(argv[i], "--mesh") == 0 && i < argc - 1) {
+            mesh_file = argv[i + 1];
+            i++;
+            continue;
+        }
+        if (strcmp(argv[i], "--quantize") == 0) {
+            quantize = true;
+            continue;
+        }
+        if (strcmp(argv[i], "--quantize_benchmark") == 0) {
+            quantize_benchmark = true;
+            continue;
+        }
+        if (strcmp(argv[i], "--hot_reload") == 0) {
+            hot_reload = true;
+            continue;
+        }
+        if (strcmp(argv[i], "--bindless") == 0) {
+            bindless = true;
+            continue;
+        }
+        if (strcmp(argv[i], "--materials") == 0 && i < argc - 1 && sscanf(argv[i + 1], "%" SCNu32, &material_count) == 1 &&
+            material_count > 0) {
+            i++;
+            continue;
+        }
+        if (strcmp(argv[i], "--trace") == 0 && i < argc - 1) {
+            trace_file = argv[i + 1];
+            i++;
+            continue;
+        }
+
+        fprintf(stderr,
+                "Usage:\n  %s [--use_staging] [--validate] [--break] [--c <framecount>] \n"
+                "       [--suppress_popups] [--present_mode {0,1,2,3}]\n"
+                "       [--headless] [--readback <file.ppm>]\n"
+                "       [--benchmark <file.json>] [--benchmark_warmup <framecount>]\n"
+                "       [--pipeline_cache <file> | --no_pipeline_cache] [--objects <count>]\n"
+                "       [--allocator_stats] [--threads <count>] [--record_sweep]\n"
+                "       [--instances <count> [--cull | --hiz]]\n"
+                "       [--transform_kernel {scalar,sse2,avx2}] [--transform_benchmark]\n"
+                "       [--decode_benchmark <file.ppm>] [--no_mips] [--camera_distance <scale>]\n"
+                "       [--texture <file.ppm | file.ktx2>] [--frame_lag <1-%u>] [--no_timeline]\n"
+                "       [--trace <file.json>] [--wireframe] [--hot_reload]\n"
+                "       [--mesh <file.obj | file.glb> [--quantize]] [--quantize_benchmark]\n"
+                "       [--bindless [--materials <count>]]\n"
+                "\n"
+                "Options for --present_mode:\n"
+                "  %d: VK_PRESENT_MODE_IMMEDIATE_KHR\n"
+                "  %d: VK_PRESENT_MODE_MAILBOX_KHR\n"
+                "  %d: VK_PRESENT_MODE_FIFO_KHR (default)\n"
+                "  %d: VK_PRESENT_MODE_FIFO_RELAXED_KHR\n",
+                APP_SHORT_NAME, MAX_FRAME_LAG, VK_PRESENT_MODE_IMMEDIATE_KHR, VK_PRESENT_MODE_MAILBOX_KHR, VK_PRESENT_MODE_FIFO_KHR,
+                VK_PRESENT_MODE_FIFO_RELAXED_KHR);
+        fflush(stderr);
+        exit(1);
+    }
+
+    if (bindless && instance_count) {
+        ERR_EXIT("--bindless cannot be combined with --instances", "Bindless Failure");
+    }
+    if (material_count > 1 && !bindless) {
+        ERR_EXIT("--materials needs --bindless", "Bindless Failure");
+    }
+
+    // Needs no device: measure the MVP kernels for the arena's layout and quit
+    if (transform_benchmark) {
+        size_t const stride = (sizeof(vktexcube_vs_uniform) + 255) / 256 * 256;
+        batch_transform_benchmark(stdout, std::max<uint32_t>(object_count, 65536), stride);
+        exit(0);
+    }
+
+    // Also needs no device: the PPM decoder against the old per-pixel loop
+    if (decode_benchmark_file) {
+        bool const pass = ppm_decode_benchmark(stdout, decode_benchmark_file, std::max(1u, std::thread::hardware_concurrency()));
+        exit(pass ? 0 : 1);
+    }
+
+    // The --mesh file, or a sphere of a million vertices without one
+    if (quantize_benchmark) {
+        mesh_data data;
+        if (mesh_file) {
+            job_system loader;
+            loader.start(std::max(1u, std::thread::hardware_concurrency()) - 1);
+            if (!mesh_load(mesh_file, loader, &data, &mesh.stats)) {
+                exit(1);
+            }
+        } else {
+            quantize_test_sphere(1000, 1000, &data);
+        }
+        vertex_quantize_benchmark(stdout, data);
+        exit(0);
+    }
+
+    if (!use_xlib && !headless) {
+        init_connection();
+    }
+
+    init_vk();
+
+    width = 500;
+    height = 500;
+
+    spin_angle = 4.0f;
+    spin_increment = 0.2f;
+    pause = false;
+
+    vec3_scale(eye, eye, camera_distance);
+
+    mat4x4_perspective(projection_matrix, (float)degreesToRadians(45.0f), 1.0f, 0.1f, 100.0f);
+    mat4x4_look_at(view_matrix, eye, origin, up);
+    mat4x4_identity(model_matrix);
 
-        fprintf(stderr,
-                "Usage:\n  %s [--use_staging] [--validate] [--break] [--c <framecount>] \n"
-                "       [--suppress_popups] [--present_mode {0,1,2,3}]\n"
-                "\n"
-                "Options for --present_mode:\n"
-                "  %d: VK_PRESENT_MODE_IMMEDIATE_KHR\n"
-                "  %d: VK_PRESENT_MODE_MAILBOX_KHR\n"
-                "  %d: VK_PRESENT_MODE_FIFO_KHR (default)\n"
-                "  %d: VK_PRESENT_MODE_FIFO_RELAXED_KHR\n",
-                APP_SHORT_NAME, VK_PRESENT_MODE_IMMEDIATE_KHR, VK_PRESENT_MODE_MAILBOX_KHR, VK_PRESENT_MODE_FIFO_KHR,
-                VK_PRESENT_MODE_FIFO_RELAXED_KHR);
-        fflush(stderr);
-        exit(1);
-    }
-
-    if (!use_xlib) {
-        init_connection();
-    }
-
-    init_vk();
-
-    width = 500;
-    height = 500;
-
-    spin_angle = 4.0f;
-    spin_increment = 0.2f;
-    pause = false;
-
-    mat4x4_perspective(projection_matrix, (float)degreesToRadians(45.0f), 1.0f, 0.1f, 100.0f);
-    mat4x4_look_at(view_matrix, eye, origin, up);
-    mat4x4_identity(model_matrix);
-
     projection_matrix[1][1] *= -1;  // Flip projection matrix from GL to Vulkan orientation.
 }
 
@@ -1016,6 +2070,7 @@ void Demo::init_connection() {
 }
 
 void Demo::init_vk() {
+    TRACE_ZONE("init_vk");
     uint32_t instance_extension_count = 0;
     uint32_t instance_layer_count = 0;
     uint32_t validation_layer_count = 0;
@@ -1076,7 +2131,8 @@ void Demo::init_vk() {
     auto result = vk::enumerateInstanceExtensionProperties(nullptr, &instance_extension_count, nullptr);
     VERIFY(result == vk::Result::eSuccess);
 
-    if (instance_extension_count > 0) {
+    // Headless runs render offscreen only, so no WSI extension is needed
+    if (instance_extension_count > 0 && !headless) {
         std::unique_ptr<vk::ExtensionProperties[]> instance_extensions(new vk::ExtensionProperties[instance_extension_count]);
         result = vk::enumerateInstanceExtensionProperties(nullptr, &instance_extension_count, instance_extensions.get());
         VERIFY(result == vk::Result::eSuccess);
@@ -1128,7 +2184,7 @@ void Demo::init_vk() {
         }
     }
 
-    if (!surfaceExtFound) {
+    if (!surfaceExtFound && !headless) {
         ERR_EXIT("vkEnumerateInstanceExtensionProperties failed to find the " VK_KHR_SURFACE_EXTENSION_NAME
                  " extension.\n\n"
                  "Do you have a compatible Vulkan installable client driver (ICD) installed?\n"
@@ -1136,7 +2192,7 @@ void Demo::init_vk() {
                  "vkCreateInstance Failure");
     }
 
-    if (!platformSurfaceExtFound) {
+    if (!platformSurfaceExtFound && !headless) {
 #if defined(VK_USE_PLATFORM_WIN32_KHR)
         ERR_EXIT("vkEnumerateInstanceExtensionProperties failed to find the " VK_KHR_WIN32_SURFACE_EXTENSION_NAME
                  " extension.\n\n"
@@ -1184,6 +2240,23 @@ void Demo::init_vk() {
                  "vkCreateInstance Failure");
 #endif
     }
+    // Timeline semaphore and descriptor indexing support can only be queried
+    // through vkGetPhysicalDeviceFeatures2KHR, and both extensions require it
+    bool properties2_found = false;
+    if (instance_extension_count > 0) {
+        std::unique_ptr<vk::ExtensionProperties[]> instance_extensions(new vk::ExtensionProperties[instance_extension_count]);
+        result = vk::enumerateInstanceExtensionProperties(nullptr, &instance_extension_count, instance_extensions.get());
+        VERIFY(result == vk::Result::eSuccess);
+
+        for (uint32_t i = 0; i < instance_extension_count; i++) {
+            if (!strcmp(VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME, instance_extensions[i].extensionName)) {
+                properties2_found = true;
+                extension_names[enabled_extension_count++] = VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME;
+            }
+        }
+        assert(enabled_extension_count < 64);
+    }
+
     auto const app = vk::ApplicationInfo()
                          .setPApplicationName(APP_SHORT_NAME)
                          .setApplicationVersion(0)
@@ -1238,6 +2311,9 @@ void Demo::init_vk() {
     /* Look for device extensions */
     uint32_t device_extension_count = 0;
     vk::Bool32 swapchainExtFound = VK_FALSE;
+    bool timeline_found = false;
+    bool descriptor_indexing_found = false;
+    bool maintenance3_found = false;
     enabled_extension_count = 0;
     memset(extension_names, 0, sizeof(extension_names));
 
@@ -1250,15 +2326,29 @@ void Demo::init_vk() {
         VERIFY(result == vk::Result::eSuccess);
 
         for (uint32_t i = 0; i < device_extension_count; i++) {
-            if (!strcmp(VK_KHR_SWAPCHAIN_EXTENSION_NAME, device_extensions[i].extensionName)) {
+            if (!headless && !strcmp(VK_KHR_SWAPCHAIN_EXTENSION_NAME, device_extensions[i].extensionName)) {
                 swapchainExtFound = 1;
                 extension_names[enabled_extension_count++] = VK_KHR_SWAPCHAIN_EXTENSION_NAME;
             }
+            // Enabled once the features are known to be there
+#ifdef VK_KHR_timeline_semaphore
+            if (!strcmp(VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME, device_extensions[i].extensionName)) {
+                timeline_found = true;
+            }
+#endif
+#ifdef VK_EXT_descriptor_indexing
+            if (!strcmp(VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME, device_extensions[i].extensionName)) {
+                descriptor_indexing_found = true;
+            }
+            if (!strcmp(VK_KHR_MAINTENANCE3_EXTENSION_NAME, device_extensions[i].extensionName)) {
+                maintenance3_found = true;
+            }
+#endif
             assert(enabled_extension_count < 64);
         }
     }
 
-    if (!swapchainExtFound) {
+    if (!swapchainExtFound && !headless) {
         ERR_EXIT("vkEnumerateDeviceExtensionProperties failed to find the " VK_KHR_SWAPCHAIN_EXTENSION_NAME
                  " extension.\n\n"
                  "Do you have a compatible Vulkan installable client driver (ICD) installed?\n"
@@ -1280,9 +2370,151 @@ void Demo::init_vk() {
     //  features based on this query
     vk::PhysicalDeviceFeatures physDevFeatures;
     gpu.getFeatures(&physDevFeatures);
+    wireframe_supported = physDevFeatures.fillModeNonSolid == VK_TRUE;
+
+    // Without them frame_scheduler paces the frames with per-slot fences
+    if (timeline_frames && timeline_found && properties2_found && query_timeline_support()) {
+#ifdef VK_KHR_timeline_semaphore
+        timeline_enabled = true;
+        extension_names[enabled_extension_count++] = VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME;
+#endif
+    }
+
+    if (bindless) {
+        if (properties2_found && descriptor_indexing_found && maintenance3_found && query_bindless_support()) {
+#ifdef VK_EXT_descriptor_indexing
+            extension_names[enabled_extension_count++] = VK_KHR_MAINTENANCE3_EXTENSION_NAME;
+            extension_names[enabled_extension_count++] = VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME;
+#endif
+        } else {
+            fprintf(stderr, "Descriptor indexing is not available here, --bindless and --materials ignored\n");
+            bindless = false;
+            material_count = 1;
+        }
+    }
+}
+
+bool Demo::query_timeline_support() {
+#ifdef VK_KHR_timeline_semaphore
+    auto const get_features = (PFN_vkGetPhysicalDeviceFeatures2KHR)inst.getProcAddr("vkGetPhysicalDeviceFeatures2KHR");
+    if (!get_features) {
+        return false;
+    }
+
+    VkPhysicalDeviceTimelineSemaphoreFeaturesKHR timeline = {};
+    timeline.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES_KHR;
+    VkPhysicalDeviceFeatures2KHR features = {};
+    features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2_KHR;
+    features.pNext = &timeline;
+    get_features((VkPhysicalDevice)gpu, &features);
+    return timeline.timelineSemaphore == VK_TRUE;
+#else
+    return false;
+#endif
+}
+
+// The update-after-bind texture array needs these features, and has to fit
+// the device's limits for such descriptors
+bool Demo::query_bindless_support() {
+#ifdef VK_EXT_descriptor_indexing
+    auto const get_features = (PFN_vkGetPhysicalDeviceFeatures2KHR)inst.getProcAddr("vkGetPhysicalDeviceFeatures2KHR");
+    auto const get_properties = (PFN_vkGetPhysicalDeviceProperties2KHR)inst.getProcAddr("vkGetPhysicalDeviceProperties2KHR");
+    if (!get_features || !get_properties) {
+        return false;
+    }
+
+    VkPhysicalDeviceDescriptorIndexingFeaturesEXT indexing = {};
+    indexing.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
+    VkPhysicalDeviceFeatures2KHR features = {};
+    features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2_KHR;
+    features.pNext = &indexing;
+    get_features((VkPhysicalDevice)gpu, &features);
+    if (!features.features.shaderSampledImageArrayDynamicIndexing || !indexing.runtimeDescriptorArray ||
+        !indexing.descriptorBindingPartiallyBound || !indexing.descriptorBindingSampledImageUpdateAfterBind ||
+        !indexing.descriptorBindingUpdateUnusedWhilePending) {
+        return false;
+    }
+
+    VkPhysicalDeviceDescriptorIndexingPropertiesEXT limits = {};
+    limits.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_PROPERTIES_EXT;
+    VkPhysicalDeviceProperties2KHR properties = {};
+    properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2_KHR;
+    properties.pNext = &limits;
+    get_properties((VkPhysicalDevice)gpu, &properties);
+
+    // Plenty for thousands of materials; the two storage buffers also count
+    // against the pool-wide limit
+    uint32_t const pool_limit = limits.maxUpdateAfterBindDescriptorsInAllPools;
+    bindless_capacity = std::min({4096u, limits.maxDescriptorSetUpdateAfterBindSampledImages,
+                                  limits.maxDescriptorSetUpdateAfterBindSamplers,
+                                  limits.maxPerStageDescriptorUpdateAfterBindSampledImages,
+                                  limits.maxPerStageDescriptorUpdateAfterBindSamplers, pool_limit - std::min(pool_limit, 2u)});
+
+    // Every texture needs a second slot for the one streaming in to replace it
+    return bindless_capacity >= 2 * texture_count;
+#else
+    return false;
+#endif
+}
+
+void Demo::init_vk_headless() {
+    // Without a surface any graphics queue will do; there is nothing to present
+    uint32_t graphicsQueueFamilyIndex = UINT32_MAX;
+    for (uint32_t i = 0; i < queue_family_count; i++) {
+        if (queue_props[i].queueFlags & vk::QueueFlagBits::eGraphics) {
+            graphicsQueueFamilyIndex = i;
+            break;
+        }
+    }
+
+    if (graphicsQueueFamilyIndex == UINT32_MAX) {
+        ERR_EXIT("Could not find a graphics queue\n", "Headless Initialization Failure");
+    }
+
+    graphics_queue_family_index = graphicsQueueFamilyIndex;
+    present_queue_family_index = graphicsQueueFamilyIndex;
+    separate_present_queue = false;
+    pick_transfer_queue_family();
+
+    create_device();
+
+    device.getQueue(graphics_queue_family_index, 0, &graphics_queue);
+    present_queue = graphics_queue;
+    if (!separate_transfer_queue) {
+        transfer_queue = graphics_queue;
+    } else {
+        device.getQueue(transfer_queue_family_index, 0, &transfer_queue);
+    }
+
+    // Offscreen images are read back as RGBA8 so the output needs no swizzle
+    format = vk::Format::eR8G8B8A8Unorm;
+    color_space = vk::ColorSpaceKHR::eSrgbNonlinear;
+
+    prepare_frame_sync();
+}
+
+// A family with transfer but neither graphics nor compute is usually a
+// dedicated copy engine, which uploads without competing with rendering.
+// Without one, uploads share the graphics queue.
+void Demo::pick_transfer_queue_family() {
+    transfer_queue_family_index = graphics_queue_family_index;
+    for (uint32_t i = 0; i < queue_family_count; i++) {
+        auto const flags = queue_props[i].queueFlags;
+        if ((flags & vk::QueueFlagBits::eTransfer) && !(flags & (vk::QueueFlagBits::eGraphics | vk::QueueFlagBits::eCompute))) {
+            transfer_queue_family_index = i;
+            break;
+        }
+    }
+    separate_transfer_queue = (transfer_queue_family_index != graphics_queue_family_index);
 }
 
 void Demo::init_vk_swapchain() {
+    TRACE_ZONE("init_vk_swapchain");
+    if (headless) {
+        init_vk_headless();
+        return;
+    }
+
 // Create a WSI surface for the window:
 #if defined(VK_USE_PLATFORM_WIN32_KHR)
     {
@@ -1375,6 +2607,7 @@ void Demo::init_vk_swapchain() {
     graphics_queue_family_index = graphicsQueueFamilyIndex;
     present_queue_family_index = presentQueueFamilyIndex;
     separate_present_queue = (graphics_queue_family_index != present_queue_family_index);
+    pick_transfer_queue_family();
 
     create_device();
 
@@ -1384,6 +2617,11 @@ void Demo::init_vk_swapchain() {
     } else {
         device.getQueue(present_queue_family_index, 0, &present_queue);
     }
+    if (!separate_transfer_queue) {
+        transfer_queue = graphics_queue;
+    } else {
+        device.getQueue(transfer_queue_family_index, 0, &transfer_queue);
+    }
 
     // Get the list of VkFormat's that are supported:
     uint32_t formatCount;
@@ -1405,6 +2643,10 @@ void Demo::init_vk_swapchain() {
     }
     color_space = surfFormats[0].colorSpace;
 
+    prepare_frame_sync();
+}
+
+void Demo::prepare_frame_sync() {
     quit = false;
     curFrame = 0;
 
@@ -1412,14 +2654,10 @@ void Demo::init_vk_swapchain() {
     // rendering and waiting for drawing to be complete before presenting
     auto const semaphoreCreateInfo = vk::SemaphoreCreateInfo();
 
-    // Create fences that we can use to throttle if we get too far
-    // ahead of the image presents
-    auto const fence_ci = vk::FenceCreateInfo().setFlags(vk::FenceCreateFlagBits::eSignaled);
-    for (uint32_t i = 0; i < FRAME_LAG; i++) {
-        result = device.createFence(&fence_ci, nullptr, &fences[i]);
-        VERIFY(result == vk::Result::eSuccess);
-
-        result = device.createSemaphore(&semaphoreCreateInfo, nullptr, &image_acquired_semaphores[i]);
+    // The scheduler throttles us if we get too far ahead of the image presents
+    frames.init(device, frame_lag, timeline_frames && timeline_enabled);
+    for (uint32_t i = 0; i < frame_lag; i++) {
+        auto result = device.createSemaphore(&semaphoreCreateInfo, nullptr, &image_acquired_semaphores[i]);
         VERIFY(result == vk::Result::eSuccess);
 
         result = device.createSemaphore(&semaphoreCreateInfo, nullptr, &draw_complete_semaphores[i]);
@@ -1434,39 +2672,42 @@ void Demo::init_vk_swapchain() {
 
     // Get Memory information and properties
     gpu.getMemoryProperties(&memory_properties);
+    allocator.init(gpu, device);
 }
 
 void Demo::prepare() {
-    auto const cmd_pool_info = vk::CommandPoolCreateInfo().setQueueFamilyIndex(graphics_queue_family_index);
+    TRACE_ZONE("prepare");
+    // Frame command buffers are re-recorded individually every frame
+    auto const cmd_pool_info = vk::CommandPoolCreateInfo()
+                                   .setFlags(vk::CommandPoolCreateFlagBits::eResetCommandBuffer)
+                                   .setQueueFamilyIndex(graphics_queue_family_index);
     auto result = device.createCommandPool(&cmd_pool_info, nullptr, &cmd_pool);
     VERIFY(result == vk::Result::eSuccess);
 
-    auto const cmd = vk::CommandBufferAllocateInfo()
-                         .setCommandPool(cmd_pool)
-                         .setLevel(vk::CommandBufferLevel::ePrimary)
-                         .setCommandBufferCount(1);
-
-    result = device.allocateCommandBuffers(&cmd, &this->cmd);
-    VERIFY(result == vk::Result::eSuccess);
-
-    auto const cmd_buf_info = vk::CommandBufferBeginInfo().setPInheritanceInfo(nullptr);
-
-    result = this->cmd.begin(&cmd_buf_info);
-    VERIFY(result == vk::Result::eSuccess);
+    begin_init_cmd();
 
     prepare_buffers();
     prepare_depth();
     prepare_textures();
     prepare_cube_data_buffers();
+    prepare_instance_buffers();
+    prepare_mesh_buffers();
 
     prepare_descriptor_layout();
     prepare_render_pass();
     prepare_pipeline();
 
-    for (uint32_t i = 0; i < swapchainImageCount; ++i) {
-        result = device.allocateCommandBuffers(&cmd, &swapchain_image_resources[i].cmd);
-        VERIFY(result == vk::Result::eSuccess);
-    }
+    auto const draw_cmd_info = vk::CommandBufferAllocateInfo()
+                                   .setCommandPool(cmd_pool)
+                                   .setLevel(vk::CommandBufferLevel::ePrimary)
+                                   .setCommandBufferCount(frame_lag);
+
+    result = device.allocateCommandBuffers(&draw_cmd_info, draw_cmds);
+    VERIFY(result == vk::Result::eSuccess);
+
+    prepare_worker_recording();
+
+    prepare_timestamp_queries();
 
     if (separate_present_queue) {
         auto const present_cmd_pool_info = vk::CommandPoolCreateInfo().setQueueFamilyIndex(present_queue_family_index);
@@ -1474,43 +2715,45 @@ void Demo::prepare() {
         result = device.createCommandPool(&present_cmd_pool_info, nullptr, &present_cmd_pool);
         VERIFY(result == vk::Result::eSuccess);
 
-        auto const present_cmd = vk::CommandBufferAllocateInfo()
-                                     .setCommandPool(present_cmd_pool)
-                                     .setLevel(vk::CommandBufferLevel::ePrimary)
-                                     .setCommandBufferCount(1);
-
-        for (uint32_t i = 0; i < swapchainImageCount; i++) {
-            result = device.allocateCommandBuffers(&present_cmd, &swapchain_image_resources[i].graphics_to_present_cmd);
-            VERIFY(result == vk::Result::eSuccess);
-
-            build_image_ownership_cmd(i);
-        }
+        prepare_present_cmds();
     }
 
     prepare_descriptor_pool();
     prepare_descriptor_set();
 
     prepare_framebuffers();
-
-    for (uint32_t i = 0; i < swapchainImageCount; ++i) {
-        current_buffer = i;
-        draw_build_cmd(swapchain_image_resources[i].cmd);
-    }
+    prepare_culling();
 
     /*
      * Prepare functions above may generate pipeline commands
      * that need to be flushed before beginning the render loop.
      */
     flush_init_cmd();
-    if (staging_texture.image) {
-        destroy_texture_image(&staging_texture);
+    allocator.trim();
+
+    // A capture must not depend on how fast the textures happened to arrive
+    if (readback_file) {
+        streamer.flush();
     }
 
     current_buffer = 0;
+
+    // Only once, not again after a resize
+    if (record_sweep) {
+        benchmark_recording();
+        record_sweep = false;
+    }
+
     prepared = true;
 }
 
 void Demo::prepare_buffers() {
+    TRACE_ZONE("prepare_buffers");
+    if (headless) {
+        prepare_offscreen_buffers();
+        return;
+    }
+
     vk::SwapchainKHR oldSwapchain = swapchain;
 
     // Check the surface capabilities and formats
@@ -1647,14 +2890,8 @@ void Demo::prepare_buffers() {
     result = device.createSwapchainKHR(&swapchain_ci, nullptr, &swapchain);
     VERIFY(result == vk::Result::eSuccess);
 
-    // If we just re-created an existing swapchain, we should destroy the
-    // old
-    // swapchain at this point.
-    // Note: destroying the swapchain also cleans up all its associated
-    // presentable images once the platform is done with them.
-    if (oldSwapchain) {
-        device.destroySwapchainKHR(oldSwapchain, nullptr);
-    }
+    // An old swapchain is not destroyed here: frames in flight may still
+    // render to its images.  resize() retired it along with them.
 
     result = device.getSwapchainImagesKHR(swapchain, &swapchainImageCount, nullptr);
     VERIFY(result == vk::Result::eSuccess);
@@ -1680,6 +2917,62 @@ void Demo::prepare_buffers() {
     }
 }
 
+// One ownership transfer per swapchain image, from the present command pool
+void Demo::prepare_present_cmds() {
+    auto const present_cmd = vk::CommandBufferAllocateInfo()
+                                 .setCommandPool(present_cmd_pool)
+                                 .setLevel(vk::CommandBufferLevel::ePrimary)
+                                 .setCommandBufferCount(1);
+
+    for (uint32_t i = 0; i < swapchainImageCount; i++) {
+        auto const result = device.allocateCommandBuffers(&present_cmd, &swapchain_image_resources[i].graphics_to_present_cmd);
+        VERIFY(result == vk::Result::eSuccess);
+
+        build_image_ownership_cmd(i);
+    }
+}
+
+void Demo::prepare_offscreen_buffers() {
+    // Headless mode renders into plain images instead of swapchain images.
+    // One image per frame slot lets frames be pushed as fast as the device
+    // allows without waiting on a presentation engine.
+    swapchainImageCount = frame_lag;
+    swapchain_image_resources.reset(new SwapchainImageResources[swapchainImageCount]);
+
+    auto const image_ci = vk::ImageCreateInfo()
+                              .setImageType(vk::ImageType::e2D)
+                              .setFormat(format)
+                              .setExtent({width, height, 1})
+                              .setMipLevels(1)
+                              .setArrayLayers(1)
+                              .setSamples(vk::SampleCountFlagBits::e1)
+                              .setTiling(vk::ImageTiling::eOptimal)
+                              .setUsage(vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eTransferSrc)
+                              .setSharingMode(vk::SharingMode::eExclusive)
+                              .setQueueFamilyIndexCount(0)
+                              .setPQueueFamilyIndices(nullptr)
+                              .setInitialLayout(vk::ImageLayout::eUndefined);
+
+    for (uint32_t i = 0; i < swapchainImageCount; ++i) {
+        auto result = device.createImage(&image_ci, nullptr, &swapchain_image_resources[i].image);
+        VERIFY(result == vk::Result::eSuccess);
+
+        bool const pass = allocator.allocate_image(swapchain_image_resources[i].image, vk::ImageTiling::eOptimal,
+                                                   vk::MemoryPropertyFlagBits::eDeviceLocal, vk::MemoryPropertyFlags(),
+                                                   allocation_strategy::buddy, &swapchain_image_resources[i].image_alloc);
+        VERIFY(pass);
+
+        auto const color_image_view = vk::ImageViewCreateInfo()
+                                          .setImage(swapchain_image_resources[i].image)
+                                          .setViewType(vk::ImageViewType::e2D)
+                                          .setFormat(format)
+                                          .setSubresourceRange(vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1));
+
+        result = device.createImageView(&color_image_view, nullptr, &swapchain_image_resources[i].view);
+        VERIFY(result == vk::Result::eSuccess);
+    }
+}
+
 void Demo::prepare_cube_data_buffers() {
     mat4x4 VP;
     mat4x4_mul(VP, projection_matrix, view_matrix);
@@ -1702,36 +2995,571 @@ void Demo::prepare_cube_data_buffers() {
         data.attr[i][3] = 0;
     }
 
-    auto const buf_info = vk::BufferCreateInfo().setSize(sizeof(data)).setUsage(vk::BufferUsageFlagBits::eUniformBuffer);
+    prepare_object_placements();
 
-    for (unsigned int i = 0; i < swapchainImageCount; i++) {
-        auto result = device.createBuffer(&buf_info, nullptr, &swapchain_image_resources[i].uniform_buffer);
+    // Dynamic offsets must be multiples of minUniformBufferOffsetAlignment
+    vk::DeviceSize const alignment = std::max<vk::DeviceSize>(gpu_props.limits.minUniformBufferOffsetAlignment, 1);
+    uniform_data.object_stride = (sizeof(data) + alignment - 1) / alignment * alignment;
+    uniform_data.frame_stride = uniform_data.object_stride * object_count;
+
+    // The bindless shaders index the whole arena as a storage buffer instead
+    auto const usage = bindless ? vk::BufferUsageFlagBits::eStorageBuffer : vk::BufferUsageFlagBits::eUniformBuffer;
+    auto const buf_info = vk::BufferCreateInfo().setSize(uniform_data.frame_stride * frame_lag).setUsage(usage);
+
+    auto result = device.createBuffer(&buf_info, nullptr, &uniform_data.buf);
+    VERIFY(result == vk::Result::eSuccess);
+
+    // The allocator keeps host visible blocks mapped; coherent, so no flushes either
+    bool const pass = allocator.allocate_buffer(uniform_data.buf,
+                                                vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
+                                                vk::MemoryPropertyFlags(), allocation_strategy::buddy, &uniform_data.alloc);
+    VERIFY(pass);
+
+    // The vertex data never changes; only the MVP at the front of each entry
+    // is rewritten per frame.
+    for (uint32_t f = 0; f < frame_lag; f++) {
+        for (uint32_t i = 0; i < object_count; i++) {
+            memcpy(uniform_data.alloc.mapped + f * uniform_data.frame_stride + i * uniform_data.object_stride, &data, sizeof data);
+        }
+    }
+}
+
+void Demo::prepare_object_placements() {
+    // Instances carry their own placements; the arena then holds one unplaced cube
+    if (instance_count) {
+        object_count = 1;
+    }
+
+    grid_placements(object_count, objects);
+
+    // Positions and scales are fixed; the shared rotation is refilled every frame
+    object_soa.assign(8 * (size_t)object_count, 0.0f);
+    float *const arrays[8] = {&object_soa[0 * object_count], &object_soa[1 * object_count], &object_soa[2 * object_count],
+                              &object_soa[3 * object_count], &object_soa[4 * object_count], &object_soa[5 * object_count],
+                              &object_soa[6 * object_count], &object_soa[7 * object_count]};
+    for (uint32_t i = 0; i < object_count; i++) {
+        arrays[0][i] = objects[i].x;
+        arrays[1][i] = objects[i].y;
+        arrays[2][i] = objects[i].z;
+        arrays[6][i] = 1.0f;
+        arrays[7][i] = objects[i].scale;
+    }
+
+    object_transforms.x = arrays[0];
+    object_transforms.y = arrays[1];
+    object_transforms.z = arrays[2];
+    object_transforms.qx = arrays[3];
+    object_transforms.qy = arrays[4];
+    object_transforms.qz = arrays[5];
+    object_transforms.qw = arrays[6];
+    object_transforms.scale = arrays[7];
+}
+
+void Demo::destroy_uniform_arena() {
+    device.destroyBuffer(uniform_data.buf, nullptr);
+    allocator.free(&uniform_data.alloc);
+}
+
+void Demo::prepare_instance_buffers() {
+    if (!instance_count) {
+        return;
+    }
+
+    std::vector<object_placement> placements;
+    grid_placements(instance_count, placements);
+
+    // Written once from the CPU and then only read by the GPU: device local
+    // memory the host can write to is ideal, plain host memory works too.
+    auto buf_info = vk::BufferCreateInfo()
+                        .setSize(sizeof(object_placement) * instance_count)
+                        .setUsage(vk::BufferUsageFlagBits::eStorageBuffer);
+
+    auto result = device.createBuffer(&buf_info, nullptr, &instancing.placements);
+    VERIFY(result == vk::Result::eSuccess);
+
+    bool pass = allocator.allocate_buffer(
+        instancing.placements, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
+        vk::MemoryPropertyFlagBits::eDeviceLocal, allocation_strategy::buddy, &instancing.placements_alloc);
+    VERIFY(pass);
+
+    memcpy(instancing.placements_alloc.mapped, placements.data(), sizeof(object_placement) * instance_count);
+
+    // The cull pass resets and rewrites the draw every frame
+    buf_info.setSize(sizeof(vk::DrawIndirectCommand))
+        .setUsage(cull ? vk::BufferUsageFlagBits::eIndirectBuffer | vk::BufferUsageFlagBits::eStorageBuffer |
+                             vk::BufferUsageFlagBits::eTransferDst
+                       : vk::BufferUsageFlagBits::eIndirectBuffer);
+
+    result = device.createBuffer(&buf_info, nullptr, &instancing.indirect);
+    VERIFY(result == vk::Result::eSuccess);
+
+    pass = allocator.allocate_buffer(instancing.indirect,
+                                     vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
+                                     vk::MemoryPropertyFlagBits::eDeviceLocal, allocation_strategy::buddy, &instancing.indirect_alloc);
+    VERIFY(pass);
+
+    auto const draw = vk::DrawIndirectCommand().setVertexCount(12 * 3).setInstanceCount(instance_count);
+    memcpy(instancing.indirect_alloc.mapped, &draw, sizeof(draw));
+
+    if (cull) {
+        // Never touched by the CPU
+        buf_info.setSize(sizeof(object_placement) * instance_count).setUsage(vk::BufferUsageFlagBits::eStorageBuffer);
+
+        result = device.createBuffer(&buf_info, nullptr, &culling.visible);
         VERIFY(result == vk::Result::eSuccess);
 
-        vk::MemoryRequirements mem_reqs;
-        device.getBufferMemoryRequirements(swapchain_image_resources[i].uniform_buffer, &mem_reqs);
+        pass = allocator.allocate_buffer(culling.visible, vk::MemoryPropertyFlagBits::eDeviceLocal, vk::MemoryPropertyFlags(),
+                                         allocation_strategy::buddy, &culling.visible_alloc);
+        VERIFY(pass);
+    }
+}
+
+void Demo::destroy_instance_buffers() {
+    if (!instance_count) {
+        return;
+    }
+
+    device.destroyBuffer(instancing.placements, nullptr);
+    allocator.free(&instancing.placements_alloc);
+    device.destroyBuffer(instancing.indirect, nullptr);
+    allocator.free(&instancing.indirect_alloc);
 
-        auto mem_alloc = vk::MemoryAllocateInfo().setAllocationSize(mem_reqs.size).setMemoryTypeIndex(0);
+    if (cull) {
+        device.destroyBuffer(culling.visible, nullptr);
+        allocator.free(&culling.visible_alloc);
+    }
+}
+
+void Demo::prepare_mesh_buffers() {
+    TRACE_ZONE("prepare_mesh_buffers");
+    if (!mesh_file) {
+        if (quantize) {
+            ERR_EXIT("--quantize needs --mesh", "Mesh Failure");
+        }
+        return;
+    }
+    if (instance_count) {
+        ERR_EXIT("--mesh cannot be combined with --instances", "Mesh Failure");
+    }
 
-        bool const pass = memory_type_from_properties(
-            mem_reqs.memoryTypeBits, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
-            &mem_alloc.memoryTypeIndex);
+    // Parsing is spread over every core; the pool goes away once loaded
+    mesh_data data;
+    {
+        job_system loader;
+        loader.start(std::max(1u, std::thread::hardware_concurrency()) - 1);
+        if (!mesh_load(mesh_file, loader, &data, &mesh.stats)) {
+            ERR_EXIT("Cannot load the --mesh file", "Mesh Failure");
+        }
+    }
+    mesh.index_count = (uint32_t)data.indices.size();
+
+    mesh_stats const &stats = mesh.stats;
+    printf("Mesh %s: %" PRIu32 " vertices (%" PRIu32 " corners before welding), %" PRIu32 " triangles\n", mesh_file,
+           stats.vertices, stats.corners, stats.triangles);
+    printf("  ACMR %.3f -> %.3f, ATVR %.3f; parse %.2f ms on %" PRIu32 " threads, weld %.2f ms, optimize %.2f ms\n",
+           stats.acmr_before, stats.acmr_after, stats.atvr_after, stats.parse_ms, stats.threads, stats.weld_ms, stats.optimize_ms);
+
+    // Half the size; the shader reads the same floats either way
+    std::vector<packed_vertex> packed;
+    if (quantize) {
+        packed.resize(data.vertices.size());
+        quantize_kernel const kernel = quantize_best_kernel();
+        auto const start = bench_clock::now();
+        quantize_vertices(kernel, data.vertices.data(), data.vertices.size(), packed.data());
+        printf("  Quantized to %zu bytes per vertex in %.2f ms (%s)\n", sizeof(packed_vertex),
+               elapsed_ms(start, bench_clock::now()), quantize_kernel_name(kernel));
+    }
+    mesh.vertex_bytes = quantize ? packed.size() * sizeof(packed_vertex) : data.vertices.size() * sizeof(mesh_vertex);
+
+    // Written once, like the instance placements
+    struct {
+        vk::Buffer *buffer;
+        device_allocation *alloc;
+        void const *contents;
+        size_t size;
+        vk::BufferUsageFlags usage;
+    } const uploads[2] = {
+        {&mesh.vertices, &mesh.vertices_alloc, quantize ? (void const *)packed.data() : (void const *)data.vertices.data(),
+         (size_t)mesh.vertex_bytes, vk::BufferUsageFlagBits::eVertexBuffer},
+        {&mesh.indices, &mesh.indices_alloc, data.indices.data(), data.indices.size() * sizeof(uint32_t),
+         vk::BufferUsageFlagBits::eIndexBuffer},
+    };
+    for (auto const &upload : uploads) {
+        auto const buf_info = vk::BufferCreateInfo().setSize(upload.size).setUsage(upload.usage);
+        auto result = device.createBuffer(&buf_info, nullptr, upload.buffer);
+        VERIFY(result == vk::Result::eSuccess);
+
+        bool const pass = allocator.allocate_buffer(
+            *upload.buffer, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
+            vk::MemoryPropertyFlagBits::eDeviceLocal, allocation_strategy::buddy, upload.alloc);
         VERIFY(pass);
 
-        result = device.allocateMemory(&mem_alloc, nullptr, &swapchain_image_resources[i].uniform_memory);
+        memcpy(upload.alloc->mapped, upload.contents, upload.size);
+    }
+}
+
+void Demo::destroy_mesh_buffers() {
+    if (!mesh_file) {
+        return;
+    }
+
+    device.destroyBuffer(mesh.vertices, nullptr);
+    allocator.free(&mesh.vertices_alloc);
+    device.destroyBuffer(mesh.indices, nullptr);
+    allocator.free(&mesh.indices_alloc);
+}
+
+vk::Pipeline Demo::create_compute_pipeline(char const *filename, vk::PipelineLayout layout) {
+    // The library keeps the module; compute pipelines are not hot reloaded
+    auto const module = shaders.load(filename, nullptr, 0);
+    if (!module) {
+        fprintf(stderr, "Cannot load %s, build it with compile_shaders.cmd\n", filename);
+        ERR_EXIT("Cannot load a compute shader", "Load Shader Failure");
+    }
+
+    auto const pipeline_info =
+        vk::ComputePipelineCreateInfo()
+            .setStage(vk::PipelineShaderStageCreateInfo().setStage(vk::ShaderStageFlagBits::eCompute).setModule(module).setPName("main"))
+            .setLayout(layout);
+
+    vk::Pipeline compute_pipeline;
+    auto result = device.createComputePipelines(pipelineCache, 1, &pipeline_info, nullptr, &compute_pipeline);
+    VERIFY(result == vk::Result::eSuccess);
+
+    return compute_pipeline;
+}
+
+void Demo::prepare_culling() {
+    TRACE_ZONE("prepare_culling");
+    if (!cull) {
+        return;
+    }
+    if (!instance_count) {
+        ERR_EXIT("--cull and --hiz need --instances", "Culling Failure");
+    }
+
+    vk::DescriptorSetLayoutBinding layout_bindings[5];
+    layout_bindings[0].setBinding(0).setDescriptorType(vk::DescriptorType::eUniformBufferDynamic);
+    for (uint32_t i = 1; i < 4; i++) {
+        layout_bindings[i].setBinding(i).setDescriptorType(vk::DescriptorType::eStorageBuffer);
+    }
+    layout_bindings[4].setBinding(4).setDescriptorType(vk::DescriptorType::eCombinedImageSampler);
+    for (auto &binding : layout_bindings) {
+        binding.setDescriptorCount(1).setStageFlags(vk::ShaderStageFlagBits::eCompute);
+    }
+
+    auto descriptor_layout = vk::DescriptorSetLayoutCreateInfo().setBindingCount(5).setPBindings(layout_bindings);
+    auto result = device.createDescriptorSetLayout(&descriptor_layout, nullptr, &culling.desc_layout);
+    VERIFY(result == vk::Result::eSuccess);
+
+    auto pipeline_layout_info = vk::PipelineLayoutCreateInfo().setSetLayoutCount(1).setPSetLayouts(&culling.desc_layout);
+    result = device.createPipelineLayout(&pipeline_layout_info, nullptr, &culling.pipeline_layout);
+    VERIFY(result == vk::Result::eSuccess);
+
+    culling.pipeline = create_compute_pipeline("cube_cull.comp.spv", culling.pipeline_layout);
+
+    if (hiz) {
+        layout_bindings[0].setBinding(0).setDescriptorType(vk::DescriptorType::eCombinedImageSampler);
+        layout_bindings[1].setBinding(1).setDescriptorType(vk::DescriptorType::eStorageImage);
+
+        descriptor_layout.setBindingCount(2);
+        result = device.createDescriptorSetLayout(&descriptor_layout, nullptr, &culling.reduce_desc_layout);
+        VERIFY(result == vk::Result::eSuccess);
+
+        pipeline_layout_info.setPSetLayouts(&culling.reduce_desc_layout);
+        result = device.createPipelineLayout(&pipeline_layout_info, nullptr, &culling.reduce_pipeline_layout);
+        VERIFY(result == vk::Result::eSuccess);
+
+        culling.reduce_pipeline = create_compute_pipeline("cube_depth_reduce.comp.spv", culling.reduce_pipeline_layout);
+    }
+
+    prepare_culling_sets();
+}
+
+// The depth pyramid and the descriptor sets, which depend on the window size
+// and are rebuilt by resize()
+void Demo::prepare_culling_sets() {
+    prepare_depth_pyramid();
+
+    uint32_t const reduce_sets = hiz ? culling.pyramid_levels : 0;
+    vk::DescriptorPoolSize const pool_sizes[4] = {
+        vk::DescriptorPoolSize().setType(vk::DescriptorType::eUniformBufferDynamic).setDescriptorCount(1),
+        vk::DescriptorPoolSize().setType(vk::DescriptorType::eStorageBuffer).setDescriptorCount(3),
+        vk::DescriptorPoolSize().setType(vk::DescriptorType::eCombinedImageSampler).setDescriptorCount(1 + reduce_sets),
+        vk::DescriptorPoolSize().setType(vk::DescriptorType::eStorageImage).setDescriptorCount(std::max(reduce_sets, 1u))};
+
+    auto const pool_info = vk::DescriptorPoolCreateInfo().setMaxSets(1 + reduce_sets).setPoolSizeCount(4).setPPoolSizes(pool_sizes);
+    auto result = device.createDescriptorPool(&pool_info, nullptr, &culling.desc_pool);
+    VERIFY(result == vk::Result::eSuccess);
+
+    auto alloc_info = vk::DescriptorSetAllocateInfo()
+                          .setDescriptorPool(culling.desc_pool)
+                          .setDescriptorSetCount(1)
+                          .setPSetLayouts(&culling.desc_layout);
+    result = device.allocateDescriptorSets(&alloc_info, &culling.desc_set);
+    VERIFY(result == vk::Result::eSuccess);
+
+    vk::DescriptorBufferInfo const buffer_infos[4] = {
+        vk::DescriptorBufferInfo().setBuffer(uniform_data.buf).setOffset(0).setRange(sizeof(struct vktexcube_vs_uniform)),
+        vk::DescriptorBufferInfo().setBuffer(instancing.placements).setOffset(0).setRange(VK_WHOLE_SIZE),
+        vk::DescriptorBufferInfo().setBuffer(culling.visible).setOffset(0).setRange(VK_WHOLE_SIZE),
+        vk::DescriptorBufferInfo().setBuffer(instancing.indirect).setOffset(0).setRange(VK_WHOLE_SIZE)};
+
+    auto const pyramid_info = vk::DescriptorImageInfo()
+                                  .setSampler(culling.sampler)
+                                  .setImageView(culling.pyramid_view)
+                                  .setImageLayout(vk::ImageLayout::eGeneral);
+
+    vk::WriteDescriptorSet writes[5];
+    for (uint32_t i = 0; i < 4; i++) {
+        writes[i].setDstSet(culling.desc_set).setDstBinding(i).setDescriptorCount(1).setPBufferInfo(&buffer_infos[i]);
+        writes[i].setDescriptorType(i == 0 ? vk::DescriptorType::eUniformBufferDynamic : vk::DescriptorType::eStorageBuffer);
+    }
+    writes[4]
+        .setDstSet(culling.desc_set)
+        .setDstBinding(4)
+        .setDescriptorCount(1)
+        .setDescriptorType(vk::DescriptorType::eCombinedImageSampler)
+        .setPImageInfo(&pyramid_info);
+
+    device.updateDescriptorSets(5, writes, 0, nullptr);
+
+    culling.reduce_sets.resize(reduce_sets);
+    for (uint32_t level = 0; level < reduce_sets; level++) {
+        alloc_info.setPSetLayouts(&culling.reduce_desc_layout);
+        result = device.allocateDescriptorSets(&alloc_info, &culling.reduce_sets[level]);
         VERIFY(result == vk::Result::eSuccess);
 
-        auto pData = device.mapMemory(swapchain_image_resources[i].uniform_memory, 0, VK_WHOLE_SIZE, vk::MemoryMapFlags());
-        VERIFY(pData.result == vk::Result::eSuccess);
+        auto const src_info = level == 0 ? vk::DescriptorImageInfo()
+                                               .setSampler(culling.sampler)
+                                               .setImageView(depth.view)
+                                               .setImageLayout(vk::ImageLayout::eShaderReadOnlyOptimal)
+                                         : vk::DescriptorImageInfo()
+                                               .setSampler(culling.sampler)
+                                               .setImageView(culling.level_views[level - 1])
+                                               .setImageLayout(vk::ImageLayout::eGeneral);
+
+        auto const dst_info = vk::DescriptorImageInfo().setImageView(culling.level_views[level]).setImageLayout(vk::ImageLayout::eGeneral);
+
+        writes[0]
+            .setDstSet(culling.reduce_sets[level])
+            .setDstBinding(0)
+            .setDescriptorType(vk::DescriptorType::eCombinedImageSampler)
+            .setPBufferInfo(nullptr)
+            .setPImageInfo(&src_info);
+        writes[1]
+            .setDstSet(culling.reduce_sets[level])
+            .setDstBinding(1)
+            .setDescriptorType(vk::DescriptorType::eStorageImage)
+            .setPBufferInfo(nullptr)
+            .setPImageInfo(&dst_info);
+
+        device.updateDescriptorSets(2, writes, 0, nullptr);
+    }
+}
+
+void Demo::prepare_depth_pyramid() {
+    // Level 0 is the largest power of two that fits in the depth buffer, so
+    // that each level is exactly half the previous one
+    culling.pyramid_width = 1;
+    culling.pyramid_height = 1;
+    if (hiz) {
+        while (culling.pyramid_width * 2 <= width) {
+            culling.pyramid_width *= 2;
+        }
+        while (culling.pyramid_height * 2 <= height) {
+            culling.pyramid_height *= 2;
+        }
+    }
 
-        memcpy(pData.value, &data, sizeof data);
+    culling.pyramid_levels = 1;
+    while ((std::max(culling.pyramid_width, culling.pyramid_height) >> culling.pyramid_levels) > 0) {
+        culling.pyramid_levels++;
+    }
 
-        device.unmapMemory(swapchain_image_resources[i].uniform_memory);
+    auto const image_info = vk::ImageCreateInfo()
+                                .setImageType(vk::ImageType::e2D)
+                                .setFormat(vk::Format::eR32Sfloat)
+                                .setExtent({culling.pyramid_width, culling.pyramid_height, 1})
+                                .setMipLevels(culling.pyramid_levels)
+                                .setArrayLayers(1)
+                                .setSamples(vk::SampleCountFlagBits::e1)
+                                .setTiling(vk::ImageTiling::eOptimal)
+                                .setUsage(vk::ImageUsageFlagBits::eSampled | vk::ImageUsageFlagBits::eStorage |
+                                          vk::ImageUsageFlagBits::eTransferDst)
+                                .setSharingMode(vk::SharingMode::eExclusive)
+                                .setInitialLayout(vk::ImageLayout::eUndefined);
+
+    auto result = device.createImage(&image_info, nullptr, &culling.pyramid);
+    VERIFY(result == vk::Result::eSuccess);
 
-        result =
-            device.bindBufferMemory(swapchain_image_resources[i].uniform_buffer, swapchain_image_resources[i].uniform_memory, 0);
+    bool const pass = allocator.allocate_image(culling.pyramid, vk::ImageTiling::eOptimal, vk::MemoryPropertyFlagBits::eDeviceLocal,
+                                               vk::MemoryPropertyFlags(), allocation_strategy::buddy, &culling.pyramid_alloc);
+    VERIFY(pass);
+
+    auto view_info = vk::ImageViewCreateInfo()
+                         .setImage(culling.pyramid)
+                         .setViewType(vk::ImageViewType::e2D)
+                         .setFormat(vk::Format::eR32Sfloat)
+                         .setSubresourceRange(vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, culling.pyramid_levels, 0, 1));
+
+    result = device.createImageView(&view_info, nullptr, &culling.pyramid_view);
+    VERIFY(result == vk::Result::eSuccess);
+
+    culling.level_views.resize(culling.pyramid_levels);
+    for (uint32_t level = 0; level < culling.pyramid_levels; level++) {
+        view_info.setSubresourceRange(vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, level, 1, 0, 1));
+        result = device.createImageView(&view_info, nullptr, &culling.level_views[level]);
         VERIFY(result == vk::Result::eSuccess);
     }
+
+    // texelFetch ignores filtering, only the sampler object is needed
+    auto const sampler_info = vk::SamplerCreateInfo()
+                                  .setMagFilter(vk::Filter::eNearest)
+                                  .setMinFilter(vk::Filter::eNearest)
+                                  .setMipmapMode(vk::SamplerMipmapMode::eNearest)
+                                  .setAddressModeU(vk::SamplerAddressMode::eClampToEdge)
+                                  .setAddressModeV(vk::SamplerAddressMode::eClampToEdge)
+                                  .setAddressModeW(vk::SamplerAddressMode::eClampToEdge)
+                                  .setMaxLod((float)culling.pyramid_levels);
+
+    result = device.createSampler(&sampler_info, nullptr, &culling.sampler);
+    VERIFY(result == vk::Result::eSuccess);
+
+    // Until the first frame has been reduced everything is at the far plane,
+    // which occludes nothing
+    auto const range = vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, culling.pyramid_levels, 0, 1);
+
+    auto barrier = vk::ImageMemoryBarrier()
+                       .setSrcAccessMask(vk::AccessFlags())
+                       .setDstAccessMask(vk::AccessFlagBits::eTransferWrite)
+                       .setOldLayout(vk::ImageLayout::eUndefined)
+                       .setNewLayout(vk::ImageLayout::eGeneral)
+                       .setSrcQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+                       .setDstQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+                       .setImage(culling.pyramid)
+                       .setSubresourceRange(range);
+
+    cmd.pipelineBarrier(vk::PipelineStageFlagBits::eTopOfPipe, vk::PipelineStageFlagBits::eTransfer, vk::DependencyFlagBits(), 0,
+                        nullptr, 0, nullptr, 1, &barrier);
+
+    auto const far_plane = vk::ClearColorValue(std::array<float, 4>({{1.0f, 1.0f, 1.0f, 1.0f}}));
+    cmd.clearColorImage(culling.pyramid, vk::ImageLayout::eGeneral, &far_plane, 1, &range);
+
+    barrier.setSrcAccessMask(vk::AccessFlagBits::eTransferWrite)
+        .setDstAccessMask(vk::AccessFlagBits::eShaderRead)
+        .setOldLayout(vk::ImageLayout::eGeneral);
+
+    cmd.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eComputeShader, vk::DependencyFlagBits(), 0,
+                        nullptr, 0, nullptr, 1, &barrier);
+}
+
+void Demo::destroy_culling() {
+    if (!cull) {
+        return;
+    }
+
+    device.destroyPipeline(culling.pipeline, nullptr);
+    device.destroyPipelineLayout(culling.pipeline_layout, nullptr);
+    device.destroyDescriptorSetLayout(culling.desc_layout, nullptr);
+    if (hiz) {
+        device.destroyPipeline(culling.reduce_pipeline, nullptr);
+        device.destroyPipelineLayout(culling.reduce_pipeline_layout, nullptr);
+        device.destroyDescriptorSetLayout(culling.reduce_desc_layout, nullptr);
+    }
+    device.destroyDescriptorPool(culling.desc_pool, nullptr);
+    culling.reduce_sets.clear();
+
+    for (auto &view : culling.level_views) {
+        device.destroyImageView(view, nullptr);
+    }
+    culling.level_views.clear();
+    device.destroyImageView(culling.pyramid_view, nullptr);
+    device.destroySampler(culling.sampler, nullptr);
+    device.destroyImage(culling.pyramid, nullptr);
+    allocator.free(&culling.pyramid_alloc);
+}
+
+void Demo::record_culling(vk::CommandBuffer commandBuffer) {
+    // The previous frame may still be drawing from the buffers rewritten
+    // here, and its cull pass wrote the instance count that is reset next
+    auto const before_reset = vk::MemoryBarrier()
+                                  .setSrcAccessMask(vk::AccessFlagBits::eShaderWrite)
+                                  .setDstAccessMask(vk::AccessFlagBits::eTransferWrite | vk::AccessFlagBits::eShaderWrite);
+
+    commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eDrawIndirect | vk::PipelineStageFlagBits::eVertexShader |
+                                      vk::PipelineStageFlagBits::eComputeShader,
+                                  vk::PipelineStageFlagBits::eTransfer | vk::PipelineStageFlagBits::eComputeShader,
+                                  vk::DependencyFlagBits(), 1, &before_reset, 0, nullptr, 0, nullptr);
+
+    auto const reset = vk::DrawIndirectCommand().setVertexCount(12 * 3).setInstanceCount(0);
+    commandBuffer.updateBuffer(instancing.indirect, 0, sizeof(reset), &reset);
+
+    // Make the reset, and the depth pyramid reduced after the last frame, visible to the cull shader
+    auto const before_cull = vk::MemoryBarrier()
+                                 .setSrcAccessMask(vk::AccessFlagBits::eTransferWrite | vk::AccessFlagBits::eShaderWrite)
+                                 .setDstAccessMask(vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite);
+
+    commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer | vk::PipelineStageFlagBits::eComputeShader,
+                                  vk::PipelineStageFlagBits::eComputeShader, vk::DependencyFlagBits(), 1, &before_cull, 0, nullptr,
+                                  0, nullptr);
+
+    uint32_t const dynamic_offset = (uint32_t)(frame_index * uniform_data.frame_stride);
+    commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, culling.pipeline);
+    commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, culling.pipeline_layout, 0, 1, &culling.desc_set, 1,
+                                     &dynamic_offset);
+    commandBuffer.dispatch((instance_count + 63) / 64, 1, 1);
+
+    auto const after_cull = vk::MemoryBarrier()
+                                .setSrcAccessMask(vk::AccessFlagBits::eShaderWrite)
+                                .setDstAccessMask(vk::AccessFlagBits::eIndirectCommandRead | vk::AccessFlagBits::eShaderRead);
+
+    commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader,
+                                  vk::PipelineStageFlagBits::eDrawIndirect | vk::PipelineStageFlagBits::eVertexShader,
+                                  vk::DependencyFlagBits(), 1, &after_cull, 0, nullptr, 0, nullptr);
+}
+
+void Demo::record_depth_pyramid(vk::CommandBuffer commandBuffer) {
+    // Also waits for this frame's cull pass, which read the levels about to be rewritten
+    auto const depth_barrier = vk::ImageMemoryBarrier()
+                                   .setSrcAccessMask(vk::AccessFlagBits::eDepthStencilAttachmentWrite)
+                                   .setDstAccessMask(vk::AccessFlagBits::eShaderRead)
+                                   .setOldLayout(vk::ImageLayout::eDepthStencilAttachmentOptimal)
+                                   .setNewLayout(vk::ImageLayout::eShaderReadOnlyOptimal)
+                                   .setSrcQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+                                   .setDstQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+                                   .setImage(depth.image)
+                                   .setSubresourceRange(vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eDepth, 0, 1, 0, 1));
+
+    commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eLateFragmentTests | vk::PipelineStageFlagBits::eComputeShader,
+                                  vk::PipelineStageFlagBits::eComputeShader, vk::DependencyFlagBits(), 0, nullptr, 0, nullptr, 1,
+                                  &depth_barrier);
+
+    commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, culling.reduce_pipeline);
+
+    for (uint32_t level = 0; level < culling.pyramid_levels; level++) {
+        uint32_t const level_width = std::max(culling.pyramid_width >> level, 1u);
+        uint32_t const level_height = std::max(culling.pyramid_height >> level, 1u);
+
+        commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, culling.reduce_pipeline_layout, 0, 1,
+                                         &culling.reduce_sets[level], 0, nullptr);
+        commandBuffer.dispatch((level_width + 7) / 8, (level_height + 7) / 8, 1);
+
+        // The next level reads this one
+        auto const level_barrier =
+            vk::ImageMemoryBarrier()
+                .setSrcAccessMask(vk::AccessFlagBits::eShaderWrite)
+                .setDstAccessMask(vk::AccessFlagBits::eShaderRead)
+                .setOldLayout(vk::ImageLayout::eGeneral)
+                .setNewLayout(vk::ImageLayout::eGeneral)
+                .setSrcQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+                .setDstQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+                .setImage(culling.pyramid)
+                .setSubresourceRange(vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, level, 1, 0, 1));
+
+        commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eComputeShader,
+                                      vk::DependencyFlagBits(), 0, nullptr, 0, nullptr, 1, &level_barrier);
+    }
 }
 
 void Demo::prepare_depth() {
@@ -1745,7 +3573,8 @@ void Demo::prepare_depth() {
                            .setArrayLayers(1)
                            .setSamples(vk::SampleCountFlagBits::e1)
                            .setTiling(vk::ImageTiling::eOptimal)
-                           .setUsage(vk::ImageUsageFlagBits::eDepthStencilAttachment)
+                           .setUsage(hiz ? vk::ImageUsageFlagBits::eDepthStencilAttachment | vk::ImageUsageFlagBits::eSampled
+                                         : vk::ImageUsageFlagBits::eDepthStencilAttachment)
                            .setSharingMode(vk::SharingMode::eExclusive)
                            .setQueueFamilyIndexCount(0)
                            .setPQueueFamilyIndices(nullptr)
@@ -1754,22 +3583,10 @@ void Demo::prepare_depth() {
     auto result = device.createImage(&image, nullptr, &depth.image);
     VERIFY(result == vk::Result::eSuccess);
 
-    vk::MemoryRequirements mem_reqs;
-    device.getImageMemoryRequirements(depth.image, &mem_reqs);
-
-    depth.mem_alloc.setAllocationSize(mem_reqs.size);
-    depth.mem_alloc.setMemoryTypeIndex(0);
-
-    auto const pass = memory_type_from_properties(mem_reqs.memoryTypeBits, vk::MemoryPropertyFlagBits::eDeviceLocal,
-                                                  &depth.mem_alloc.memoryTypeIndex);
+    auto const pass = allocator.allocate_image(depth.image, vk::ImageTiling::eOptimal, vk::MemoryPropertyFlagBits::eDeviceLocal,
+                                               vk::MemoryPropertyFlags(), allocation_strategy::buddy, &depth.alloc);
     VERIFY(pass);
 
-    result = device.allocateMemory(&depth.mem_alloc, nullptr, &depth.mem);
-    VERIFY(result == vk::Result::eSuccess);
-
-    result = device.bindImageMemory(depth.image, depth.mem, 0);
-    VERIFY(result == vk::Result::eSuccess);
-
     auto const view = vk::ImageViewCreateInfo()
                           .setImage(depth.image)
                           .setViewType(vk::ImageViewType::e2D)
@@ -1780,9 +3597,29 @@ void Demo::prepare_depth() {
 }
 
 void Demo::prepare_descriptor_layout() {
-    vk::DescriptorSetLayoutBinding const layout_bindings[2] = {vk::DescriptorSetLayoutBinding()
+    if (bindless) {
+        if (!bindless_descriptors.init(device, bindless_capacity)) {
+            ERR_EXIT("Cannot create the bindless descriptor set", "Bindless Failure");
+        }
+
+        auto const set_layout = bindless_descriptors.layout();
+        auto const push_range = vk::PushConstantRange()
+                                    .setStageFlags(vk::ShaderStageFlagBits::eVertex | vk::ShaderStageFlagBits::eFragment)
+                                    .setOffset(0)
+                                    .setSize(sizeof(bindless_draw));
+        auto const layout_info = vk::PipelineLayoutCreateInfo()
+                                     .setSetLayoutCount(1)
+                                     .setPSetLayouts(&set_layout)
+                                     .setPushConstantRangeCount(1)
+                                     .setPPushConstantRanges(&push_range);
+        auto const result = device.createPipelineLayout(&layout_info, nullptr, &pipeline_layout);
+        VERIFY(result == vk::Result::eSuccess);
+        return;
+    }
+
+    vk::DescriptorSetLayoutBinding const layout_bindings[3] = {vk::DescriptorSetLayoutBinding()
                                                                    .setBinding(0)
-                                                                   .setDescriptorType(vk::DescriptorType::eUniformBuffer)
+                                                                   .setDescriptorType(vk::DescriptorType::eUniformBufferDynamic)
                                                                    .setDescriptorCount(1)
                                                                    .setStageFlags(vk::ShaderStageFlagBits::eVertex)
                                                                    .setPImmutableSamplers(nullptr),
@@ -1791,9 +3628,17 @@ void Demo::prepare_descriptor_layout() {
                                                                    .setDescriptorType(vk::DescriptorType::eCombinedImageSampler)
                                                                    .setDescriptorCount(texture_count)
                                                                    .setStageFlags(vk::ShaderStageFlagBits::eFragment)
+                                                                   .setPImmutableSamplers(nullptr),
+                                                               vk::DescriptorSetLayoutBinding()
+                                                                   .setBinding(2)
+                                                                   .setDescriptorType(vk::DescriptorType::eStorageBuffer)
+                                                                   .setDescriptorCount(1)
+                                                                   .setStageFlags(vk::ShaderStageFlagBits::eVertex)
                                                                    .setPImmutableSamplers(nullptr)};
 
-    auto const descriptor_layout = vk::DescriptorSetLayoutCreateInfo().setBindingCount(2).setPBindings(layout_bindings);
+    // The placements binding only exists when drawing instances
+    auto const descriptor_layout =
+        vk::DescriptorSetLayoutCreateInfo().setBindingCount(instance_count ? 3 : 2).setPBindings(layout_bindings);
 
     auto result = device.createDescriptorSetLayout(&descriptor_layout, nullptr, &desc_layout);
     VERIFY(result == vk::Result::eSuccess);
@@ -1805,24 +3650,49 @@ void Demo::prepare_descriptor_layout() {
 }
 
 void Demo::prepare_descriptor_pool() {
-    vk::DescriptorPoolSize const poolSizes[2] = {
-        vk::DescriptorPoolSize().setType(vk::DescriptorType::eUniformBuffer).setDescriptorCount(swapchainImageCount),
-        vk::DescriptorPoolSize()
-            .setType(vk::DescriptorType::eCombinedImageSampler)
-            .setDescriptorCount(swapchainImageCount * texture_count)};
+    // bindless_table has its own
+    if (bindless) {
+        return;
+    }
+
+    // A single set serves every frame and object: the uniform binding is
+    // dynamic.  The second one is the spare that streamed textures go into.
+    vk::DescriptorPoolSize const poolSizes[3] = {
+        vk::DescriptorPoolSize().setType(vk::DescriptorType::eUniformBufferDynamic).setDescriptorCount(2),
+        vk::DescriptorPoolSize().setType(vk::DescriptorType::eCombinedImageSampler).setDescriptorCount(2 * texture_count),
+        vk::DescriptorPoolSize().setType(vk::DescriptorType::eStorageBuffer).setDescriptorCount(2)};
 
     auto const descriptor_pool =
-        vk::DescriptorPoolCreateInfo().setMaxSets(swapchainImageCount).setPoolSizeCount(2).setPPoolSizes(poolSizes);
+        vk::DescriptorPoolCreateInfo().setMaxSets(2).setPoolSizeCount(instance_count ? 3 : 2).setPPoolSizes(poolSizes);
 
     auto result = device.createDescriptorPool(&descriptor_pool, nullptr, &desc_pool);
     VERIFY(result == vk::Result::eSuccess);
 }
 
 void Demo::prepare_descriptor_set() {
+    if (bindless) {
+        prepare_bindless_descriptors();
+        return;
+    }
+
+    vk::DescriptorSetLayout const layouts[2] = {desc_layout, desc_layout};
     auto const alloc_info =
-        vk::DescriptorSetAllocateInfo().setDescriptorPool(desc_pool).setDescriptorSetCount(1).setPSetLayouts(&desc_layout);
+        vk::DescriptorSetAllocateInfo().setDescriptorPool(desc_pool).setDescriptorSetCount(2).setPSetLayouts(layouts);
+
+    vk::DescriptorSet sets[2];
+    auto result = device.allocateDescriptorSets(&alloc_info, sets);
+    VERIFY(result == vk::Result::eSuccess);
 
-    auto buffer_info = vk::DescriptorBufferInfo().setOffset(0).setRange(sizeof(struct vktexcube_vs_uniform));
+    desc_set = sets[0];
+    spare_desc_set = sets[1];
+    spare_desc_set_last_frame = 0;
+
+    write_descriptor_set(desc_set);
+}
+
+void Demo::write_descriptor_set(vk::DescriptorSet set) {
+    auto const buffer_info =
+        vk::DescriptorBufferInfo().setBuffer(uniform_data.buf).setOffset(0).setRange(sizeof(struct vktexcube_vs_uniform));
 
     vk::DescriptorImageInfo tex_descs[texture_count];
     for (uint32_t i = 0; i < texture_count; i++) {
@@ -1831,26 +3701,77 @@ void Demo::prepare_descriptor_set() {
         tex_descs[i].setImageLayout(vk::ImageLayout::eGeneral);
     }
 
-    vk::WriteDescriptorSet writes[2];
+    // When culling, the vertex shader only sees the survivors
+    auto const placements_info = vk::DescriptorBufferInfo()
+                                     .setBuffer(cull ? culling.visible : instancing.placements)
+                                     .setOffset(0)
+                                     .setRange(VK_WHOLE_SIZE);
+
+    vk::WriteDescriptorSet writes[3];
 
+    writes[0].setDstSet(set);
     writes[0].setDescriptorCount(1);
-    writes[0].setDescriptorType(vk::DescriptorType::eUniformBuffer);
+    writes[0].setDescriptorType(vk::DescriptorType::eUniformBufferDynamic);
     writes[0].setPBufferInfo(&buffer_info);
 
+    writes[1].setDstSet(set);
     writes[1].setDstBinding(1);
     writes[1].setDescriptorCount(texture_count);
     writes[1].setDescriptorType(vk::DescriptorType::eCombinedImageSampler);
     writes[1].setPImageInfo(tex_descs);
 
-    for (unsigned int i = 0; i < swapchainImageCount; i++) {
-        auto result = device.allocateDescriptorSets(&alloc_info, &swapchain_image_resources[i].descriptor_set);
-        VERIFY(result == vk::Result::eSuccess);
+    writes[2].setDstSet(set);
+    writes[2].setDstBinding(2);
+    writes[2].setDescriptorCount(1);
+    writes[2].setDescriptorType(vk::DescriptorType::eStorageBuffer);
+    writes[2].setPBufferInfo(&placements_info);
 
-        buffer_info.setBuffer(swapchain_image_resources[i].uniform_buffer);
-        writes[0].setDstSet(swapchain_image_resources[i].descriptor_set);
-        writes[1].setDstSet(swapchain_image_resources[i].descriptor_set);
-        device.updateDescriptorSets(2, writes, 0, nullptr);
+    device.updateDescriptorSets(instance_count ? 3 : 2, writes, 0, nullptr);
+}
+
+// The arena, the materials and the current textures go into the bindless set
+void Demo::prepare_bindless_descriptors() {
+    // One color per material; the first is white so a single material draws the plain texture
+    std::vector<float> tints(4 * (size_t)material_count);
+    for (uint32_t m = 0; m < material_count; m++) {
+        uint32_t hash = m * 0x9e3779b9u;
+        hash ^= hash >> 15;
+        for (uint32_t c = 0; c < 3; c++) {
+            tints[4 * m + c] = m == 0 ? 1.0f : 0.5f + 0.5f * (float)((hash >> (8 * c)) & 0xff) / 255.0f;
+        }
+        tints[4 * m + 3] = 1.0f;
     }
+
+    auto const buf_info =
+        vk::BufferCreateInfo().setSize(tints.size() * sizeof(float)).setUsage(vk::BufferUsageFlagBits::eStorageBuffer);
+    auto result = device.createBuffer(&buf_info, nullptr, &materials.buf);
+    VERIFY(result == vk::Result::eSuccess);
+
+    bool const pass = allocator.allocate_buffer(
+        materials.buf, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
+        vk::MemoryPropertyFlagBits::eDeviceLocal, allocation_strategy::buddy, &materials.alloc);
+    VERIFY(pass);
+    memcpy(materials.alloc.mapped, tints.data(), tints.size() * sizeof(float));
+
+    bindless_descriptors.set_buffer(bindless_table::OBJECTS, uniform_data.buf);
+    bindless_descriptors.set_buffer(bindless_table::MATERIALS, materials.buf);
+    for (uint32_t i = 0; i < texture_count; i++) {
+        texture_slots[i] = bindless_descriptors.add_texture(textures[i].sampler, textures[i].view, textures[i].imageLayout);
+        VERIFY(texture_slots[i] != bindless_table::NO_SLOT);
+    }
+
+    printf("Bindless descriptors: %" PRIu32 " texture slots, %" PRIu32 " material%s\n", bindless_descriptors.capacity(),
+           material_count, material_count == 1 ? "" : "s");
+}
+
+void Demo::destroy_bindless_descriptors() {
+    if (!bindless) {
+        return;
+    }
+
+    bindless_descriptors.destroy();
+    device.destroyBuffer(materials.buf, nullptr);
+    allocator.free(&materials.alloc);
 }
 
 void Demo::prepare_framebuffers() {
@@ -1873,84 +3794,215 @@ void Demo::prepare_framebuffers() {
 }
 
 vk::ShaderModule Demo::prepare_fs() {
-    const uint32_t fragShaderCode[] = {
+    if (bindless) {
+        frag_shader_module = shaders.load("cube_bindless.frag.spv", nullptr, 0);
+        if (!frag_shader_module) {
+            ERR_EXIT("Cannot load cube_bindless.frag.spv, build it with compile_shaders.cmd", "Load Shader Failure");
+        }
+        return frag_shader_module;
+    }
+
+    // cube.frag.spv next to the binary replaces the built-in code
+    static const uint32_t fragShaderCode[] = {
 #include "cube.frag.inc"
     };
 
-    frag_shader_module = prepare_shader_module(fragShaderCode, sizeof(fragShaderCode));
+    frag_shader_module = shaders.load("cube.frag.spv", fragShaderCode, sizeof(fragShaderCode));
+    VERIFY(frag_shader_module);
 
     return frag_shader_module;
 }
 
-void Demo::prepare_pipeline() {
-    vk::PipelineCacheCreateInfo const pipelineCacheInfo;
+void Demo::prepare_pipeline_cache() {
+    std::vector<uint8_t> initial_data;
+    if (pipeline_cache_file) {
+        pipeline_cache_status = load_pipeline_cache_data(initial_data) ? "hit" : "miss";
+    }
+
+    auto const pipelineCacheInfo =
+        vk::PipelineCacheCreateInfo().setInitialDataSize(initial_data.size()).setPInitialData(initial_data.data());
     auto result = device.createPipelineCache(&pipelineCacheInfo, nullptr, &pipelineCache);
+    if (result != vk::Result::eSuccess && !initial_data.empty()) {
+        // The driver may still refuse data that passed our checks; start cold
+        pipeline_cache_status = "rejected";
+        auto const emptyCacheInfo = vk::PipelineCacheCreateInfo();
+        result = device.createPipelineCache(&emptyCacheInfo, nullptr, &pipelineCache);
+    }
     VERIFY(result == vk::Result::eSuccess);
+}
 
-    vk::PipelineShaderStageCreateInfo const shaderStageInfo[2] = {
-        vk::PipelineShaderStageCreateInfo().setStage(vk::ShaderStageFlagBits::eVertex).setModule(prepare_vs()).setPName("main"),
-        vk::PipelineShaderStageCreateInfo().setStage(vk::ShaderStageFlagBits::eFragment).setModule(prepare_fs()).setPName("main")};
-
-    vk::PipelineVertexInputStateCreateInfo const vertexInputInfo;
-
-    auto const inputAssemblyInfo = vk::PipelineInputAssemblyStateCreateInfo().setTopology(vk::PrimitiveTopology::eTriangleList);
-
-    // TODO: Where are pViewports and pScissors set?
-    auto const viewportInfo = vk::PipelineViewportStateCreateInfo().setViewportCount(1).setScissorCount(1);
-
-    auto const rasterizationInfo = vk::PipelineRasterizationStateCreateInfo()
-                                       .setDepthClampEnable(VK_FALSE)
-                                       .setRasterizerDiscardEnable(VK_FALSE)
-                                       .setPolygonMode(vk::PolygonMode::eFill)
-                                       .setCullMode(vk::CullModeFlagBits::eBack)
-                                       .setFrontFace(vk::FrontFace::eCounterClockwise)
-                                       .setDepthBiasEnable(VK_FALSE)
-                                       .setLineWidth(1.0f);
-
-    auto const multisampleInfo = vk::PipelineMultisampleStateCreateInfo();
-
-    auto const stencilOp =
-        vk::StencilOpState().setFailOp(vk::StencilOp::eKeep).setPassOp(vk::StencilOp::eKeep).setCompareOp(vk::CompareOp::eAlways);
-
-    auto const depthStencilInfo = vk::PipelineDepthStencilStateCreateInfo()
-                                      .setDepthTestEnable(VK_TRUE)
-                                      .setDepthWriteEnable(VK_TRUE)
-                                      .setDepthCompareOp(vk::CompareOp::eLessOrEqual)
-                                      .setDepthBoundsTestEnable(VK_FALSE)
-                                      .setStencilTestEnable(VK_FALSE)
-                                      .setFront(stencilOp)
-                                      .setBack(stencilOp);
-
-    vk::PipelineColorBlendAttachmentState const colorBlendAttachments[1] = {
-        vk::PipelineColorBlendAttachmentState().setColorWriteMask(vk::ColorComponentFlagBits::eR | vk::ColorComponentFlagBits::eG |
-                                                                  vk::ColorComponentFlagBits::eB | vk::ColorComponentFlagBits::eA)};
-
-    auto const colorBlendInfo =
-        vk::PipelineColorBlendStateCreateInfo().setAttachmentCount(1).setPAttachments(colorBlendAttachments);
-
-    vk::DynamicState const dynamicStates[2] = {vk::DynamicState::eViewport, vk::DynamicState::eScissor};
-
-    auto const dynamicStateInfo = vk::PipelineDynamicStateCreateInfo().setPDynamicStates(dynamicStates).setDynamicStateCount(2);
-
-    auto const pipeline = vk::GraphicsPipelineCreateInfo()
-                              .setStageCount(2)
-                              .setPStages(shaderStageInfo)
-                              .setPVertexInputState(&vertexInputInfo)
-                              .setPInputAssemblyState(&inputAssemblyInfo)
-                              .setPViewportState(&viewportInfo)
-                              .setPRasterizationState(&rasterizationInfo)
-                              .setPMultisampleState(&multisampleInfo)
-                              .setPDepthStencilState(&depthStencilInfo)
-                              .setPColorBlendState(&colorBlendInfo)
-                              .setPDynamicState(&dynamicStateInfo)
-                              .setLayout(pipeline_layout)
-                              .setRenderPass(render_pass);
-
-    result = device.createGraphicsPipelines(pipelineCache, 1, &pipeline, nullptr, &this->pipeline);
-    VERIFY(result == vk::Result::eSuccess);
+bool Demo::load_pipeline_cache_data(std::vector<uint8_t> &data) {
+    FILE *fPtr = fopen(pipeline_cache_file, "rb");
+    if (!fPtr) {
+        return false;
+    }
+
+    pipeline_cache_file_header header;
+    bool valid = fread(&header, sizeof(header), 1, fPtr) == 1;
+
+    // Anything built for another device, driver or cache layout is stale
+    valid = valid && header.magic == pipeline_cache_magic && header.version == pipeline_cache_version &&
+            header.vendor_id == gpu_props.vendorID && header.device_id == gpu_props.deviceID &&
+            header.driver_version == gpu_props.driverVersion &&
+            memcmp(header.uuid, gpu_props.pipelineCacheUUID, VK_UUID_SIZE) == 0 && header.data_size > 0 &&
+            header.data_size < ((uint64_t)1 << 30);
+
+    if (valid) {
+        data.resize((size_t)header.data_size);
+        valid = fread(data.data(), data.size(), 1, fPtr) == 1 && fnv1a_64(data.data(), data.size()) == header.data_hash;
+    }
+
+    // Also check the driver's own header (VkPipelineCacheHeaderVersionOne):
+    // length, version, vendor, device and UUID.
+    if (valid) {
+        uint32_t blob_header[4];
+        valid = data.size() >= 16 + VK_UUID_SIZE;
+        if (valid) {
+            memcpy(blob_header, data.data(), sizeof(blob_header));
+            valid = blob_header[0] >= 16 + VK_UUID_SIZE && blob_header[1] == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+                    blob_header[2] == gpu_props.vendorID && blob_header[3] == gpu_props.deviceID &&
+                    memcmp(data.data() + 16, gpu_props.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+        }
+    }
+
+    fclose(fPtr);
 
-    device.destroyShaderModule(frag_shader_module, nullptr);
-    device.destroyShaderModule(vert_shader_module, nullptr);
+    if (!valid) {
+        fprintf(stderr, "Ignoring stale or corrupt pipeline cache %s\n", pipeline_cache_file);
+        data.clear();
+    }
+
+    return valid;
+}
+
+void Demo::save_pipeline_cache() {
+    if (!pipeline_cache_file || !pipelineCache) {
+        return;
+    }
+
+    size_t size = 0;
+    auto result = device.getPipelineCacheData(pipelineCache, &size, nullptr);
+    if (result != vk::Result::eSuccess || size == 0) {
+        return;
+    }
+
+    std::vector<uint8_t> data(size);
+    result = device.getPipelineCacheData(pipelineCache, &size, data.data());
+    if (result != vk::Result::eSuccess) {
+        return;
+    }
+    data.resize(size);
+
+    pipeline_cache_file_header header = {};
+    header.magic = pipeline_cache_magic;
+    header.version = pipeline_cache_version;
+    header.vendor_id = gpu_props.vendorID;
+    header.device_id = gpu_props.deviceID;
+    header.driver_version = gpu_props.driverVersion;
+    memcpy(header.uuid, gpu_props.pipelineCacheUUID, VK_UUID_SIZE);
+    header.data_size = data.size();
+    header.data_hash = fnv1a_64(data.data(), data.size());
+
+    // Write to the side and swap in, so a crash never leaves a torn file behind
+    char tmp_file[1024];
+    snprintf(tmp_file, sizeof(tmp_file), "%s.tmp", pipeline_cache_file);
+
+    FILE *fPtr = fopen(tmp_file, "wb");
+    if (!fPtr) {
+        fprintf(stderr, "Cannot write pipeline cache %s\n", tmp_file);
+        return;
+    }
+
+    bool const written = fwrite(&header, sizeof(header), 1, fPtr) == 1 && fwrite(data.data(), data.size(), 1, fPtr) == 1;
+    bool const closed = fclose(fPtr) == 0;
+    if (!written || !closed) {
+        fprintf(stderr, "Cannot write pipeline cache %s\n", tmp_file);
+        remove(tmp_file);
+        return;
+    }
+
+    // POSIX rename replaces the old cache atomically; Windows refuses to
+    // rename over an existing file, so only then is the old one removed first
+    if (rename(tmp_file, pipeline_cache_file) != 0) {
+        remove(pipeline_cache_file);
+        if (rename(tmp_file, pipeline_cache_file) != 0) {
+            fprintf(stderr, "Cannot write pipeline cache %s\n", pipeline_cache_file);
+            remove(tmp_file);
+        }
+    }
+}
+
+void Demo::prepare_pipeline() {
+    TRACE_ZONE("prepare_pipeline");
+    // Created once and kept across resizes; seeded from disk when possible
+    if (!pipelineCache) {
+        prepare_pipeline_cache();
+    }
+    if (!pipelines.worker_count()) {
+        pipelines.start(device, pipelineCache, std::min(2u, std::max(1u, std::thread::hardware_concurrency() / 2)));
+    }
+
+    auto const pipeline_start = bench_clock::now();
+
+    // The modules stay around for variants requested later
+    graphics_pipeline_desc desc;
+    desc.vertex_shader = prepare_vs();
+    desc.fragment_shader = prepare_fs();
+    desc.layout = pipeline_layout;
+    desc.render_pass = render_pass;
+    if (mesh_file) {
+        // Mesh files wind front faces counter-clockwise in a Y-up space,
+        // which the flipped projection turns clockwise
+        if (quantize) {
+            desc.vertex_bindings = {vk::VertexInputBindingDescription(0, sizeof(packed_vertex), vk::VertexInputRate::eVertex)};
+            desc.vertex_attributes = {
+                vk::VertexInputAttributeDescription(0, 0, vk::Format::eR16G16B16A16Sfloat, offsetof(packed_vertex, position)),
+                vk::VertexInputAttributeDescription(1, 0, vk::Format::eR16G16Unorm, offsetof(packed_vertex, uv))};
+        } else {
+            desc.vertex_bindings = {vk::VertexInputBindingDescription(0, sizeof(mesh_vertex), vk::VertexInputRate::eVertex)};
+            desc.vertex_attributes = {
+                vk::VertexInputAttributeDescription(0, 0, vk::Format::eR32G32B32Sfloat, offsetof(mesh_vertex, position)),
+                vk::VertexInputAttributeDescription(1, 0, vk::Format::eR32G32Sfloat, offsetof(mesh_vertex, uv))};
+        }
+        desc.front_face = vk::FrontFace::eClockwise;
+    }
+    fill_pipeline_key = pipelines.request(desc);
+
+    // Compiles in the background while the fill pipeline starts drawing
+    wireframe_pipeline_key = fill_pipeline_key;
+    if (wireframe_supported) {
+        desc.polygon_mode = vk::PolygonMode::eLine;
+        desc.cull_mode = vk::CullModeFlagBits::eNone;
+        wireframe_pipeline_key = pipelines.request(desc);
+    }
+
+    // Nothing to fall back to for the first frame
+    pipeline = pipelines.wait(fill_pipeline_key);
+    VERIFY(pipeline);
+
+    pipeline_create_ms = elapsed_ms(pipeline_start, bench_clock::now());
+}
+
+// Swaps in shader files that changed on disk.  Only the pipelines built from
+// the old module are requested again; they compile in the background while
+// the old ones keep drawing, and old modules and pipelines stay cached in case
+// the edit is reverted.
+void Demo::reload_shaders() {
+    for (auto const &change : shaders.poll()) {
+        uint64_t const fill = pipelines.replace_shader(fill_pipeline_key, change.old_module, change.new_module);
+        uint64_t const wire = pipelines.replace_shader(wireframe_pipeline_key, change.old_module, change.new_module);
+        uint32_t const rebuilt = (fill != fill_pipeline_key) + (wire != wireframe_pipeline_key && wire != fill);
+        fill_pipeline_key = fill;
+        wireframe_pipeline_key = wire;
+
+        if (vert_shader_module == change.old_module) {
+            vert_shader_module = change.new_module;
+        }
+        if (frag_shader_module == change.old_module) {
+            frag_shader_module = change.new_module;
+        }
+        printf("Reloaded %s, %" PRIu32 " pipeline%s to rebuild\n", change.path.c_str(), rebuilt, rebuilt == 1 ? "" : "s");
+    }
 }
 
 void Demo::prepare_render_pass() {
@@ -1961,7 +4013,10 @@ void Demo::prepare_render_pass() {
     // will be transitioned to LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL.  At the end of
     // the renderpass, the color attachment's layout will be transitioned to
     // LAYOUT_PRESENT_SRC_KHR to be ready to present.  This is all done as part of
-    // the renderpass, no barriers are necessary.
+    // the renderpass, no barriers are necessary.  Headless images are never
+    // presented, they end in LAYOUT_TRANSFER_SRC_OPTIMAL ready to be read back.
+    vk::ImageLayout const color_final_layout = headless ? vk::ImageLayout::eTransferSrcOptimal : vk::ImageLayout::ePresentSrcKHR;
+
     const vk::AttachmentDescription attachments[2] = {vk::AttachmentDescription()
                                                           .setFormat(format)
                                                           .setSamples(vk::SampleCountFlagBits::e1)
@@ -1970,12 +4025,12 @@ void Demo::prepare_render_pass() {
                                                           .setStencilLoadOp(vk::AttachmentLoadOp::eDontCare)
                                                           .setStencilStoreOp(vk::AttachmentStoreOp::eDontCare)
                                                           .setInitialLayout(vk::ImageLayout::eUndefined)
-                                                          .setFinalLayout(vk::ImageLayout::ePresentSrcKHR),
+                                                          .setFinalLayout(color_final_layout),
                                                       vk::AttachmentDescription()
                                                           .setFormat(depth.format)
                                                           .setSamples(vk::SampleCountFlagBits::e1)
                                                           .setLoadOp(vk::AttachmentLoadOp::eClear)
-                                                          .setStoreOp(vk::AttachmentStoreOp::eDontCare)
+                                                          .setStoreOp(hiz ? vk::AttachmentStoreOp::eStore : vk::AttachmentStoreOp::eDontCare)
                                                           .setStencilLoadOp(vk::AttachmentLoadOp::eDontCare)
                                                           .setStencilStoreOp(vk::AttachmentStoreOp::eDontCare)
                                                           .setInitialLayout(vk::ImageLayout::eUndefined)
@@ -2003,145 +4058,94 @@ void Demo::prepare_render_pass() {
                              .setSubpassCount(1)
                              .setPSubpasses(&subpass)
                              .setDependencyCount(0)
-                             .setPDependencies(nullptr);
-
-    auto result = device.createRenderPass(&rp_info, nullptr, &render_pass);
-    VERIFY(result == vk::Result::eSuccess);
-}
-
-vk::ShaderModule Demo::prepare_shader_module(const uint32_t *code, size_t size) {
-    const auto moduleCreateInfo = vk::ShaderModuleCreateInfo().setCodeSize(size).setPCode(code);
+                             .setPDependencies(nullptr);
 
-    vk::ShaderModule module;
-    auto result = device.createShaderModule(&moduleCreateInfo, nullptr, &module);
+    auto result = device.createRenderPass(&rp_info, nullptr, &render_pass);
     VERIFY(result == vk::Result::eSuccess);
-
-    return module;
 }
 
-void Demo::prepare_texture_image(const char *filename, texture_object *tex_obj, vk::ImageTiling tiling, vk::ImageUsageFlags usage,
-                                 vk::MemoryPropertyFlags required_props) {
-    int32_t tex_width;
-    int32_t tex_height;
-    printf("Texture %s", filename);
-    if (!loadTexture(filename, nullptr, nullptr, &tex_width, &tex_height)) {
-        ERR_EXIT("Failed to load textures", "Load Texture Failure");
-    }
-
-    tex_obj->tex_width = tex_width;
-    tex_obj->tex_height = tex_height;
+// A 1x1 white texture, cleared by the init commands, that stands in until
+// the real one has streamed in
+void Demo::prepare_placeholder_texture(texture_object *tex_obj) {
+    tex_obj->tex_width = 1;
+    tex_obj->tex_height = 1;
 
     auto const image_create_info = vk::ImageCreateInfo()
                                        .setImageType(vk::ImageType::e2D)
                                        .setFormat(vk::Format::eR8G8B8A8Unorm)
-                                       .setExtent({(uint32_t)tex_width, (uint32_t)tex_height, 1})
+                                       .setExtent({1, 1, 1})
                                        .setMipLevels(1)
                                        .setArrayLayers(1)
                                        .setSamples(vk::SampleCountFlagBits::e1)
-                                       .setTiling(tiling)
-                                       .setUsage(usage)
+                                       .setTiling(vk::ImageTiling::eOptimal)
+                                       .setUsage(vk::ImageUsageFlagBits::eTransferDst | vk::ImageUsageFlagBits::eSampled)
                                        .setSharingMode(vk::SharingMode::eExclusive)
                                        .setQueueFamilyIndexCount(0)
                                        .setPQueueFamilyIndices(nullptr)
-                                       .setInitialLayout(vk::ImageLayout::ePreinitialized);
+                                       .setInitialLayout(vk::ImageLayout::eUndefined);
 
     auto result = device.createImage(&image_create_info, nullptr, &tex_obj->image);
     VERIFY(result == vk::Result::eSuccess);
 
-    vk::MemoryRequirements mem_reqs;
-    device.getImageMemoryRequirements(tex_obj->image, &mem_reqs);
-
-    tex_obj->mem_alloc.setAllocationSize(mem_reqs.size);
-    tex_obj->mem_alloc.setMemoryTypeIndex(0);
-
-    auto pass = memory_type_from_properties(mem_reqs.memoryTypeBits, required_props, &tex_obj->mem_alloc.memoryTypeIndex);
+    auto pass = allocator.allocate_image(tex_obj->image, vk::ImageTiling::eOptimal, vk::MemoryPropertyFlagBits::eDeviceLocal,
+                                         vk::MemoryPropertyFlags(), allocation_strategy::buddy, &tex_obj->alloc);
     VERIFY(pass == true);
 
-    result = device.allocateMemory(&tex_obj->mem_alloc, nullptr, &(tex_obj->mem));
-    VERIFY(result == vk::Result::eSuccess);
-
-    result = device.bindImageMemory(tex_obj->image, tex_obj->mem, 0);
-    VERIFY(result == vk::Result::eSuccess);
-
-    if (required_props & vk::MemoryPropertyFlagBits::eHostVisible) {
-        auto const subres = vk::ImageSubresource().setAspectMask(vk::ImageAspectFlagBits::eColor).setMipLevel(0).setArrayLayer(0);
-        vk::SubresourceLayout layout;
-        device.getImageSubresourceLayout(tex_obj->image, &subres, &layout);
+    set_image_layout(tex_obj->image, vk::ImageAspectFlagBits::eColor, vk::ImageLayout::eUndefined,
+                     vk::ImageLayout::eTransferDstOptimal, vk::AccessFlagBits(), vk::PipelineStageFlagBits::eTopOfPipe,
+                     vk::PipelineStageFlagBits::eTransfer);
 
-        auto data = device.mapMemory(tex_obj->mem, 0, tex_obj->mem_alloc.allocationSize);
-        VERIFY(data.result == vk::Result::eSuccess);
+    vk::ClearColorValue const white(std::array<float, 4>({{1.0f, 1.0f, 1.0f, 1.0f}}));
+    auto const range = vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1);
+    cmd.clearColorImage(tex_obj->image, vk::ImageLayout::eTransferDstOptimal, &white, 1, &range);
 
-        if (!loadTexture(filename, (uint8_t *)data.value, &layout, &tex_width, &tex_height)) {
-            fprintf(stderr, "Error loading texture: %s\n", filename);
-        }
+    tex_obj->imageLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
+    set_image_layout(tex_obj->image, vk::ImageAspectFlagBits::eColor, vk::ImageLayout::eTransferDstOptimal, tex_obj->imageLayout,
+                     vk::AccessFlagBits::eTransferWrite, vk::PipelineStageFlagBits::eTransfer,
+                     vk::PipelineStageFlagBits::eFragmentShader);
 
-        device.unmapMemory(tex_obj->mem);
-    }
+    auto const viewInfo = vk::ImageViewCreateInfo()
+                              .setImage(tex_obj->image)
+                              .setViewType(vk::ImageViewType::e2D)
+                              .setFormat(vk::Format::eR8G8B8A8Unorm)
+                              .setSubresourceRange(range);
 
-    tex_obj->imageLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
+    result = device.createImageView(&viewInfo, nullptr, &tex_obj->view);
+    VERIFY(result == vk::Result::eSuccess);
 }
 
 void Demo::prepare_textures() {
+    TRACE_ZONE("prepare_textures");
     vk::Format const tex_format = vk::Format::eR8G8B8A8Unorm;
     vk::FormatProperties props;
     gpu.getFormatProperties(tex_format, &props);
+    if (!(props.optimalTilingFeatures & vk::FormatFeatureFlagBits::eSampledImage)) {
+        assert(!"No support for R8G8B8A8_UNORM as texture image format");
+    }
+
+    // Decoding happens on the loader threads, straight into the staging ring
+    auto const decode = [this](char const *filename, texture_streamer::reserver const &reserve) {
+        return loadTexture(filename, reserve);
+    };
+
+    bool const pass = streamer.init(gpu, device, &allocator, transfer_queue, transfer_queue_family_index,
+                                    graphics_queue_family_index, std::min<uint32_t>(texture_count, 4), decode, texture_mips);
+    VERIFY(pass);
+
+    texture_request_time = bench_clock::now();
+    texture_resident_ms = -1.0;
+    textures_pending = texture_count;
 
     for (uint32_t i = 0; i < texture_count; i++) {
-        if ((props.linearTilingFeatures & vk::FormatFeatureFlagBits::eSampledImage) && !use_staging_buffer) {
-            /* Device can texture using linear textures */
-            prepare_texture_image(tex_files[i], &textures[i], vk::ImageTiling::eLinear, vk::ImageUsageFlagBits::eSampled,
-                                  vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
-            // Nothing in the pipeline needs to be complete to start, and don't allow fragment
-            // shader to run until layout transition completes
-            set_image_layout(textures[i].image, vk::ImageAspectFlagBits::eColor, vk::ImageLayout::ePreinitialized,
-                             textures[i].imageLayout, vk::AccessFlagBits(), vk::PipelineStageFlagBits::eTopOfPipe,
-                             vk::PipelineStageFlagBits::eFragmentShader);
-            staging_texture.image = vk::Image();
-        } else if (props.optimalTilingFeatures & vk::FormatFeatureFlagBits::eSampledImage) {
-            /* Must use staging buffer to copy linear texture to optimized */
-
-            prepare_texture_image(tex_files[i], &staging_texture, vk::ImageTiling::eLinear, vk::ImageUsageFlagBits::eTransferSrc,
-                                  vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
-
-            prepare_texture_image(tex_files[i], &textures[i], vk::ImageTiling::eOptimal,
-                                  vk::ImageUsageFlagBits::eTransferDst | vk::ImageUsageFlagBits::eSampled,
-                                  vk::MemoryPropertyFlagBits::eDeviceLocal);
-
-            set_image_layout(staging_texture.image, vk::ImageAspectFlagBits::eColor, vk::ImageLayout::ePreinitialized,
-                             vk::ImageLayout::eTransferSrcOptimal, vk::AccessFlagBits(), vk::PipelineStageFlagBits::eTopOfPipe,
-                             vk::PipelineStageFlagBits::eTransfer);
-
-            set_image_layout(textures[i].image, vk::ImageAspectFlagBits::eColor, vk::ImageLayout::ePreinitialized,
-                             vk::ImageLayout::eTransferDstOptimal, vk::AccessFlagBits(), vk::PipelineStageFlagBits::eTopOfPipe,
-                             vk::PipelineStageFlagBits::eTransfer);
-
-            auto const subresource = vk::ImageSubresourceLayers()
-                                         .setAspectMask(vk::ImageAspectFlagBits::eColor)
-                                         .setMipLevel(0)
-                                         .setBaseArrayLayer(0)
-                                         .setLayerCount(1);
-
-            auto const copy_region = vk::ImageCopy()
-                                         .setSrcSubresource(subresource)
-                                         .setSrcOffset({0, 0, 0})
-                                         .setDstSubresource(subresource)
-                                         .setDstOffset({0, 0, 0})
-                                         .setExtent({(uint32_t)staging_texture.tex_width, (uint32_t)staging_texture.tex_height, 1});
-
-            cmd.copyImage(staging_texture.image, vk::ImageLayout::eTransferSrcOptimal, textures[i].image,
-                          vk::ImageLayout::eTransferDstOptimal, 1, &copy_region);
-
-            set_image_layout(textures[i].image, vk::ImageAspectFlagBits::eColor, vk::ImageLayout::eTransferDstOptimal,
-                             textures[i].imageLayout, vk::AccessFlagBits::eTransferWrite, vk::PipelineStageFlagBits::eTransfer,
-                             vk::PipelineStageFlagBits::eFragmentShader);
-        } else {
-            assert(!"No support for R8G8B8A8_UNORM as texture image format");
-        }
+        prepare_placeholder_texture(&textures[i]);
+        streamer.request(i, i == 0 ? texture_file : tex_files[i]);
 
+        // Trilinear when minified, so distant cubes read the small levels
+        bool const mips = streamer.mips() != mip_generation::none;
         auto const samplerInfo = vk::SamplerCreateInfo()
                                      .setMagFilter(vk::Filter::eNearest)
-                                     .setMinFilter(vk::Filter::eNearest)
-                                     .setMipmapMode(vk::SamplerMipmapMode::eNearest)
+                                     .setMinFilter(mips ? vk::Filter::eLinear : vk::Filter::eNearest)
+                                     .setMipmapMode(mips ? vk::SamplerMipmapMode::eLinear : vk::SamplerMipmapMode::eNearest)
                                      .setAddressModeU(vk::SamplerAddressMode::eClampToEdge)
                                      .setAddressModeV(vk::SamplerAddressMode::eClampToEdge)
                                      .setAddressModeW(vk::SamplerAddressMode::eClampToEdge)
@@ -2151,89 +4155,378 @@ void Demo::prepare_textures() {
                                      .setCompareEnable(VK_FALSE)
                                      .setCompareOp(vk::CompareOp::eNever)
                                      .setMinLod(0.0f)
-                                     .setMaxLod(0.0f)
+                                     .setMaxLod(mips ? VK_LOD_CLAMP_NONE : 0.0f)
                                      .setBorderColor(vk::BorderColor::eFloatOpaqueWhite)
                                      .setUnnormalizedCoordinates(VK_FALSE);
 
         auto result = device.createSampler(&samplerInfo, nullptr, &textures[i].sampler);
         VERIFY(result == vk::Result::eSuccess);
+    }
+}
+
+// Called at the start of each frame, once its slot is free again
+void Demo::update_streamed_textures() {
+    TRACE_ZONE("update_streamed_textures");
+    // The slot's previous submission has completed, and with it its waits
+    streamer.release_semaphores(texture_waits[frame_index]);
+
+    for (size_t i = 0; i < retired_textures.size();) {
+        if (!frames.reached(retired_textures[i].last_frame)) {
+            i++;
+            continue;
+        }
+        device.destroyImageView(retired_textures[i].texture.view, nullptr);
+        destroy_texture_image(&retired_textures[i].texture);
+        retired_textures[i] = retired_textures.back();
+        retired_textures.pop_back();
+    }
+
+    if (bindless) {
+        bindless_descriptors.reclaim(frames.completed());
+    }
+
+    streamer.poll(arrived_textures, arrived_waits);
+    if (arrived_textures.empty() || !frames.reached(spare_desc_set_last_frame)) {
+        return;
+    }
+
+    // The frames still in flight keep sampling the old images through the
+    // old set, or the old slots; this frame is the first to use the new ones
+    for (auto const &arrived : arrived_textures) {
+        texture_object &tex = textures[arrived.id];
+        retired_textures.push_back({tex, frames.submitted()});
+
+        tex.image = arrived.image;
+        tex.alloc = arrived.alloc;
+        tex.tex_width = arrived.width;
+        tex.tex_height = arrived.height;
+        tex.mip_levels = arrived.mip_levels;
+        tex.format = arrived.format;
+
+        auto const viewInfo =
+            vk::ImageViewCreateInfo()
+                .setImage(tex.image)
+                .setViewType(vk::ImageViewType::e2D)
+                .setFormat(tex.format)
+                .setSubresourceRange(vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, tex.mip_levels, 0, 1));
+
+        auto result = device.createImageView(&viewInfo, nullptr, &tex.view);
+        VERIFY(result == vk::Result::eSuccess);
+        textures_pending--;
+
+        if (bindless) {
+            bindless_descriptors.remove_texture(texture_slots[arrived.id], frames.submitted());
+            texture_slots[arrived.id] = bindless_descriptors.add_texture(tex.sampler, tex.view, tex.imageLayout);
+            VERIFY(texture_slots[arrived.id] != bindless_table::NO_SLOT);
+        }
+    }
+    arrived_textures.clear();
+
+    if (!bindless) {
+        write_descriptor_set(spare_desc_set);
+        std::swap(desc_set, spare_desc_set);
+        spare_desc_set_last_frame = frames.submitted();
+    }
+
+    texture_waits[frame_index].insert(texture_waits[frame_index].end(), arrived_waits.begin(), arrived_waits.end());
+    arrived_waits.clear();
+
+    if (textures_pending == 0 && texture_resident_ms < 0.0) {
+        texture_resident_ms = elapsed_ms(texture_request_time, bench_clock::now());
+    }
+}
+
+// Only after the device is idle
+void Demo::destroy_texture_streaming() {
+    for (uint32_t i = 0; i < frame_lag; i++) {
+        streamer.release_semaphores(texture_waits[i]);
+    }
+    streamer.release_semaphores(arrived_waits);
+
+    for (auto &arrived : arrived_textures) {
+        device.destroyImage(arrived.image, nullptr);
+        allocator.free(&arrived.alloc);
+    }
+    arrived_textures.clear();
+
+    for (auto &retired : retired_textures) {
+        device.destroyImageView(retired.texture.view, nullptr);
+        destroy_texture_image(&retired.texture);
+    }
+    retired_textures.clear();
+
+    streamer.destroy();
+}
+
+void Demo::prepare_timestamp_queries() {
+    if (!benchmark_file && !trace_file) {
+        return;
+    }
+
+    // GPU timing is optional: without timestamp support only CPU times are reported
+    timestamps_supported =
+        queue_props[graphics_queue_family_index].timestampValidBits != 0 && gpu_props.limits.timestampPeriod > 0.0f;
+    if (!timestamps_supported) {
+        fprintf(stderr, "Graphics queue does not support timestamps, GPU frame time will not be reported\n");
+        return;
+    }
+
+    // Two queries per frame slot: one before and one after the frame's commands
+    auto const query_pool_info = vk::QueryPoolCreateInfo().setQueryType(vk::QueryType::eTimestamp).setQueryCount(2 * frame_lag);
+    auto result = device.createQueryPool(&query_pool_info, nullptr, &timestamp_pool);
+    VERIFY(result == vk::Result::eSuccess);
 
-        auto const viewInfo = vk::ImageViewCreateInfo()
-                                  .setImage(textures[i].image)
-                                  .setViewType(vk::ImageViewType::e2D)
-                                  .setFormat(tex_format)
-                                  .setSubresourceRange(vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1));
+    auto const cmd_info = vk::CommandBufferAllocateInfo()
+                              .setCommandPool(cmd_pool)
+                              .setLevel(vk::CommandBufferLevel::ePrimary)
+                              .setCommandBufferCount(frame_lag);
 
-        result = device.createImageView(&viewInfo, nullptr, &textures[i].view);
+    result = device.allocateCommandBuffers(&cmd_info, timestamp_begin_cmds);
+    VERIFY(result == vk::Result::eSuccess);
+
+    result = device.allocateCommandBuffers(&cmd_info, timestamp_end_cmds);
+    VERIFY(result == vk::Result::eSuccess);
+
+    auto const cmd_buf_info = vk::CommandBufferBeginInfo();
+    for (uint32_t i = 0; i < frame_lag; i++) {
+        result = timestamp_begin_cmds[i].begin(&cmd_buf_info);
+        VERIFY(result == vk::Result::eSuccess);
+        timestamp_begin_cmds[i].resetQueryPool(timestamp_pool, 2 * i, 2);
+        timestamp_begin_cmds[i].writeTimestamp(vk::PipelineStageFlagBits::eTopOfPipe, timestamp_pool, 2 * i);
+        result = timestamp_begin_cmds[i].end();
+        VERIFY(result == vk::Result::eSuccess);
+
+        result = timestamp_end_cmds[i].begin(&cmd_buf_info);
+        VERIFY(result == vk::Result::eSuccess);
+        timestamp_end_cmds[i].writeTimestamp(vk::PipelineStageFlagBits::eBottomOfPipe, timestamp_pool, 2 * i + 1);
+        result = timestamp_end_cmds[i].end();
         VERIFY(result == vk::Result::eSuccess);
+
+        timestamp_frame[i] = UINT32_MAX;
+    }
+}
+
+void Demo::destroy_timestamp_queries() {
+    if (!timestamp_pool) {
+        return;
+    }
+
+    device.freeCommandBuffers(cmd_pool, frame_lag, timestamp_begin_cmds);
+    device.freeCommandBuffers(cmd_pool, frame_lag, timestamp_end_cmds);
+    device.destroyQueryPool(timestamp_pool, nullptr);
+    timestamp_pool = vk::QueryPool();
+
+    // Anything still unresolved is dropped and reported as CPU-only
+    for (uint32_t i = 0; i < MAX_FRAME_LAG; i++) {
+        timestamp_frame[i] = UINT32_MAX;
+    }
+}
+
+void Demo::record_frame_timing(frame_timing const &timing) {
+    if (startup_ms < 0.0) {
+        startup_ms = elapsed_ms(start_time, bench_clock::now());
+        if (benchmark_file) {
+            printf("Startup to first frame: %.3f ms (pipeline creation %.3f ms, pipeline cache %s)\n", startup_ms,
+                   pipeline_create_ms, pipeline_cache_status);
+            fflush(stdout);
+        }
+    }
+
+    if (!benchmark_file && !trace_file) {
+        return;
+    }
+
+    frame_timings.push_back(timing);
+    frame_timings.back().gpu = -1.0;
+
+    if (timestamp_pool) {
+        timestamp_frame[frame_index] = (uint32_t)frame_timings.size() - 1;
+    }
+}
+
+void Demo::resolve_gpu_timestamps(uint32_t slot) {
+    // Only called once the slot's previous frame has completed, so the results are ready
+    if (!timestamp_pool || timestamp_frame[slot] == UINT32_MAX) {
+        return;
+    }
+
+    uint64_t ticks[2];
+    auto const result = device.getQueryPoolResults(timestamp_pool, 2 * slot, 2, sizeof(ticks), ticks, sizeof(uint64_t),
+                                                   vk::QueryResultFlagBits::e64);
+    if (result == vk::Result::eSuccess) {
+        uint32_t const valid_bits = queue_props[graphics_queue_family_index].timestampValidBits;
+        uint64_t const mask = valid_bits >= 64 ? UINT64_MAX : (((uint64_t)1 << valid_bits) - 1);
+        uint64_t const delta = (ticks[1] - ticks[0]) & mask;
+        frame_timings[timestamp_frame[slot]].gpu = (double)delta * gpu_props.limits.timestampPeriod / 1e6;
+
+#if TRACE_ENABLED
+        if (trace_file) {
+            // Timestamps wrap after timestampValidBits.  Take the step from the
+            // previous begin as signed, since cleanup resolves the last frames
+            // in slot order rather than submission order.
+            uint64_t const begin = ticks[0] & mask;
+            if (gpu_trace_frames.empty()) {
+                gpu_trace_ticks = begin;
+            } else {
+                uint32_t const shift = valid_bits >= 64 ? 0 : 64 - valid_bits;
+                gpu_trace_ticks += (uint64_t)((int64_t)(((begin - gpu_trace_ticks) & mask) << shift) >> shift);
+            }
+            int64_t const begin_ns = (int64_t)(gpu_trace_ticks * (double)gpu_props.limits.timestampPeriod);
+            int64_t const end_ns = begin_ns + (int64_t)(delta * (double)gpu_props.limits.timestampPeriod);
+            gpu_trace_frames.push_back({begin_ns, end_ns, frame_submit_ns[slot]});
+        }
+#endif
+    }
+
+    timestamp_frame[slot] = UINT32_MAX;
+}
+
+void Demo::write_gpu_trace() {
+#if TRACE_ENABLED
+    // The GPU clock has its own origin.  A frame cannot start before it was
+    // submitted, so the smallest offset that keeps every frame after its
+    // submission is the closest estimate without calibrated timestamps.  All
+    // frames share it, so it is only applied once every frame is resolved.
+    int64_t offset_ns = INT64_MIN;
+    for (auto const &frame : gpu_trace_frames) {
+        offset_ns = std::max(offset_ns, (int64_t)frame.submit_ns - frame.begin_ns);
     }
+    for (auto const &frame : gpu_trace_frames) {
+        TRACE_GPU("gpu frame", (uint64_t)(frame.begin_ns + offset_ns), (uint64_t)(frame.end_ns + offset_ns));
+    }
+#endif
+    gpu_trace_frames.clear();
 }
 
 vk::ShaderModule Demo::prepare_vs() {
-    const uint32_t vertShaderCode[] = {
+    if (bindless) {
+        char const *const path = mesh_file ? "cube_mesh_bindless.vert.spv" : "cube_bindless.vert.spv";
+        vert_shader_module = shaders.load(path, nullptr, 0);
+        if (!vert_shader_module) {
+            fprintf(stderr, "Cannot load %s, build it with compile_shaders.cmd\n", path);
+            ERR_EXIT("Cannot load the bindless vertex shader", "Load Shader Failure");
+        }
+        return vert_shader_module;
+    }
+
+    if (mesh_file) {
+        vert_shader_module = shaders.load("cube_mesh.vert.spv", nullptr, 0);
+        if (!vert_shader_module) {
+            ERR_EXIT("Cannot load cube_mesh.vert.spv, build it with compile_shaders.cmd", "Load Shader Failure");
+        }
+        return vert_shader_module;
+    }
+
+    if (instance_count) {
+        vert_shader_module = shaders.load("cube_instanced.vert.spv", nullptr, 0);
+        if (!vert_shader_module) {
+            ERR_EXIT("Cannot load cube_instanced.vert.spv, build it with compile_shaders.cmd", "Load Shader Failure");
+        }
+        return vert_shader_module;
+    }
+
+    // cube.vert.spv next to the binary replaces the built-in code
+    static const uint32_t vertShaderCode[] = {
 #include "cube.vert.inc"
     };
 
-    vert_shader_module = prepare_shader_module(vertShaderCode, sizeof(vertShaderCode));
+    vert_shader_module = shaders.load("cube.vert.spv", vertShaderCode, sizeof(vertShaderCode));
+    VERIFY(vert_shader_module);
 
     return vert_shader_module;
 }
 
 void Demo::resize() {
-    uint32_t i;
-
+    TRACE_ZONE("resize");
     // Don't react to resize until after first initialization.
     if (!prepared) {
         return;
     }
 
-    // In order to properly resize the window, we must re-create the
-    // swapchain
-    // AND redo the command buffers, etc.
-    //
-    // First, perform part of the cleanup() function:
-    prepared = false;
-    auto result = device.waitIdle();
-    VERIFY(result == vk::Result::eSuccess);
+    // Only what depends on the window size is rebuilt: the swapchain, its
+    // framebuffers, the depth buffer and the depth pyramid.  The pipeline
+    // uses dynamic viewport and scissor and the render pass only depends on
+    // the formats, so both stay, as do textures, buffers and command buffers.
+    // The frames in flight keep their old objects until they complete, so
+    // nothing waits for the device to go idle.
+    retired_surface retired;
+    retired.swapchain = swapchain;
+    retired.images = std::move(swapchain_image_resources);
+    retired.image_count = swapchainImageCount;
+    retired.depth_image = depth.image;
+    retired.depth_alloc = depth.alloc;
+    retired.depth_view = depth.view;
+    if (cull) {
+        retired.pyramid = culling.pyramid;
+        retired.pyramid_alloc = culling.pyramid_alloc;
+        retired.pyramid_view = culling.pyramid_view;
+        retired.level_views = std::move(culling.level_views);
+        retired.pyramid_sampler = culling.sampler;
+        retired.culling_desc_pool = culling.desc_pool;
+        culling.level_views.clear();
+        culling.reduce_sets.clear();
+    }
+    retired.last_frame = frames.submitted();
+    retired_surfaces.push_back(std::move(retired));
 
-    for (i = 0; i < swapchainImageCount; i++) {
-        device.destroyFramebuffer(swapchain_image_resources[i].framebuffer, nullptr);
+    // The new pyramid is cleared before it is first read
+    if (cull) {
+        begin_init_cmd();
     }
 
-    device.destroyDescriptorPool(desc_pool, nullptr);
+    // Passes the old swapchain as oldSwapchain
+    prepare_buffers();
+    prepare_depth();
+    if (separate_present_queue) {
+        prepare_present_cmds();
+    }
+    prepare_framebuffers();
+    if (cull) {
+        prepare_culling_sets();
+    }
 
-    device.destroyPipeline(pipeline, nullptr);
-    device.destroyPipelineCache(pipelineCache, nullptr);
-    device.destroyRenderPass(render_pass, nullptr);
-    device.destroyPipelineLayout(pipeline_layout, nullptr);
-    device.destroyDescriptorSetLayout(desc_layout, nullptr);
+    flush_init_cmd();
+    current_buffer = 0;
+}
 
-    for (i = 0; i < texture_count; i++) {
-        device.destroyImageView(textures[i].view, nullptr);
-        device.destroyImage(textures[i].image, nullptr);
-        device.freeMemory(textures[i].mem, nullptr);
-        device.destroySampler(textures[i].sampler, nullptr);
-    }
+// Destroys what resize() retired once no frame in flight uses it any more,
+// or all of it when the device is idle
+void Demo::destroy_retired_surfaces(bool idle) {
+    for (size_t i = 0; i < retired_surfaces.size();) {
+        retired_surface &retired = retired_surfaces[i];
+        if (!idle && !frames.reached(retired.last_frame)) {
+            i++;
+            continue;
+        }
 
-    device.destroyImageView(depth.view, nullptr);
-    device.destroyImage(depth.image, nullptr);
-    device.freeMemory(depth.mem, nullptr);
+        for (uint32_t j = 0; j < retired.image_count; j++) {
+            device.destroyFramebuffer(retired.images[j].framebuffer, nullptr);
+            device.destroyImageView(retired.images[j].view, nullptr);
+            if (separate_present_queue) {
+                device.freeCommandBuffers(present_cmd_pool, 1, &retired.images[j].graphics_to_present_cmd);
+            }
+        }
+        // Also releases the images once the presentation engine is done with them
+        device.destroySwapchainKHR(retired.swapchain, nullptr);
 
-    for (i = 0; i < swapchainImageCount; i++) {
-        device.destroyImageView(swapchain_image_resources[i].view, nullptr);
-        device.freeCommandBuffers(cmd_pool, 1, &swapchain_image_resources[i].cmd);
-        device.destroyBuffer(swapchain_image_resources[i].uniform_buffer, nullptr);
-        device.freeMemory(swapchain_image_resources[i].uniform_memory, nullptr);
-    }
+        device.destroyImageView(retired.depth_view, nullptr);
+        device.destroyImage(retired.depth_image, nullptr);
+        allocator.free(&retired.depth_alloc);
 
-    device.destroyCommandPool(cmd_pool, nullptr);
-    if (separate_present_queue) {
-        device.destroyCommandPool(present_cmd_pool, nullptr);
-    }
+        if (cull) {
+            device.destroyDescriptorPool(retired.culling_desc_pool, nullptr);
+            for (auto &view : retired.level_views) {
+                device.destroyImageView(view, nullptr);
+            }
+            device.destroyImageView(retired.pyramid_view, nullptr);
+            device.destroySampler(retired.pyramid_sampler, nullptr);
+            device.destroyImage(retired.pyramid, nullptr);
+            allocator.free(&retired.pyramid_alloc);
+        }
 
-    // Second, re-perform the prepare() function, which will re-create the
-    // swapchain.
-    prepare();
+        retired_surfaces[i] = std::move(retired_surfaces.back());
+        retired_surfaces.pop_back();
+    }
 }
 
 void Demo::set_image_layout(vk::Image image, vk::ImageAspectFlags aspectMask, vk::ImageLayout oldLayout, vk::ImageLayout newLayout,
@@ -2286,6 +4579,7 @@ void Demo::set_image_layout(vk::Image image, vk::ImageAspectFlags aspectMask, vk
 }
 
 void Demo::update_data_buffer() {
+    TRACE_ZONE("update_data_buffer");
     mat4x4 VP;
     mat4x4_mul(VP, projection_matrix, view_matrix);
 
@@ -2294,87 +4588,388 @@ void Demo::update_data_buffer() {
     mat4x4_dup(Model, model_matrix);
     mat4x4_rotate(model_matrix, Model, 0.0f, 1.0f, 0.0f, (float)degreesToRadians(spin_angle));
 
-    mat4x4 MVP;
-    mat4x4_mul(MVP, VP, model_matrix);
-
-    auto data = device.mapMemory(swapchain_image_resources[current_buffer].uniform_memory, 0, VK_WHOLE_SIZE, vk::MemoryMapFlags());
-    VERIFY(data.result == vk::Result::eSuccess);
-
-    memcpy(data.value, (const void *)&MVP[0][0], sizeof(MVP));
-
-    device.unmapMemory(swapchain_image_resources[current_buffer].uniform_memory);
+    // This slot's previous frame has completed, so its part of the arena is free
+    uint8_t *slot = uniform_data.alloc.mapped + frame_index * uniform_data.frame_stride;
+
+    // Every object shares the spin; the uniform scale commutes with it, so
+    // each model matrix is translate * rotate * scale as batch_transform wants.
+    float q[4];
+    rotation_to_quat(model_matrix, q);
+    std::fill_n(object_soa.begin() + 3 * object_count, object_count, q[0]);
+    std::fill_n(object_soa.begin() + 4 * object_count, object_count, q[1]);
+    std::fill_n(object_soa.begin() + 5 * object_count, object_count, q[2]);
+    std::fill_n(object_soa.begin() + 6 * object_count, object_count, q[3]);
+
+    // The MVP leads each entry, so the kernel writes it in place
+    static_assert(offsetof(vktexcube_vs_uniform, mvp) == 0, "batch_transform writes the MVP at the entry's start");
+    batch_transform(transform_kernel_choice, &VP[0][0], object_transforms, object_count, slot, uniform_data.object_stride);
+
+    // Only the instanced shaders and the cull pass read VP, from the first entry
+    memcpy(slot + offsetof(vktexcube_vs_uniform, vp), (const void *)&VP[0][0], sizeof(VP));
+
+    if (cull) {
+        vktexcube_vs_uniform *data = (vktexcube_vs_uniform *)slot;
+        frustum_planes(VP, data->frustum);
+        data->cull[0] = (float)instance_count;
+        data->cull[1] = hiz ? 1.0f : 0.0f;
+        data->cull[2] = (float)culling.pyramid_width;
+        data->cull[3] = (float)culling.pyramid_height;
+    }
 }
 
-bool Demo::loadTexture(const char *filename, uint8_t *rgba_data, vk::SubresourceLayout *layout, int32_t *width, int32_t *height) {
+// Maps the file, parses the header in place and expands the texels straight
+// into the memory `reserve` hands out for them (see ppm_decoder.h)
+bool Demo::loadTexture(const char *filename, texture_streamer::reserver const &reserve) {
 #if (defined(VK_USE_PLATFORM_IOS_MVK) || defined(VK_USE_PLATFORM_MACOS_MVK))
     filename = [[[NSBundle mainBundle] resourcePath] stringByAppendingPathComponent:@(filename)].UTF8String;
 #endif
 
-    FILE *fPtr = fopen(filename, "rb");
-    if (!fPtr) {
+    mapped_file file;
+    if (!file.open(filename)) {
         return false;
     }
 
-    char header[256];
-    char *cPtr = fgets(header, 256, fPtr);  // P6
-    if (cPtr == nullptr || strncmp(header, "P6\n", 3)) {
-        fclose(fPtr);
-        return false;
-    }
+    // KTX2 levels are already in their final format and go to the ring as they are
+    ktx2_image ktx;
+    if (ktx2_parse(file.data(), file.size(), &ktx)) {
+        vk::FormatProperties props;
+        gpu.getFormatProperties((vk::Format)ktx.format, &props);
+        auto const needed = vk::FormatFeatureFlagBits::eSampledImage | vk::FormatFeatureFlagBits::eSampledImageFilterLinear;
+        if ((props.optimalTilingFeatures & needed) != needed) {
+            // Fall back to the PPM next to it, if there is one
+            std::string ppm = filename;
+            ppm = ppm.substr(0, ppm.find_last_of('.')) + ".ppm";
+            if (ppm == filename) {
+                return false;
+            }
+            fprintf(stderr, "%s is %s, which this device cannot sample; trying %s\n", filename,
+                    vk::to_string((vk::Format)ktx.format).c_str(), ppm.c_str());
+            return loadTexture(ppm.c_str(), reserve);
+        }
 
-    do {
-        cPtr = fgets(header, 256, fPtr);
-        if (cPtr == nullptr) {
-            fclose(fPtr);
+        vk::DeviceSize row_pitch;
+        uint8_t *data = reserve((int32_t)ktx.width, (int32_t)ktx.height, (vk::Format)ktx.format, ktx.levels, &row_pitch);
+        if (data == nullptr) {
             return false;
         }
-    } while (!strncmp(header, "#", 1));
-
-    sscanf(header, "%" SCNd32 " %" SCNd32, width, height);
-    if (rgba_data == nullptr) {
-        fclose(fPtr);
+        for (uint32_t level = 0; level < ktx.levels; level++) {
+            memcpy(data, ktx.level_data[level], (size_t)ktx.level_size[level]);
+            data += ktx.level_size[level];
+        }
         return true;
     }
 
-    char *result = fgets(header, 256, fPtr);  // Format
-    VERIFY(result != nullptr);
-    if (cPtr == nullptr || strncmp(header, "255\n", 3)) {
-        fclose(fPtr);
+    ppm_image image;
+    if (!ppm_parse(file.data(), file.size(), &image)) {
+        return false;
+    }
+
+    vk::DeviceSize row_pitch;
+    uint8_t *rgba_data = reserve(image.width, image.height, vk::Format::eR8G8B8A8Unorm, 1, &row_pitch);
+    if (rgba_data == nullptr) {
         return false;
     }
 
-    for (int y = 0; y < *height; y++) {
-        uint8_t *rowPtr = rgba_data;
+    ppm_decode(image, rgba_data, (size_t)row_pitch, ppm_kernel_choice, std::max(1u, std::thread::hardware_concurrency()));
+    return true;
+}
+
+void Demo::run_headless() {
+    while (!quit) {
+        draw();
+        curFrame++;
 
-        for (int x = 0; x < *width; x++) {
-            size_t s = fread(rowPtr, 3, 1, fPtr);
-            (void)s;
-            rowPtr[3] = 255; /* Alpha of 1 */
-            rowPtr += 4;
+        if (frameCount != UINT32_MAX && curFrame == frameCount) {
+            quit = true;
         }
+    }
 
-        rgba_data += layout->rowPitch;
+    if (readback_file) {
+        write_frame_ppm(readback_file);
     }
+}
 
-    fclose(fPtr);
-    return true;
+// Nearest-rank percentile of an ascending sorted sample set
+static double percentile(std::vector<double> const &sorted, double p) {
+    size_t rank = (size_t)(p / 100.0 * sorted.size() + 0.999999);
+    rank = std::max<size_t>(rank, 1);
+    rank = std::min(rank, sorted.size());
+    return sorted[rank - 1];
+}
+
+// Writes str as a quoted JSON string, for text the demo does not control
+static void write_json_string(FILE *out, char const *str) {
+    fputc('"', out);
+    for (; *str; str++) {
+        unsigned char const c = (unsigned char)*str;
+        if (c == '"' || c == '\\') {
+            fprintf(out, "\\%c", c);
+        } else if (c < 0x20) {
+            fprintf(out, "\\u%04x", c);
+        } else {
+            fputc(c, out);
+        }
+    }
+    fputc('"', out);
 }
 
-bool Demo::memory_type_from_properties(uint32_t typeBits, vk::MemoryPropertyFlags requirements_mask, uint32_t *typeIndex) {
-    // Search memtypes to find first index with those properties
-    for (uint32_t i = 0; i < VK_MAX_MEMORY_TYPES; i++) {
-        if ((typeBits & 1) == 1) {
-            // Type is available, does it match user properties?
-            if ((memory_properties.memoryTypes[i].propertyFlags & requirements_mask) == requirements_mask) {
-                *typeIndex = i;
-                return true;
+void Demo::write_benchmark_report() {
+    struct phase {
+        char const *name;
+        double frame_timing::*field;
+    };
+
+    phase const phases[] = {
+        {"fence_wait", &frame_timing::fence_wait}, {"acquire", &frame_timing::acquire}, {"update", &frame_timing::update},
+        {"record", &frame_timing::record},
+        {"submit", &frame_timing::submit},         {"present", &frame_timing::present}, {"cpu_total", &frame_timing::cpu_total},
+        {"gpu", &frame_timing::gpu},
+    };
+
+    // The first frames pay for lazy driver work and are not representative
+    size_t const first = std::min<size_t>(benchmark_warmup, frame_timings.size());
+
+    FILE *out = fopen(benchmark_file, "w");
+    if (!out) {
+        fprintf(stderr, "Cannot open %s for writing\n", benchmark_file);
+    }
+
+    printf("Benchmark on %s: %" PRIu32 " frames measured, %" PRIu32 " warm-up frames skipped\n", gpu_props.deviceName,
+           (uint32_t)(frame_timings.size() - first), (uint32_t)first);
+    printf("  %-12s %10s %10s %10s %10s %10s\n", "phase (ms)", "mean", "p50", "p95", "p99", "max");
+
+    if (out) {
+        fprintf(out, "{\n");
+        fprintf(out, "  \"device\": ");
+        write_json_string(out, (char const *)gpu_props.deviceName);
+        fprintf(out, ",\n");
+        fprintf(out, "  \"vendor_id\": %" PRIu32 ",\n", gpu_props.vendorID);
+        fprintf(out, "  \"device_id\": %" PRIu32 ",\n", gpu_props.deviceID);
+        fprintf(out, "  \"driver_version\": %" PRIu32 ",\n", gpu_props.driverVersion);
+        fprintf(out, "  \"headless\": %s,\n", headless ? "true" : "false");
+        fprintf(out, "  \"present_mode\": %d,\n", (int)presentMode);
+        fprintf(out, "  \"frame_lag\": %" PRIu32 ",\n", frame_lag);
+        fprintf(out, "  \"frame_sync\": \"%s\",\n", frames.timeline() ? "timeline" : "fences");
+        fprintf(out, "  \"width\": %" PRIu32 ",\n", width);
+        fprintf(out, "  \"height\": %" PRIu32 ",\n", height);
+        fprintf(out, "  \"warmup_frames\": %" PRIu32 ",\n", (uint32_t)first);
+        fprintf(out, "  \"frames\": %" PRIu32 ",\n", (uint32_t)(frame_timings.size() - first));
+        fprintf(out, "  \"pipeline_cache\": \"%s\",\n", pipeline_cache_status);
+        fprintf(out, "  \"pipeline_create_ms\": %.6f,\n", pipeline_create_ms);
+        fprintf(out, "  \"pipeline_variants_compiled\": %" PRIu32 ",\n", pipelines.compiled());
+        fprintf(out, "  \"pipeline_compile_total_ms\": %.6f,\n", pipelines.total_compile_ms());
+        fprintf(out, "  \"wireframe\": %s,\n", wireframe ? "true" : "false");
+        fprintf(out, "  \"shader_modules\": %" PRIu32 ",\n", shaders.module_count());
+        fprintf(out, "  \"shader_module_cache_hits\": %" PRIu32 ",\n", shaders.cache_hits());
+        fprintf(out, "  \"shader_reloads\": %" PRIu32 ",\n", shaders.reload_count());
+        fprintf(out, "  \"startup_to_first_frame_ms\": %.6f,\n", startup_ms);
+        fprintf(out, "  \"objects\": %" PRIu32 ",\n", object_count);
+        fprintf(out, "  \"descriptors\": \"%s\",\n", bindless ? "bindless" : "sets");
+        fprintf(out, "  \"materials\": %" PRIu32 ",\n", material_count);
+        fprintf(out, "  \"descriptor_binds_per_frame\": %" PRIu32 ",\n",
+                bindless ? std::min(active_record_threads, object_count) : (instance_count ? 1 : object_count));
+        if (bindless) {
+            fprintf(out, "  \"bindless_texture_slots\": %" PRIu32 ",\n", bindless_descriptors.capacity());
+            fprintf(out, "  \"bindless_descriptor_writes\": %" PRIu32 ",\n", bindless_descriptors.descriptor_writes());
+        }
+        fprintf(out, "  \"record_threads\": %" PRIu32 ",\n", record_threads);
+        fprintf(out, "  \"transform_kernel\": \"%s\",\n", transform_kernel_name(transform_kernel_choice));
+        fprintf(out, "  \"separate_transfer_queue\": %s,\n", separate_transfer_queue ? "true" : "false");
+        fprintf(out, "  \"texture_resident_ms\": %.6f,\n", texture_resident_ms);
+        fprintf(out, "  \"mip_generation\": \"%s\",\n", mip_generation_name(streamer.mips()));
+        fprintf(out, "  \"texture_mip_levels\": %" PRIu32 ",\n", textures[0].mip_levels);
+        fprintf(out, "  \"texture_format\": \"%s\",\n", vk::to_string(textures[0].format).c_str());
+        vk::DeviceSize texture_bytes = 0;
+        for (uint32_t level = 0; level < textures[0].mip_levels; level++) {
+            texture_bytes += texture_level_size(textures[0].format, textures[0].tex_width, textures[0].tex_height, level);
+        }
+        fprintf(out, "  \"texture_bytes\": %" PRIu64 ",\n", (uint64_t)texture_bytes);
+        fprintf(out, "  \"camera_distance\": %.3f,\n", camera_distance);
+        if (mesh_file) {
+            mesh_stats const &stats = mesh.stats;
+            fprintf(out, "  \"mesh\": {\"vertices\": %" PRIu32 ", \"corners\": %" PRIu32 ", \"triangles\": %" PRIu32 ", ",
+                    stats.vertices, stats.corners, stats.triangles);
+            fprintf(out, "\"acmr_before\": %.6f, \"acmr_after\": %.6f, \"atvr_after\": %.6f, ", stats.acmr_before,
+                    stats.acmr_after, stats.atvr_after);
+            fprintf(out, "\"parse_ms\": %.6f, \"weld_ms\": %.6f, \"optimize_ms\": %.6f, \"load_threads\": %" PRIu32 ", ",
+                    stats.parse_ms, stats.weld_ms, stats.optimize_ms, stats.threads);
+            fprintf(out, "\"vertex_format\": \"%s\", \"vertex_bytes\": %" PRIu64 "},\n", quantize ? "packed" : "float32",
+                    (uint64_t)mesh.vertex_bytes);
+        }
+        if (!record_sweep_ms.empty()) {
+            fprintf(out, "  \"record_sweep_ms\": [");
+            for (size_t i = 0; i < record_sweep_ms.size(); i++) {
+                fprintf(out, "%s{\"threads\": %" PRIu32 ", \"mean\": %.6f}", i ? ", " : "", record_sweep_ms[i].first,
+                        record_sweep_ms[i].second);
             }
+            fprintf(out, "],\n");
         }
-        typeBits >>= 1;
+        fprintf(out, "  \"phases_ms\": {");
     }
 
-    // No memory types matched, return failure
-    return false;
+    bool first_phase = true;
+    double frame_ms = 0.0;
+    for (auto const &ph : phases) {
+        std::vector<double> samples;
+        samples.reserve(frame_timings.size() - first);
+        for (size_t i = first; i < frame_timings.size(); i++) {
+            double const value = frame_timings[i].*ph.field;
+            if (value >= 0.0) {
+                samples.push_back(value);
+            }
+        }
+
+        if (samples.empty()) {
+            continue;
+        }
+
+        std::sort(samples.begin(), samples.end());
+
+        double sum = 0.0;
+        for (double value : samples) {
+            sum += value;
+        }
+        double const mean = sum / samples.size();
+        double const p50 = percentile(samples, 50.0);
+        double const p95 = percentile(samples, 95.0);
+        double const p99 = percentile(samples, 99.0);
+
+        printf("  %-12s %10.4f %10.4f %10.4f %10.4f %10.4f\n", ph.name, mean, p50, p95, p99, samples.back());
+
+        // Once the queue is full the CPU frame includes waiting for the GPU,
+        // so it is the frame interval
+        if (ph.field == &frame_timing::cpu_total) {
+            frame_ms = mean;
+        }
+
+        if (out) {
+            fprintf(out,
+                    "%s\n    \"%s\": {\"samples\": %" PRIu32
+                    ", \"mean\": %.6f, \"p50\": %.6f, \"p95\": %.6f, \"p99\": %.6f, \"max\": %.6f}",
+                    first_phase ? "" : ",", ph.name, (uint32_t)samples.size(), mean, p50, p95, p99, samples.back());
+        }
+        first_phase = false;
+    }
+
+    uint32_t const instances = instance_count ? instance_count : object_count;
+    double const instances_per_second = frame_ms > 0.0 ? instances * 1000.0 / frame_ms : 0.0;
+    printf("  %" PRIu32 " cubes per frame, %.0f instances/s\n", instances, instances_per_second);
+
+    // What survived culling in the last frame; every frame has been waited on
+    uint32_t visible = instances;
+    if (cull) {
+        visible = ((vk::DrawIndirectCommand const *)instancing.indirect_alloc.mapped)->instanceCount;
+        printf("  %" PRIu32 " of %" PRIu32 " instances survived culling in the last frame\n", visible, instances);
+    }
+
+    if (out) {
+        fprintf(out, "\n  },\n");
+        fprintf(out, "  \"instanced\": %s,\n", instance_count ? "true" : "false");
+        fprintf(out, "  \"instances\": %" PRIu32 ",\n", instances);
+        fprintf(out, "  \"culling\": \"%s\",\n", hiz ? "frustum+hiz" : cull ? "frustum" : "none");
+        fprintf(out, "  \"visible_instances\": %" PRIu32 ",\n", visible);
+        fprintf(out, "  \"instances_per_second\": %.1f\n", instances_per_second);
+        fprintf(out, "}\n");
+        fclose(out);
+    }
+}
+
+void Demo::write_frame_ppm(char const *filename) {
+    TRACE_ZONE("write_frame_ppm");
+    // Only the frames need to be done, not the texture uploads
+    frames.wait(frames.submitted());
+
+    vk::DeviceSize const row_size = width * 4;
+    auto const buf_info = vk::BufferCreateInfo().setSize(row_size * height).setUsage(vk::BufferUsageFlagBits::eTransferDst);
+
+    vk::Buffer readback_buffer;
+    auto result = device.createBuffer(&buf_info, nullptr, &readback_buffer);
+    VERIFY(result == vk::Result::eSuccess);
+
+    // Prefer cached memory, the CPU reads every byte of it
+    device_allocation readback_alloc;
+    bool const pass = allocator.allocate_buffer(
+        readback_buffer, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
+        vk::MemoryPropertyFlagBits::eHostCached, allocation_strategy::linear, &readback_alloc);
+    VERIFY(pass);
+
+    auto const cmd_info = vk::CommandBufferAllocateInfo()
+                              .setCommandPool(cmd_pool)
+                              .setLevel(vk::CommandBufferLevel::ePrimary)
+                              .setCommandBufferCount(1);
+
+    vk::CommandBuffer copy_cmd;
+    result = device.allocateCommandBuffers(&cmd_info, &copy_cmd);
+    VERIFY(result == vk::Result::eSuccess);
+
+    auto const begin_info = vk::CommandBufferBeginInfo().setFlags(vk::CommandBufferUsageFlagBits::eOneTimeSubmit);
+    result = copy_cmd.begin(&begin_info);
+    VERIFY(result == vk::Result::eSuccess);
+
+    // The render pass left the image in TRANSFER_SRC_OPTIMAL; make the color
+    // writes visible to the copy.
+    auto const image_barrier = vk::ImageMemoryBarrier()
+                                   .setSrcAccessMask(vk::AccessFlagBits::eColorAttachmentWrite)
+                                   .setDstAccessMask(vk::AccessFlagBits::eTransferRead)
+                                   .setOldLayout(vk::ImageLayout::eTransferSrcOptimal)
+                                   .setNewLayout(vk::ImageLayout::eTransferSrcOptimal)
+                                   .setSrcQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+                                   .setDstQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+                                   .setImage(swapchain_image_resources[last_frame_image].image)
+                                   .setSubresourceRange(vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1));
+
+    copy_cmd.pipelineBarrier(vk::PipelineStageFlagBits::eColorAttachmentOutput, vk::PipelineStageFlagBits::eTransfer,
+                             vk::DependencyFlagBits(), 0, nullptr, 0, nullptr, 1, &image_barrier);
+
+    auto const copy_region = vk::BufferImageCopy()
+                                 .setBufferOffset(0)
+                                 .setBufferRowLength(0)
+                                 .setBufferImageHeight(0)
+                                 .setImageSubresource(vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, 0, 0, 1))
+                                 .setImageOffset({0, 0, 0})
+                                 .setImageExtent({width, height, 1});
+
+    copy_cmd.copyImageToBuffer(swapchain_image_resources[last_frame_image].image, vk::ImageLayout::eTransferSrcOptimal,
+                               readback_buffer, 1, &copy_region);
+
+    auto const buffer_barrier = vk::BufferMemoryBarrier()
+                                    .setSrcAccessMask(vk::AccessFlagBits::eTransferWrite)
+                                    .setDstAccessMask(vk::AccessFlagBits::eHostRead)
+                                    .setSrcQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+                                    .setDstQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+                                    .setBuffer(readback_buffer)
+                                    .setOffset(0)
+                                    .setSize(VK_WHOLE_SIZE);
+
+    copy_cmd.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eHost, vk::DependencyFlagBits(), 0,
+                             nullptr, 1, &buffer_barrier, 0, nullptr);
+
+    result = copy_cmd.end();
+    VERIFY(result == vk::Result::eSuccess);
+
+    auto const submit_info = vk::SubmitInfo().setCommandBufferCount(1).setPCommandBuffers(&copy_cmd);
+    result = graphics_queue.submit(1, &submit_info, vk::Fence());
+    VERIFY(result == vk::Result::eSuccess);
+
+    result = graphics_queue.waitIdle();
+    VERIFY(result == vk::Result::eSuccess);
+
+    FILE *fPtr = fopen(filename, "wb");
+    if (fPtr) {
+        // PPM has no alpha channel, drop it while writing
+        fprintf(fPtr, "P6\n%" PRIu32 " %" PRIu32 "\n255\n", width, height);
+        uint8_t const *pixels = readback_alloc.mapped;
+        for (uint32_t i = 0; i < width * height; i++) {
+            fwrite(&pixels[i * 4], 3, 1, fPtr);
+        }
+        fclose(fPtr);
+    } else {
+        fprintf(stderr, "Cannot open %s for writing\n", filename);
+    }
+
+    device.freeCommandBuffers(cmd_pool, 1, &copy_cmd);
+    device.destroyBuffer(readback_buffer, nullptr);
+    allocator.free(&readback_alloc);
 }
 
 #if defined(VK_USE_PLATFORM_WIN32_KHR)
@@ -2501,6 +5096,9 @@ void Demo::handle_xlib_event(const XEvent *event) {
                 case 0x41:  // space bar
                     pause = !pause;
                     break;
+                case 0x19:  // w
+                    wireframe = !wireframe;
+                    break;
             }
             break;
         case ConfigureNotify:
@@ -2565,6 +5163,9 @@ void Demo::handle_xcb_event(const xcb_generic_event_t *event) {
                 case 0x41:  // space bar
                     pause = !pause;
                     break;
+                case 0x19:  // w
+                    wireframe = !wireframe;
+                    break;
             }
         } break;
         case XCB_CONFIGURE_NOTIFY: {
@@ -2918,6 +5519,16 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR pCmdLine,
         free(argv);
     }
 
+    if (demo.headless) {
+        // No window, no surface: render offscreen until the frame count is reached
+        demo.init_vk_swapchain();
+        demo.prepare();
+        demo.run_headless();
+        demo.cleanup();
+
+        return validation_error;
+    }
+
     demo.connection = hInstance;
     strncpy(demo.name, "cube", APP_NAME_STR_LEN);
     demo.create_window();
@@ -2953,30 +5564,36 @@ int main(int argc, char **argv) {
 
     demo.init(argc, argv);
 
+    if (!demo.headless) {
 #if defined(VK_USE_PLATFORM_XCB_KHR)
-    demo.create_xcb_window();
+        demo.create_xcb_window();
 #elif defined(VK_USE_PLATFORM_XLIB_KHR)
-    demo.use_xlib = true;
-    demo.create_xlib_window();
+        demo.use_xlib = true;
+        demo.create_xlib_window();
 #elif defined(VK_USE_PLATFORM_WAYLAND_KHR)
-    demo.create_window();
+        demo.create_window();
 #elif defined(VK_USE_PLATFORM_MIR_KHR)
 #endif
+    }
 
     demo.init_vk_swapchain();
 
     demo.prepare();
 
+    if (demo.headless) {
+        demo.run_headless();
+    } else {
 #if defined(VK_USE_PLATFORM_XCB_KHR)
-    demo.run_xcb();
+        demo.run_xcb();
 #elif defined(VK_USE_PLATFORM_XLIB_KHR)
-    demo.run_xlib();
+        demo.run_xlib();
 #elif defined(VK_USE_PLATFORM_WAYLAND_KHR)
-    demo.run();
+        demo.run();
 #elif defined(VK_USE_PLATFORM_MIR_KHR)
 #elif defined(VK_USE_PLATFORM_DISPLAY_KHR)
-    demo.run_display();
+        demo.run_display();
 #endif
+    }
 
     demo.cleanup();
 
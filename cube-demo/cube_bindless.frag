@@ -0,0 +1,42 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Fragment shader for --bindless: the texture comes out of one large array
+ * and is tinted by the draw's material.  Both indices are push constants,
+ * the same for the whole draw, so no nonuniformEXT is needed.
+ */
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_ARB_shading_language_420pack : enable
+#extension GL_EXT_nonuniform_qualifier : require
+
+layout(std430, binding = 1) readonly buffer materials {
+    vec4 tint[];
+} mats;
+
+layout(binding = 2) uniform sampler2D textures[];
+
+layout(push_constant) uniform draw {
+    uint object;
+    uint material;
+    uint texture;  // Slot in textures
+} pc;
+
+layout(location = 0) in vec4 texcoord;
+layout(location = 0) out vec4 uFragColor;
+
+void main() {
+    uFragColor = texture(textures[pc.texture], texcoord.xy) * mats.tint[pc.material];
+}
@@ -0,0 +1,43 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Vertex shader for --bindless: cube.vert, reading its object's entry of the
+ * uniform arena from a storage buffer.  Push constants say where the entry
+ * starts, so no descriptor set is bound per object.
+ */
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_ARB_shading_language_420pack : enable
+
+// The arena as vec4s; an entry is the MVP, 36 positions and 36 texcoords
+layout(std430, binding = 0) readonly buffer objects {
+    vec4 data[];
+} arena;
+
+layout(push_constant) uniform draw {
+    uint object;  // First vec4 of the object's entry
+    uint material;
+    uint texture;
+} pc;
+
+layout(location = 0) out vec4 texcoord;
+
+void main() {
+    uint base = pc.object;
+    mat4 mvp = mat4(arena.data[base], arena.data[base + 1], arena.data[base + 2], arena.data[base + 3]);
+
+    texcoord = arena.data[base + 4 + 12 * 3 + gl_VertexIndex];
+    gl_Position = mvp * arena.data[base + 4 + gl_VertexIndex];
+}
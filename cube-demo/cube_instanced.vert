@@ -0,0 +1,43 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Vertex shader for --instances: cube.vert, with each instance moved into
+ * place from a storage buffer of (offset.xyz, scale) placements.
+ */
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_ARB_shading_language_420pack : enable
+
+layout(std140, binding = 0) uniform buf {
+    mat4 MVP;
+    vec4 position[12 * 3];
+    vec4 attr[12 * 3];
+    mat4 VP;
+} ubuf;
+
+layout(std430, binding = 2) readonly buffer placements {
+    vec4 placement[];
+} instances;
+
+layout(location = 0) out vec4 texcoord;
+
+void main() {
+    vec4 placement = instances.placement[gl_InstanceIndex];
+
+    // The model matrix only rotates, so the placement can be applied after it:
+    // VP * (offset + scale * M * p) == MVP * (scale * p) + VP * offset
+    texcoord = ubuf.attr[gl_VertexIndex];
+    gl_Position = ubuf.MVP * vec4(ubuf.position[gl_VertexIndex].xyz * placement.w, 1.0) + ubuf.VP * vec4(placement.xyz, 0.0);
+}
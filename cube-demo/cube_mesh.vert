@@ -0,0 +1,35 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Vertex shader for --mesh: the vertices come from an indexed vertex buffer
+ * instead of the uniform block, which only contributes the MVP.
+ */
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_ARB_shading_language_420pack : enable
+
+layout(std140, binding = 0) uniform buf {
+    mat4 MVP;
+} ubuf;
+
+layout(location = 0) in vec3 position;
+layout(location = 1) in vec2 uv;
+
+layout(location = 0) out vec4 texcoord;
+
+void main() {
+    texcoord = vec4(uv, 0.0, 0.0);
+    gl_Position = ubuf.MVP * vec4(position, 1.0);
+}
@@ -0,0 +1,44 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Vertex shader for --mesh with --bindless: cube_mesh.vert, with the MVP
+ * read from the object's entry of the uniform arena like cube_bindless.vert.
+ */
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_ARB_shading_language_420pack : enable
+
+layout(std430, binding = 0) readonly buffer objects {
+    vec4 data[];
+} arena;
+
+layout(push_constant) uniform draw {
+    uint object;  // First vec4 of the object's entry
+    uint material;
+    uint texture;
+} pc;
+
+layout(location = 0) in vec3 position;
+layout(location = 1) in vec2 uv;
+
+layout(location = 0) out vec4 texcoord;
+
+void main() {
+    uint base = pc.object;
+    mat4 mvp = mat4(arena.data[base], arena.data[base + 1], arena.data[base + 2], arena.data[base + 3]);
+
+    texcoord = vec4(uv, 0.0, 0.0);
+    gl_Position = mvp * vec4(position, 1.0);
+}
@@ -0,0 +1,629 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Sub-allocates buffers and images out of large vk::DeviceMemory blocks.
+//
+// Every memory type gets its own pools, created on first use.  A pool hands
+// out ranges of its blocks either with a buddy allocator (general purpose,
+// freed ranges coalesce with their buddy) or a linear bump allocator (for
+// short lived uploads; a block is rewound once everything in it is freed).
+// Requests larger than half a block get a dedicated allocation.
+//
+// bufferImageGranularity is respected by never letting linear resources
+// (buffers, linearly tiled images) and optimally tiled images share a block:
+// they go to separate pools, unless the device reports a granularity of 1.
+//
+// Host visible blocks are mapped once when created and stay mapped, so
+// device_allocation::mapped can be used directly; never map an allocation's
+// memory yourself.
+//
+// Include vulkan.hpp (with VULKAN_HPP_NO_EXCEPTIONS) before this header.
+
+#ifndef DEVICE_ALLOCATOR_H
+#define DEVICE_ALLOCATOR_H
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <map>
+#include <vector>
+
+enum class allocation_strategy { buddy, linear };
+
+enum class resource_tiling { linear, optimal };
+
+struct device_allocation {
+    vk::DeviceMemory memory;
+    vk::DeviceSize offset{0};
+    vk::DeviceSize size{0};  // Size of the range handed out, at least the requested size
+    uint8_t *mapped{nullptr};  // Host address of offset, for host visible memory types
+    uint32_t memory_type{UINT32_MAX};
+    uint32_t pool{UINT32_MAX};  // UINT32_MAX for dedicated allocations
+    uint32_t block{0};
+};
+
+struct device_allocator_stats {
+    uint32_t memory_object_count;  // Live vkAllocateMemory objects, blocks and dedicated
+    uint32_t block_count;
+    uint32_t dedicated_count;
+    uint32_t allocation_count;  // Live sub-allocations, including dedicated ones
+    vk::DeviceSize reserved_bytes;  // Device memory owned by the allocator
+    vk::DeviceSize used_bytes;      // Bytes handed out, after rounding
+    vk::DeviceSize largest_free_range;
+};
+
+class device_allocator {
+   public:
+    static vk::DeviceSize const DEFAULT_BLOCK_SIZE = 64ull * 1024 * 1024;
+    static vk::DeviceSize const MIN_BUDDY_SIZE = 256;
+
+    void init(vk::PhysicalDevice gpu, vk::Device device, vk::DeviceSize block_size = DEFAULT_BLOCK_SIZE) {
+        this->device = device;
+        gpu.getMemoryProperties(&memory_properties);
+
+        vk::PhysicalDeviceProperties props;
+        gpu.getProperties(&props);
+        max_memory_objects = props.limits.maxMemoryAllocationCount;
+        shared_tiling = props.limits.bufferImageGranularity <= 1;
+
+        // Buddy blocks must be a power of two
+        preferred_block_size = MIN_BUDDY_SIZE;
+        while (preferred_block_size < block_size) {
+            preferred_block_size <<= 1;
+        }
+    }
+
+    void destroy() {
+        for (auto &pool : pools) {
+            for (auto &block : pool.blocks) {
+                release_block(block);
+            }
+        }
+        pools.clear();
+
+        for (auto &dedicated : dedicated_allocations) {
+            device.freeMemory(dedicated.memory, nullptr);
+        }
+        dedicated_allocations.clear();
+        memory_object_count = 0;
+    }
+
+    // Picks the memory type allowed by type_bits that has all of the
+    // required flags and as many of the preferred flags as possible.
+    bool find_memory_type(uint32_t type_bits, vk::MemoryPropertyFlags required, vk::MemoryPropertyFlags preferred,
+                          uint32_t *type_index) const {
+        int best_score = -1;
+        for (uint32_t i = 0; i < memory_properties.memoryTypeCount; i++) {
+            if (!(type_bits & (1u << i))) {
+                continue;
+            }
+
+            auto const flags = memory_properties.memoryTypes[i].propertyFlags;
+            if ((flags & required) != required) {
+                continue;
+            }
+
+            int const score = popcount((VkMemoryPropertyFlags)(flags & preferred));
+            if (score > best_score) {
+                best_score = score;
+                *type_index = i;
+            }
+        }
+
+        return best_score >= 0;
+    }
+
+    bool allocate(vk::MemoryRequirements const &reqs, vk::MemoryPropertyFlags required, vk::MemoryPropertyFlags preferred,
+                  resource_tiling tiling, allocation_strategy strategy, device_allocation *allocation) {
+        uint32_t type_index;
+        if (!find_memory_type(reqs.memoryTypeBits, required, preferred, &type_index)) {
+            return false;
+        }
+
+        vk::DeviceSize const block_size = block_size_for(type_index);
+        if (reqs.size > block_size / 2 || reqs.alignment > block_size) {
+            return allocate_dedicated(reqs.size, type_index, allocation);
+        }
+
+        uint32_t const pool_index = find_pool(type_index, tiling, strategy);
+        auto &pool = pools[pool_index];
+
+        for (uint32_t i = 0; i < pool.blocks.size(); i++) {
+            if (pool.blocks[i].memory && allocate_from_block(pool, i, reqs.size, reqs.alignment, allocation)) {
+                allocation->pool = pool_index;
+                return true;
+            }
+        }
+
+        uint32_t const block_index = create_block(pool, block_size);
+        if (block_index == UINT32_MAX || !allocate_from_block(pool, block_index, reqs.size, reqs.alignment, allocation)) {
+            return false;
+        }
+
+        allocation->pool = pool_index;
+        return true;
+    }
+
+    bool allocate_buffer(vk::Buffer buffer, vk::MemoryPropertyFlags required, vk::MemoryPropertyFlags preferred,
+                         allocation_strategy strategy, device_allocation *allocation) {
+        vk::MemoryRequirements reqs;
+        device.getBufferMemoryRequirements(buffer, &reqs);
+
+        if (!allocate(reqs, required, preferred, resource_tiling::linear, strategy, allocation)) {
+            return false;
+        }
+
+        if (device.bindBufferMemory(buffer, allocation->memory, allocation->offset) != vk::Result::eSuccess) {
+            free(allocation);
+            return false;
+        }
+
+        return true;
+    }
+
+    bool allocate_image(vk::Image image, vk::ImageTiling image_tiling, vk::MemoryPropertyFlags required,
+                        vk::MemoryPropertyFlags preferred, allocation_strategy strategy, device_allocation *allocation) {
+        vk::MemoryRequirements reqs;
+        device.getImageMemoryRequirements(image, &reqs);
+
+        auto const tiling = image_tiling == vk::ImageTiling::eLinear ? resource_tiling::linear : resource_tiling::optimal;
+        if (!allocate(reqs, required, preferred, tiling, strategy, allocation)) {
+            return false;
+        }
+
+        if (device.bindImageMemory(image, allocation->memory, allocation->offset) != vk::Result::eSuccess) {
+            free(allocation);
+            return false;
+        }
+
+        return true;
+    }
+
+    void free(device_allocation *allocation) {
+        if (!allocation->memory) {
+            return;
+        }
+
+        if (allocation->pool == UINT32_MAX) {
+            free_dedicated(allocation->memory);
+        } else {
+            auto &pool = pools[allocation->pool];
+            free_in_block(pool, pool.blocks[allocation->block], allocation->offset);
+        }
+
+        *allocation = device_allocation();
+    }
+
+    // Releases blocks that no longer hold any allocation, keeping one empty
+    // block per pool so that alloc/free cycles do not thrash vkAllocateMemory.
+    // Returns the number of bytes given back to the driver.
+    vk::DeviceSize trim(bool keep_one = true) {
+        vk::DeviceSize released = 0;
+        for (auto &pool : pools) {
+            bool kept = !keep_one;
+            for (auto &block : pool.blocks) {
+                if (!block.memory || !block.ranges.empty()) {
+                    continue;
+                }
+                if (!kept) {
+                    kept = true;
+                    continue;
+                }
+                released += block.size;
+                release_block(block);
+            }
+        }
+        return released;
+    }
+
+    // Compacts buddy pools by moving allocations out of their least occupied
+    // block into free space of the others, then trims the blocks left empty.
+    //
+    // The allocator only knows about ranges, not the resources bound to
+    // them, so every move goes through the callback.  It must recreate the
+    // resource owning `from` on `to` (copying its contents) and update its
+    // own bookkeeping, or return false to leave that allocation in place.
+    // The GPU must not be using any resource in the allocator meanwhile.
+    // Returns the number of bytes moved.
+    vk::DeviceSize defragment(std::function<bool(device_allocation const &from, device_allocation const &to)> const &move) {
+        vk::DeviceSize moved = 0;
+        for (uint32_t p = 0; p < pools.size(); p++) {
+            auto &pool = pools[p];
+            if (pool.strategy != allocation_strategy::buddy) {
+                continue;
+            }
+
+            // Pick the emptiest live block as the one to drain
+            uint32_t source = UINT32_MAX;
+            uint32_t live_blocks = 0;
+            for (uint32_t i = 0; i < pool.blocks.size(); i++) {
+                if (!pool.blocks[i].memory || pool.blocks[i].ranges.empty()) {
+                    continue;
+                }
+                live_blocks++;
+                if (source == UINT32_MAX || pool.blocks[i].used < pool.blocks[source].used) {
+                    source = i;
+                }
+            }
+            if (live_blocks < 2) {
+                continue;
+            }
+
+            // Copy: ranges is modified as allocations move out
+            auto const ranges = pool.blocks[source].ranges;
+            for (auto const &range : ranges) {
+                device_allocation from;
+                fill_allocation(pool, p, source, range.first, range.second, &from);
+
+                device_allocation to;
+                bool placed = false;
+                for (uint32_t i = 0; i < pool.blocks.size() && !placed; i++) {
+                    if (i != source && pool.blocks[i].memory && !pool.blocks[i].ranges.empty()) {
+                        placed = allocate_from_block(pool, i, range.second, 1, &to);
+                    }
+                }
+                if (!placed) {
+                    break;
+                }
+                to.pool = p;
+
+                if (move(from, to)) {
+                    free_in_block(pool, pool.blocks[source], from.offset);
+                    moved += from.size;
+                } else {
+                    free_in_block(pool, pool.blocks[to.block], to.offset);
+                }
+            }
+        }
+
+        trim();
+        return moved;
+    }
+
+    device_allocator_stats stats() const {
+        device_allocator_stats stats = {};
+        stats.memory_object_count = memory_object_count;
+
+        for (auto const &pool : pools) {
+            for (auto const &block : pool.blocks) {
+                if (!block.memory) {
+                    continue;
+                }
+                stats.block_count++;
+                stats.allocation_count += (uint32_t)block.ranges.size();
+                stats.reserved_bytes += block.size;
+                stats.used_bytes += block.used;
+                stats.largest_free_range = std::max(stats.largest_free_range, largest_free_range(pool, block));
+            }
+        }
+
+        for (auto const &dedicated : dedicated_allocations) {
+            stats.dedicated_count++;
+            stats.allocation_count++;
+            stats.reserved_bytes += dedicated.size;
+            stats.used_bytes += dedicated.size;
+        }
+
+        return stats;
+    }
+
+    void print_stats(FILE *out) const {
+        auto const s = stats();
+        fprintf(out,
+                "Device memory: %" PRIu32 " memory objects (%" PRIu32 " blocks, %" PRIu32 " dedicated), %" PRIu32
+                " allocations\n",
+                s.memory_object_count, s.block_count, s.dedicated_count, s.allocation_count);
+        fprintf(out, "  reserved %.2f MiB, used %.2f MiB, largest free range %.2f MiB\n", s.reserved_bytes / 1048576.0,
+                s.used_bytes / 1048576.0, s.largest_free_range / 1048576.0);
+
+        for (auto const &pool : pools) {
+            uint32_t blocks = 0;
+            vk::DeviceSize used = 0;
+            for (auto const &block : pool.blocks) {
+                if (block.memory) {
+                    blocks++;
+                    used += block.used;
+                }
+            }
+            if (blocks == 0) {
+                continue;
+            }
+            fprintf(out, "  type %" PRIu32 " %s %s: %" PRIu32 " blocks, %.2f MiB used\n", pool.memory_type,
+                    pool.tiling == resource_tiling::linear ? "linear" : "optimal",
+                    pool.strategy == allocation_strategy::buddy ? "buddy" : "bump", blocks, used / 1048576.0);
+        }
+    }
+
+   private:
+    struct memory_block {
+        vk::DeviceMemory memory;
+        vk::DeviceSize size{0};
+        uint8_t *mapped{nullptr};
+        vk::DeviceSize used{0};
+        vk::DeviceSize head{0};  // Linear strategy: end of the last allocation
+
+        std::map<vk::DeviceSize, vk::DeviceSize> ranges;  // Live allocations, offset -> size
+
+        // Buddy strategy: free_lists[k] holds the offsets of free ranges of MIN_BUDDY_SIZE << k bytes
+        std::vector<std::vector<vk::DeviceSize>> free_lists;
+    };
+
+    struct memory_pool {
+        uint32_t memory_type;
+        resource_tiling tiling;
+        allocation_strategy strategy;
+        std::vector<memory_block> blocks;  // Released blocks stay as empty slots so indices remain valid
+    };
+
+    struct dedicated_allocation {
+        vk::DeviceMemory memory;
+        vk::DeviceSize size;
+    };
+
+    static int popcount(uint32_t bits) {
+        int count = 0;
+        for (; bits; bits &= bits - 1) {
+            count++;
+        }
+        return count;
+    }
+
+    static uint32_t buddy_order(vk::DeviceSize size) {
+        uint32_t order = 0;
+        while ((MIN_BUDDY_SIZE << order) < size) {
+            order++;
+        }
+        return order;
+    }
+
+    bool is_host_visible(uint32_t type_index) const {
+        return !!(memory_properties.memoryTypes[type_index].propertyFlags & vk::MemoryPropertyFlagBits::eHostVisible);
+    }
+
+    // Keep small heaps (such as a 256 MiB host visible device local window)
+    // from being claimed by a handful of blocks
+    vk::DeviceSize block_size_for(uint32_t type_index) const {
+        uint32_t const heap = memory_properties.memoryTypes[type_index].heapIndex;
+        vk::DeviceSize size = preferred_block_size;
+        while (size > MIN_BUDDY_SIZE && size > memory_properties.memoryHeaps[heap].size / 8) {
+            size >>= 1;
+        }
+        return size;
+    }
+
+    uint32_t find_pool(uint32_t type_index, resource_tiling tiling, allocation_strategy strategy) {
+        if (shared_tiling) {
+            tiling = resource_tiling::linear;
+        }
+
+        for (uint32_t i = 0; i < pools.size(); i++) {
+            if (pools[i].memory_type == type_index && pools[i].tiling == tiling && pools[i].strategy == strategy) {
+                return i;
+            }
+        }
+
+        memory_pool pool;
+        pool.memory_type = type_index;
+        pool.tiling = tiling;
+        pool.strategy = strategy;
+        pools.push_back(pool);
+        return (uint32_t)pools.size() - 1;
+    }
+
+    bool allocate_memory(vk::DeviceSize size, uint32_t type_index, vk::DeviceMemory *memory, uint8_t **mapped) {
+        if (memory_object_count >= max_memory_objects) {
+            return false;
+        }
+
+        auto const mem_alloc = vk::MemoryAllocateInfo().setAllocationSize(size).setMemoryTypeIndex(type_index);
+        if (device.allocateMemory(&mem_alloc, nullptr, memory) != vk::Result::eSuccess) {
+            return false;
+        }
+
+        *mapped = nullptr;
+        if (is_host_visible(type_index)) {
+            auto data = device.mapMemory(*memory, 0, VK_WHOLE_SIZE, vk::MemoryMapFlags());
+            if (data.result != vk::Result::eSuccess) {
+                device.freeMemory(*memory, nullptr);
+                return false;
+            }
+            *mapped = (uint8_t *)data.value;
+        }
+
+        memory_object_count++;
+        return true;
+    }
+
+    bool allocate_dedicated(vk::DeviceSize size, uint32_t type_index, device_allocation *allocation) {
+        uint8_t *mapped;
+        vk::DeviceMemory memory;
+        if (!allocate_memory(size, type_index, &memory, &mapped)) {
+            return false;
+        }
+
+        dedicated_allocations.push_back({memory, size});
+
+        *allocation = device_allocation();
+        allocation->memory = memory;
+        allocation->size = size;
+        allocation->mapped = mapped;
+        allocation->memory_type = type_index;
+        return true;
+    }
+
+    void free_dedicated(vk::DeviceMemory memory) {
+        for (auto it = dedicated_allocations.begin(); it != dedicated_allocations.end(); ++it) {
+            if (it->memory == memory) {
+                device.freeMemory(memory, nullptr);
+                dedicated_allocations.erase(it);
+                memory_object_count--;
+                return;
+            }
+        }
+    }
+
+    uint32_t create_block(memory_pool &pool, vk::DeviceSize size) {
+        memory_block block;
+        if (!allocate_memory(size, pool.memory_type, &block.memory, &block.mapped)) {
+            return UINT32_MAX;
+        }
+        block.size = size;
+
+        if (pool.strategy == allocation_strategy::buddy) {
+            uint32_t const top = buddy_order(size);
+            block.free_lists.resize(top + 1);
+            block.free_lists[top].push_back(0);
+        }
+
+        // Reuse a released slot if there is one
+        for (uint32_t i = 0; i < pool.blocks.size(); i++) {
+            if (!pool.blocks[i].memory) {
+                pool.blocks[i] = block;
+                return i;
+            }
+        }
+
+        pool.blocks.push_back(block);
+        return (uint32_t)pool.blocks.size() - 1;
+    }
+
+    void release_block(memory_block &block) {
+        if (!block.memory) {
+            return;
+        }
+
+        if (block.mapped) {
+            device.unmapMemory(block.memory);
+        }
+        device.freeMemory(block.memory, nullptr);
+        memory_object_count--;
+        block = memory_block();
+    }
+
+    bool allocate_from_block(memory_pool &pool, uint32_t block_index, vk::DeviceSize size, vk::DeviceSize alignment,
+                             device_allocation *allocation) {
+        auto &block = pool.blocks[block_index];
+        vk::DeviceSize offset;
+        vk::DeviceSize range_size;
+
+        if (pool.strategy == allocation_strategy::buddy) {
+            // Buddy ranges are aligned to their own size, so rounding the
+            // size up to the alignment also satisfies the alignment
+            uint32_t const order = buddy_order(std::max(size, alignment));
+            uint32_t level = order;
+            while (level < block.free_lists.size() && block.free_lists[level].empty()) {
+                level++;
+            }
+            if (level >= block.free_lists.size()) {
+                return false;
+            }
+
+            offset = block.free_lists[level].back();
+            block.free_lists[level].pop_back();
+
+            // Split down to the requested order, freeing the upper halves
+            while (level > order) {
+                level--;
+                block.free_lists[level].push_back(offset + (MIN_BUDDY_SIZE << level));
+            }
+            range_size = MIN_BUDDY_SIZE << order;
+        } else {
+            offset = (block.head + alignment - 1) / alignment * alignment;
+            if (offset + size > block.size) {
+                return false;
+            }
+            block.head = offset + size;
+            range_size = size;
+        }
+
+        block.ranges[offset] = range_size;
+        block.used += range_size;
+        fill_allocation(pool, UINT32_MAX, block_index, offset, range_size, allocation);
+        return true;
+    }
+
+    void free_in_block(memory_pool &pool, memory_block &block, vk::DeviceSize offset) {
+        auto const it = block.ranges.find(offset);
+        if (it == block.ranges.end()) {
+            return;
+        }
+
+        vk::DeviceSize const size = it->second;
+        block.used -= size;
+        block.ranges.erase(it);
+
+        if (pool.strategy == allocation_strategy::linear) {
+            // Space is only reclaimed once the whole block is free
+            if (block.ranges.empty()) {
+                block.head = 0;
+            }
+            return;
+        }
+
+        // Coalesce with the buddy for as long as it is free too
+        uint32_t order = buddy_order(size);
+        while (order + 1 < block.free_lists.size()) {
+            vk::DeviceSize const buddy = offset ^ (MIN_BUDDY_SIZE << order);
+            auto &list = block.free_lists[order];
+            auto const found = std::find(list.begin(), list.end(), buddy);
+            if (found == list.end()) {
+                break;
+            }
+            list.erase(found);
+            offset = std::min(offset, buddy);
+            order++;
+        }
+        block.free_lists[order].push_back(offset);
+    }
+
+    void fill_allocation(memory_pool const &pool, uint32_t pool_index, uint32_t block_index, vk::DeviceSize offset,
+                         vk::DeviceSize size, device_allocation *allocation) const {
+        auto const &block = pool.blocks[block_index];
+        *allocation = device_allocation();
+        allocation->memory = block.memory;
+        allocation->offset = offset;
+        allocation->size = size;
+        allocation->mapped = block.mapped ? block.mapped + offset : nullptr;
+        allocation->memory_type = pool.memory_type;
+        allocation->pool = pool_index;
+        allocation->block = block_index;
+    }
+
+    vk::DeviceSize largest_free_range(memory_pool const &pool, memory_block const &block) const {
+        if (pool.strategy == allocation_strategy::linear) {
+            return block.ranges.empty() ? block.size : block.size - block.head;
+        }
+
+        for (size_t order = block.free_lists.size(); order-- > 0;) {
+            if (!block.free_lists[order].empty()) {
+                return MIN_BUDDY_SIZE << order;
+            }
+        }
+        return 0;
+    }
+
+    vk::Device device;
+    vk::PhysicalDeviceMemoryProperties memory_properties;
+    vk::DeviceSize preferred_block_size{DEFAULT_BLOCK_SIZE};
+    uint32_t max_memory_objects{4096};
+    uint32_t memory_object_count{0};
+    bool shared_tiling{false};
+
+    std::vector<memory_pool> pools;
+    std::vector<dedicated_allocation> dedicated_allocations;
+};
+
+#endif  // DEVICE_ALLOCATOR_H
@@ -0,0 +1,240 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Paces frames and tells when the GPU is done with them.
+//
+// Frames are numbered from 1 in submission order.  Each frame's last
+// submission goes through submit(), which makes it signal a timeline
+// semaphore (VK_KHR_timeline_semaphore) with the frame's number, so
+// completed() is a single counter read and reached(n) says whether the GPU
+// has finished frame n.  Anything a frame used can be recycled once
+// reached() holds for the last frame that used it; nothing else needs a
+// fence of its own.
+//
+// begin_frame() blocks until at most frames_in_flight - 1 frames are still
+// on the GPU and returns the slot of the new frame, which per-frame resources
+// (command buffers, semaphores, uniform ranges) are indexed with.  The depth
+// can be anything from 1 to MAX_FRAMES and is chosen at init().
+//
+// Without the extension, or when headers predate it, the same interface is
+// kept with one fence per slot: completed() then advances over the frames
+// whose fences have signalled.
+//
+// Must be used from one thread.  Include vulkan.hpp (with
+// VULKAN_HPP_NO_EXCEPTIONS) before this header.
+
+#ifndef FRAME_SCHEDULER_H
+#define FRAME_SCHEDULER_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+class frame_scheduler {
+   public:
+    static uint32_t const MAX_FRAMES = 8;
+
+    // timeline: VK_KHR_timeline_semaphore is enabled on the device
+    void init(vk::Device device, uint32_t frames_in_flight, bool timeline) {
+        this->device = device;
+        depth = frames_in_flight < 1 ? 1 : frames_in_flight > MAX_FRAMES ? MAX_FRAMES : frames_in_flight;
+        submitted_frames = 0;
+        completed_frames = 0;
+        use_timeline = false;
+
+#ifdef VK_KHR_timeline_semaphore
+        if (timeline) {
+            wait_semaphores = (PFN_vkWaitSemaphoresKHR)device.getProcAddr("vkWaitSemaphoresKHR");
+            get_counter_value = (PFN_vkGetSemaphoreCounterValueKHR)device.getProcAddr("vkGetSemaphoreCounterValueKHR");
+            use_timeline = wait_semaphores && get_counter_value;
+        }
+        if (use_timeline) {
+            VkSemaphoreTypeCreateInfoKHR type_info = {};
+            type_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO_KHR;
+            type_info.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE_KHR;
+            type_info.initialValue = 0;
+
+            auto const semaphore_info = vk::SemaphoreCreateInfo().setPNext(&type_info);
+            check(device.createSemaphore(&semaphore_info, nullptr, &timeline_semaphore), "vkCreateSemaphore");
+            return;
+        }
+#endif
+        (void)timeline;
+
+        // Signalled, so the first frame in each slot does not wait
+        auto const fence_info = vk::FenceCreateInfo().setFlags(vk::FenceCreateFlagBits::eSignaled);
+        for (uint32_t i = 0; i < depth; i++) {
+            check(device.createFence(&fence_info, nullptr, &fences[i]), "vkCreateFence");
+            fence_frames[i] = 0;
+        }
+    }
+
+    // Only after the device is idle
+    void destroy() {
+        if (use_timeline) {
+            device.destroySemaphore(timeline_semaphore, nullptr);
+            timeline_semaphore = vk::Semaphore();
+            return;
+        }
+        for (uint32_t i = 0; i < depth; i++) {
+            device.destroyFence(fences[i], nullptr);
+            fences[i] = vk::Fence();
+        }
+    }
+
+    // Waits for the frame that last used the next frame's slot, and returns
+    // that slot
+    uint32_t begin_frame() {
+        uint32_t const next_slot = slot();
+        if (submitted_frames >= depth) {
+            wait(submitted_frames + 1 - depth);
+        }
+        if (!use_timeline) {
+            check(device.resetFences(1, &fences[next_slot]), "vkResetFences");
+        }
+        return next_slot;
+    }
+
+    // Submits the frame's last batch of work, adding what marks the frame as
+    // done once it completes.  The frame's number is then submitted().
+    vk::Result submit(vk::Queue queue, vk::SubmitInfo submit_info) {
+        uint64_t const frame = submitted_frames + 1;
+        vk::Fence fence;
+
+#ifdef VK_KHR_timeline_semaphore
+        VkTimelineSemaphoreSubmitInfoKHR timeline_info = {};
+        if (use_timeline) {
+            // Binary semaphores ignore their values, but each needs one
+            signal_semaphores.assign(submit_info.pSignalSemaphores, submit_info.pSignalSemaphores + submit_info.signalSemaphoreCount);
+            signal_values.assign(signal_semaphores.size(), 0);
+            signal_semaphores.push_back(timeline_semaphore);
+            signal_values.push_back(frame);
+
+            timeline_info.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR;
+            timeline_info.pNext = submit_info.pNext;
+            timeline_info.signalSemaphoreValueCount = (uint32_t)signal_values.size();
+            timeline_info.pSignalSemaphoreValues = signal_values.data();
+
+            submit_info.setPNext(&timeline_info)
+                .setSignalSemaphoreCount((uint32_t)signal_semaphores.size())
+                .setPSignalSemaphores(signal_semaphores.data());
+        }
+#endif
+        if (!use_timeline) {
+            fence = fences[slot()];
+            fence_frames[slot()] = frame;
+        }
+
+        auto const result = queue.submit(1, &submit_info, fence);
+        if (result == vk::Result::eSuccess) {
+            submitted_frames = frame;
+        }
+        return result;
+    }
+
+    // The highest frame the GPU has finished; all frames before it are done too
+    uint64_t completed() {
+        if (completed_frames == submitted_frames) {
+            return completed_frames;
+        }
+
+#ifdef VK_KHR_timeline_semaphore
+        if (use_timeline) {
+            uint64_t value = 0;
+            check((vk::Result)get_counter_value((VkDevice)device, (VkSemaphore)timeline_semaphore, &value), "vkGetSemaphoreCounterValueKHR");
+            completed_frames = std::max(completed_frames, value);
+            return completed_frames;
+        }
+#endif
+
+        // Frames complete in order; a frame's fence is only reset once the
+        // frame is known to be done, so the ones after completed_frames are
+        // all still there
+        while (completed_frames < submitted_frames) {
+            uint32_t const frame_slot = (uint32_t)(completed_frames % depth);
+            if (fence_frames[frame_slot] != completed_frames + 1 || device.getFenceStatus(fences[frame_slot]) != vk::Result::eSuccess) {
+                break;
+            }
+            completed_frames++;
+        }
+        return completed_frames;
+    }
+
+    bool reached(uint64_t frame) { return frame <= completed_frames || frame <= completed(); }
+
+    // Blocks until the GPU has finished frame (and so every frame before it)
+    void wait(uint64_t frame) {
+        frame = std::min(frame, submitted_frames);
+        if (frame <= completed_frames) {
+            return;
+        }
+
+#ifdef VK_KHR_timeline_semaphore
+        if (use_timeline) {
+            VkSemaphore semaphore = (VkSemaphore)timeline_semaphore;
+            VkSemaphoreWaitInfoKHR wait_info = {};
+            wait_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO_KHR;
+            wait_info.semaphoreCount = 1;
+            wait_info.pSemaphores = &semaphore;
+            wait_info.pValues = &frame;
+            check((vk::Result)wait_semaphores((VkDevice)device, &wait_info, UINT64_MAX), "vkWaitSemaphoresKHR");
+            completed_frames = frame;
+            return;
+        }
+#endif
+
+        uint32_t const frame_slot = (uint32_t)((frame - 1) % depth);
+        check(device.waitForFences(1, &fences[frame_slot], VK_TRUE, UINT64_MAX), "vkWaitForFences");
+        completed_frames = frame;
+    }
+
+    // Frames submitted so far, which is also the number of the last one
+    uint64_t submitted() const { return submitted_frames; }
+
+    // The slot of the frame being prepared, between begin_frame() and submit()
+    uint32_t slot() const { return (uint32_t)(submitted_frames % depth); }
+
+    uint32_t frames_in_flight() const { return depth; }
+    bool timeline() const { return use_timeline; }
+
+   private:
+    static void check(vk::Result result, char const *what) {
+        if (result != vk::Result::eSuccess) {
+            fprintf(stderr, "Frame scheduling: %s failed: %s\n", what, vk::to_string(result).c_str());
+            fflush(stderr);
+            exit(1);
+        }
+    }
+
+    vk::Device device;
+    uint32_t depth = 1;
+    uint64_t submitted_frames = 0;
+    uint64_t completed_frames = 0;
+    bool use_timeline = false;
+
+    vk::Semaphore timeline_semaphore;
+#ifdef VK_KHR_timeline_semaphore
+    PFN_vkWaitSemaphoresKHR wait_semaphores = nullptr;
+    PFN_vkGetSemaphoreCounterValueKHR get_counter_value = nullptr;
+#endif
+    std::vector<vk::Semaphore> signal_semaphores;
+    std::vector<uint64_t> signal_values;
+
+    vk::Fence fences[MAX_FRAMES];
+    uint64_t fence_frames[MAX_FRAMES];  // The frame each fence was last submitted with
+};
+
+#endif  // FRAME_SCHEDULER_H
@@ -0,0 +1,150 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// A minimal fork/join worker pool.
+//
+// run(count, job) calls job(0) .. job(count - 1) spread over the workers and
+// the calling thread, and returns once all of them have finished.  Jobs are
+// claimed one at a time from a shared counter, so uneven jobs still balance.
+// A job index is only ever executed by one thread, which lets callers give
+// each index its own externally synchronized objects (such as a
+// vk::CommandPool) without further locking.
+
+#ifndef JOB_SYSTEM_H
+#define JOB_SYSTEM_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "trace.h"
+
+class job_system {
+   public:
+    ~job_system() { stop(); }
+
+    void start(uint32_t worker_count) {
+        stop();
+        quit = false;
+        for (uint32_t i = 0; i < worker_count; i++) {
+            workers.emplace_back(&job_system::worker_main, this);
+        }
+    }
+
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            quit = true;
+        }
+        wake.notify_all();
+        for (auto &worker : workers) {
+            worker.join();
+        }
+        workers.clear();
+    }
+
+    // Threads that take part in run(), including the caller
+    uint32_t thread_count() const { return (uint32_t)workers.size() + 1; }
+
+    void run(uint32_t count, std::function<void(uint32_t)> const &job) {
+        if (count == 0) {
+            return;
+        }
+
+        if (workers.empty() || count == 1) {
+            for (uint32_t i = 0; i < count; i++) {
+                job(i);
+            }
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            current = &job;
+            job_count = count;
+            next_job = 0;
+            generation++;
+        }
+        wake.notify_all();
+
+        execute_jobs(job, count);
+
+        // Every job has been claimed; wait for the workers still running one.
+        // Clearing current under the lock keeps late wakers off this job.
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [this] { return busy == 0; });
+        current = nullptr;
+    }
+
+   private:
+    void execute_jobs(std::function<void(uint32_t)> const &job, uint32_t count) {
+        for (;;) {
+            uint32_t const index = next_job.fetch_add(1);
+            if (index >= count) {
+                return;
+            }
+
+            job(index);
+        }
+    }
+
+    void worker_main() {
+        TRACE_THREAD("job worker");
+        uint64_t seen = 0;
+        for (;;) {
+            std::function<void(uint32_t)> const *job;
+            uint32_t count;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [&] { return quit || generation != seen; });
+                if (quit) {
+                    return;
+                }
+                seen = generation;
+                job = current;
+                count = job_count;
+                if (!job) {
+                    continue;
+                }
+                busy++;
+            }
+
+            execute_jobs(*job, count);
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                busy--;
+            }
+            done.notify_one();
+        }
+    }
+
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    bool quit{false};
+    uint64_t generation{0};
+
+    std::function<void(uint32_t)> const *current{nullptr};
+    uint32_t job_count{0};
+    std::atomic<uint32_t> next_job{0};
+    uint32_t busy{0};  // Workers inside execute_jobs
+};
+
+#endif  // JOB_SYSTEM_H
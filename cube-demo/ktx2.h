@@ -0,0 +1,278 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// KTX2 containers of 2D textures.
+//
+// Only what the demo streams is accepted: one layer, one face, no
+// supercompression, in RGBA8 or one of the BC1, BC3 and BC7 formats.  The
+// file keeps its levels smallest first; ktx2_parse() points at each of them
+// in place, so a mapped file is read without copying.  ktx2_write() emits
+// the same subset with a basic data format descriptor, for texconv.
+//
+// Formats are the VkFormat values the file stores, so this header does not
+// need Vulkan.
+
+#ifndef KTX2_H
+#define KTX2_H
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+enum ktx2_format : uint32_t {
+    ktx2_format_rgba8_unorm = 37,  // VK_FORMAT_R8G8B8A8_UNORM
+    ktx2_format_bc1_rgb_unorm = 131,
+    ktx2_format_bc1_rgb_srgb = 132,
+    ktx2_format_bc1_rgba_unorm = 133,
+    ktx2_format_bc1_rgba_srgb = 134,
+    ktx2_format_bc3_unorm = 137,
+    ktx2_format_bc3_srgb = 138,
+    ktx2_format_bc7_unorm = 145,
+    ktx2_format_bc7_srgb = 146,
+};
+
+static uint32_t const KTX2_MAX_LEVELS = 16;
+
+struct ktx2_image {
+    uint32_t format;
+    uint32_t width;
+    uint32_t height;
+    uint32_t levels;
+    uint8_t const *level_data[KTX2_MAX_LEVELS];  // Largest first
+    uint64_t level_size[KTX2_MAX_LEVELS];
+};
+
+// Bytes per block and block edge in texels; false for anything unsupported
+static inline bool ktx2_format_block(uint32_t format, uint32_t *block_bytes, uint32_t *block_dim) {
+    switch (format) {
+        case ktx2_format_rgba8_unorm:
+            *block_bytes = 4;
+            *block_dim = 1;
+            return true;
+        case ktx2_format_bc1_rgb_unorm:
+        case ktx2_format_bc1_rgb_srgb:
+        case ktx2_format_bc1_rgba_unorm:
+        case ktx2_format_bc1_rgba_srgb:
+            *block_bytes = 8;
+            *block_dim = 4;
+            return true;
+        case ktx2_format_bc3_unorm:
+        case ktx2_format_bc3_srgb:
+        case ktx2_format_bc7_unorm:
+        case ktx2_format_bc7_srgb:
+            *block_bytes = 16;
+            *block_dim = 4;
+            return true;
+        default:
+            return false;
+    }
+}
+
+static inline uint64_t ktx2_level_size(uint32_t format, uint32_t width, uint32_t height, uint32_t level) {
+    uint32_t block_bytes, block_dim;
+    if (!ktx2_format_block(format, &block_bytes, &block_dim)) {
+        return 0;
+    }
+    uint64_t const w = width >> level ? width >> level : 1;
+    uint64_t const h = height >> level ? height >> level : 1;
+    return (w + block_dim - 1) / block_dim * ((h + block_dim - 1) / block_dim) * block_bytes;
+}
+
+static uint8_t const KTX2_IDENTIFIER[12] = {0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n'};
+
+// The fixed part of the file, after the identifier
+struct ktx2_header {
+    uint32_t vk_format;
+    uint32_t type_size;
+    uint32_t pixel_width;
+    uint32_t pixel_height;
+    uint32_t pixel_depth;
+    uint32_t layer_count;
+    uint32_t face_count;
+    uint32_t level_count;
+    uint32_t supercompression_scheme;
+    uint32_t dfd_byte_offset;
+    uint32_t dfd_byte_length;
+    uint32_t kvd_byte_offset;
+    uint32_t kvd_byte_length;
+    uint32_t sgd_byte_offset[2];  // 64-bit, low word first, but only 4-byte aligned
+    uint32_t sgd_byte_length[2];
+};
+
+struct ktx2_level_index {
+    uint64_t byte_offset;
+    uint64_t byte_length;
+    uint64_t uncompressed_byte_length;
+};
+
+static inline bool ktx2_parse(uint8_t const *data, size_t size, ktx2_image *image) {
+    ktx2_header header;
+    if (size < sizeof(KTX2_IDENTIFIER) + sizeof(header) || memcmp(data, KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER)) != 0) {
+        return false;
+    }
+    memcpy(&header, data + sizeof(KTX2_IDENTIFIER), sizeof(header));
+
+    uint32_t block_bytes, block_dim;
+    if (!ktx2_format_block(header.vk_format, &block_bytes, &block_dim) || header.pixel_width == 0 || header.pixel_height == 0 ||
+        header.pixel_depth > 1 || header.layer_count > 1 || header.face_count != 1 || header.supercompression_scheme != 0) {
+        return false;
+    }
+
+    // Zero levels asks the reader to make the chain; the data is level 0 alone
+    uint32_t const levels = header.level_count ? header.level_count : 1;
+    size_t const index_offset = sizeof(KTX2_IDENTIFIER) + sizeof(header);
+    if (levels > KTX2_MAX_LEVELS || index_offset + levels * sizeof(ktx2_level_index) > size) {
+        return false;
+    }
+
+    image->format = header.vk_format;
+    image->width = header.pixel_width;
+    image->height = header.pixel_height;
+    image->levels = levels;
+    for (uint32_t level = 0; level < levels; level++) {
+        ktx2_level_index index;
+        memcpy(&index, data + index_offset + level * sizeof(index), sizeof(index));
+        if (index.byte_length != ktx2_level_size(header.vk_format, header.pixel_width, header.pixel_height, level) ||
+            index.byte_offset > size || index.byte_length > size - index.byte_offset) {
+            return false;
+        }
+        image->level_data[level] = data + index.byte_offset;
+        image->level_size[level] = index.byte_length;
+    }
+    return true;
+}
+
+// A basic data format descriptor (Khronos Data Format 1.3) for the formats
+// above, which KTX2 requires even though ktx2_parse() goes by vk_format
+static inline std::vector<uint32_t> ktx2_descriptor(uint32_t format) {
+    enum : uint32_t {
+        model_rgbsda = 1,
+        model_bc1a = 128,
+        model_bc3 = 130,
+        model_bc7 = 134,
+        primaries_bt709 = 1,
+        transfer_linear = 1,
+        transfer_srgb = 2,
+        channel_alpha = 15,
+    };
+    struct sample {
+        uint32_t bit_offset;
+        uint32_t bit_length;
+        uint32_t channel;
+        uint32_t upper;
+    };
+
+    uint32_t block_bytes = 0, block_dim = 0;
+    ktx2_format_block(format, &block_bytes, &block_dim);
+
+    uint32_t model = model_rgbsda;
+    bool const srgb = format == ktx2_format_bc1_rgb_srgb || format == ktx2_format_bc1_rgba_srgb || format == ktx2_format_bc3_srgb ||
+                      format == ktx2_format_bc7_srgb;
+    std::vector<sample> samples;
+    switch (format) {
+        case ktx2_format_rgba8_unorm:
+            samples = {{0, 8, 0, 255}, {8, 8, 1, 255}, {16, 8, 2, 255}, {24, 8, channel_alpha, 255}};
+            break;
+        case ktx2_format_bc1_rgb_unorm:
+        case ktx2_format_bc1_rgb_srgb:
+            model = model_bc1a;
+            samples = {{0, 64, 0, UINT32_MAX}};
+            break;
+        case ktx2_format_bc1_rgba_unorm:
+        case ktx2_format_bc1_rgba_srgb:
+            model = model_bc1a;
+            samples = {{0, 64, 1, UINT32_MAX}};
+            break;
+        case ktx2_format_bc3_unorm:
+        case ktx2_format_bc3_srgb:
+            model = model_bc3;
+            samples = {{0, 64, channel_alpha, UINT32_MAX}, {64, 64, 0, UINT32_MAX}};
+            break;
+        default:
+            model = model_bc7;
+            samples = {{0, 128, 0, UINT32_MAX}};
+            break;
+    }
+
+    uint32_t const block_size = 24 + 16 * (uint32_t)samples.size();
+    std::vector<uint32_t> dfd;
+    dfd.push_back(4 + block_size);
+    dfd.push_back(0);                        // Khronos vendor, basic descriptor type
+    dfd.push_back(2 | (block_size << 16));  // Version 1.3
+    dfd.push_back(model | (primaries_bt709 << 8) | ((srgb ? transfer_srgb : transfer_linear) << 16));
+    dfd.push_back((block_dim - 1) | ((block_dim - 1) << 8));
+    dfd.push_back(block_bytes);
+    dfd.push_back(0);
+    for (auto const &s : samples) {
+        dfd.push_back(s.bit_offset | ((s.bit_length - 1) << 16) | (s.channel << 24));
+        dfd.push_back(0);  // Sample position
+        dfd.push_back(0);  // Lower
+        dfd.push_back(s.upper);
+    }
+    return dfd;
+}
+
+// Writes levels[0] (largest) to levels[level_count - 1], each exactly
+// ktx2_level_size() bytes
+static inline bool ktx2_write(FILE *out, uint32_t format, uint32_t width, uint32_t height, uint32_t level_count,
+                              uint8_t const *const *levels) {
+    uint32_t block_bytes, block_dim;
+    if (!ktx2_format_block(format, &block_bytes, &block_dim) || level_count == 0 || level_count > KTX2_MAX_LEVELS) {
+        return false;
+    }
+
+    std::vector<uint32_t> const dfd = ktx2_descriptor(format);
+    size_t const index_offset = sizeof(KTX2_IDENTIFIER) + sizeof(ktx2_header);
+    size_t const dfd_offset = index_offset + level_count * sizeof(ktx2_level_index);
+    size_t const data_offset = dfd_offset + dfd.size() * sizeof(uint32_t);
+
+    // Level data is smallest first, each level aligned to lcm(block size, 4)
+    uint64_t const alignment = block_bytes % 4 ? block_bytes * 4 : block_bytes;
+    std::vector<ktx2_level_index> index(level_count);
+    uint64_t offset = data_offset;
+    for (uint32_t level = level_count; level-- > 0;) {
+        offset = (offset + alignment - 1) / alignment * alignment;
+        index[level].byte_offset = offset;
+        index[level].byte_length = ktx2_level_size(format, width, height, level);
+        index[level].uncompressed_byte_length = index[level].byte_length;
+        offset += index[level].byte_length;
+    }
+
+    ktx2_header header = {};
+    header.vk_format = format;
+    header.type_size = 1;
+    header.pixel_width = width;
+    header.pixel_height = height;
+    header.face_count = 1;
+    header.level_count = level_count;
+    header.dfd_byte_offset = (uint32_t)dfd_offset;
+    header.dfd_byte_length = (uint32_t)(dfd.size() * sizeof(uint32_t));
+
+    bool pass = fwrite(KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER), 1, out) == 1;
+    pass = pass && fwrite(&header, sizeof(header), 1, out) == 1;
+    pass = pass && fwrite(index.data(), sizeof(ktx2_level_index), level_count, out) == level_count;
+    pass = pass && fwrite(dfd.data(), sizeof(uint32_t), dfd.size(), out) == dfd.size();
+
+    uint64_t written = data_offset;
+    uint8_t const zeros[16] = {};
+    for (uint32_t level = level_count; pass && level-- > 0;) {
+        pass = fwrite(zeros, 1, (size_t)(index[level].byte_offset - written), out) == index[level].byte_offset - written;
+        pass = pass && fwrite(levels[level], 1, (size_t)index[level].byte_length, out) == index[level].byte_length;
+        written = index[level].byte_offset + index[level].byte_length;
+    }
+    return pass;
+}
+
+#endif  // KTX2_H
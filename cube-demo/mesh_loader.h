@@ -0,0 +1,1216 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Indexed triangle meshes from Wavefront OBJ and binary glTF (.glb) files,
+// optimized for the post-transform vertex cache.
+//
+// mesh_load() maps the file and tells the formats apart by the glTF magic.
+// OBJ text is cut into line-aligned chunks that are parsed on the job
+// system: a first pass counts the v/vt/vn lines of every chunk, so that the
+// second one knows where each chunk's elements land and can resolve
+// relative (negative) indices on its own.  Polygons are fanned into
+// triangles.  In a .glb every triangle primitive of every mesh is decoded
+// in parallel; node transforms are not applied.
+//
+// The corners are then welded: a hash table over the vertex bits keeps one
+// copy of each distinct position/normal/uv, and triangles that collapse are
+// dropped.  Three passes reorder the result:
+//
+//   - triangles for the vertex cache, after Forsyth's "Linear-speed vertex
+//     cache optimisation" (LRU of 32, scores favour recent and lonely
+//     vertices);
+//   - clusters of those triangles for less overdraw, after Sander, Nehab and
+//     Barczak's "Fast triangle reordering": the order is cut where the cache
+//     starts cold, or where a cluster's ACMR is within threshold of the
+//     whole run's, and clusters facing outward from the centre go first;
+//   - vertices into the order the indices first use them, for fetch locality.
+//
+// ACMR (average cache miss ratio: vertex shader invocations per triangle,
+// 0.5 to 3) is measured on a FIFO of MESH_FIFO_CACHE_SIZE, which is closer
+// to current hardware than the LRU the optimizer models.  Finally the mesh
+// is centred and scaled to span [-1, 1] like the cube.
+
+#ifndef MESH_LOADER_H
+#define MESH_LOADER_H
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "job_system.h"
+#include "ppm_decoder.h"
+#include "trace.h"
+
+#define MESH_FIFO_CACHE_SIZE 16
+
+struct mesh_vertex {
+    float position[3];
+    float normal[3];  // Zero when the file has none
+    float uv[2];
+};
+
+struct mesh_data {
+    std::vector<mesh_vertex> vertices;
+    std::vector<uint32_t> indices;  // Triangle list
+};
+
+struct mesh_stats {
+    uint32_t corners;    // Triangle corners in the file, before welding
+    uint32_t vertices;   // After welding
+    uint32_t triangles;  // After dropping degenerate ones
+    double acmr_before;  // Welded, in file order
+    double acmr_after;
+    double atvr_after;  // Vertex shader invocations per vertex, 1 is ideal
+    double parse_ms;
+    double weld_ms;
+    double optimize_ms;
+    uint32_t threads;
+};
+
+//--------------------------------------------------------------------------------------
+// Measurement
+//--------------------------------------------------------------------------------------
+
+// Vertex shader invocations for indices on a FIFO cache of cache_size.  A
+// vertex is cached while fewer than cache_size misses happened since its own.
+static inline uint32_t mesh_cache_misses(uint32_t const *indices, size_t index_count, size_t vertex_count, uint32_t cache_size) {
+    std::vector<uint32_t> stamps(vertex_count, 0);
+    uint32_t time = cache_size + 1;
+    uint32_t misses = 0;
+    for (size_t i = 0; i < index_count; i++) {
+        uint32_t const v = indices[i];
+        if (time - stamps[v] > cache_size) {
+            stamps[v] = time++;
+            misses++;
+        }
+    }
+    return misses;
+}
+
+static inline double mesh_acmr(std::vector<uint32_t> const &indices, size_t vertex_count) {
+    if (indices.empty()) {
+        return 0.0;
+    }
+    return (double)mesh_cache_misses(indices.data(), indices.size(), vertex_count, MESH_FIFO_CACHE_SIZE) / (indices.size() / 3);
+}
+
+//--------------------------------------------------------------------------------------
+// Welding and reordering
+//--------------------------------------------------------------------------------------
+
+static inline uint32_t mesh_vertex_hash(mesh_vertex const &v) {
+    uint32_t words[sizeof(mesh_vertex) / 4];
+    memcpy(words, &v, sizeof(words));
+
+    // MurmurHash3's 32-bit body and finalizer
+    uint32_t h = 0;
+    for (uint32_t k : words) {
+        k *= 0xcc9e2d51u;
+        k = (k << 15) | (k >> 17);
+        k *= 0x1b873593u;
+        h ^= k;
+        h = (h << 13) | (h >> 19);
+        h = h * 5 + 0xe6546b64u;
+    }
+    h ^= h >> 16;
+    h *= 0x85ebca6bu;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35u;
+    h ^= h >> 16;
+    return h;
+}
+
+// Keeps one copy of every distinct vertex and drops the triangles that are
+// left with a repeated index.  -0.0 is folded into 0.0 first so that the
+// bitwise comparison matches the numeric one.
+static inline void mesh_weld(mesh_data *mesh) {
+    size_t const count = mesh->vertices.size();
+    size_t capacity = 16;
+    while (capacity < count * 2) {
+        capacity *= 2;
+    }
+
+    std::vector<uint32_t> table(capacity, UINT32_MAX);
+    std::vector<uint32_t> remap(count);
+    std::vector<mesh_vertex> unique;
+    unique.reserve(count);
+
+    for (size_t i = 0; i < count; i++) {
+        mesh_vertex v = mesh->vertices[i];
+        for (float &f : v.position) f += 0.0f;
+        for (float &f : v.normal) f += 0.0f;
+        for (float &f : v.uv) f += 0.0f;
+
+        size_t slot = mesh_vertex_hash(v) & (capacity - 1);
+        while (table[slot] != UINT32_MAX && memcmp(&unique[table[slot]], &v, sizeof(v)) != 0) {
+            slot = (slot + 1) & (capacity - 1);
+        }
+        if (table[slot] == UINT32_MAX) {
+            table[slot] = (uint32_t)unique.size();
+            unique.push_back(v);
+        }
+        remap[i] = table[slot];
+    }
+
+    size_t kept = 0;
+    auto &indices = mesh->indices;
+    for (size_t t = 0; t + 2 < indices.size(); t += 3) {
+        uint32_t const a = remap[indices[t]], b = remap[indices[t + 1]], c = remap[indices[t + 2]];
+        if (a != b && b != c && c != a) {
+            indices[kept++] = a;
+            indices[kept++] = b;
+            indices[kept++] = c;
+        }
+    }
+    indices.resize(kept);
+    mesh->vertices.swap(unique);
+}
+
+// Forsyth's greedy triangle order for an LRU cache of 32 entries
+static inline void mesh_optimize_vertex_cache(std::vector<uint32_t> &indices, size_t vertex_count) {
+    static const uint32_t cache_size = 32;
+    static const uint32_t max_valence = 32;
+    size_t const triangle_count = indices.size() / 3;
+    if (triangle_count == 0) {
+        return;
+    }
+
+    // Position 0-2 held the last triangle, which scores lower so that the
+    // next one does not simply reuse two of its vertices in a thin strip
+    float cache_scores[cache_size];
+    for (uint32_t i = 0; i < cache_size; i++) {
+        cache_scores[i] = i < 3 ? 0.75f : powf(1.0f - (float)(i - 3) / (cache_size - 3), 1.5f);
+    }
+    float valence_scores[max_valence];
+    for (uint32_t i = 0; i < max_valence; i++) {
+        valence_scores[i] = i ? 2.0f / sqrtf((float)i) : 0.0f;
+    }
+
+    // Triangles of each vertex; the first live[v] of them are not emitted yet
+    std::vector<uint32_t> first(vertex_count + 1, 0);
+    for (uint32_t index : indices) {
+        first[index + 1]++;
+    }
+    for (size_t v = 0; v < vertex_count; v++) {
+        first[v + 1] += first[v];
+    }
+    std::vector<uint32_t> adjacency(indices.size());
+    std::vector<uint32_t> live(vertex_count, 0);
+    for (size_t t = 0; t < triangle_count; t++) {
+        for (int k = 0; k < 3; k++) {
+            uint32_t const v = indices[t * 3 + k];
+            adjacency[first[v] + live[v]++] = (uint32_t)t;
+        }
+    }
+
+    std::vector<int32_t> cache_position(vertex_count, -1);
+    std::vector<float> vertex_score(vertex_count);
+    auto const score = [&](size_t v) {
+        if (live[v] == 0) {
+            return -1.0f;
+        }
+        float s = valence_scores[std::min(live[v], max_valence - 1)];
+        if (cache_position[v] >= 0) {
+            s += cache_scores[cache_position[v]];
+        }
+        return s;
+    };
+    for (size_t v = 0; v < vertex_count; v++) {
+        vertex_score[v] = score(v);
+    }
+
+    std::vector<float> triangle_score(triangle_count);
+    std::vector<bool> emitted(triangle_count, false);
+    size_t best = 0;
+    for (size_t t = 0; t < triangle_count; t++) {
+        triangle_score[t] = vertex_score[indices[t * 3]] + vertex_score[indices[t * 3 + 1]] + vertex_score[indices[t * 3 + 2]];
+        if (triangle_score[t] > triangle_score[best]) {
+            best = t;
+        }
+    }
+
+    std::vector<uint32_t> output(indices.size());
+    uint32_t cache[cache_size + 3];
+    uint32_t cache_count = 0;
+    size_t cursor = 0;  // No triangle before it is left to emit
+
+    for (size_t out = 0; out < triangle_count; out++) {
+        if (best == SIZE_MAX) {
+            // Nothing around the cache is left; start over elsewhere
+            while (emitted[cursor]) {
+                cursor++;
+            }
+            best = cursor;
+        }
+
+        uint32_t const *tri = &indices[best * 3];
+        memcpy(&output[out * 3], tri, 3 * sizeof(uint32_t));
+        emitted[best] = true;
+
+        for (int k = 0; k < 3; k++) {
+            uint32_t const v = tri[k];
+            uint32_t *list = &adjacency[first[v]];
+            for (uint32_t i = 0; i < live[v]; i++) {
+                if (list[i] == best) {
+                    std::swap(list[i], list[live[v] - 1]);
+                    break;
+                }
+            }
+            live[v]--;
+        }
+
+        // The triangle's vertices move to the front of the LRU
+        uint32_t next_cache[cache_size + 3];
+        uint32_t next_count = 0;
+        for (int k = 0; k < 3; k++) {
+            next_cache[next_count++] = tri[k];
+        }
+        for (uint32_t i = 0; i < cache_count; i++) {
+            uint32_t const v = cache[i];
+            if (v != tri[0] && v != tri[1] && v != tri[2]) {
+                next_cache[next_count++] = v;
+            }
+        }
+
+        // Vertices pushed out, and the triangles around everything that
+        // stayed, get new scores; the best of those is the next candidate
+        for (uint32_t i = 0; i < next_count; i++) {
+            uint32_t const v = next_cache[i];
+            cache_position[v] = i < cache_size ? (int32_t)i : -1;
+            vertex_score[v] = score(v);
+        }
+        best = SIZE_MAX;
+        float best_score = 0.0f;
+        for (uint32_t i = 0; i < next_count; i++) {
+            uint32_t const v = next_cache[i];
+            for (uint32_t j = 0; j < live[v]; j++) {
+                uint32_t const t = adjacency[first[v] + j];
+                float const s = vertex_score[indices[t * 3]] + vertex_score[indices[t * 3 + 1]] + vertex_score[indices[t * 3 + 2]];
+                triangle_score[t] = s;
+                if (best == SIZE_MAX || s > best_score) {
+                    best = t;
+                    best_score = s;
+                }
+            }
+        }
+
+        cache_count = std::min(next_count, cache_size);
+        memcpy(cache, next_cache, cache_count * sizeof(uint32_t));
+    }
+
+    indices.swap(output);
+}
+
+// Reorders clusters of a cache-optimized index buffer so that outward-facing
+// ones draw first.  threshold bounds how much ACMR may be given up, 1.05
+// allows 5%.
+static inline void mesh_optimize_overdraw(std::vector<uint32_t> &indices, std::vector<mesh_vertex> const &vertices,
+                                          float threshold) {
+    size_t const triangle_count = indices.size() / 3;
+    if (triangle_count < 2) {
+        return;
+    }
+
+    // Hard boundaries: triangles that miss on all three vertices
+    std::vector<uint32_t> stamps(vertices.size(), 0);
+    uint32_t time = MESH_FIFO_CACHE_SIZE + 1;
+    auto const misses = [&](size_t t) {
+        uint32_t m = 0;
+        for (int k = 0; k < 3; k++) {
+            uint32_t const v = indices[t * 3 + k];
+            if (time - stamps[v] > MESH_FIFO_CACHE_SIZE) {
+                stamps[v] = time++;
+                m++;
+            }
+        }
+        return m;
+    };
+
+    std::vector<size_t> hard;
+    for (size_t t = 0; t < triangle_count; t++) {
+        if (misses(t) == 3) {
+            hard.push_back(t);
+        }
+    }
+    hard.push_back(triangle_count);
+
+    // Soft boundaries: cut a hard cluster wherever the run since the last
+    // cut, starting from a cold cache, is already about as good as the whole
+    std::vector<size_t> clusters;
+    for (size_t h = 0; h + 1 < hard.size(); h++) {
+        size_t const begin = hard[h], end = hard[h + 1];
+        time += MESH_FIFO_CACHE_SIZE + 1;
+        uint32_t total = 0;
+        for (size_t t = begin; t < end; t++) {
+            total += misses(t);
+        }
+        float const cluster_acmr = (float)total / (end - begin);
+
+        size_t start = begin;
+        uint32_t running = 0;
+        time += MESH_FIFO_CACHE_SIZE + 1;
+        clusters.push_back(begin);
+        for (size_t t = begin; t < end; t++) {
+            running += misses(t);
+            if (t + 1 < end && (float)running / (t + 1 - start) <= threshold * cluster_acmr) {
+                clusters.push_back(t + 1);
+                start = t + 1;
+                running = 0;
+                time += MESH_FIFO_CACHE_SIZE + 1;
+            }
+        }
+    }
+    clusters.push_back(triangle_count);
+
+    // Area-weighted centroid and normal of every cluster, and of the mesh
+    size_t const cluster_count = clusters.size() - 1;
+    std::vector<float> centroids(cluster_count * 3, 0.0f), normals(cluster_count * 3, 0.0f), areas(cluster_count, 0.0f);
+    float mesh_centroid[3] = {0.0f, 0.0f, 0.0f};
+    float mesh_area = 0.0f;
+    for (size_t c = 0; c < cluster_count; c++) {
+        for (size_t t = clusters[c]; t < clusters[c + 1]; t++) {
+            float const *a = vertices[indices[t * 3]].position;
+            float const *b = vertices[indices[t * 3 + 1]].position;
+            float const *d = vertices[indices[t * 3 + 2]].position;
+            float const e1[3] = {b[0] - a[0], b[1] - a[1], b[2] - a[2]};
+            float const e2[3] = {d[0] - a[0], d[1] - a[1], d[2] - a[2]};
+            float const n[3] = {e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0]};
+            float const area = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+            for (int k = 0; k < 3; k++) {
+                float const centre = (a[k] + b[k] + d[k]) / 3.0f;
+                centroids[c * 3 + k] += centre * area;
+                normals[c * 3 + k] += n[k];
+                mesh_centroid[k] += centre * area;
+            }
+            areas[c] += area;
+            mesh_area += area;
+        }
+    }
+    for (int k = 0; k < 3; k++) {
+        mesh_centroid[k] /= std::max(mesh_area, 1e-30f);
+    }
+
+    std::vector<float> keys(cluster_count);
+    std::vector<uint32_t> order(cluster_count);
+    for (size_t c = 0; c < cluster_count; c++) {
+        float const *n = &normals[c * 3];
+        float const length = std::max(sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]), 1e-30f);
+        float key = 0.0f;
+        for (int k = 0; k < 3; k++) {
+            key += (centroids[c * 3 + k] / std::max(areas[c], 1e-30f) - mesh_centroid[k]) * n[k] / length;
+        }
+        keys[c] = key;
+        order[c] = (uint32_t)c;
+    }
+    std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return keys[a] > keys[b]; });
+
+    std::vector<uint32_t> output;
+    output.reserve(indices.size());
+    for (uint32_t c : order) {
+        output.insert(output.end(), indices.begin() + clusters[c] * 3, indices.begin() + clusters[c + 1] * 3);
+    }
+    indices.swap(output);
+}
+
+// Renumbers vertices in the order the indices first reach them; unreferenced
+// ones are dropped
+static inline void mesh_optimize_vertex_fetch(mesh_data *mesh) {
+    std::vector<uint32_t> remap(mesh->vertices.size(), UINT32_MAX);
+    std::vector<mesh_vertex> ordered;
+    ordered.reserve(mesh->vertices.size());
+    for (uint32_t &index : mesh->indices) {
+        if (remap[index] == UINT32_MAX) {
+            remap[index] = (uint32_t)ordered.size();
+            ordered.push_back(mesh->vertices[index]);
+        }
+        index = remap[index];
+    }
+    mesh->vertices.swap(ordered);
+}
+
+// Centres the bounding box on the origin and scales its longest side to 2
+static inline void mesh_fit_unit_cube(mesh_data *mesh) {
+    if (mesh->vertices.empty()) {
+        return;
+    }
+    float lo[3], hi[3];
+    for (int k = 0; k < 3; k++) {
+        lo[k] = hi[k] = mesh->vertices[0].position[k];
+    }
+    for (auto const &v : mesh->vertices) {
+        for (int k = 0; k < 3; k++) {
+            lo[k] = std::min(lo[k], v.position[k]);
+            hi[k] = std::max(hi[k], v.position[k]);
+        }
+    }
+    float const extent = std::max(std::max(hi[0] - lo[0], hi[1] - lo[1]), hi[2] - lo[2]);
+    float const scale = extent > 0.0f ? 2.0f / extent : 1.0f;
+    for (auto &v : mesh->vertices) {
+        for (int k = 0; k < 3; k++) {
+            v.position[k] = (v.position[k] - 0.5f * (lo[k] + hi[k])) * scale;
+        }
+    }
+}
+
+//--------------------------------------------------------------------------------------
+// OBJ
+//--------------------------------------------------------------------------------------
+
+// Decimal numbers without strtod's locale lookups; exact for up to 18
+// significant digits and exponents within +-22, close enough beyond
+static inline char const *mesh_parse_number(char const *p, char const *end, double *out) {
+    static const double powers[] = {1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+                                    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+    while (p < end && (*p == ' ' || *p == '\t')) {
+        p++;
+    }
+    bool const negative = p < end && *p == '-';
+    if (p < end && (*p == '-' || *p == '+')) {
+        p++;
+    }
+
+    uint64_t mantissa = 0;
+    int exponent = 0;
+    bool digits = false;
+    for (; p < end && *p >= '0' && *p <= '9'; p++, digits = true) {
+        if (mantissa < 100000000000000000ull) {
+            mantissa = mantissa * 10 + (uint64_t)(*p - '0');
+        } else {
+            exponent++;
+        }
+    }
+    if (p < end && *p == '.') {
+        for (p++; p < end && *p >= '0' && *p <= '9'; p++, digits = true) {
+            if (mantissa < 100000000000000000ull) {
+                mantissa = mantissa * 10 + (uint64_t)(*p - '0');
+                exponent--;
+            }
+        }
+    }
+    if (!digits) {
+        return nullptr;
+    }
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        char const *q = p + 1;
+        bool const negative_exponent = q < end && *q == '-';
+        if (q < end && (*q == '-' || *q == '+')) {
+            q++;
+        }
+        int e = 0;
+        bool exponent_digits = false;
+        for (; q < end && *q >= '0' && *q <= '9'; q++, exponent_digits = true) {
+            e = std::min(e * 10 + (*q - '0'), 1000);
+        }
+        if (exponent_digits) {
+            exponent += negative_exponent ? -e : e;
+            p = q;
+        }
+    }
+
+    double value = (double)mantissa;
+    if (exponent >= 0) {
+        value = exponent <= 22 ? value * powers[exponent] : value * pow(10.0, exponent);
+    } else {
+        value = exponent >= -22 ? value / powers[-exponent] : value * pow(10.0, exponent);
+    }
+    *out = negative ? -value : value;
+    return p;
+}
+
+static inline char const *mesh_parse_float(char const *p, char const *end, float *out) {
+    double value;
+    p = mesh_parse_number(p, end, &value);
+    *out = (float)value;
+    return p;
+}
+
+static inline char const *mesh_parse_int(char const *p, char const *end, int64_t *out) {
+    bool const negative = p < end && *p == '-';
+    if (p < end && (*p == '-' || *p == '+')) {
+        p++;
+    }
+    if (p >= end || *p < '0' || *p > '9') {
+        return nullptr;
+    }
+    int64_t value = 0;
+    for (; p < end && *p >= '0' && *p <= '9'; p++) {
+        value = std::min<int64_t>(value * 10 + (*p - '0'), INT32_MAX);
+    }
+    *out = negative ? -value : value;
+    return p;
+}
+
+enum class obj_line { other, position, uv, normal, face };
+
+static inline obj_line mesh_obj_line_kind(char const *&p, char const *end) {
+    while (p < end && (*p == ' ' || *p == '\t')) {
+        p++;
+    }
+    if (end - p < 2) {
+        return obj_line::other;
+    }
+    bool const gap1 = p[1] == ' ' || p[1] == '\t';
+    bool const gap2 = end - p > 2 && (p[2] == ' ' || p[2] == '\t');
+    if (p[0] == 'v' && gap1) {
+        p += 2;
+        return obj_line::position;
+    }
+    if (p[0] == 'v' && p[1] == 't' && gap2) {
+        p += 3;
+        return obj_line::uv;
+    }
+    if (p[0] == 'v' && p[1] == 'n' && gap2) {
+        p += 3;
+        return obj_line::normal;
+    }
+    if (p[0] == 'f' && gap1) {
+        p += 2;
+        return obj_line::face;
+    }
+    return obj_line::other;
+}
+
+struct obj_chunk {
+    char const *begin;
+    char const *end;
+    uint32_t counts[3];  // Positions, uvs, normals in this chunk
+    uint32_t bases[3];   // And in all chunks before it
+    std::vector<int32_t> corners;  // Position, uv, normal index per corner, -1 if absent
+    bool valid;
+};
+
+// Resolves a 1-based or negative OBJ index against the elements seen so far
+static inline int32_t mesh_obj_index(int64_t index, uint32_t seen) {
+    int64_t const resolved = index > 0 ? index - 1 : (int64_t)seen + index;
+    return resolved >= 0 && resolved < (int64_t)seen ? (int32_t)resolved : INT32_MIN;
+}
+
+static inline void mesh_parse_obj_chunk(obj_chunk *chunk, std::vector<float> &positions, std::vector<float> &uvs,
+                                        std::vector<float> &normals) {
+    uint32_t seen[3] = {chunk->bases[0], chunk->bases[1], chunk->bases[2]};
+    chunk->valid = true;
+
+    std::vector<int32_t> polygon;
+    for (char const *line = chunk->begin; line < chunk->end;) {
+        char const *eol = (char const *)memchr(line, '\n', chunk->end - line);
+        eol = eol ? eol : chunk->end;
+        char const *p = line;
+        line = eol + 1;
+
+        switch (mesh_obj_line_kind(p, eol)) {
+            case obj_line::position: {
+                float *out = &positions[seen[0]++ * 3];
+                for (int k = 0; k < 3 && p; k++) {
+                    p = mesh_parse_float(p, eol, &out[k]);
+                }
+                chunk->valid &= p != nullptr;
+                break;
+            }
+            case obj_line::uv: {
+                float *out = &uvs[seen[1]++ * 2];
+                p = mesh_parse_float(p, eol, &out[0]);
+                // v is optional, and OBJ puts its origin at the bottom
+                char const *q = p ? mesh_parse_float(p, eol, &out[1]) : nullptr;
+                out[1] = q ? 1.0f - out[1] : 1.0f;
+                chunk->valid &= p != nullptr;
+                break;
+            }
+            case obj_line::normal: {
+                float *out = &normals[seen[2]++ * 3];
+                for (int k = 0; k < 3 && p; k++) {
+                    p = mesh_parse_float(p, eol, &out[k]);
+                }
+                chunk->valid &= p != nullptr;
+                break;
+            }
+            case obj_line::face: {
+                // v, v/t, v//n or v/t/n per corner
+                polygon.clear();
+                for (;;) {
+                    while (p < eol && (*p == ' ' || *p == '\t' || *p == '\r')) {
+                        p++;
+                    }
+                    if (p >= eol) {
+                        break;
+                    }
+                    int32_t corner[3] = {-1, -1, -1};
+                    for (int k = 0; k < 3; k++) {
+                        int64_t index;
+                        char const *q = mesh_parse_int(p, eol, &index);
+                        if (q) {
+                            corner[k] = mesh_obj_index(index, seen[k]);
+                            chunk->valid &= corner[k] != INT32_MIN;
+                            p = q;
+                        } else if (k == 0) {
+                            chunk->valid = false;
+                            return;
+                        }
+                        if (p >= eol || *p != '/') {
+                            break;
+                        }
+                        p++;
+                    }
+                    polygon.insert(polygon.end(), corner, corner + 3);
+                }
+                size_t const corner_count = polygon.size() / 3;
+                for (size_t i = 1; i + 1 < corner_count; i++) {
+                    chunk->corners.insert(chunk->corners.end(), &polygon[0], &polygon[3]);
+                    chunk->corners.insert(chunk->corners.end(), &polygon[i * 3], &polygon[i * 3 + 6]);
+                }
+                break;
+            }
+            case obj_line::other:
+                break;
+        }
+    }
+}
+
+static inline bool mesh_parse_obj(char const *text, size_t size, job_system &jobs, mesh_data *mesh) {
+    // A few chunks per thread keeps the threads busy when lines differ in cost
+    size_t const chunk_count = std::max<size_t>(1, std::min<size_t>(jobs.thread_count() * 4, size / (64 * 1024)));
+    std::vector<obj_chunk> chunks(chunk_count);
+    char const *const end = text + size;
+    for (size_t i = 0; i < chunk_count; i++) {
+        char const *begin = text + size * i / chunk_count;
+        if (i > 0) {
+            char const *eol = (char const *)memchr(begin, '\n', end - begin);
+            begin = eol ? eol + 1 : end;
+        }
+        chunks[i].begin = std::max(begin, i > 0 ? chunks[i - 1].begin : text);
+    }
+    for (size_t i = 0; i < chunk_count; i++) {
+        chunks[i].end = i + 1 < chunk_count ? chunks[i + 1].begin : end;
+    }
+
+    jobs.run((uint32_t)chunk_count, [&](uint32_t i) {
+        TRACE_ZONE("count obj lines");
+        obj_chunk &chunk = chunks[i];
+        memset(chunk.counts, 0, sizeof(chunk.counts));
+        for (char const *line = chunk.begin; line < chunk.end;) {
+            char const *eol = (char const *)memchr(line, '\n', chunk.end - line);
+            eol = eol ? eol : chunk.end;
+            char const *p = line;
+            obj_line const kind = mesh_obj_line_kind(p, eol);
+            if (kind != obj_line::other && kind != obj_line::face) {
+                chunk.counts[(int)kind - 1]++;
+            }
+            line = eol + 1;
+        }
+    });
+
+    uint32_t totals[3] = {0, 0, 0};
+    for (auto &chunk : chunks) {
+        for (int k = 0; k < 3; k++) {
+            chunk.bases[k] = totals[k];
+            totals[k] += chunk.counts[k];
+        }
+    }
+
+    std::vector<float> positions(totals[0] * 3), uvs(totals[1] * 2), normals(totals[2] * 3);
+    jobs.run((uint32_t)chunk_count, [&](uint32_t i) {
+        TRACE_ZONE("parse obj");
+        mesh_parse_obj_chunk(&chunks[i], positions, uvs, normals);
+    });
+
+    size_t corner_count = 0;
+    std::vector<size_t> firsts(chunk_count);
+    for (size_t i = 0; i < chunk_count; i++) {
+        if (!chunks[i].valid) {
+            return false;
+        }
+        firsts[i] = corner_count;
+        corner_count += chunks[i].corners.size() / 3;
+    }
+
+    // Every corner becomes a vertex of its own; welding sorts them out
+    mesh->vertices.resize(corner_count);
+    mesh->indices.resize(corner_count);
+    jobs.run((uint32_t)chunk_count, [&](uint32_t i) {
+        std::vector<int32_t> const &corners = chunks[i].corners;
+        for (size_t c = 0; c < corners.size() / 3; c++) {
+            mesh_vertex &v = mesh->vertices[firsts[i] + c];
+            int32_t const *corner = &corners[c * 3];
+            memcpy(v.position, &positions[corner[0] * 3], sizeof(v.position));
+            if (corner[1] >= 0) {
+                memcpy(v.uv, &uvs[corner[1] * 2], sizeof(v.uv));
+            } else {
+                v.uv[0] = v.uv[1] = 0.0f;
+            }
+            if (corner[2] >= 0) {
+                memcpy(v.normal, &normals[corner[2] * 3], sizeof(v.normal));
+            } else {
+                v.normal[0] = v.normal[1] = v.normal[2] = 0.0f;
+            }
+            mesh->indices[firsts[i] + c] = (uint32_t)(firsts[i] + c);
+        }
+    });
+    return true;
+}
+
+//--------------------------------------------------------------------------------------
+// glTF binary
+//--------------------------------------------------------------------------------------
+
+// Just enough JSON for a glTF document
+struct json_value {
+    enum class kind { null, boolean, number, string, array, object };
+
+    kind type = kind::null;
+    double number = 0.0;
+    std::string string;
+    std::vector<json_value> items;  // Array elements, or object values
+    std::vector<std::string> keys;  // Object keys, one per item
+
+    json_value const *find(char const *key) const {
+        for (size_t i = 0; i < keys.size(); i++) {
+            if (keys[i] == key) {
+                return &items[i];
+            }
+        }
+        return nullptr;
+    }
+
+    double get(char const *key, double fallback) const {
+        json_value const *value = find(key);
+        return value && value->type == kind::number ? value->number : fallback;
+    }
+};
+
+class json_parser {
+   public:
+    json_parser(char const *text, size_t size) : p(text), end(text + size) {}
+
+    bool parse(json_value *value, int depth = 0) {
+        skip_space();
+        if (p >= end || depth > 64) {
+            return false;
+        }
+        switch (*p) {
+            case '{': {
+                value->type = json_value::kind::object;
+                p++;
+                skip_space();
+                if (p < end && *p == '}') {
+                    p++;
+                    return true;
+                }
+                for (;;) {
+                    value->keys.emplace_back();
+                    value->items.emplace_back();
+                    skip_space();
+                    if (!parse_string(&value->keys.back())) {
+                        return false;
+                    }
+                    skip_space();
+                    if (p >= end || *p++ != ':' || !parse(&value->items.back(), depth + 1)) {
+                        return false;
+                    }
+                    skip_space();
+                    if (p < end && *p == ',') {
+                        p++;
+                        continue;
+                    }
+                    return p < end && *p++ == '}';
+                }
+            }
+            case '[': {
+                value->type = json_value::kind::array;
+                p++;
+                skip_space();
+                if (p < end && *p == ']') {
+                    p++;
+                    return true;
+                }
+                for (;;) {
+                    value->items.emplace_back();
+                    if (!parse(&value->items.back(), depth + 1)) {
+                        return false;
+                    }
+                    skip_space();
+                    if (p < end && *p == ',') {
+                        p++;
+                        continue;
+                    }
+                    return p < end && *p++ == ']';
+                }
+            }
+            case '"':
+                value->type = json_value::kind::string;
+                return parse_string(&value->string);
+            case 't':
+            case 'f':
+            case 'n': {
+                static char const *const words[] = {"true", "false", "null"};
+                for (char const *word : words) {
+                    size_t const length = strlen(word);
+                    if ((size_t)(end - p) >= length && memcmp(p, word, length) == 0) {
+                        value->type = word[0] == 'n' ? json_value::kind::null : json_value::kind::boolean;
+                        value->number = word[0] == 't' ? 1.0 : 0.0;
+                        p += length;
+                        return true;
+                    }
+                }
+                return false;
+            }
+            default: {
+                double number;
+                char const *q = mesh_parse_number(p, end, &number);
+                if (!q) {
+                    return false;
+                }
+                value->type = json_value::kind::number;
+                value->number = number;
+                p = q;
+                return true;
+            }
+        }
+    }
+
+   private:
+    void skip_space() {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')) {
+            p++;
+        }
+    }
+
+    // Escapes other than \uXXXX are decoded, which is all glTF keys need
+    bool parse_string(std::string *out) {
+        if (p >= end || *p != '"') {
+            return false;
+        }
+        for (p++; p < end && *p != '"'; p++) {
+            if (*p != '\\') {
+                out->push_back(*p);
+                continue;
+            }
+            if (++p >= end) {
+                return false;
+            }
+            switch (*p) {
+                case 'n': out->push_back('\n'); break;
+                case 't': out->push_back('\t'); break;
+                case 'r': out->push_back('\r'); break;
+                case 'b': out->push_back('\b'); break;
+                case 'f': out->push_back('\f'); break;
+                case 'u':
+                    out->push_back('?');
+                    p += std::min<ptrdiff_t>(4, end - p - 1);
+                    break;
+                default: out->push_back(*p); break;
+            }
+        }
+        return p < end && *p++ == '"';
+    }
+
+    char const *p;
+    char const *end;
+};
+
+struct gltf_accessor {
+    uint8_t const *data;
+    size_t stride;
+    uint32_t count;
+    uint32_t component_type;
+    uint32_t components;
+    bool normalized;
+};
+
+static inline uint32_t gltf_component_size(uint32_t component_type) {
+    switch (component_type) {
+        case 5120:  // BYTE
+        case 5121:  // UNSIGNED_BYTE
+            return 1;
+        case 5122:  // SHORT
+        case 5123:  // UNSIGNED_SHORT
+            return 2;
+        case 5125:  // UNSIGNED_INT
+        case 5126:  // FLOAT
+            return 4;
+        default:
+            return 0;
+    }
+}
+
+// Locates accessor index in the binary chunk, checking that all of it is there
+static inline bool gltf_find_accessor(json_value const &doc, double index, uint8_t const *bin, size_t bin_size,
+                                      gltf_accessor *out) {
+    json_value const *accessors = doc.find("accessors");
+    json_value const *views = doc.find("bufferViews");
+    if (!accessors || !views || index < 0 || index >= accessors->items.size()) {
+        return false;
+    }
+    json_value const &accessor = accessors->items[(size_t)index];
+    double const view_index = accessor.get("bufferView", -1.0);
+    if (view_index < 0 || view_index >= views->items.size() || accessor.find("sparse")) {
+        return false;
+    }
+    json_value const &view = views->items[(size_t)view_index];
+    if (view.get("buffer", 0.0) != 0.0) {
+        return false;  // Only the GLB's own buffer
+    }
+
+    json_value const *type = accessor.find("type");
+    static char const *const types[] = {"SCALAR", "VEC2", "VEC3", "VEC4"};
+    out->components = 0;
+    for (uint32_t i = 0; i < 4; i++) {
+        if (type && type->string == types[i]) {
+            out->components = i + 1;
+        }
+    }
+    out->component_type = (uint32_t)accessor.get("componentType", 0.0);
+    out->count = (uint32_t)accessor.get("count", 0.0);
+    json_value const *normalized = accessor.find("normalized");
+    out->normalized = normalized && normalized->number != 0.0;
+
+    size_t const element_size = gltf_component_size(out->component_type) * out->components;
+    size_t const view_offset = (size_t)view.get("byteOffset", 0.0);
+    size_t const view_length = (size_t)view.get("byteLength", 0.0);
+    size_t const offset = (size_t)accessor.get("byteOffset", 0.0);
+    out->stride = (size_t)view.get("byteStride", (double)element_size);
+    if (element_size == 0 || out->count == 0 || out->stride < element_size || view_offset > bin_size ||
+        view_length > bin_size - view_offset || offset + out->stride * (out->count - 1) + element_size > view_length) {
+        return false;
+    }
+    out->data = bin + view_offset + offset;
+    return true;
+}
+
+static inline float gltf_read_float(gltf_accessor const &a, uint32_t element, uint32_t component) {
+    uint8_t const *p = a.data + element * a.stride + component * gltf_component_size(a.component_type);
+    switch (a.component_type) {
+        case 5126: {
+            float f;
+            memcpy(&f, p, sizeof(f));
+            return f;
+        }
+        case 5121:
+            return a.normalized ? *p / 255.0f : *p;
+        case 5120:
+            return a.normalized ? std::max(*(int8_t const *)p / 127.0f, -1.0f) : *(int8_t const *)p;
+        case 5123: {
+            uint16_t v;
+            memcpy(&v, p, sizeof(v));
+            return a.normalized ? v / 65535.0f : v;
+        }
+        case 5122: {
+            int16_t v;
+            memcpy(&v, p, sizeof(v));
+            return a.normalized ? std::max(v / 32767.0f, -1.0f) : v;
+        }
+        default: {
+            uint32_t v;
+            memcpy(&v, p, sizeof(v));
+            return (float)v;
+        }
+    }
+}
+
+static inline uint32_t gltf_read_index(gltf_accessor const &a, uint32_t element) {
+    uint8_t const *p = a.data + element * a.stride;
+    switch (a.component_type) {
+        case 5121:
+            return *p;
+        case 5123: {
+            uint16_t v;
+            memcpy(&v, p, sizeof(v));
+            return v;
+        }
+        default: {
+            uint32_t v;
+            memcpy(&v, p, sizeof(v));
+            return v;
+        }
+    }
+}
+
+static inline bool mesh_decode_gltf_primitive(json_value const &doc, json_value const &primitive, uint8_t const *bin,
+                                              size_t bin_size, mesh_data *out) {
+    json_value const *attributes = primitive.find("attributes");
+    gltf_accessor positions, normals, uvs, indices;
+    if (!attributes || !gltf_find_accessor(doc, attributes->get("POSITION", -1.0), bin, bin_size, &positions) ||
+        positions.components != 3 || positions.component_type != 5126) {
+        return false;
+    }
+    bool const has_normals = gltf_find_accessor(doc, attributes->get("NORMAL", -1.0), bin, bin_size, &normals) &&
+                             normals.components == 3 && normals.count == positions.count;
+    bool const has_uvs = gltf_find_accessor(doc, attributes->get("TEXCOORD_0", -1.0), bin, bin_size, &uvs) &&
+                         uvs.components == 2 && uvs.count == positions.count;
+
+    out->vertices.resize(positions.count);
+    for (uint32_t i = 0; i < positions.count; i++) {
+        mesh_vertex &v = out->vertices[i];
+        for (uint32_t k = 0; k < 3; k++) {
+            v.position[k] = gltf_read_float(positions, i, k);
+            v.normal[k] = has_normals ? gltf_read_float(normals, i, k) : 0.0f;
+        }
+        for (uint32_t k = 0; k < 2; k++) {
+            v.uv[k] = has_uvs ? gltf_read_float(uvs, i, k) : 0.0f;
+        }
+    }
+
+    if (primitive.find("indices")) {
+        if (!gltf_find_accessor(doc, primitive.get("indices", -1.0), bin, bin_size, &indices) || indices.components != 1 ||
+            indices.component_type == 5126) {
+            return false;
+        }
+        out->indices.resize(indices.count / 3 * 3);
+        for (uint32_t i = 0; i < out->indices.size(); i++) {
+            out->indices[i] = gltf_read_index(indices, i);
+            if (out->indices[i] >= positions.count) {
+                return false;
+            }
+        }
+    } else {
+        out->indices.resize(positions.count / 3 * 3);
+        for (uint32_t i = 0; i < out->indices.size(); i++) {
+            out->indices[i] = i;
+        }
+    }
+    return true;
+}
+
+static inline bool mesh_parse_glb(uint8_t const *data, size_t size, job_system &jobs, mesh_data *mesh) {
+    // 12-byte header, then the JSON chunk and usually one binary chunk
+    uint32_t header[5];
+    if (size < sizeof(header)) {
+        return false;
+    }
+    memcpy(header, data, sizeof(header));
+    if (header[1] != 2 || header[2] > size || header[4] != 0x4e4f534a || header[3] > size - sizeof(header)) {
+        fprintf(stderr, "Only glTF 2.0 binaries with a JSON chunk are supported\n");
+        return false;
+    }
+    char const *json = (char const *)data + sizeof(header);
+    size_t const json_size = header[3];
+
+    uint8_t const *bin = nullptr;
+    size_t bin_size = 0;
+    size_t const bin_header = sizeof(header) + ((json_size + 3) & ~(size_t)3);
+    if (bin_header + 8 <= size) {
+        uint32_t chunk[2];
+        memcpy(chunk, data + bin_header, sizeof(chunk));
+        if (chunk[1] == 0x004e4942 && chunk[0] <= size - bin_header - 8) {
+            bin = data + bin_header + 8;
+            bin_size = chunk[0];
+        }
+    }
+
+    json_value doc;
+    json_parser parser(json, json_size);
+    if (!parser.parse(&doc) || doc.type != json_value::kind::object) {
+        fprintf(stderr, "Malformed glTF JSON\n");
+        return false;
+    }
+
+    // Triangle lists only (mode 4, the default)
+    std::vector<json_value const *> primitives;
+    if (json_value const *meshes = doc.find("meshes")) {
+        for (auto const &m : meshes->items) {
+            if (json_value const *list = m.find("primitives")) {
+                for (auto const &primitive : list->items) {
+                    if (primitive.get("mode", 4.0) == 4.0) {
+                        primitives.push_back(&primitive);
+                    }
+                }
+            }
+        }
+    }
+
+    std::vector<mesh_data> parts(primitives.size());
+    std::vector<char> decoded(primitives.size(), 0);
+    jobs.run((uint32_t)primitives.size(), [&](uint32_t i) {
+        TRACE_ZONE("decode gltf primitive");
+        decoded[i] = mesh_decode_gltf_primitive(doc, *primitives[i], bin, bin_size, &parts[i]);
+    });
+
+    for (size_t i = 0; i < parts.size(); i++) {
+        if (!decoded[i]) {
+            fprintf(stderr, "Skipping glTF primitive %zu: unsupported or out of bounds\n", i);
+            continue;
+        }
+        uint32_t const base = (uint32_t)mesh->vertices.size();
+        mesh->vertices.insert(mesh->vertices.end(), parts[i].vertices.begin(), parts[i].vertices.end());
+        for (uint32_t index : parts[i].indices) {
+            mesh->indices.push_back(base + index);
+        }
+    }
+    return true;
+}
+
+//--------------------------------------------------------------------------------------
+// Entry point
+//--------------------------------------------------------------------------------------
+
+static inline bool mesh_load(char const *filename, job_system &jobs, mesh_data *mesh, mesh_stats *stats) {
+    TRACE_ZONE("load mesh");
+    typedef std::chrono::steady_clock clock;
+    auto const ms = [](clock::time_point a, clock::time_point b) {
+        return std::chrono::duration<double, std::milli>(b - a).count();
+    };
+
+    *stats = {};
+    stats->threads = jobs.thread_count();
+    mesh->vertices.clear();
+    mesh->indices.clear();
+
+    auto const t_start = clock::now();
+    mapped_file file;
+    if (!file.open(filename)) {
+        fprintf(stderr, "Cannot open %s\n", filename);
+        return false;
+    }
+    bool const glb = file.size() >= 4 && memcmp(file.data(), "glTF", 4) == 0;
+    bool const parsed = glb ? mesh_parse_glb(file.data(), file.size(), jobs, mesh)
+                            : mesh_parse_obj((char const *)file.data(), file.size(), jobs, mesh);
+    if (!parsed || mesh->indices.empty()) {
+        fprintf(stderr, "%s: no triangles could be read\n", filename);
+        return false;
+    }
+    stats->corners = (uint32_t)mesh->indices.size();
+
+    auto const t_parsed = clock::now();
+    mesh_weld(mesh);
+    if (mesh->indices.empty()) {
+        fprintf(stderr, "%s: every triangle is degenerate\n", filename);
+        return false;
+    }
+    stats->acmr_before = mesh_acmr(mesh->indices, mesh->vertices.size());
+
+    auto const t_welded = clock::now();
+    {
+        TRACE_ZONE("optimize mesh");
+        mesh_optimize_vertex_cache(mesh->indices, mesh->vertices.size());
+        mesh_optimize_overdraw(mesh->indices, mesh->vertices, 1.05f);
+        mesh_optimize_vertex_fetch(mesh);
+    }
+    auto const t_optimized = clock::now();
+
+    mesh_fit_unit_cube(mesh);
+
+    stats->vertices = (uint32_t)mesh->vertices.size();
+    stats->triangles = (uint32_t)(mesh->indices.size() / 3);
+    stats->acmr_after = mesh_acmr(mesh->indices, mesh->vertices.size());
+    stats->atvr_after = stats->acmr_after * stats->triangles / stats->vertices;
+    stats->parse_ms = ms(t_start, t_parsed);
+    stats->weld_ms = ms(t_parsed, t_welded);
+    stats->optimize_ms = ms(t_welded, t_optimized);
+    return true;
+}
+
+#endif  // MESH_LOADER_H
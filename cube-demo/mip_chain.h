@@ -0,0 +1,111 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Mip chains of RGBA8 images on the CPU.
+//
+// Level i is max(1, width >> i) by max(1, height >> i), as Vulkan sizes
+// them.  Each texel of a level is the rounded average of the 2x2 block
+// under it in the level above; along a dimension that is already 1 only
+// two texels are averaged, and an odd last row or column is dropped, like a
+// linear blit would.  The 2x2 case runs 4 output texels at a time with SSE2
+// (part of x86-64), and bands of rows of large levels go to several
+// threads.
+
+#ifndef MIP_CHAIN_H
+#define MIP_CHAIN_H
+
+#include <algorithm>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define MIP_CHAIN_SSE2 1
+#include <emmintrin.h>
+#endif
+
+static inline uint32_t mip_level_count(uint32_t width, uint32_t height) {
+    uint32_t levels = 1;
+    for (uint32_t size = std::max(width, height); size > 1; size >>= 1) {
+        levels++;
+    }
+    return levels;
+}
+
+static inline uint32_t mip_extent(uint32_t size, uint32_t level) { return std::max(1u, size >> level); }
+
+static inline void mip_downsample_rows(uint8_t const *src, size_t src_pitch, uint32_t src_width, uint32_t src_height, uint8_t *dst,
+                                       size_t dst_pitch, uint32_t dst_width, uint32_t first, uint32_t end) {
+    uint32_t const dx = src_width > 1 ? 1 : 0;
+    uint32_t const dy = src_height > 1 ? 1 : 0;
+
+    for (uint32_t y = first; y < end; y++) {
+        uint8_t const *row0 = src + (size_t)(2 * y) * src_pitch;
+        uint8_t const *row1 = row0 + dy * src_pitch;
+        uint8_t *out = dst + (size_t)y * dst_pitch;
+        uint32_t x = 0;
+
+#if defined(MIP_CHAIN_SSE2)
+        if (dx && dy) {
+            __m128i const zero = _mm_setzero_si128();
+            __m128i const round = _mm_set1_epi16(2);
+            for (; x + 4 <= dst_width; x += 4) {
+                __m128i t[2];
+                for (int half = 0; half < 2; half++) {
+                    // Four source texels of each row: two output texels
+                    __m128i const a = _mm_loadu_si128((__m128i const *)(row0 + 8 * x + 16 * half));
+                    __m128i const b = _mm_loadu_si128((__m128i const *)(row1 + 8 * x + 16 * half));
+                    __m128i const lo = _mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero));
+                    __m128i const hi = _mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero));
+                    __m128i const sum = _mm_add_epi16(_mm_unpacklo_epi64(lo, hi), _mm_unpackhi_epi64(lo, hi));
+                    t[half] = _mm_srli_epi16(_mm_add_epi16(sum, round), 2);
+                }
+                _mm_storeu_si128((__m128i *)(out + 4 * x), _mm_packus_epi16(t[0], t[1]));
+            }
+        }
+#endif
+
+        for (; x < dst_width; x++) {
+            uint8_t const *p = row0 + 8 * x;
+            for (int c = 0; c < 4; c++) {
+                uint32_t const sum = p[c] + p[4 * dx + c] + row1[8 * x + c] + row1[8 * x + 4 * dx + c];
+                out[4 * x + c] = (uint8_t)((sum + 2) >> 2);
+            }
+        }
+    }
+}
+
+// Writes the level below src into dst.  Bands of rows go to up to max_threads
+// threads, the caller included, but none smaller than about a megabyte.
+static inline void mip_downsample(uint8_t const *src, size_t src_pitch, uint32_t src_width, uint32_t src_height, uint8_t *dst,
+                                  size_t dst_pitch, uint32_t max_threads) {
+    uint32_t const dst_width = std::max(1u, src_width >> 1);
+    uint32_t const dst_height = std::max(1u, src_height >> 1);
+
+    uint64_t const bytes = (uint64_t)src_width * src_height * 4;
+    uint32_t const bands = (uint32_t)std::max<uint64_t>(1, std::min<uint64_t>(std::min<uint64_t>(max_threads, bytes >> 20), dst_height));
+
+    std::vector<std::thread> threads;
+    for (uint32_t band = 1; band < bands; band++) {
+        uint32_t const first = (uint32_t)((uint64_t)dst_height * band / bands);
+        uint32_t const end = (uint32_t)((uint64_t)dst_height * (band + 1) / bands);
+        threads.emplace_back(mip_downsample_rows, src, src_pitch, src_width, src_height, dst, dst_pitch, dst_width, first, end);
+    }
+    mip_downsample_rows(src, src_pitch, src_width, src_height, dst, dst_pitch, dst_width, 0, dst_height / bands);
+    for (auto &thread : threads) {
+        thread.join();
+    }
+}
+
+#endif  // MIP_CHAIN_H
@@ -0,0 +1,488 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Graphics pipelines compiled in the background and looked up by content.
+//
+// A graphics_pipeline_desc holds the state that varies between the demo's
+// pipelines; everything else is fixed.  request() expands it into the full
+// vk::GraphicsPipelineCreateInfo and hashes every field the create-info
+// points at, so two requests share a pipeline exactly when they would have
+// created the same one.  A new key is queued for the worker threads and
+// returned at once; asking again while it compiles, from any thread, only
+// returns the same key.
+//
+// The workers compile against one vk::PipelineCache.  Pipeline creation is
+// internally synchronized on the cache, so they need no lock around it.
+//
+// Rendering never waits for a compile: get(key, fallback) hands out the
+// fallback until the requested pipeline is ready (or if it failed).  Only
+// wait() blocks, for the first pipeline there is nothing to fall back to.
+//
+// Shader modules, layouts and render passes in a desc must outlive the
+// compile; pipelines live until stop().  Include vulkan.hpp (with
+// VULKAN_HPP_NO_EXCEPTIONS) before this header.
+
+#ifndef PIPELINE_REGISTRY_H
+#define PIPELINE_REGISTRY_H
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <initializer_list>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "trace.h"
+
+struct graphics_pipeline_desc {
+    vk::ShaderModule vertex_shader;
+    vk::ShaderModule fragment_shader;
+    std::vector<vk::VertexInputBindingDescription> vertex_bindings;
+    std::vector<vk::VertexInputAttributeDescription> vertex_attributes;
+    vk::PrimitiveTopology topology = vk::PrimitiveTopology::eTriangleList;
+    vk::PolygonMode polygon_mode = vk::PolygonMode::eFill;
+    vk::CullModeFlags cull_mode = vk::CullModeFlagBits::eBack;
+    vk::FrontFace front_face = vk::FrontFace::eCounterClockwise;
+    bool depth_test = true;
+    bool depth_write = true;
+    vk::CompareOp depth_compare = vk::CompareOp::eLessOrEqual;
+    vk::PipelineLayout layout;
+    vk::RenderPass render_pass;
+};
+
+// The create-info for a desc, with everything it points to.  Not copyable,
+// the pointers are into itself.
+struct graphics_pipeline_state {
+    explicit graphics_pipeline_state(graphics_pipeline_desc const &desc) {
+        stages[0] = vk::PipelineShaderStageCreateInfo()
+                        .setStage(vk::ShaderStageFlagBits::eVertex)
+                        .setModule(desc.vertex_shader)
+                        .setPName("main");
+        stages[1] = vk::PipelineShaderStageCreateInfo()
+                        .setStage(vk::ShaderStageFlagBits::eFragment)
+                        .setModule(desc.fragment_shader)
+                        .setPName("main");
+
+        vertex_input = vk::PipelineVertexInputStateCreateInfo()
+                           .setVertexBindingDescriptionCount((uint32_t)desc.vertex_bindings.size())
+                           .setPVertexBindingDescriptions(desc.vertex_bindings.data())
+                           .setVertexAttributeDescriptionCount((uint32_t)desc.vertex_attributes.size())
+                           .setPVertexAttributeDescriptions(desc.vertex_attributes.data());
+
+        input_assembly = vk::PipelineInputAssemblyStateCreateInfo().setTopology(desc.topology);
+
+        // Viewport and scissor are dynamic, so a resize needs no new pipeline
+        viewport = vk::PipelineViewportStateCreateInfo().setViewportCount(1).setScissorCount(1);
+
+        rasterization = vk::PipelineRasterizationStateCreateInfo()
+                            .setDepthClampEnable(VK_FALSE)
+                            .setRasterizerDiscardEnable(VK_FALSE)
+                            .setPolygonMode(desc.polygon_mode)
+                            .setCullMode(desc.cull_mode)
+                            .setFrontFace(desc.front_face)
+                            .setDepthBiasEnable(VK_FALSE)
+                            .setLineWidth(1.0f);
+
+        auto const stencil_op = vk::StencilOpState()
+                                    .setFailOp(vk::StencilOp::eKeep)
+                                    .setPassOp(vk::StencilOp::eKeep)
+                                    .setCompareOp(vk::CompareOp::eAlways);
+
+        depth_stencil = vk::PipelineDepthStencilStateCreateInfo()
+                            .setDepthTestEnable(desc.depth_test)
+                            .setDepthWriteEnable(desc.depth_write)
+                            .setDepthCompareOp(desc.depth_compare)
+                            .setDepthBoundsTestEnable(VK_FALSE)
+                            .setStencilTestEnable(VK_FALSE)
+                            .setFront(stencil_op)
+                            .setBack(stencil_op);
+
+        blend_attachment = vk::PipelineColorBlendAttachmentState().setColorWriteMask(
+            vk::ColorComponentFlagBits::eR | vk::ColorComponentFlagBits::eG | vk::ColorComponentFlagBits::eB |
+            vk::ColorComponentFlagBits::eA);
+        color_blend = vk::PipelineColorBlendStateCreateInfo().setAttachmentCount(1).setPAttachments(&blend_attachment);
+
+        dynamic_states[0] = vk::DynamicState::eViewport;
+        dynamic_states[1] = vk::DynamicState::eScissor;
+        dynamic = vk::PipelineDynamicStateCreateInfo().setPDynamicStates(dynamic_states).setDynamicStateCount(2);
+
+        info = vk::GraphicsPipelineCreateInfo()
+                   .setStageCount(2)
+                   .setPStages(stages)
+                   .setPVertexInputState(&vertex_input)
+                   .setPInputAssemblyState(&input_assembly)
+                   .setPViewportState(&viewport)
+                   .setPRasterizationState(&rasterization)
+                   .setPMultisampleState(&multisample)
+                   .setPDepthStencilState(&depth_stencil)
+                   .setPColorBlendState(&color_blend)
+                   .setPDynamicState(&dynamic)
+                   .setLayout(desc.layout)
+                   .setRenderPass(desc.render_pass);
+    }
+
+    graphics_pipeline_state(graphics_pipeline_state const &) = delete;
+    graphics_pipeline_state &operator=(graphics_pipeline_state const &) = delete;
+
+    vk::PipelineShaderStageCreateInfo stages[2];
+    vk::PipelineVertexInputStateCreateInfo vertex_input;
+    vk::PipelineInputAssemblyStateCreateInfo input_assembly;
+    vk::PipelineViewportStateCreateInfo viewport;
+    vk::PipelineRasterizationStateCreateInfo rasterization;
+    vk::PipelineMultisampleStateCreateInfo multisample;
+    vk::PipelineDepthStencilStateCreateInfo depth_stencil;
+    vk::PipelineColorBlendAttachmentState blend_attachment;
+    vk::PipelineColorBlendStateCreateInfo color_blend;
+    vk::DynamicState dynamic_states[2];
+    vk::PipelineDynamicStateCreateInfo dynamic;
+    vk::GraphicsPipelineCreateInfo info;
+};
+
+// FNV-1a over the fields of a create-info and what it points at.  Fields are
+// hashed one by one, never whole structs, so padding and pNext pointers do
+// not leak into the key.
+class pipeline_hasher {
+   public:
+    template <typename T>
+    void add(T const &value) {
+        bytes(&value, sizeof(value));
+    }
+
+    void add_string(char const *s) {
+        bytes(s, s ? strlen(s) + 1 : 0);
+    }
+
+    void add(vk::GraphicsPipelineCreateInfo const &info) {
+        add(info.flags);
+        add(info.stageCount);
+        for (uint32_t i = 0; i < info.stageCount; i++) {
+            auto const &stage = info.pStages[i];
+            add(stage.flags);
+            add(stage.stage);
+            add(stage.module);
+            add_string(stage.pName);
+            if (stage.pSpecializationInfo) {
+                auto const &spec = *stage.pSpecializationInfo;
+                for (uint32_t j = 0; j < spec.mapEntryCount; j++) {
+                    add(spec.pMapEntries[j].constantID);
+                    add(spec.pMapEntries[j].offset);
+                    add(spec.pMapEntries[j].size);
+                }
+                bytes(spec.pData, spec.dataSize);
+            }
+        }
+        if (auto const *s = info.pVertexInputState) {
+            for (uint32_t i = 0; i < s->vertexBindingDescriptionCount; i++) {
+                add(s->pVertexBindingDescriptions[i].binding);
+                add(s->pVertexBindingDescriptions[i].stride);
+                add(s->pVertexBindingDescriptions[i].inputRate);
+            }
+            for (uint32_t i = 0; i < s->vertexAttributeDescriptionCount; i++) {
+                add(s->pVertexAttributeDescriptions[i].location);
+                add(s->pVertexAttributeDescriptions[i].binding);
+                add(s->pVertexAttributeDescriptions[i].format);
+                add(s->pVertexAttributeDescriptions[i].offset);
+            }
+        }
+        if (auto const *s = info.pInputAssemblyState) {
+            add(s->topology);
+            add(s->primitiveRestartEnable);
+        }
+        if (auto const *s = info.pTessellationState) {
+            add(s->patchControlPoints);
+        }
+        if (auto const *s = info.pViewportState) {
+            add(s->viewportCount);
+            add(s->scissorCount);
+        }
+        if (auto const *s = info.pRasterizationState) {
+            add(s->depthClampEnable);
+            add(s->rasterizerDiscardEnable);
+            add(s->polygonMode);
+            add(s->cullMode);
+            add(s->frontFace);
+            add(s->depthBiasEnable);
+            add(s->depthBiasConstantFactor);
+            add(s->depthBiasClamp);
+            add(s->depthBiasSlopeFactor);
+            add(s->lineWidth);
+        }
+        if (auto const *s = info.pMultisampleState) {
+            add(s->rasterizationSamples);
+            add(s->sampleShadingEnable);
+            add(s->minSampleShading);
+            add(s->alphaToCoverageEnable);
+            add(s->alphaToOneEnable);
+        }
+        if (auto const *s = info.pDepthStencilState) {
+            add(s->depthTestEnable);
+            add(s->depthWriteEnable);
+            add(s->depthCompareOp);
+            add(s->depthBoundsTestEnable);
+            add(s->stencilTestEnable);
+            for (auto const *op : {&s->front, &s->back}) {
+                add(op->failOp);
+                add(op->passOp);
+                add(op->depthFailOp);
+                add(op->compareOp);
+                add(op->compareMask);
+                add(op->writeMask);
+                add(op->reference);
+            }
+            add(s->minDepthBounds);
+            add(s->maxDepthBounds);
+        }
+        if (auto const *s = info.pColorBlendState) {
+            add(s->logicOpEnable);
+            add(s->logicOp);
+            for (uint32_t i = 0; i < s->attachmentCount; i++) {
+                auto const &a = s->pAttachments[i];
+                add(a.blendEnable);
+                add(a.srcColorBlendFactor);
+                add(a.dstColorBlendFactor);
+                add(a.colorBlendOp);
+                add(a.srcAlphaBlendFactor);
+                add(a.dstAlphaBlendFactor);
+                add(a.alphaBlendOp);
+                add(a.colorWriteMask);
+            }
+            add(s->blendConstants);
+        }
+        if (auto const *s = info.pDynamicState) {
+            for (uint32_t i = 0; i < s->dynamicStateCount; i++) {
+                add(s->pDynamicStates[i]);
+            }
+        }
+        add(info.layout);
+        add(info.renderPass);
+        add(info.subpass);
+    }
+
+    uint64_t value() const { return hash; }
+
+   private:
+    void bytes(void const *data, size_t size) {
+        auto const *p = static_cast<uint8_t const *>(data);
+        for (size_t i = 0; i < size; i++) {
+            hash = (hash ^ p[i]) * 0x100000001b3ull;
+        }
+    }
+
+    uint64_t hash = 0xcbf29ce484222325ull;
+};
+
+class pipeline_registry {
+   public:
+    ~pipeline_registry() { stop(); }
+
+    void start(vk::Device device, vk::PipelineCache cache, uint32_t worker_count) {
+        this->device = device;
+        this->cache = cache;
+        quit = false;
+        for (uint32_t i = 0; i < std::max(worker_count, 1u); i++) {
+            workers.emplace_back(&pipeline_registry::worker_main, this);
+        }
+    }
+
+    // Waits for the compiles in flight, drops the queued ones and destroys
+    // every pipeline; only once no command buffer uses them any more
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            quit = true;
+        }
+        wake.notify_all();
+        for (auto &worker : workers) {
+            worker.join();
+        }
+        workers.clear();
+
+        for (auto &it : entries) {
+            device.destroyPipeline(it.second->pipeline, nullptr);
+        }
+        entries.clear();
+        queue.clear();
+        compiled_count = 0;
+        compile_total_ms = 0.0;
+    }
+
+    // The key of the pipeline for desc, queueing its compile if it is new
+    uint64_t request(graphics_pipeline_desc const &desc) {
+        graphics_pipeline_state const state(desc);
+        pipeline_hasher hasher;
+        hasher.add(state.info);
+        uint64_t const key = hasher.value();
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto &entry = entries[key];
+            if (entry) {
+                return key;
+            }
+            entry.reset(new pipeline_entry{desc, vk::Pipeline(), status::queued, 0.0});
+            queue.push_back(key);
+        }
+        wake.notify_one();
+        return key;
+    }
+
+    // The key for key's desc with shader module from swapped for to, queueing
+    // the rebuild; key itself if its pipeline does not use from
+    uint64_t replace_shader(uint64_t key, vk::ShaderModule from, vk::ShaderModule to) {
+        graphics_pipeline_desc desc;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto const it = entries.find(key);
+            if (it == entries.end()) {
+                return key;
+            }
+            desc = it->second->desc;
+        }
+        if (desc.vertex_shader != from && desc.fragment_shader != from) {
+            return key;
+        }
+        if (desc.vertex_shader == from) {
+            desc.vertex_shader = to;
+        }
+        if (desc.fragment_shader == from) {
+            desc.fragment_shader = to;
+        }
+        return request(desc);
+    }
+
+    // The pipeline for key, or for fallback while key is not ready; null if
+    // neither is
+    vk::Pipeline get(uint64_t key, uint64_t fallback) {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (uint64_t k : {key, fallback}) {
+            auto const it = entries.find(k);
+            if (it != entries.end() && it->second->state == status::ready) {
+                return it->second->pipeline;
+            }
+        }
+        return vk::Pipeline();
+    }
+
+    bool ready(uint64_t key) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto const it = entries.find(key);
+        return it != entries.end() && it->second->state == status::ready;
+    }
+
+    // Blocks until key has been compiled; null if that failed
+    vk::Pipeline wait(uint64_t key) {
+        std::unique_lock<std::mutex> lock(mutex);
+        auto const it = entries.find(key);
+        if (it == entries.end()) {
+            return vk::Pipeline();
+        }
+        pipeline_entry const &entry = *it->second;
+        done.wait(lock, [&] { return entry.state == status::ready || entry.state == status::failed; });
+        return entry.pipeline;
+    }
+
+    // How long the compile of key took on its worker, negative until it is ready
+    double compile_ms(uint64_t key) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto const it = entries.find(key);
+        return it != entries.end() && it->second->state == status::ready ? it->second->ms : -1.0;
+    }
+
+    uint32_t compiled() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return compiled_count;
+    }
+
+    double total_compile_ms() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return compile_total_ms;
+    }
+
+    uint32_t worker_count() const { return (uint32_t)workers.size(); }
+
+   private:
+    enum class status { queued, compiling, ready, failed };
+
+    struct pipeline_entry {
+        graphics_pipeline_desc desc;
+        vk::Pipeline pipeline;
+        status state;
+        double ms;
+    };
+
+    void worker_main() {
+        TRACE_THREAD("pipeline compiler");
+        for (;;) {
+            pipeline_entry *entry;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [this] { return quit || !queue.empty(); });
+                if (quit) {
+                    return;
+                }
+                entry = entries[queue.front()].get();
+                queue.pop_front();
+                entry->state = status::compiling;
+            }
+
+            // Entries are only removed by stop(), after the workers are gone
+            vk::Pipeline pipeline;
+            auto const start = std::chrono::steady_clock::now();
+            vk::Result result;
+            {
+                TRACE_ZONE("compile pipeline");
+                graphics_pipeline_state const state(entry->desc);
+                result = device.createGraphicsPipelines(cache, 1, &state.info, nullptr, &pipeline);
+            }
+            double const ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            if (result != vk::Result::eSuccess) {
+                fprintf(stderr, "Pipeline compile failed: %s, keeping the fallback\n", vk::to_string(result).c_str());
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                entry->pipeline = pipeline;
+                entry->state = result == vk::Result::eSuccess ? status::ready : status::failed;
+                entry->ms = ms;
+                if (result == vk::Result::eSuccess) {
+                    compiled_count++;
+                    compile_total_ms += ms;
+                }
+            }
+            done.notify_all();
+        }
+    }
+
+    vk::Device device;
+    vk::PipelineCache cache;
+
+    std::mutex mutex;
+    std::condition_variable wake;  // Work was queued, or quit
+    std::condition_variable done;  // A compile finished
+    std::unordered_map<uint64_t, std::unique_ptr<pipeline_entry>> entries;
+    std::deque<uint64_t> queue;
+    std::vector<std::thread> workers;
+    bool quit = false;
+    uint32_t compiled_count = 0;
+    double compile_total_ms = 0.0;
+};
+
+#endif  // PIPELINE_REGISTRY_H
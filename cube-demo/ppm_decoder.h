@@ -0,0 +1,479 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Binary PPM (P6, maxval 255) decoding to RGBA8.
+//
+// The file is memory mapped once; the header is parsed in place and the
+// RGB texels are expanded to RGBA straight from the mapping into the
+// destination, typically mapped staging memory, with rows any pitch apart.
+//
+// Kernels:
+//  - scalar: portable reference.
+//  - ssse3: one pshufb turns 12 RGB bytes into 4 RGBA pixels.
+//  - avx2: the same on two 128-bit lanes, 8 pixels per shuffle.
+// The vector kernels never read past the end of a row, so the last row is
+// safe at the very end of the mapping.  Large images are split into bands of
+// rows decoded on several threads.
+
+#ifndef PPM_DECODER_H
+#define PPM_DECODER_H
+
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#if defined(_WIN32)
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define PPM_DECODER_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(PPM_DECODER_X86) && (defined(__GNUC__) || defined(__clang__))
+#define PPM_DECODER_SSSE3_TARGET __attribute__((target("ssse3")))
+#define PPM_DECODER_AVX2_TARGET __attribute__((target("avx2")))
+#else
+#define PPM_DECODER_SSSE3_TARGET
+#define PPM_DECODER_AVX2_TARGET
+#endif
+
+// A read-only view of a whole file
+class mapped_file {
+   public:
+    mapped_file() = default;
+    mapped_file(mapped_file const &) = delete;
+    mapped_file &operator=(mapped_file const &) = delete;
+    ~mapped_file() { close(); }
+
+    bool open(char const *filename) {
+        close();
+#if defined(_WIN32)
+        file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (file == INVALID_HANDLE_VALUE) {
+            return false;
+        }
+        LARGE_INTEGER file_size;
+        if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0) {
+            close();
+            return false;
+        }
+        mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (!mapping) {
+            close();
+            return false;
+        }
+        bytes = (uint8_t const *)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        if (!bytes) {
+            close();
+            return false;
+        }
+        length = (size_t)file_size.QuadPart;
+#else
+        int const fd = ::open(filename, O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size == 0) {
+            ::close(fd);
+            return false;
+        }
+        void *const view = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (view == MAP_FAILED) {
+            return false;
+        }
+        // The texels are read front to back exactly once
+        madvise(view, (size_t)st.st_size, MADV_SEQUENTIAL);
+        bytes = (uint8_t const *)view;
+        length = (size_t)st.st_size;
+#endif
+        return true;
+    }
+
+    void close() {
+#if defined(_WIN32)
+        if (bytes) {
+            UnmapViewOfFile(bytes);
+        }
+        if (mapping) {
+            CloseHandle(mapping);
+        }
+        if (file != INVALID_HANDLE_VALUE) {
+            CloseHandle(file);
+        }
+        mapping = nullptr;
+        file = INVALID_HANDLE_VALUE;
+#else
+        if (bytes) {
+            munmap((void *)bytes, length);
+        }
+#endif
+        bytes = nullptr;
+        length = 0;
+    }
+
+    uint8_t const *data() const { return bytes; }
+    size_t size() const { return length; }
+
+   private:
+    uint8_t const *bytes{nullptr};
+    size_t length{0};
+#if defined(_WIN32)
+    HANDLE file{INVALID_HANDLE_VALUE};
+    HANDLE mapping{nullptr};
+#endif
+};
+
+struct ppm_image {
+    int32_t width{0};
+    int32_t height{0};
+    uint8_t const *texels{nullptr};  // width * height * 3 bytes of RGB
+};
+
+// Parses a P6 header in place.  Comments may appear between any two fields.
+static inline bool ppm_parse(uint8_t const *data, size_t size, ppm_image *image) {
+    size_t pos = 0;
+    if (size < 2 || data[0] != 'P' || data[1] != '6') {
+        return false;
+    }
+    pos = 2;
+
+    int64_t fields[3];
+    for (int i = 0; i < 3; i++) {
+        for (;;) {
+            if (pos >= size) {
+                return false;
+            }
+            if (data[pos] == '#') {
+                while (pos < size && data[pos] != '\n') {
+                    pos++;
+                }
+            } else if (data[pos] == ' ' || data[pos] == '\t' || data[pos] == '\n' || data[pos] == '\r') {
+                pos++;
+            } else {
+                break;
+            }
+        }
+
+        if (data[pos] < '0' || data[pos] > '9') {
+            return false;
+        }
+        fields[i] = 0;
+        while (pos < size && data[pos] >= '0' && data[pos] <= '9' && fields[i] <= INT32_MAX) {
+            fields[i] = fields[i] * 10 + (data[pos] - '0');
+            pos++;
+        }
+    }
+
+    // Exactly one whitespace byte separates the header from the texels
+    if (pos >= size || fields[0] <= 0 || fields[1] <= 0 || fields[0] > INT32_MAX || fields[1] > INT32_MAX || fields[2] != 255) {
+        return false;
+    }
+    pos++;
+
+    if ((uint64_t)fields[0] * (uint64_t)fields[1] * 3 > size - pos) {
+        return false;
+    }
+
+    image->width = (int32_t)fields[0];
+    image->height = (int32_t)fields[1];
+    image->texels = data + pos;
+    return true;
+}
+
+enum class ppm_kernel { scalar, ssse3, avx2 };
+
+static inline char const *ppm_kernel_name(ppm_kernel kernel) {
+    switch (kernel) {
+        case ppm_kernel::ssse3:
+            return "ssse3";
+        case ppm_kernel::avx2:
+            return "avx2";
+        default:
+            return "scalar";
+    }
+}
+
+static inline bool ppm_kernel_supported(ppm_kernel kernel) {
+    switch (kernel) {
+        case ppm_kernel::scalar:
+            return true;
+#if defined(PPM_DECODER_X86) && (defined(__GNUC__) || defined(__clang__))
+        case ppm_kernel::ssse3:
+            return __builtin_cpu_supports("ssse3");
+        case ppm_kernel::avx2:
+            return __builtin_cpu_supports("avx2");
+#elif defined(PPM_DECODER_X86) && defined(_MSC_VER)
+        case ppm_kernel::ssse3: {
+            int info[4];
+            __cpuid(info, 1);
+            return (info[2] & (1 << 9)) != 0;
+        }
+        case ppm_kernel::avx2: {
+            int info[4];
+            __cpuid(info, 1);
+            bool const osxsave = (info[2] & (1 << 27)) != 0;
+            __cpuidex(info, 7, 0);
+            bool const avx2 = (info[1] & (1 << 5)) != 0;
+            // The OS must also save the YMM registers
+            return avx2 && osxsave && (_xgetbv(0) & 6) == 6;
+        }
+#endif
+        default:
+            return false;
+    }
+}
+
+static inline ppm_kernel ppm_best_kernel() {
+    if (ppm_kernel_supported(ppm_kernel::avx2)) {
+        return ppm_kernel::avx2;
+    }
+    if (ppm_kernel_supported(ppm_kernel::ssse3)) {
+        return ppm_kernel::ssse3;
+    }
+    return ppm_kernel::scalar;
+}
+
+static inline void ppm_expand_row_scalar(uint8_t const *src, uint8_t *dst, int32_t first, int32_t width) {
+    for (int32_t x = first; x < width; x++) {
+        dst[4 * x + 0] = src[3 * x + 0];
+        dst[4 * x + 1] = src[3 * x + 1];
+        dst[4 * x + 2] = src[3 * x + 2];
+        dst[4 * x + 3] = 255;
+    }
+}
+
+#if defined(PPM_DECODER_X86)
+
+// RGB RGB RGB RGB (xxxx) -> RGBA RGBA RGBA RGBA, the alpha bytes zeroed and then set
+#define PPM_DECODER_SHUFFLE 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1
+
+PPM_DECODER_SSSE3_TARGET static inline void ppm_expand_row_ssse3(uint8_t const *src, uint8_t *dst, int32_t width) {
+    __m128i const shuffle = _mm_setr_epi8(PPM_DECODER_SHUFFLE);
+    __m128i const alpha = _mm_set1_epi32((int)0xff000000);
+
+    // Each 16-byte load uses 12 bytes; the last one must end inside the row
+    int32_t x = 0;
+    for (; x + 18 <= width; x += 16) {
+        __m128i const a = _mm_loadu_si128((__m128i const *)(src + 3 * x + 0));
+        __m128i const b = _mm_loadu_si128((__m128i const *)(src + 3 * x + 12));
+        __m128i const c = _mm_loadu_si128((__m128i const *)(src + 3 * x + 24));
+        __m128i const d = _mm_loadu_si128((__m128i const *)(src + 3 * x + 36));
+        _mm_storeu_si128((__m128i *)(dst + 4 * x + 0), _mm_or_si128(_mm_shuffle_epi8(a, shuffle), alpha));
+        _mm_storeu_si128((__m128i *)(dst + 4 * x + 16), _mm_or_si128(_mm_shuffle_epi8(b, shuffle), alpha));
+        _mm_storeu_si128((__m128i *)(dst + 4 * x + 32), _mm_or_si128(_mm_shuffle_epi8(c, shuffle), alpha));
+        _mm_storeu_si128((__m128i *)(dst + 4 * x + 48), _mm_or_si128(_mm_shuffle_epi8(d, shuffle), alpha));
+    }
+    for (; x + 6 <= width; x += 4) {
+        __m128i const a = _mm_loadu_si128((__m128i const *)(src + 3 * x));
+        _mm_storeu_si128((__m128i *)(dst + 4 * x), _mm_or_si128(_mm_shuffle_epi8(a, shuffle), alpha));
+    }
+    ppm_expand_row_scalar(src, dst, x, width);
+}
+
+PPM_DECODER_AVX2_TARGET static inline void ppm_expand_row_avx2(uint8_t const *src, uint8_t *dst, int32_t width) {
+    __m256i const shuffle = _mm256_setr_epi8(PPM_DECODER_SHUFFLE, PPM_DECODER_SHUFFLE);
+    __m256i const alpha = _mm256_set1_epi32((int)0xff000000);
+
+    // Lane 0 gets pixels x..x+3, lane 1 pixels x+4..x+7
+    int32_t x = 0;
+    for (; x + 18 <= width; x += 16) {
+        __m256i const a = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((__m128i const *)(src + 3 * x + 0))),
+                                                  _mm_loadu_si128((__m128i const *)(src + 3 * x + 12)), 1);
+        __m256i const b = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((__m128i const *)(src + 3 * x + 24))),
+                                                  _mm_loadu_si128((__m128i const *)(src + 3 * x + 36)), 1);
+        _mm256_storeu_si256((__m256i *)(dst + 4 * x + 0), _mm256_or_si256(_mm256_shuffle_epi8(a, shuffle), alpha));
+        _mm256_storeu_si256((__m256i *)(dst + 4 * x + 32), _mm256_or_si256(_mm256_shuffle_epi8(b, shuffle), alpha));
+    }
+    for (; x + 10 <= width; x += 8) {
+        __m256i const a = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((__m128i const *)(src + 3 * x + 0))),
+                                                  _mm_loadu_si128((__m128i const *)(src + 3 * x + 12)), 1);
+        _mm256_storeu_si256((__m256i *)(dst + 4 * x), _mm256_or_si256(_mm256_shuffle_epi8(a, shuffle), alpha));
+    }
+    ppm_expand_row_scalar(src, dst, x, width);
+}
+
+#undef PPM_DECODER_SHUFFLE
+
+#endif  // PPM_DECODER_X86
+
+static inline void ppm_expand_rows(ppm_kernel kernel, ppm_image const &image, int32_t first, int32_t end, uint8_t *dst,
+                                   size_t row_pitch) {
+    size_t const src_pitch = (size_t)image.width * 3;
+    for (int32_t y = first; y < end; y++) {
+        uint8_t const *src = image.texels + y * src_pitch;
+        uint8_t *row = dst + y * row_pitch;
+        switch (kernel) {
+#if defined(PPM_DECODER_X86)
+            case ppm_kernel::avx2:
+                ppm_expand_row_avx2(src, row, image.width);
+                break;
+            case ppm_kernel::ssse3:
+                ppm_expand_row_ssse3(src, row, image.width);
+                break;
+#endif
+            default:
+                ppm_expand_row_scalar(src, row, 0, image.width);
+                break;
+        }
+    }
+}
+
+// Writes the image as RGBA8 rows row_pitch bytes apart.  Bands of rows go to
+// up to max_threads threads, the caller included, but no band is smaller
+// than about a megabyte: below that starting a thread costs more than it saves.
+static inline void ppm_decode(ppm_image const &image, uint8_t *dst, size_t row_pitch, ppm_kernel kernel, uint32_t max_threads) {
+    if (!ppm_kernel_supported(kernel)) {
+        kernel = ppm_kernel::scalar;
+    }
+
+    uint64_t const bytes = (uint64_t)image.width * image.height * 4;
+    uint32_t const bands = (uint32_t)std::max<uint64_t>(1, std::min<uint64_t>(std::min<uint64_t>(max_threads, bytes >> 20), image.height));
+
+    std::vector<std::thread> threads;
+    for (uint32_t band = 1; band < bands; band++) {
+        int32_t const first = (int32_t)((uint64_t)image.height * band / bands);
+        int32_t const end = (int32_t)((uint64_t)image.height * (band + 1) / bands);
+        threads.emplace_back(ppm_expand_rows, kernel, std::cref(image), first, end, dst, row_pitch);
+    }
+    ppm_expand_rows(kernel, image, 0, (int32_t)(image.height / bands), dst, row_pitch);
+    for (auto &thread : threads) {
+        thread.join();
+    }
+}
+
+// The decoder this replaces: a stdio read per pixel.  Kept for the benchmark.
+static inline bool ppm_decode_fread(char const *filename, uint8_t *dst, size_t row_pitch) {
+    FILE *file = fopen(filename, "rb");
+    if (!file) {
+        return false;
+    }
+
+    char header[256];
+    int32_t width = 0, height = 0;
+    if (!fgets(header, sizeof(header), file) || strncmp(header, "P6\n", 3)) {
+        fclose(file);
+        return false;
+    }
+    do {
+        if (!fgets(header, sizeof(header), file)) {
+            fclose(file);
+            return false;
+        }
+    } while (header[0] == '#');
+    sscanf(header, "%" SCNd32 " %" SCNd32, &width, &height);
+    if (!fgets(header, sizeof(header), file) || strncmp(header, "255\n", 3)) {
+        fclose(file);
+        return false;
+    }
+
+    for (int32_t y = 0; y < height; y++) {
+        uint8_t *row = dst + y * row_pitch;
+        for (int32_t x = 0; x < width; x++) {
+            size_t s = fread(row, 3, 1, file);
+            (void)s;
+            row[3] = 255;
+            row += 4;
+        }
+    }
+
+    fclose(file);
+    return true;
+}
+
+// Decodes filename with the old loop and with every supported kernel, on
+// one thread and on `threads`, and prints the throughput in MB/s of RGBA
+// output.  The results are checked against the old loop.
+static inline bool ppm_decode_benchmark(FILE *out, char const *filename, uint32_t threads) {
+    typedef std::chrono::steady_clock clock;
+
+    mapped_file file;
+    ppm_image image;
+    if (!file.open(filename) || !ppm_parse(file.data(), file.size(), &image)) {
+        fprintf(out, "Cannot decode %s as a binary PPM\n", filename);
+        return false;
+    }
+
+    // Pad rows the way a linear image's subresource layout might
+    size_t const row_pitch = ((size_t)image.width * 4 + 255) / 256 * 256;
+    size_t const size = row_pitch * image.height;
+    double const megabytes = (double)image.width * image.height * 4 / (1024.0 * 1024.0);
+    std::vector<uint8_t> reference(size), output(size);
+
+    fprintf(out, "PPM decode, %s, %" PRId32 "x%" PRId32 ":\n", filename, image.width, image.height);
+    fprintf(out, "  %-8s %8s %12s %10s\n", "kernel", "threads", "MB/s", "speedup");
+
+    auto start = clock::now();
+    ppm_decode_fread(filename, reference.data(), row_pitch);
+    double const fread_seconds = std::chrono::duration<double>(clock::now() - start).count();
+    fprintf(out, "  %-8s %8u %12.1f %9.2fx\n", "fread", 1u, megabytes / fread_seconds, 1.0);
+
+    bool matches = true;
+    ppm_kernel const kernels[] = {ppm_kernel::scalar, ppm_kernel::ssse3, ppm_kernel::avx2};
+    for (auto kernel : kernels) {
+        if (!ppm_kernel_supported(kernel)) {
+            fprintf(out, "  %-8s %8s\n", ppm_kernel_name(kernel), "unsupported");
+            continue;
+        }
+
+        for (uint32_t thread_count : {1u, std::max(threads, 1u)}) {
+            // Repeat until enough time has passed to be measurable
+            uint32_t iterations = 0;
+            double seconds = 0.0;
+            start = clock::now();
+            do {
+                ppm_decode(image, output.data(), row_pitch, kernel, thread_count);
+                iterations++;
+                seconds = std::chrono::duration<double>(clock::now() - start).count();
+            } while (seconds < 0.25);
+
+            double const rate = megabytes * iterations / seconds;
+            fprintf(out, "  %-8s %8u %12.1f %9.2fx\n", ppm_kernel_name(kernel), thread_count, rate,
+                    rate / (megabytes / fread_seconds));
+
+            for (int32_t y = 0; y < image.height; y++) {
+                matches = matches && memcmp(&reference[y * row_pitch], &output[y * row_pitch], (size_t)image.width * 4) == 0;
+            }
+            if (thread_count == std::max(threads, 1u)) {
+                break;
+            }
+        }
+    }
+
+    if (!matches) {
+        fprintf(out, "  MISMATCH against the fread loop\n");
+    }
+    return matches;
+}
+
+#endif  // PPM_DECODER_H
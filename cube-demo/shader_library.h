@@ -0,0 +1,273 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// SPIR-V shader modules loaded from files and cached by content.
+//
+// load() reads a .spv file, or takes the words compiled into the binary when
+// the file is not there, and hands back the vk::ShaderModule for that code.
+// Modules are keyed by a 64-bit FNV-1a hash of the words, so the same code
+// is only ever turned into one module however many paths or reloads lead to
+// it.  Modules live until destroy(): pipelines keyed on a module stay valid,
+// and reverting an edit finds both the module and its pipelines again.
+//
+// With watching enabled (Linux only), the directory of every loaded path is
+// watched with inotify.  poll() is non-blocking and meant to be called once
+// per frame; it rereads the files that were written or moved into place since
+// the last call and returns those whose code changed, with the module they
+// had and the one they have now.  Files that do not hold valid SPIR-V, e.g.
+// while a compiler is still writing them, are skipped and keep their module.
+//
+// Not thread safe.  Include vulkan.hpp (with VULKAN_HPP_NO_EXCEPTIONS) before
+// this header.
+
+#ifndef SHADER_LIBRARY_H
+#define SHADER_LIBRARY_H
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#if defined(__linux__)
+#define SHADER_LIBRARY_INOTIFY 1
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+class shader_library {
+   public:
+    struct change {
+        std::string path;
+        vk::ShaderModule old_module;
+        vk::ShaderModule new_module;
+    };
+
+    ~shader_library() { destroy(); }
+
+    // Returns false if watch was asked for but is not available
+    bool init(vk::Device device, bool watch) {
+        this->device = device;
+#ifdef SHADER_LIBRARY_INOTIFY
+        if (watch) {
+            notify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+            if (notify_fd < 0) {
+                perror("inotify_init1");
+                return false;
+            }
+        }
+        return true;
+#else
+        return !watch;
+#endif
+    }
+
+    void destroy() {
+        for (auto &it : modules) {
+            device.destroyShaderModule(it.second, nullptr);
+        }
+        modules.clear();
+        sources.clear();
+        watched_dirs.clear();
+#ifdef SHADER_LIBRARY_INOTIFY
+        if (notify_fd >= 0) {
+            close(notify_fd);
+            notify_fd = -1;
+        }
+#endif
+    }
+
+    // The module for the code in path, or for fallback when the file cannot
+    // be read; null if there is neither.  A path loaded before is reread.
+    vk::ShaderModule load(char const *path, uint32_t const *fallback, size_t fallback_size) {
+        std::vector<uint32_t> code;
+        if (!read_spirv(path, code)) {
+            if (!fallback) {
+                return vk::ShaderModule();
+            }
+            code.assign(fallback, fallback + fallback_size / sizeof(uint32_t));
+            embedded_loads++;
+        }
+
+        uint64_t const hash = hash_code(code);
+        vk::ShaderModule const module = module_for(hash, code);
+        for (auto &s : sources) {
+            if (s.path == path) {
+                s.hash = hash;
+                s.module = module;
+                return module;
+            }
+        }
+        sources.push_back({path, hash, module});
+        watch(path);
+        return module;
+    }
+
+    // The watched files whose code changed since the last call
+    std::vector<change> poll() {
+        std::vector<change> changes;
+#ifdef SHADER_LIBRARY_INOTIFY
+        if (notify_fd < 0) {
+            return changes;
+        }
+
+        alignas(inotify_event) char buffer[4096];
+        for (;;) {
+            ssize_t const size = read(notify_fd, buffer, sizeof(buffer));
+            if (size <= 0) {
+                break;  // EAGAIN: nothing more pending
+            }
+            for (ssize_t offset = 0; offset < size;) {
+                auto const *event = (inotify_event const *)(buffer + offset);
+                offset += sizeof(inotify_event) + event->len;
+                if (event->len == 0) {
+                    continue;
+                }
+                auto const dir = watched_dirs.find(event->wd);
+                if (dir == watched_dirs.end()) {
+                    continue;
+                }
+                std::string const path = dir->second + event->name;
+                for (auto &s : sources) {
+                    if (s.path == path || (dir->second == "./" && s.path == event->name)) {
+                        reload(s, changes);
+                    }
+                }
+            }
+        }
+#endif
+        return changes;
+    }
+
+    bool watching() const {
+#ifdef SHADER_LIBRARY_INOTIFY
+        return notify_fd >= 0;
+#else
+        return false;
+#endif
+    }
+
+    uint32_t module_count() const { return (uint32_t)modules.size(); }
+    uint32_t cache_hits() const { return hits; }
+    uint32_t reload_count() const { return reloads; }
+    uint32_t embedded_count() const { return embedded_loads; }
+
+    static bool read_spirv(char const *path, std::vector<uint32_t> &code) {
+        FILE *file = fopen(path, "rb");
+        if (!file) {
+            return false;
+        }
+
+        fseek(file, 0, SEEK_END);
+        long const size = ftell(file);
+        fseek(file, 0, SEEK_SET);
+
+        // SPIR-V is a stream of 32-bit words starting with the magic number
+        bool valid = size > 0 && size % sizeof(uint32_t) == 0;
+        if (valid) {
+            code.resize(size / sizeof(uint32_t));
+            valid = fread(code.data(), size, 1, file) == 1 && code[0] == 0x07230203;
+        }
+
+        fclose(file);
+        return valid;
+    }
+
+   private:
+    struct source {
+        std::string path;
+        uint64_t hash;
+        vk::ShaderModule module;
+    };
+
+    static uint64_t hash_code(std::vector<uint32_t> const &code) {
+        uint64_t hash = 0xcbf29ce484222325ull;
+        for (uint32_t word : code) {
+            hash = (hash ^ word) * 0x100000001b3ull;
+        }
+        return hash ^ code.size();
+    }
+
+    vk::ShaderModule module_for(uint64_t hash, std::vector<uint32_t> const &code) {
+        auto &module = modules[hash];
+        if (module) {
+            hits++;
+            return module;
+        }
+
+        auto const info = vk::ShaderModuleCreateInfo().setCodeSize(code.size() * sizeof(uint32_t)).setPCode(code.data());
+        auto const result = device.createShaderModule(&info, nullptr, &module);
+        if (result != vk::Result::eSuccess) {
+            fprintf(stderr, "Cannot create a shader module: %s\n", vk::to_string(result).c_str());
+            modules.erase(hash);
+            return vk::ShaderModule();
+        }
+        return module;
+    }
+
+    void reload(source &s, std::vector<change> &changes) {
+        std::vector<uint32_t> code;
+        if (!read_spirv(s.path.c_str(), code)) {
+            return;
+        }
+        uint64_t const hash = hash_code(code);
+        if (hash == s.hash) {
+            return;
+        }
+        vk::ShaderModule const module = module_for(hash, code);
+        if (!module) {
+            return;
+        }
+        changes.push_back({s.path, s.module, module});
+        s.hash = hash;
+        s.module = module;
+        reloads++;
+    }
+
+    void watch(std::string const &path) {
+#ifdef SHADER_LIBRARY_INOTIFY
+        if (notify_fd < 0) {
+            return;
+        }
+        // Compilers usually write a new file and rename it over the old one,
+        // so the directory is watched rather than the file
+        size_t const slash = path.rfind('/');
+        std::string const dir = slash == std::string::npos ? "./" : path.substr(0, slash + 1);
+        for (auto const &it : watched_dirs) {
+            if (it.second == dir) {
+                return;
+            }
+        }
+        int const wd = inotify_add_watch(notify_fd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+        if (wd < 0) {
+            perror(dir.c_str());
+            return;
+        }
+        watched_dirs[wd] = dir;
+#else
+        (void)path;
+#endif
+    }
+
+    vk::Device device;
+    std::unordered_map<uint64_t, vk::ShaderModule> modules;
+    std::vector<source> sources;
+    std::unordered_map<int, std::string> watched_dirs;
+    int notify_fd = -1;
+    uint32_t hits = 0;
+    uint32_t reloads = 0;
+    uint32_t embedded_loads = 0;
+};
+
+#endif  // SHADER_LIBRARY_H
@@ -0,0 +1,137 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Offline converter from PPM to block-compressed KTX2 textures that the
+// cube demo streams as they are:
+//
+//   texconv [--format {bc1,bc7,rgba8}] [--threads <count>] [--no_mips] <in.ppm> <out.ktx2>
+//
+// The mip chain is made with the same box filter the demo uses at load time
+// and every level is encoded on all cores.  Needs no Vulkan:
+//
+//   g++ -O2 -o texconv texconv.cpp -pthread
+
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include "bc_encoder.h"
+#include "ktx2.h"
+#include "mip_chain.h"
+#include "ppm_decoder.h"
+
+static void usage(char const *name) {
+    fprintf(stderr, "Usage:\n  %s [--format {bc1,bc7,rgba8}] [--threads <count>] [--no_mips] <in.ppm> <out.ktx2>\n", name);
+    exit(1);
+}
+
+int main(int argc, char **argv) {
+    char const *format_name = "bc7";
+    uint32_t threads = std::max(1u, std::thread::hardware_concurrency());
+    bool mips = true;
+    char const *files[2] = {nullptr, nullptr};
+    int file_count = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--format") == 0 && i < argc - 1) {
+            format_name = argv[++i];
+        } else if (strcmp(argv[i], "--threads") == 0 && i < argc - 1 && sscanf(argv[i + 1], "%" SCNu32, &threads) == 1 &&
+                   threads > 0) {
+            i++;
+        } else if (strcmp(argv[i], "--no_mips") == 0) {
+            mips = false;
+        } else if (argv[i][0] != '-' && file_count < 2) {
+            files[file_count++] = argv[i];
+        } else {
+            usage(argv[0]);
+        }
+    }
+    if (file_count != 2) {
+        usage(argv[0]);
+    }
+
+    uint32_t format;
+    bc_format encoding = bc_format::bc7;
+    if (strcmp(format_name, "bc1") == 0) {
+        format = ktx2_format_bc1_rgb_unorm;
+        encoding = bc_format::bc1;
+    } else if (strcmp(format_name, "bc7") == 0) {
+        format = ktx2_format_bc7_unorm;
+    } else if (strcmp(format_name, "rgba8") == 0) {
+        format = ktx2_format_rgba8_unorm;
+    } else {
+        usage(argv[0]);
+    }
+
+    mapped_file file;
+    ppm_image image;
+    if (!file.open(files[0]) || !ppm_parse(file.data(), file.size(), &image)) {
+        fprintf(stderr, "Cannot read %s as a binary PPM\n", files[0]);
+        return 1;
+    }
+
+    auto const start = std::chrono::steady_clock::now();
+
+    uint32_t const width = (uint32_t)image.width;
+    uint32_t const height = (uint32_t)image.height;
+    uint32_t const levels = mips ? std::min(mip_level_count(width, height), KTX2_MAX_LEVELS) : 1;
+
+    // Every level as tightly packed RGBA8
+    std::vector<std::vector<uint8_t>> rgba(levels);
+    rgba[0].resize((size_t)width * height * 4);
+    ppm_decode(image, rgba[0].data(), (size_t)width * 4, ppm_best_kernel(), threads);
+    for (uint32_t level = 1; level < levels; level++) {
+        uint32_t const w = mip_extent(width, level - 1);
+        uint32_t const h = mip_extent(height, level - 1);
+        rgba[level].resize((size_t)mip_extent(w, 1) * mip_extent(h, 1) * 4);
+        mip_downsample(rgba[level - 1].data(), (size_t)w * 4, w, h, rgba[level].data(), (size_t)mip_extent(w, 1) * 4, threads);
+    }
+
+    std::vector<std::vector<uint8_t>> encoded(levels);
+    std::vector<uint8_t const *> level_data(levels);
+    uint64_t rgba_bytes = 0, encoded_bytes = 0;
+    for (uint32_t level = 0; level < levels; level++) {
+        rgba_bytes += rgba[level].size();
+        if (format == ktx2_format_rgba8_unorm) {
+            level_data[level] = rgba[level].data();
+        } else {
+            encoded[level].resize((size_t)ktx2_level_size(format, width, height, level));
+            bc_encode(encoding, rgba[level].data(), (size_t)mip_extent(width, level) * 4, mip_extent(width, level),
+                      mip_extent(height, level), encoded[level].data(), threads);
+            level_data[level] = encoded[level].data();
+        }
+        encoded_bytes += ktx2_level_size(format, width, height, level);
+    }
+
+    double const ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    FILE *out = fopen(files[1], "wb");
+    bool const pass = out && ktx2_write(out, format, width, height, levels, level_data.data());
+    if (out) {
+        fclose(out);
+    }
+    if (!pass) {
+        fprintf(stderr, "Cannot write %s\n", files[1]);
+        return 1;
+    }
+
+    printf("%s: %" PRIu32 "x%" PRIu32 ", %" PRIu32 " levels, %s, %" PRIu64 " bytes (%.2fx smaller than RGBA8), %.3f ms on %" PRIu32
+           " threads\n",
+           files[1], width, height, levels, format_name, encoded_bytes, (double)rgba_bytes / encoded_bytes, ms, threads);
+    return 0;
+}
@@ -0,0 +1,753 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Uploads textures in the background while frames keep rendering.
+//
+// request() queues a file.  A loader thread opens it with the decoder, which
+// reserves space for the texels in a persistently mapped staging ring once it
+// knows the size and decodes straight into it, so nothing is copied on the
+// CPU.  The render thread calls poll() once per
+// frame: it records the copies of whatever has been decoded into one batch
+// on the transfer queue, and hands back the textures of batches that have
+// finished.  Nothing ever blocks on the GPU except flush().
+//
+// Completion is tracked like a timeline: every batch gets the next value of
+// a counter, and completed() is the highest value whose fence has signaled.
+// Batches retire in order, which frees their part of the ring.  A finished
+// batch also leaves a signaled semaphore that the first graphics submission
+// sampling its textures must wait on; this makes the copies visible to the
+// graphics queue even when the transfer queue is a different family.  Once
+// that submission has completed the semaphore goes back through
+// release_semaphores().
+//
+// Images are created with concurrent sharing when the two queue families
+// differ, so no ownership transfers are needed, and arrive in
+// eShaderReadOnlyOptimal.
+//
+// Decoders may also hand over block-compressed textures (BC1, BC3, BC7) with
+// their levels already made; those are copied as they are.
+//
+// RGBA8 textures get a full mip chain unless init() is told otherwise.  The levels
+// are blitted on the GPU with linear filtering when the streaming queue can
+// do graphics work and RGBA8 supports it; otherwise the loader threads box
+// filter them into the ring behind level 0 and every level is copied.  A
+// dedicated transfer queue cannot blit, so it always takes the CPU path.
+//
+// Everything except the loader threads must be called from one thread.
+// Include vulkan.hpp (with VULKAN_HPP_NO_EXCEPTIONS) and device_allocator.h
+// before this header.
+
+#ifndef TEXTURE_STREAMER_H
+#define TEXTURE_STREAMER_H
+
+#include <algorithm>
+#include <cinttypes>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "mip_chain.h"
+#include "trace.h"
+
+// A texture whose upload has completed; the caller now owns the image
+struct streamed_texture {
+    uint32_t id;
+    vk::Image image;
+    device_allocation alloc;
+    int32_t width;
+    int32_t height;
+    uint32_t mip_levels;
+    vk::Format format;
+};
+
+// Bytes per block and block edge in texels of the formats that can be
+// streamed; 0 bytes for the rest
+static inline uint32_t texture_block_bytes(vk::Format format, uint32_t *block_dim) {
+    *block_dim = 4;
+    switch (format) {
+        case vk::Format::eR8G8B8A8Unorm:
+            *block_dim = 1;
+            return 4;
+        case vk::Format::eBc1RgbUnormBlock:
+        case vk::Format::eBc1RgbSrgbBlock:
+        case vk::Format::eBc1RgbaUnormBlock:
+        case vk::Format::eBc1RgbaSrgbBlock:
+            return 8;
+        case vk::Format::eBc3UnormBlock:
+        case vk::Format::eBc3SrgbBlock:
+        case vk::Format::eBc7UnormBlock:
+        case vk::Format::eBc7SrgbBlock:
+            return 16;
+        default:
+            return 0;
+    }
+}
+
+static inline vk::DeviceSize texture_level_size(vk::Format format, int32_t width, int32_t height, uint32_t level) {
+    uint32_t block_dim;
+    uint32_t const block_bytes = texture_block_bytes(format, &block_dim);
+    vk::DeviceSize const w = mip_extent((uint32_t)width, level);
+    vk::DeviceSize const h = mip_extent((uint32_t)height, level);
+    return (w + block_dim - 1) / block_dim * ((h + block_dim - 1) / block_dim) * block_bytes;
+}
+
+// How mip levels below 0 are made
+enum class mip_generation { none, gpu_blit, cpu_box };
+
+static inline char const *mip_generation_name(mip_generation generation) {
+    switch (generation) {
+        case mip_generation::gpu_blit:
+            return "gpu_blit";
+        case mip_generation::cpu_box:
+            return "cpu_box";
+        default:
+            return "none";
+    }
+}
+
+class texture_streamer {
+   public:
+    // Hands out the destination of a width x height texture of `levels`
+    // levels, tightly packed largest first, with the rows of level 0
+    // *row_pitch bytes apart.  An RGBA8 texture of one level gets the rest
+    // of its chain from the streamer.  Null if the texture cannot be taken.
+    typedef std::function<uint8_t *(int32_t width, int32_t height, vk::Format format, uint32_t levels, vk::DeviceSize *row_pitch)>
+        reserver;
+
+    // Opens filename, reserves room for it and decodes it there, in one pass.
+    // Called on the loader threads.
+    typedef std::function<bool(char const *filename, reserver const &reserve)> decoder;
+
+    static vk::DeviceSize const DEFAULT_RING_SIZE = 16ull * 1024 * 1024;
+    static uint32_t const MAX_BATCHES = 4;
+
+    ~texture_streamer() { stop_loaders(); }
+
+    bool init(vk::PhysicalDevice gpu, vk::Device device, device_allocator *allocator, vk::Queue queue, uint32_t queue_family,
+              uint32_t graphics_queue_family, uint32_t loader_count, decoder const &decode, bool mipmaps = true,
+              vk::DeviceSize ring_size = DEFAULT_RING_SIZE) {
+        this->device = device;
+        this->allocator = allocator;
+        this->queue = queue;
+        this->queue_family = queue_family;
+        this->graphics_queue_family = graphics_queue_family;
+        this->decode = decode;
+        this->ring_size = ring_size;
+
+        vk::PhysicalDeviceProperties props;
+        gpu.getProperties(&props);
+        // Also a multiple of every block size, as copies of compressed levels need
+        copy_alignment = std::max<vk::DeviceSize>(props.limits.optimalBufferCopyOffsetAlignment, 16);
+
+        generation = mip_generation::none;
+        if (mipmaps) {
+            uint32_t family_count = 0;
+            gpu.getQueueFamilyProperties(&family_count, nullptr);
+            std::vector<vk::QueueFamilyProperties> families(family_count);
+            gpu.getQueueFamilyProperties(&family_count, families.data());
+
+            vk::FormatProperties format_props;
+            gpu.getFormatProperties(vk::Format::eR8G8B8A8Unorm, &format_props);
+            auto const blit_features = vk::FormatFeatureFlagBits::eBlitSrc | vk::FormatFeatureFlagBits::eBlitDst |
+                                       vk::FormatFeatureFlagBits::eSampledImageFilterLinear;
+
+            if ((families[queue_family].queueFlags & vk::QueueFlagBits::eGraphics) &&
+                (format_props.optimalTilingFeatures & blit_features) == blit_features) {
+                generation = mip_generation::gpu_blit;
+            } else {
+                generation = mip_generation::cpu_box;
+            }
+        }
+        uint32_t const cores = std::max(std::thread::hardware_concurrency(), 1u);
+        filter_threads = std::max(cores / std::max(loader_count, 1u), 1u);
+
+        auto const buf_info = vk::BufferCreateInfo().setSize(ring_size).setUsage(vk::BufferUsageFlagBits::eTransferSrc);
+        auto result = device.createBuffer(&buf_info, nullptr, &ring);
+        if (result != vk::Result::eSuccess) {
+            return false;
+        }
+
+        // The box filter reads the ring back, which is slow from uncached memory
+        auto const preferred =
+            generation == mip_generation::cpu_box ? vk::MemoryPropertyFlags(vk::MemoryPropertyFlagBits::eHostCached) : vk::MemoryPropertyFlags();
+        if (!allocator->allocate_buffer(ring, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
+                                        preferred, allocation_strategy::buddy, &ring_alloc)) {
+            return false;
+        }
+
+        auto const pool_info =
+            vk::CommandPoolCreateInfo().setFlags(vk::CommandPoolCreateFlagBits::eResetCommandBuffer).setQueueFamilyIndex(queue_family);
+        result = device.createCommandPool(&pool_info, nullptr, &cmd_pool);
+        if (result != vk::Result::eSuccess) {
+            return false;
+        }
+
+        auto const cmd_info =
+            vk::CommandBufferAllocateInfo().setCommandPool(cmd_pool).setLevel(vk::CommandBufferLevel::ePrimary).setCommandBufferCount(1);
+        auto const fence_info = vk::FenceCreateInfo();
+        for (auto &b : batches) {
+            result = device.allocateCommandBuffers(&cmd_info, &b.cmd);
+            if (result != vk::Result::eSuccess) {
+                return false;
+            }
+            result = device.createFence(&fence_info, nullptr, &b.fence);
+            if (result != vk::Result::eSuccess) {
+                return false;
+            }
+        }
+
+        quit = false;
+        for (uint32_t i = 0; i < std::max(loader_count, 1u); i++) {
+            loaders.emplace_back(&texture_streamer::loader_main, this);
+        }
+        return true;
+    }
+
+    // Drops whatever has not been handed out yet.  Semaphores given out by
+    // poll() must have been released.
+    void destroy() {
+        stop_loaders();
+        if (!device) {
+            return;
+        }
+
+        for (auto &b : batches) {
+            if (b.value) {
+                device.waitForFences(1, &b.fence, VK_TRUE, UINT64_MAX);
+                for (auto &tex : b.textures) {
+                    free_texture(tex);
+                }
+                free_semaphores.push_back(b.semaphore);
+            }
+            device.destroyFence(b.fence, nullptr);
+            b = batch();
+        }
+        in_flight.clear();
+
+        for (auto &tex : ready) {
+            free_texture(tex);
+        }
+        ready.clear();
+        free_semaphores.insert(free_semaphores.end(), ready_semaphores.begin(), ready_semaphores.end());
+        ready_semaphores.clear();
+        for (auto semaphore : free_semaphores) {
+            device.destroySemaphore(semaphore, nullptr);
+        }
+        free_semaphores.clear();
+
+        requests.clear();
+        decoded.clear();
+        ranges.clear();
+        first_range = 0;
+
+        device.destroyCommandPool(cmd_pool, nullptr);
+        device.destroyBuffer(ring, nullptr);
+        allocator->free(&ring_alloc);
+        device = vk::Device();
+    }
+
+    // Thread safe
+    void request(uint32_t id, char const *filename) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            requests.push_back({id, filename});
+        }
+        wake.notify_one();
+    }
+
+    // Submits the copies of decoded textures and retires finished batches.
+    // Appends the textures that are now resident to `textures`, and to
+    // `waits` the semaphores the next graphics submission must wait on
+    // (at the stage that first samples them) before it uses any of them.
+    void poll(std::vector<streamed_texture> &textures, std::vector<vk::Semaphore> &waits) {
+        retire(false);
+        submit_decoded();
+
+        textures.insert(textures.end(), ready.begin(), ready.end());
+        ready.clear();
+        waits.insert(waits.end(), ready_semaphores.begin(), ready_semaphores.end());
+        ready_semaphores.clear();
+    }
+
+    // Waits until every request so far has been uploaded; poll() then returns them
+    void flush() {
+        for (;;) {
+            retire(true);
+            submit_decoded();
+            if (!in_flight.empty()) {
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(mutex);
+            if (requests.empty() && loading == 0 && decoded.empty()) {
+                return;
+            }
+            idle.wait(lock, [this] { return !decoded.empty() || (requests.empty() && loading == 0); });
+        }
+    }
+
+    // Semaphores waited on by graphics submissions that have completed
+    void release_semaphores(std::vector<vk::Semaphore> &semaphores) {
+        free_semaphores.insert(free_semaphores.end(), semaphores.begin(), semaphores.end());
+        semaphores.clear();
+    }
+
+    uint64_t submitted() const { return submitted_value; }
+    uint64_t completed() const { return completed_value; }
+    mip_generation mips() const { return generation; }
+
+   private:
+    struct load_request {
+        uint32_t id;
+        std::string filename;
+    };
+
+    struct decoded_texture {
+        uint32_t id;
+        int32_t width;
+        int32_t height;
+        vk::Format format;
+        uint32_t mip_levels;
+        uint32_t staged_levels;  // The rest are blitted
+        uint64_t range;          // Sequence number of its ring range
+    };
+
+    struct ring_range {
+        vk::DeviceSize begin;
+        vk::DeviceSize end;
+        bool retired;
+    };
+
+    struct batch {
+        vk::CommandBuffer cmd;
+        vk::Fence fence;
+        vk::Semaphore semaphore;
+        uint64_t value{0};  // Timeline value, 0 while the batch is free
+        std::vector<streamed_texture> textures;
+        std::vector<uint64_t> ranges;
+    };
+
+    void stop_loaders() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            quit = true;
+        }
+        wake.notify_all();
+        space.notify_all();
+        for (auto &loader : loaders) {
+            loader.join();
+        }
+        loaders.clear();
+    }
+
+    void loader_main() {
+        TRACE_THREAD("texture loader");
+        for (;;) {
+            load_request req;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [this] { return quit || !requests.empty(); });
+                if (quit) {
+                    return;
+                }
+                req = requests.front();
+                requests.pop_front();
+                loading++;
+            }
+
+            decoded_texture tex;
+            bool loaded;
+            {
+                TRACE_ZONE("load texture");
+                loaded = load(req, &tex);
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                loading--;
+                if (loaded) {
+                    decoded.push_back(tex);
+                }
+            }
+            idle.notify_all();
+        }
+    }
+
+    bool load(load_request const &req, decoded_texture *tex) {
+        tex->id = req.id;
+
+        // The reserved range is ours alone until it is submitted
+        bool reserved = false;
+        bool box_filter = false;
+        uint8_t *texels = nullptr;
+        auto const reserve_texels = [&](int32_t width, int32_t height, vk::Format format, uint32_t levels,
+                                        vk::DeviceSize *row_pitch) -> uint8_t * {
+            uint32_t block_dim;
+            if (width <= 0 || height <= 0 || levels == 0 || levels > mip_level_count((uint32_t)width, (uint32_t)height) ||
+                texture_block_bytes(format, &block_dim) == 0) {
+                return nullptr;
+            }
+            tex->width = width;
+            tex->height = height;
+            tex->format = format;
+            tex->mip_levels = levels;
+            tex->staged_levels = levels;
+            if (format == vk::Format::eR8G8B8A8Unorm && levels == 1 && generation != mip_generation::none) {
+                tex->mip_levels = mip_level_count((uint32_t)width, (uint32_t)height);
+                box_filter = generation == mip_generation::cpu_box;
+                tex->staged_levels = box_filter ? tex->mip_levels : 1;
+            }
+
+            // Rows of blocks, for the compressed formats
+            *row_pitch = texture_level_size(format, width, 1, 0);
+            vk::DeviceSize const size = staged_size(*tex);
+            if (size > ring_size) {
+                fprintf(stderr, "Texture %s does not fit the %" PRIu64 " byte staging ring\n", req.filename.c_str(),
+                        (uint64_t)ring_size);
+                return nullptr;
+            }
+
+            vk::DeviceSize offset;
+            std::unique_lock<std::mutex> lock(mutex);
+            space.wait(lock, [&] { return quit || reserve(size, &offset, &tex->range); });
+            if (quit) {
+                return nullptr;
+            }
+            reserved = true;
+            texels = ring_alloc.mapped + offset;
+            return texels;
+        };
+
+        if (!decode(req.filename.c_str(), reserve_texels) || !reserved) {
+            fprintf(stderr, "Failed to load texture %s\n", req.filename.c_str());
+            if (reserved) {
+                std::lock_guard<std::mutex> lock(mutex);
+                retire_range(tex->range);
+            }
+            return false;
+        }
+
+        if (box_filter) {
+            vk::DeviceSize offset = 0;
+            for (uint32_t level = 1; level < tex->mip_levels; level++) {
+                uint32_t const width = mip_extent((uint32_t)tex->width, level - 1);
+                uint32_t const height = mip_extent((uint32_t)tex->height, level - 1);
+                vk::DeviceSize const size = (vk::DeviceSize)width * height * 4;
+                mip_downsample(texels + offset, width * 4, width, height, texels + offset + size, mip_extent(width, 1) * 4,
+                               filter_threads);
+                offset += size;
+            }
+        }
+        return true;
+    }
+
+    // Bytes of the ring a texture takes: its staged levels, tightly packed
+    // back to back
+    static vk::DeviceSize staged_size(decoded_texture const &tex) {
+        vk::DeviceSize size = 0;
+        for (uint32_t level = 0; level < tex.staged_levels; level++) {
+            size += texture_level_size(tex.format, tex.width, tex.height, level);
+        }
+        return size;
+    }
+
+    // Called with the mutex held.  Ranges are handed out in ring order; the
+    // oldest live one bounds the free space.
+    bool reserve(vk::DeviceSize size, vk::DeviceSize *offset, uint64_t *sequence) {
+        vk::DeviceSize begin = 0;
+        if (!ranges.empty()) {
+            vk::DeviceSize const tail = ranges.front().begin;
+            vk::DeviceSize const head = (ranges.back().end + copy_alignment - 1) / copy_alignment * copy_alignment;
+            bool const wrapped = ranges.back().begin < tail;
+
+            if (!wrapped && head + size <= ring_size) {
+                begin = head;
+            } else if (!wrapped && size <= tail) {
+                begin = 0;
+            } else if (wrapped && head + size <= tail) {
+                begin = head;
+            } else {
+                return false;
+            }
+        }
+
+        ranges.push_back({begin, begin + size, false});
+        *offset = begin;
+        *sequence = first_range + ranges.size() - 1;
+        return true;
+    }
+
+    // Called with the mutex held
+    void retire_range(uint64_t sequence) {
+        ranges[(size_t)(sequence - first_range)].retired = true;
+        while (!ranges.empty() && ranges.front().retired) {
+            ranges.pop_front();
+            first_range++;
+        }
+        space.notify_all();
+    }
+
+    void submit_decoded() {
+        batch *b = nullptr;
+        for (auto &candidate : batches) {
+            if (!candidate.value) {
+                b = &candidate;
+                break;
+            }
+        }
+
+        std::vector<decoded_texture> work;
+        std::vector<vk::DeviceSize> offsets;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!b || decoded.empty()) {
+                return;
+            }
+            work.assign(decoded.begin(), decoded.end());
+            decoded.clear();
+            for (auto const &tex : work) {
+                offsets.push_back(ranges[(size_t)(tex.range - first_range)].begin);
+            }
+        }
+
+        if (!b->semaphore) {
+            if (!free_semaphores.empty()) {
+                b->semaphore = free_semaphores.back();
+                free_semaphores.pop_back();
+            } else {
+                auto const semaphore_info = vk::SemaphoreCreateInfo();
+                check(device.createSemaphore(&semaphore_info, nullptr, &b->semaphore), "vkCreateSemaphore");
+            }
+        }
+
+        auto const begin_info = vk::CommandBufferBeginInfo().setFlags(vk::CommandBufferUsageFlagBits::eOneTimeSubmit);
+        check(b->cmd.begin(&begin_info), "vkBeginCommandBuffer");
+
+        uint32_t const families[2] = {graphics_queue_family, queue_family};
+        bool const concurrent = graphics_queue_family != queue_family;
+
+        for (size_t i = 0; i < work.size(); i++) {
+            uint32_t const levels = work[i].mip_levels;
+            uint32_t const staged_levels = work[i].staged_levels;
+            bool const blit = staged_levels < levels;
+            auto usage = vk::ImageUsageFlagBits::eTransferDst | vk::ImageUsageFlagBits::eSampled;
+            if (blit) {
+                usage |= vk::ImageUsageFlagBits::eTransferSrc;
+            }
+            auto const range = vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, levels, 0, 1);
+            auto const image_info = vk::ImageCreateInfo()
+                                        .setImageType(vk::ImageType::e2D)
+                                        .setFormat(work[i].format)
+                                        .setExtent({(uint32_t)work[i].width, (uint32_t)work[i].height, 1})
+                                        .setMipLevels(levels)
+                                        .setArrayLayers(1)
+                                        .setSamples(vk::SampleCountFlagBits::e1)
+                                        .setTiling(vk::ImageTiling::eOptimal)
+                                        .setUsage(usage)
+                                        .setSharingMode(concurrent ? vk::SharingMode::eConcurrent : vk::SharingMode::eExclusive)
+                                        .setQueueFamilyIndexCount(concurrent ? 2 : 0)
+                                        .setPQueueFamilyIndices(concurrent ? families : nullptr)
+                                        .setInitialLayout(vk::ImageLayout::eUndefined);
+
+            streamed_texture tex = {
+                work[i].id, vk::Image(), device_allocation(), work[i].width, work[i].height, levels, work[i].format};
+            check(device.createImage(&image_info, nullptr, &tex.image), "vkCreateImage");
+
+            bool const pass = allocator->allocate_image(tex.image, vk::ImageTiling::eOptimal, vk::MemoryPropertyFlagBits::eDeviceLocal,
+                                                        vk::MemoryPropertyFlags(), allocation_strategy::buddy, &tex.alloc);
+            check(pass ? vk::Result::eSuccess : vk::Result::eErrorOutOfDeviceMemory, "Texture memory allocation");
+
+            auto barrier = vk::ImageMemoryBarrier()
+                               .setSrcAccessMask(vk::AccessFlags())
+                               .setDstAccessMask(vk::AccessFlagBits::eTransferWrite)
+                               .setOldLayout(vk::ImageLayout::eUndefined)
+                               .setNewLayout(vk::ImageLayout::eTransferDstOptimal)
+                               .setSrcQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+                               .setDstQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+                               .setImage(tex.image)
+                               .setSubresourceRange(range);
+            b->cmd.pipelineBarrier(vk::PipelineStageFlagBits::eTopOfPipe, vk::PipelineStageFlagBits::eTransfer, vk::DependencyFlagBits(),
+                                   0, nullptr, 0, nullptr, 1, &barrier);
+
+            // Every staged level, tightly packed one after another
+            std::vector<vk::BufferImageCopy> copies(staged_levels);
+            vk::DeviceSize offset = offsets[i];
+            for (uint32_t level = 0; level < staged_levels; level++) {
+                uint32_t const width = mip_extent((uint32_t)work[i].width, level);
+                uint32_t const height = mip_extent((uint32_t)work[i].height, level);
+                copies[level]
+                    .setBufferOffset(offset)
+                    .setBufferRowLength(0)
+                    .setBufferImageHeight(0)
+                    .setImageSubresource(vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, level, 0, 1))
+                    .setImageOffset({0, 0, 0})
+                    .setImageExtent({width, height, 1});
+                offset += texture_level_size(work[i].format, work[i].width, work[i].height, level);
+            }
+            b->cmd.copyBufferToImage(ring, tex.image, vk::ImageLayout::eTransferDstOptimal, staged_levels, copies.data());
+
+            if (blit) {
+                record_blits(b->cmd, tex);
+            }
+
+            // The semaphore carries the dependency on to the graphics queue.
+            // After blitting, all but the last level are transfer sources.
+            barrier.setSrcAccessMask(vk::AccessFlagBits::eTransferWrite)
+                .setDstAccessMask(vk::AccessFlags())
+                .setNewLayout(vk::ImageLayout::eShaderReadOnlyOptimal);
+            if (blit) {
+                barrier.setOldLayout(vk::ImageLayout::eTransferSrcOptimal).setSubresourceRange(
+                    vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, levels - 1, 0, 1));
+                b->cmd.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eBottomOfPipe,
+                                       vk::DependencyFlagBits(), 0, nullptr, 0, nullptr, 1, &barrier);
+                barrier.setSubresourceRange(vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, levels - 1, 1, 0, 1));
+            }
+            barrier.setOldLayout(vk::ImageLayout::eTransferDstOptimal);
+            b->cmd.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eBottomOfPipe,
+                                   vk::DependencyFlagBits(), 0, nullptr, 0, nullptr, 1, &barrier);
+
+            b->textures.push_back(tex);
+            b->ranges.push_back(work[i].range);
+        }
+
+        check(b->cmd.end(), "vkEndCommandBuffer");
+
+        auto const submit_info =
+            vk::SubmitInfo().setCommandBufferCount(1).setPCommandBuffers(&b->cmd).setSignalSemaphoreCount(1).setPSignalSemaphores(
+                &b->semaphore);
+        check(queue.submit(1, &submit_info, b->fence), "vkQueueSubmit");
+
+        b->value = ++submitted_value;
+        in_flight.push_back(b);
+    }
+
+    // Each level is a linear blit of the one above, which first becomes a
+    // transfer source
+    static void record_blits(vk::CommandBuffer cmd, streamed_texture const &tex) {
+        auto barrier = vk::ImageMemoryBarrier()
+                           .setSrcAccessMask(vk::AccessFlagBits::eTransferWrite)
+                           .setDstAccessMask(vk::AccessFlagBits::eTransferRead)
+                           .setOldLayout(vk::ImageLayout::eTransferDstOptimal)
+                           .setNewLayout(vk::ImageLayout::eTransferSrcOptimal)
+                           .setSrcQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+                           .setDstQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+                           .setImage(tex.image);
+
+        for (uint32_t level = 1; level < tex.mip_levels; level++) {
+            barrier.setSubresourceRange(vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, level - 1, 1, 0, 1));
+            cmd.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eTransfer, vk::DependencyFlagBits(), 0,
+                                nullptr, 0, nullptr, 1, &barrier);
+
+            auto const blit =
+                vk::ImageBlit()
+                    .setSrcSubresource(vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, level - 1, 0, 1))
+                    .setSrcOffsets({{vk::Offset3D(0, 0, 0), vk::Offset3D((int32_t)mip_extent((uint32_t)tex.width, level - 1),
+                                                                         (int32_t)mip_extent((uint32_t)tex.height, level - 1), 1)}})
+                    .setDstSubresource(vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, level, 0, 1))
+                    .setDstOffsets({{vk::Offset3D(0, 0, 0), vk::Offset3D((int32_t)mip_extent((uint32_t)tex.width, level),
+                                                                         (int32_t)mip_extent((uint32_t)tex.height, level), 1)}});
+            cmd.blitImage(tex.image, vk::ImageLayout::eTransferSrcOptimal, tex.image, vk::ImageLayout::eTransferDstOptimal, 1, &blit,
+                          vk::Filter::eLinear);
+        }
+    }
+
+    // Batches finish in submission order on one queue, so stop at the first
+    // one still running
+    void retire(bool wait) {
+        while (!in_flight.empty()) {
+            batch *b = in_flight.front();
+            if (wait) {
+                device.waitForFences(1, &b->fence, VK_TRUE, UINT64_MAX);
+            } else if (device.getFenceStatus(b->fence) != vk::Result::eSuccess) {
+                return;
+            }
+            in_flight.pop_front();
+
+            device.resetFences(1, &b->fence);
+            completed_value = b->value;
+            ready.insert(ready.end(), b->textures.begin(), b->textures.end());
+            ready_semaphores.push_back(b->semaphore);
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                for (auto sequence : b->ranges) {
+                    retire_range(sequence);
+                }
+            }
+
+            b->semaphore = vk::Semaphore();
+            b->value = 0;
+            b->textures.clear();
+            b->ranges.clear();
+        }
+    }
+
+    // Failures past init() leave nothing sensible to fall back to
+    static void check(vk::Result result, char const *what) {
+        if (result != vk::Result::eSuccess) {
+            fprintf(stderr, "Texture streaming: %s failed: %s\n", what, vk::to_string(result).c_str());
+            fflush(stderr);
+            exit(1);
+        }
+    }
+
+    void free_texture(streamed_texture &tex) {
+        device.destroyImage(tex.image, nullptr);
+        allocator->free(&tex.alloc);
+    }
+
+    vk::Device device;
+    device_allocator *allocator{nullptr};
+    vk::Queue queue;
+    uint32_t queue_family{0};
+    uint32_t graphics_queue_family{0};
+    decoder decode;
+
+    vk::Buffer ring;
+    device_allocation ring_alloc;
+    vk::DeviceSize ring_size{0};
+    vk::DeviceSize copy_alignment{4};
+    mip_generation generation{mip_generation::none};
+    uint32_t filter_threads{1};  // Box filter threads per loader
+
+    vk::CommandPool cmd_pool;
+    batch batches[MAX_BATCHES];
+    std::deque<batch *> in_flight;  // Oldest first
+    uint64_t submitted_value{0};
+    uint64_t completed_value{0};
+    std::vector<streamed_texture> ready;
+    std::vector<vk::Semaphore> ready_semaphores;
+    std::vector<vk::Semaphore> free_semaphores;
+
+    // Shared with the loader threads
+    std::vector<std::thread> loaders;
+    std::mutex mutex;
+    std::condition_variable wake;   // New requests
+    std::condition_variable space;  // Ring ranges retired
+    std::condition_variable idle;   // Loads finished
+    bool quit{false};
+    uint32_t loading{0};
+    std::deque<load_request> requests;
+    std::deque<decoded_texture> decoded;
+    std::deque<ring_range> ranges;  // Live ring ranges in reservation order
+    uint64_t first_range{0};        // Sequence number of ranges.front()
+};
+
+#endif  // TEXTURE_STREAMER_H
@@ -0,0 +1,156 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Scoped trace zones, written out as Chrome trace-event JSON (load the file
+// in chrome://tracing or ui.perfetto.dev).
+//
+// TRACE_ZONE("name") times the rest of the enclosing scope.  Each thread
+// appends to its own buffer, so recording a zone takes two clock reads and a
+// vector push_back with no locking; only a thread's first zone registers its
+// buffer under a mutex.  Names must be string literals, they are kept by
+// pointer.  TRACE_GPU adds a zone measured on the device to a separate "GPU"
+// track; the caller converts it to the trace clock first.
+//
+// Everything here compiles away unless DEMO_TRACE is defined.  trace_write()
+// must only be called once the other threads have stopped recording.
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <cstdint>
+#include <cstdio>
+
+#ifdef DEMO_TRACE
+
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+struct trace_event {
+    char const *name;
+    uint64_t begin_ns;
+    uint64_t end_ns;
+};
+
+struct trace_track {
+    uint32_t id;
+    char const *name;
+    std::vector<trace_event> events;
+};
+
+class trace_registry {
+   public:
+    static trace_registry &get() {
+        static trace_registry registry;
+        return registry;
+    }
+
+    // Nanoseconds since the first call, on a monotonic clock
+    uint64_t now() const {
+        return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count();
+    }
+
+    trace_track *add_track(char const *name) {
+        std::lock_guard<std::mutex> lock(mutex);
+        tracks.emplace_back(new trace_track{(uint32_t)tracks.size() + 1, name, {}});
+        tracks.back()->events.reserve(4096);
+        return tracks.back().get();
+    }
+
+    // The calling thread's track
+    static trace_track &local() {
+        thread_local trace_track *track = get().add_track(nullptr);
+        return *track;
+    }
+
+    // Where device zones go; only touched by the thread that resolves them
+    static trace_track &gpu() {
+        static trace_track *track = get().add_track("GPU");
+        return *track;
+    }
+
+    static void name_thread(char const *name) { local().name = name; }
+
+    bool write(char const *path) {
+        FILE *out = fopen(path, "w");
+        if (!out) {
+            return false;
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        fprintf(out, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n");
+        bool first = true;
+        for (auto const &track : tracks) {
+            char const *name = track->name ? track->name : "thread";
+            fprintf(out, "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %u, \"args\": {\"name\": \"%s\"}}",
+                    first ? "" : ",\n", track->id, name);
+            first = false;
+            for (auto const &event : track->events) {
+                fprintf(out, ",\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %u, \"ts\": %.3f, \"dur\": %.3f}", event.name,
+                        track->id, event.begin_ns / 1e3, (event.end_ns - event.begin_ns) / 1e3);
+            }
+        }
+        fprintf(out, "\n]}\n");
+        fclose(out);
+        return true;
+    }
+
+   private:
+    trace_registry() : epoch(std::chrono::steady_clock::now()) {}
+
+    std::chrono::steady_clock::time_point const epoch;
+    std::mutex mutex;
+    std::vector<std::unique_ptr<trace_track>> tracks;
+};
+
+class trace_zone {
+   public:
+    explicit trace_zone(char const *name) : name(name), begin_ns(trace_registry::get().now()) {}
+    ~trace_zone() { trace_registry::local().events.push_back({name, begin_ns, trace_registry::get().now()}); }
+
+    trace_zone(trace_zone const &) = delete;
+    trace_zone &operator=(trace_zone const &) = delete;
+
+   private:
+    char const *name;
+    uint64_t begin_ns;
+};
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_ZONE(name) trace_zone TRACE_CONCAT(trace_zone_, __LINE__)(name)
+#define TRACE_THREAD(name) trace_registry::name_thread(name)
+#define TRACE_GPU(name, begin_ns, end_ns) trace_registry::gpu().events.push_back({name, begin_ns, end_ns})
+#define TRACE_NOW() trace_registry::get().now()
+#define TRACE_ENABLED 1
+
+inline bool trace_write(char const *path) { return trace_registry::get().write(path); }
+
+#else
+
+#define TRACE_ZONE(name) ((void)0)
+#define TRACE_THREAD(name) ((void)0)
+#define TRACE_GPU(name, begin_ns, end_ns) ((void)sizeof(begin_ns), (void)sizeof(end_ns))
+#define TRACE_NOW() ((uint64_t)0)
+#define TRACE_ENABLED 0
+
+inline bool trace_write(char const *path) {
+    fprintf(stderr, "Not writing %s: tracing is compiled out, build with DEMO_TRACE defined\n", path);
+    return false;
+}
+
+#endif  // DEMO_TRACE
+
+#endif  // TRACE_H
@@ -0,0 +1,344 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Mesh vertices packed into 16 bytes instead of 32.
+//
+//   position  4 x half float     (R16G16B16A16_SFLOAT, w = 1)
+//   normal    2 x snorm16        (R16G16_SNORM), octahedral
+//   uv        2 x unorm16        (R16G16_UNORM), clamped to [0, 1]
+//
+// All three are formats every Vulkan implementation must support for vertex
+// buffers, and the shader still reads floats.  Half floats keep 11 bits of
+// mantissa: inside the [-1, 1] box mesh_load() fits meshes into, positions
+// move by at most 2^-12.  The octahedral encoding projects the unit normal
+// onto the octahedron |x| + |y| + |z| = 1 and folds the lower half over the
+// upper one, so two 16-bit values land within a few hundredths of a degree.
+//
+// Kernels:
+//  - scalar: the reference, built on glm's packHalf4x16, packSnorm2x16 and
+//    packUnorm2x16 from glm/gtc/packing.hpp.
+//  - f16c: 4 vertices at a time.  Two 4x4 transposes turn the interleaved
+//    floats into columns, F16C converts the positions and SSE4.1 does the
+//    octahedral folding, rounding and saturating packs.  Compiled with
+//    target attributes and only picked when the CPU reports F16C and SSE4.1.
+// Both round to nearest; the kernels may differ by one unit on ties, which
+// glm rounds away from zero and the SSE and F16C conversions to even.
+//
+// Needs the repository's include directory on the include path for glm.
+
+#ifndef VERTEX_QUANTIZE_H
+#define VERTEX_QUANTIZE_H
+
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/packing.hpp>
+
+#include "mesh_loader.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define VERTEX_QUANTIZE_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(VERTEX_QUANTIZE_X86) && (defined(__GNUC__) || defined(__clang__))
+#define VERTEX_QUANTIZE_F16C_TARGET __attribute__((target("sse4.1,f16c")))
+#else
+#define VERTEX_QUANTIZE_F16C_TARGET
+#endif
+
+struct packed_vertex {
+    uint16_t position[4];
+    int16_t normal[2];
+    uint16_t uv[2];
+};
+
+static_assert(sizeof(packed_vertex) == 16, "packed_vertex must stay 16 bytes");
+
+enum class quantize_kernel { scalar, f16c };
+
+static inline char const *quantize_kernel_name(quantize_kernel kernel) {
+    return kernel == quantize_kernel::f16c ? "f16c" : "scalar";
+}
+
+static inline bool quantize_kernel_supported(quantize_kernel kernel) {
+    if (kernel == quantize_kernel::scalar) {
+        return true;
+    }
+#if defined(VERTEX_QUANTIZE_X86) && (defined(__GNUC__) || defined(__clang__))
+    return __builtin_cpu_supports("sse4.1") && __builtin_cpu_supports("f16c") && __builtin_cpu_supports("avx");
+#elif defined(VERTEX_QUANTIZE_X86) && defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 1);
+    bool const sse41 = (info[2] & (1 << 19)) != 0;
+    bool const f16c = (info[2] & (1 << 29)) != 0;
+    bool const osxsave = (info[2] & (1 << 27)) != 0;
+    // F16C is VEX encoded, so the OS must also save the YMM registers
+    return sse41 && f16c && osxsave && (_xgetbv(0) & 6) == 6;
+#else
+    return false;
+#endif
+}
+
+static inline quantize_kernel quantize_best_kernel() {
+    return quantize_kernel_supported(quantize_kernel::f16c) ? quantize_kernel::f16c : quantize_kernel::scalar;
+}
+
+// The unit octahedron's upper half, with the lower half folded over the
+// diagonals.  A zero normal maps to (0, 0), which decodes to +Z.
+static inline glm::vec2 octahedral_encode(glm::vec3 n) {
+    float const l1 = fabsf(n.x) + fabsf(n.y) + fabsf(n.z);
+    if (l1 == 0.0f) {
+        return glm::vec2(0.0f);
+    }
+    glm::vec2 p = glm::vec2(n.x, n.y) / l1;
+    if (n.z < 0.0f) {
+        p = glm::vec2((1.0f - fabsf(p.y)) * (p.x >= 0.0f ? 1.0f : -1.0f), (1.0f - fabsf(p.x)) * (p.y >= 0.0f ? 1.0f : -1.0f));
+    }
+    return p;
+}
+
+static inline glm::vec3 octahedral_decode(glm::vec2 p) {
+    glm::vec3 n(p.x, p.y, 1.0f - fabsf(p.x) - fabsf(p.y));
+    float const t = std::max(-n.z, 0.0f);
+    n.x += n.x >= 0.0f ? -t : t;
+    n.y += n.y >= 0.0f ? -t : t;
+    return glm::normalize(n);
+}
+
+static inline void quantize_vertices_scalar(mesh_vertex const *in, size_t count, packed_vertex *out) {
+    for (size_t i = 0; i < count; i++) {
+        mesh_vertex const &v = in[i];
+        uint64_t const position = glm::packHalf4x16(glm::vec4(v.position[0], v.position[1], v.position[2], 1.0f));
+        uint32_t const normal = glm::packSnorm2x16(octahedral_encode(glm::vec3(v.normal[0], v.normal[1], v.normal[2])));
+        uint32_t const uv = glm::packUnorm2x16(glm::clamp(glm::vec2(v.uv[0], v.uv[1]), 0.0f, 1.0f));
+        memcpy(out[i].position, &position, sizeof(position));
+        memcpy(out[i].normal, &normal, sizeof(normal));
+        memcpy(out[i].uv, &uv, sizeof(uv));
+    }
+}
+
+static inline void unpack_vertex(packed_vertex const &p, mesh_vertex *v) {
+    uint64_t position;
+    uint32_t normal, uv;
+    memcpy(&position, p.position, sizeof(position));
+    memcpy(&normal, p.normal, sizeof(normal));
+    memcpy(&uv, p.uv, sizeof(uv));
+    glm::vec4 const xyzw = glm::unpackHalf4x16(position);
+    glm::vec3 const n = octahedral_decode(glm::unpackSnorm2x16(normal));
+    glm::vec2 const t = glm::unpackUnorm2x16(uv);
+    for (int k = 0; k < 3; k++) {
+        v->position[k] = xyzw[k];
+        v->normal[k] = n[k];
+    }
+    v->uv[0] = t.x;
+    v->uv[1] = t.y;
+}
+
+#if defined(VERTEX_QUANTIZE_X86)
+
+VERTEX_QUANTIZE_F16C_TARGET static inline void quantize_vertices_f16c(mesh_vertex const *in, size_t count, packed_vertex *out) {
+    __m128 const zero = _mm_setzero_ps();
+    __m128 const one = _mm_set1_ps(1.0f);
+    __m128 const minus_one = _mm_set1_ps(-1.0f);
+    __m128 const abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+    __m128i const half_one = _mm_cvtps_ph(one, _MM_FROUND_TO_NEAREST_INT);
+
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        // Each vertex is two rows: (px py pz nx) and (ny nz u v)
+        __m128 a0 = _mm_loadu_ps(in[i].position), b0 = _mm_loadu_ps(&in[i].normal[1]);
+        __m128 a1 = _mm_loadu_ps(in[i + 1].position), b1 = _mm_loadu_ps(&in[i + 1].normal[1]);
+        __m128 a2 = _mm_loadu_ps(in[i + 2].position), b2 = _mm_loadu_ps(&in[i + 2].normal[1]);
+        __m128 a3 = _mm_loadu_ps(in[i + 3].position), b3 = _mm_loadu_ps(&in[i + 3].normal[1]);
+        _MM_TRANSPOSE4_PS(a0, a1, a2, a3);
+        _MM_TRANSPOSE4_PS(b0, b1, b2, b3);
+        __m128 const nx = a3, ny = b0, nz = b1;
+
+        __m128i const hx = _mm_cvtps_ph(a0, _MM_FROUND_TO_NEAREST_INT);
+        __m128i const hy = _mm_cvtps_ph(a1, _MM_FROUND_TO_NEAREST_INT);
+        __m128i const hz = _mm_cvtps_ph(a2, _MM_FROUND_TO_NEAREST_INT);
+        __m128i const xy = _mm_unpacklo_epi16(hx, hy);
+        __m128i const zw = _mm_unpacklo_epi16(hz, half_one);
+        __m128i const positions01 = _mm_unpacklo_epi32(xy, zw);
+        __m128i const positions23 = _mm_unpackhi_epi32(xy, zw);
+
+        __m128 const l1 = _mm_add_ps(_mm_add_ps(_mm_and_ps(nx, abs_mask), _mm_and_ps(ny, abs_mask)), _mm_and_ps(nz, abs_mask));
+        __m128 const inv = _mm_and_ps(_mm_div_ps(one, l1), _mm_cmpgt_ps(l1, zero));
+        __m128 ox = _mm_mul_ps(nx, inv);
+        __m128 oy = _mm_mul_ps(ny, inv);
+        __m128 const sign_x = _mm_blendv_ps(minus_one, one, _mm_cmpge_ps(ox, zero));
+        __m128 const sign_y = _mm_blendv_ps(minus_one, one, _mm_cmpge_ps(oy, zero));
+        __m128 const fold_x = _mm_mul_ps(_mm_sub_ps(one, _mm_and_ps(oy, abs_mask)), sign_x);
+        __m128 const fold_y = _mm_mul_ps(_mm_sub_ps(one, _mm_and_ps(ox, abs_mask)), sign_y);
+        __m128 const lower = _mm_cmplt_ps(nz, zero);
+        ox = _mm_blendv_ps(ox, fold_x, lower);
+        oy = _mm_blendv_ps(oy, fold_y, lower);
+
+        __m128 const snorm = _mm_set1_ps(32767.0f);
+        __m128i const sx = _mm_cvtps_epi32(_mm_mul_ps(_mm_min_ps(_mm_max_ps(ox, minus_one), one), snorm));
+        __m128i const sy = _mm_cvtps_epi32(_mm_mul_ps(_mm_min_ps(_mm_max_ps(oy, minus_one), one), snorm));
+        __m128i const n16 = _mm_packs_epi32(sx, sy);
+        __m128i const normals = _mm_unpacklo_epi16(n16, _mm_srli_si128(n16, 8));
+
+        __m128 const unorm = _mm_set1_ps(65535.0f);
+        __m128i const ux = _mm_cvtps_epi32(_mm_mul_ps(_mm_min_ps(_mm_max_ps(b2, zero), one), unorm));
+        __m128i const uy = _mm_cvtps_epi32(_mm_mul_ps(_mm_min_ps(_mm_max_ps(b3, zero), one), unorm));
+        __m128i const t16 = _mm_packus_epi32(ux, uy);
+        __m128i const uvs = _mm_unpacklo_epi16(t16, _mm_srli_si128(t16, 8));
+
+        __m128i const tails01 = _mm_unpacklo_epi32(normals, uvs);
+        __m128i const tails23 = _mm_unpackhi_epi32(normals, uvs);
+        _mm_storeu_si128((__m128i *)&out[i], _mm_unpacklo_epi64(positions01, tails01));
+        _mm_storeu_si128((__m128i *)&out[i + 1], _mm_unpackhi_epi64(positions01, tails01));
+        _mm_storeu_si128((__m128i *)&out[i + 2], _mm_unpacklo_epi64(positions23, tails23));
+        _mm_storeu_si128((__m128i *)&out[i + 3], _mm_unpackhi_epi64(positions23, tails23));
+    }
+    quantize_vertices_scalar(in + i, count - i, out + i);
+}
+
+#endif  // VERTEX_QUANTIZE_X86
+
+// Unsupported kernels fall back to scalar
+static inline void quantize_vertices(quantize_kernel kernel, mesh_vertex const *in, size_t count, packed_vertex *out) {
+#if defined(VERTEX_QUANTIZE_X86)
+    if (kernel == quantize_kernel::f16c && quantize_kernel_supported(kernel)) {
+        quantize_vertices_f16c(in, count, out);
+        return;
+    }
+#else
+    (void)kernel;
+#endif
+    quantize_vertices_scalar(in, count, out);
+}
+
+// A latitude/longitude sphere with smooth normals, for benchmarking without
+// a mesh file
+static inline void quantize_test_sphere(uint32_t rings, uint32_t segments, mesh_data *mesh) {
+    mesh->vertices.clear();
+    mesh->indices.clear();
+    for (uint32_t r = 0; r <= rings; r++) {
+        float const theta = 3.14159265f * r / rings;
+        for (uint32_t s = 0; s <= segments; s++) {
+            float const phi = 6.28318531f * s / segments;
+            mesh_vertex v;
+            v.normal[0] = sinf(theta) * cosf(phi);
+            v.normal[1] = cosf(theta);
+            v.normal[2] = sinf(theta) * sinf(phi);
+            memcpy(v.position, v.normal, sizeof(v.position));
+            v.uv[0] = (float)s / segments;
+            v.uv[1] = (float)r / rings;
+            mesh->vertices.push_back(v);
+        }
+    }
+    for (uint32_t r = 0; r < rings; r++) {
+        for (uint32_t s = 0; s < segments; s++) {
+            uint32_t const a = r * (segments + 1) + s, b = a + segments + 1;
+            uint32_t const quad[6] = {a, b, b + 1, a, b + 1, a + 1};
+            mesh->indices.insert(mesh->indices.end(), quad, quad + 6);
+        }
+    }
+}
+
+// Times both kernels on mesh's vertices, single threaded, checks them
+// against the originals, and compares the two layouts: the size of the
+// vertex buffer, and the bytes a frame fetches if every vertex shader
+// invocation (misses on a FIFO of MESH_FIFO_CACHE_SIZE) reads one whole
+// vertex.  The GPU side can be measured with --benchmark, with and without
+// --quantize.
+static inline void vertex_quantize_benchmark(FILE *out, mesh_data const &mesh) {
+    size_t const count = mesh.vertices.size();
+    std::vector<packed_vertex> packed(count), reference(count);
+    quantize_vertices_scalar(mesh.vertices.data(), count, reference.data());
+
+    fprintf(out, "Vertex quantization, %zu vertices, one thread:\n", count);
+    fprintf(out, "  %-8s %14s %9s %12s %12s %12s %10s\n", "kernel", "vertices/s", "speedup", "position err", "normal deg",
+            "uv err", "mismatch");
+
+    double scalar_rate = 0.0;
+    quantize_kernel const kernels[] = {quantize_kernel::scalar, quantize_kernel::f16c};
+    for (auto kernel : kernels) {
+        if (!quantize_kernel_supported(kernel)) {
+            fprintf(out, "  %-8s %14s\n", quantize_kernel_name(kernel), "unsupported");
+            continue;
+        }
+
+        // Repeat until enough time has passed to be measurable
+        uint32_t iterations = 0;
+        auto const start = std::chrono::steady_clock::now();
+        double seconds = 0.0;
+        do {
+            quantize_vertices(kernel, mesh.vertices.data(), count, packed.data());
+            iterations++;
+            seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        } while (seconds < 0.25);
+
+        double const rate = (double)count * iterations / seconds;
+        if (kernel == quantize_kernel::scalar) {
+            scalar_rate = rate;
+        }
+
+        // Errors against the float input; mismatches are vertices whose
+        // bits differ from the scalar reference
+        float position_error = 0.0f, normal_error = 0.0f, uv_error = 0.0f;
+        size_t mismatches = 0;
+        for (size_t i = 0; i < count; i++) {
+            mesh_vertex const &v = mesh.vertices[i];
+            mesh_vertex decoded;
+            unpack_vertex(packed[i], &decoded);
+            for (int k = 0; k < 3; k++) {
+                position_error = std::max(position_error, fabsf(decoded.position[k] - v.position[k]));
+            }
+            glm::vec3 const n(v.normal[0], v.normal[1], v.normal[2]);
+            if (glm::length(n) > 0.0f) {
+                glm::vec3 const d(decoded.normal[0], decoded.normal[1], decoded.normal[2]);
+                float const cosine = glm::dot(glm::normalize(n), d);
+                normal_error = std::max(normal_error, acosf(std::min(cosine, 1.0f)) * 57.2957795f);
+            }
+            for (int k = 0; k < 2; k++) {
+                uv_error = std::max(uv_error, fabsf(decoded.uv[k] - std::min(std::max(v.uv[k], 0.0f), 1.0f)));
+            }
+            mismatches += memcmp(&packed[i], &reference[i], sizeof(packed_vertex)) != 0;
+        }
+
+        fprintf(out, "  %-8s %14.0f %8.2fx %12.3g %12.3g %12.3g %10zu\n", quantize_kernel_name(kernel), rate, rate / scalar_rate,
+                position_error, normal_error, uv_error, mismatches);
+    }
+
+    uint32_t const invocations = mesh.indices.empty()
+                                     ? (uint32_t)count
+                                     : mesh_cache_misses(mesh.indices.data(), mesh.indices.size(), count, MESH_FIFO_CACHE_SIZE);
+    size_t const index_bytes = mesh.indices.size() * sizeof(uint32_t);
+    fprintf(out, "Vertex layouts, %zu triangles, %" PRIu32 " vertex shader invocations per draw:\n", mesh.indices.size() / 3,
+            invocations);
+    fprintf(out, "  %-8s %8s %14s %14s %16s\n", "layout", "stride", "vertex bytes", "+ index bytes", "fetched/draw");
+    size_t const strides[2] = {sizeof(mesh_vertex), sizeof(packed_vertex)};
+    char const *const names[2] = {"float32", "packed"};
+    for (int layout = 0; layout < 2; layout++) {
+        fprintf(out, "  %-8s %8zu %14zu %14zu %16zu\n", names[layout], strides[layout], strides[layout] * count,
+                strides[layout] * count + index_bytes, strides[layout] * invocations);
+    }
+}
+
+#endif  // VERTEX_QUANTIZE_H
@@ -1,19 +1,5 @@
 #include "App.h"
 
-VKAPI_ATTR VkBool32 VKAPI_CALL debugCallback(
-    VkDebugReportFlagsEXT flags,
-    VkDebugReportObjectTypeEXT objType,
-    uint64_t obj,
-    size_t location,
-    int32_t code,
-    const char *layerPrefix,
-    const char *msg,
-    void *userData)
-{
-    printf("Validation layer: %s\n", msg);
-    return VK_FALSE;
-}
-
 void validateLayersAreSupported(const std::vector<const char *> &layerNames)
 {
     uint32_t supportedLayerCount;
@@ -46,22 +32,40 @@ void validateLayersAreSupported(const std::vector<const char *> &layerNames)
 bool isPhysicalDeviceSuitable(VkPhysicalDevice physicalDevice, VkSurfaceKHR surface, const std::vector<const char *> &deviceExtensions)
 {
     QueueFamilyIndicies queueFamilyIndicies = findQueueFamilies(physicalDevice, surface);
-    if (areAllQueueFamiliesFound(queueFamilyIndicies))
+    if (areAllQueueFamiliesFound(queueFamilyIndicies, surface != VK_NULL_HANDLE))
     {
         if (areAllDeviceExtensionsSupported(physicalDevice, deviceExtensions))
         {
-            return true;
+            if (surface == VK_NULL_HANDLE)
+            {
+                return true;
+            }
+
+            SwapChainSupportDetails swapChainSupport = queySwapChainSupport(physicalDevice, surface);
+            return !swapChainSupport.formats.empty() && !swapChainSupport.presentModes.empty();
         }
     }
 
     return false;
 }
 
+App::App(bool headless, const char *deviceOverride, bool calibrate, PresentPolicy presentPolicy)
+    : m_headless(headless)
+    , m_deviceOverride(deviceOverride)
+    , m_calibrate(calibrate)
+    , m_presentPolicy(presentPolicy)
+{
+}
+
 void App::run()
 {
-    printf("App::run\n");
+    printf("App::run%s\n", m_headless ? " (headless)" : "");
+
+    if (!m_headless)
+    {
+        initWindow();
+    }
 
-    initWindow();
     initVulkan();
     mainLoop();
     cleanup();
@@ -69,6 +73,7 @@ void App::run()
 
 void App::initWindow()
 {
+    TRACE_ZONE("App::initWindow");
     printf("App::initWindow\n");
 
     if (glfwInit() == GLFW_FALSE)
@@ -79,52 +84,88 @@ void App::initWindow()
     // Tell GLFW to not use OpenGL
     glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
 
-    // Not resizable
-    glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
-
     m_window = glfwCreateWindow(WIDTH, HEIGHT, "Vulkan App", nullptr, nullptr);
+    glfwSetWindowUserPointer(m_window, this);
+    glfwSetFramebufferSizeCallback(m_window, framebufferSizeCallback);
 }
 
 void App::initVulkan()
 {
+    TRACE_ZONE("App::initVulkan");
     printf("App::initVulkan - start\n");
 
     createVulkanInstance();
-    createSurface();
+    if (!m_headless)
+    {
+        createSurface();
+    }
     setupDebugCallback();
     pickPhysicalDevice();
     createLogicalDevice();
+    if (!m_headless)
+    {
+        createSwapChain();
+    }
 
     printf("App::initVulkan - finish\n");
 }
 
 void App::mainLoop()
 {
+    if (m_headless)
+    {
+        // No window to pump events for; nothing is presented
+        return;
+    }
+
     while (glfwWindowShouldClose(m_window) == GLFW_FALSE)
     {
         glfwPollEvents();
+
+        // Nothing is drawn yet, so App never acquires or presents and the
+        // out-of-date path in SwapChain is not reached; the swapchain is only
+        // recreated here, when the framebuffer is resized
+        if (m_framebufferResized)
+        {
+            m_framebufferResized = false;
+
+            int width, height;
+            glfwGetFramebufferSize(m_window, &width, &height);
+            TRACE_ZONE("App::recreateSwapChain");
+            m_swapChain->create({ static_cast<uint32_t>(width), static_cast<uint32_t>(height) });
+        }
     }
 }
 
 void App::cleanup()
 {
+    TRACE_ZONE("App::cleanup");
     printf("App::cleanup\n");
 
     if (ENABLE_VALIDATION_LAYERS)
     {
         DestroyDebugReportCallbackEXT(m_vkInstance, m_vkDebugReportCallback, nullptr);
+        m_validationLog.reset();
     }
 
+    m_swapChain.reset();
     vkDestroyDevice(m_vkDevice, nullptr);
-    vkDestroySurfaceKHR(m_vkInstance, m_vkSurfaceKHR, nullptr);
+    if (!m_headless)
+    {
+        vkDestroySurfaceKHR(m_vkInstance, m_vkSurfaceKHR, nullptr);
+    }
     vkDestroyInstance(m_vkInstance, nullptr);
 
-    glfwDestroyWindow(m_window);
-    glfwTerminate();
+    if (!m_headless)
+    {
+        glfwDestroyWindow(m_window);
+        glfwTerminate();
+    }
 }
 
 void App::createVulkanInstance()
 {
+    TRACE_ZONE("App::createVulkanInstance");
     VkApplicationInfo applicationInfo = {};
     applicationInfo.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
     applicationInfo.pApplicationName = "my application";
@@ -160,15 +201,20 @@ void App::createVulkanInstance()
 
 std::vector<const char *> App::getRequiredExtensions()
 {
-    uint32_t glfwExtensionCount = 0;
-    const char **glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
-
     printf("Required extensions\n");
     std::vector<const char *> extensions;
-    for (int idx = 0; idx < glfwExtensionCount; ++idx)
+
+    // GLFW is never initialized in headless mode, and no surface extensions are needed
+    if (!m_headless)
     {
-        printf(" - %s\n", glfwExtensions[idx]);
-        extensions.push_back(glfwExtensions[idx]);
+        uint32_t glfwExtensionCount = 0;
+        const char **glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+
+        for (int idx = 0; idx < glfwExtensionCount; ++idx)
+        {
+            printf(" - %s\n", glfwExtensions[idx]);
+            extensions.push_back(glfwExtensions[idx]);
+        }
     }
 
     if (ENABLE_VALIDATION_LAYERS)
@@ -180,8 +226,19 @@ std::vector<const char *> App::getRequiredExtensions()
     return extensions;
 }
 
+std::vector<const char *> App::getRequiredDeviceExtensions()
+{
+    if (m_headless)
+    {
+        return {};
+    }
+
+    return DEVICE_EXTENSIONS;
+}
+
 void App::setupDebugCallback()
 {
+    TRACE_ZONE("App::setupDebugCallback");
     if (!ENABLE_VALIDATION_LAYERS)
     {
         return;
@@ -190,7 +247,11 @@ void App::setupDebugCallback()
     VkDebugReportCallbackCreateInfoEXT createInfo = {};
     createInfo.sType = VK_STRUCTURE_TYPE_DEBUG_REPORT_CALLBACK_CREATE_INFO_EXT;
     createInfo.flags = VK_DEBUG_REPORT_ERROR_BIT_EXT | VK_DEBUG_REPORT_WARNING_BIT_EXT;
-    createInfo.pfnCallback = debugCallback;
+    createInfo.pfnCallback = ValidationLog::debugCallback;
+
+    // Messages arrive on driver threads; the log keeps them off stdout
+    m_validationLog.reset(new ValidationLog(VALIDATION_LOG));
+    createInfo.pUserData = m_validationLog.get();
 
     if (CreateDebugReportCallbackEXT(m_vkInstance, &createInfo, nullptr, &m_vkDebugReportCallback) != VK_SUCCESS)
     {
@@ -200,6 +261,7 @@ void App::setupDebugCallback()
 
 void App::pickPhysicalDevice()
 {
+    TRACE_ZONE("App::pickPhysicalDevice");
     printf("App::pickPhysicalDevice - start\n");
 
     uint32_t physicalDeviceCount;
@@ -213,18 +275,82 @@ void App::pickPhysicalDevice()
     std::vector<VkPhysicalDevice> physicalDevices(physicalDeviceCount);
     vkEnumeratePhysicalDevices(m_vkInstance, &physicalDeviceCount, physicalDevices.data());
 
-    printf("Physical devices found\n");
-    for (VkPhysicalDevice physicalDevice : physicalDevices)
+    DeviceCalibrationCache calibrationCache(DEVICE_CALIBRATION_CACHE);
+
+    std::vector<DeviceScore> scores(physicalDeviceCount);
+    for (uint32_t idx = 0; idx < physicalDeviceCount; ++idx)
     {
         VkPhysicalDeviceProperties physicalDeviceProperties;
-        vkGetPhysicalDeviceProperties(physicalDevice, &physicalDeviceProperties);
-        printf(" - %s\n", physicalDeviceProperties.deviceName);
+        vkGetPhysicalDeviceProperties(physicalDevices[idx], &physicalDeviceProperties);
+
+        DeviceScore &score = scores[idx];
+        score.physicalDevice = physicalDevices[idx];
+        score.index = idx;
+        score.name = physicalDeviceProperties.deviceName;
+        score.suitable = isPhysicalDeviceSuitable(physicalDevices[idx], m_vkSurfaceKHR, getRequiredDeviceExtensions());
+        if (!score.suitable)
+        {
+            continue;
+        }
+
+        score.staticScore = scorePhysicalDevice(physicalDevices[idx], OPTIONAL_DEVICE_EXTENSIONS);
+
+        // Measuring takes a device of its own, so only on request; otherwise
+        // whatever an earlier run measured
+        score.calibratedGBps = calibrationCache.find(physicalDevices[idx]);
+        if (m_calibrate)
+        {
+            score.calibratedGBps = calibratePhysicalDevice(physicalDevices[idx]);
+            if (score.calibratedGBps > 0.0)
+            {
+                calibrationCache.store(physicalDevices[idx], score.calibratedGBps);
+            }
+        }
+    }
+
+    if (m_calibrate)
+    {
+        calibrationCache.save();
+    }
+
+    rankDeviceScores(scores);
+
+    printf("Physical devices found\n");
+    for (const DeviceScore &score : scores)
+    {
+        printf(" - [%u] %s\n", score.index, score.name.c_str());
+        if (!score.suitable)
+        {
+            printf("  - Device not suitable\n");
+        }
+        else if (score.calibratedGBps > 0.0)
+        {
+            printf("  - Score %.0f (static %.0f, calibrated %.1f GB/s)\n", score.score, score.staticScore, score.calibratedGBps);
+        }
+        else
+        {
+            printf("  - Score %.0f (static %.0f, not calibrated)\n", score.score, score.staticScore);
+        }
+    }
 
-        if (isPhysicalDeviceSuitable(physicalDevice, m_vkSurfaceKHR, DEVICE_EXTENSIONS))
+    // The command line wins over the environment
+    const char *deviceOverride = m_deviceOverride != nullptr ? m_deviceOverride : getenv(DEVICE_OVERRIDE_ENV);
+    if (deviceOverride != nullptr && deviceOverride[0] != '\0')
+    {
+        int overridden = findOverriddenDevice(scores, deviceOverride);
+        if (overridden == -1 || !scores[overridden].suitable)
         {
-            printf("  - Device suitable\n");
-            m_vkPhysicalDevice = physicalDevice;
+            char buffer[254];
+            snprintf(buffer, sizeof(buffer), "%s device override: %s", overridden == -1 ? "No" : "Unsuitable", deviceOverride);
+            throw std::runtime_error(buffer);
         }
+
+        printf("Device overridden: %s\n", scores[overridden].name.c_str());
+        m_vkPhysicalDevice = scores[overridden].physicalDevice;
+    }
+    else if (scores[0].suitable)
+    {
+        m_vkPhysicalDevice = scores[0].physicalDevice;
     }
 
     if (m_vkPhysicalDevice == VK_NULL_HANDLE)
@@ -237,21 +363,21 @@ void App::pickPhysicalDevice()
 
 void App::createLogicalDevice()
 {
+    TRACE_ZONE("App::createLogicalDevice");
     printf("App::createLogicalDevice - start\n");
 
     QueueFamilyIndicies queueFamilyInicies = findQueueFamilies(m_vkPhysicalDevice, m_vkSurfaceKHR);
+    m_queueAssignment = assignQueues(queueFamilyInicies, !m_headless, QUEUE_PRIORITIES);
 
-    float queuePriorities = 1.0f;
-    
+    // As many queues per family as the assignment uses, each with its own priority
     std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
-    std::set<int> uniqueQueueFamilyIndicies = { queueFamilyInicies.graphics, queueFamilyInicies.present };
-    for (int uniqueQueueFamilyIndex : uniqueQueueFamilyIndicies)
+    for (size_t idx = 0; idx < m_queueAssignment.families.size(); ++idx)
     {
         VkDeviceQueueCreateInfo deviceQueueCreateInfo = {};
         deviceQueueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
-        deviceQueueCreateInfo.queueCount = 1;
-        deviceQueueCreateInfo.queueFamilyIndex = uniqueQueueFamilyIndex;
-        deviceQueueCreateInfo.pQueuePriorities = &queuePriorities;
+        deviceQueueCreateInfo.queueCount = static_cast<uint32_t>(m_queueAssignment.priorities[idx].size());
+        deviceQueueCreateInfo.queueFamilyIndex = m_queueAssignment.families[idx];
+        deviceQueueCreateInfo.pQueuePriorities = m_queueAssignment.priorities[idx].data();
         queueCreateInfos.push_back(deviceQueueCreateInfo);
     }
 
@@ -262,8 +388,9 @@ void App::createLogicalDevice()
     deviceCreateInfo.queueCreateInfoCount = queueCreateInfos.size();
     deviceCreateInfo.pQueueCreateInfos = queueCreateInfos.data();
     deviceCreateInfo.pEnabledFeatures = &physicalDeviceFeatures;
-    deviceCreateInfo.enabledExtensionCount = static_cast<uint32_t>(DEVICE_EXTENSIONS.size());
-    deviceCreateInfo.ppEnabledExtensionNames = DEVICE_EXTENSIONS.data();
+    std::vector<const char *> deviceExtensions = getRequiredDeviceExtensions();
+    deviceCreateInfo.enabledExtensionCount = static_cast<uint32_t>(deviceExtensions.size());
+    deviceCreateInfo.ppEnabledExtensionNames = deviceExtensions.data();
     
     if (!ENABLE_VALIDATION_LAYERS)
     {
@@ -282,14 +409,24 @@ void App::createLogicalDevice()
     }
 
     printf("Getting device queues\n");
-    vkGetDeviceQueue(m_vkDevice, queueFamilyInicies.graphics, 0, &m_vkGraphicsQueue);
-    vkGetDeviceQueue(m_vkDevice, queueFamilyInicies.present, 0, &m_vkPresentQueue);
+    printf(" - graphics: family %d, queue %u\n", m_queueAssignment.graphics.family, m_queueAssignment.graphics.index);
+    vkGetDeviceQueue(m_vkDevice, m_queueAssignment.graphics.family, m_queueAssignment.graphics.index, &m_vkGraphicsQueue);
+    if (!m_headless)
+    {
+        printf(" - present: family %d, queue %u\n", m_queueAssignment.present.family, m_queueAssignment.present.index);
+        vkGetDeviceQueue(m_vkDevice, m_queueAssignment.present.family, m_queueAssignment.present.index, &m_vkPresentQueue);
+    }
+    printf(" - compute: family %d, queue %u\n", m_queueAssignment.compute.family, m_queueAssignment.compute.index);
+    vkGetDeviceQueue(m_vkDevice, m_queueAssignment.compute.family, m_queueAssignment.compute.index, &m_vkComputeQueue);
+    printf(" - transfer: family %d, queue %u\n", m_queueAssignment.transfer.family, m_queueAssignment.transfer.index);
+    vkGetDeviceQueue(m_vkDevice, m_queueAssignment.transfer.family, m_queueAssignment.transfer.index, &m_vkTransferQueue);
 
     printf("App::createLogicalDevice - finish\n");
 }
 
 void App::createSurface()
 {
+    TRACE_ZONE("App::createSurface");
     printf("App::createSurface - start\n");
 
     if (glfwCreateWindowSurface(m_vkInstance, m_window, nullptr, &m_vkSurfaceKHR) != VK_SUCCESS)
@@ -298,4 +435,24 @@ void App::createSurface()
     }
 
     printf("App::createSurface - finish\n");
+}
+
+void App::createSwapChain()
+{
+    TRACE_ZONE("App::createSwapChain");
+    printf("App::createSwapChain - start\n");
+
+    int width, height;
+    glfwGetFramebufferSize(m_window, &width, &height);
+
+    m_swapChain.reset(new SwapChain(m_vkPhysicalDevice, m_vkDevice, m_vkSurfaceKHR, m_queueAssignment, m_presentPolicy));
+    m_swapChain->create({ static_cast<uint32_t>(width), static_cast<uint32_t>(height) });
+
+    printf("App::createSwapChain - finish\n");
+}
+
+void App::framebufferSizeCallback(GLFWwindow *window, int /*width*/, int /*height*/)
+{
+    App *app = static_cast<App *>(glfwGetWindowUserPointer(window));
+    app->m_framebufferResized = true;
 }
\ No newline at end of file
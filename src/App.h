@@ -4,7 +4,9 @@
 #include <vector>
 #include <set>
 #include <cstdio>
+#include <cstdlib>
 #include <cstring>
+#include <memory>
 
 #define GLFW_INCLUDE_VULKAN
 #include <glfw/glfw3.h>
@@ -12,10 +14,16 @@
 #include "VulkanExtensions/DebugReportCallbackEXT.h"
 #include "QueueFamilies.h"
 #include "DeviceExtensions.h"
+#include "DeviceScore.h"
+#include "SwapChain.h"
+#include "ValidationLog.h"
+#include "Trace.h"
 
 class App
 {
 public:
+  explicit App(bool headless = false, const char *deviceOverride = nullptr, bool calibrate = false, PresentPolicy presentPolicy = PresentPolicy::LowLatency);
+
   void run();
 
 private:
@@ -25,6 +33,9 @@ private:
   const int HEIGHT = 600;
   const float MAX_QUEUE_PRIORITY = 1.0f;
 
+  // Graphics first; uploads only need to finish before they are used
+  const QueuePriorities QUEUE_PRIORITIES = { MAX_QUEUE_PRIORITY, 0.5f, 0.25f };
+
   const bool ENABLE_VALIDATION_LAYERS = true;
   const std::vector<const char *> VALIDATION_LAYERS = {
     "VK_LAYER_LUNARG_standard_validation"
@@ -34,16 +45,40 @@ private:
     VK_KHR_SWAPCHAIN_EXTENSION_NAME
   };
 
+  // Not needed, but a device with them ranks higher
+  const std::vector<const char *> OPTIONAL_DEVICE_EXTENSIONS = {
+    "VK_KHR_timeline_semaphore",
+    "VK_KHR_synchronization2",
+    "VK_EXT_descriptor_indexing",
+    "VK_EXT_memory_budget",
+    "VK_KHR_dedicated_allocation"
+  };
+
+  const char *DEVICE_OVERRIDE_ENV = "VULKAN_APP_DEVICE";
+  const char *DEVICE_CALIBRATION_CACHE = "device_calibration.txt";
+  const char *VALIDATION_LOG = "validation.log";
+
   /* Members */
 
-  GLFWwindow *m_window;
+  bool m_headless;
+  const char *m_deviceOverride;
+  bool m_calibrate;
+  PresentPolicy m_presentPolicy;
+
+  GLFWwindow *m_window = nullptr;
   VkInstance m_vkInstance = VK_NULL_HANDLE;
   VkDebugReportCallbackEXT m_vkDebugReportCallback = VK_NULL_HANDLE;
+  std::unique_ptr<ValidationLog> m_validationLog;
   VkPhysicalDevice m_vkPhysicalDevice = VK_NULL_HANDLE;
   VkDevice m_vkDevice = VK_NULL_HANDLE;
   VkQueue m_vkGraphicsQueue = VK_NULL_HANDLE;
   VkQueue m_vkPresentQueue = VK_NULL_HANDLE;
+  VkQueue m_vkComputeQueue = VK_NULL_HANDLE;
+  VkQueue m_vkTransferQueue = VK_NULL_HANDLE;
+  QueueAssignment m_queueAssignment;
   VkSurfaceKHR m_vkSurfaceKHR = VK_NULL_HANDLE;
+  std::unique_ptr<SwapChain> m_swapChain;
+  bool m_framebufferResized = false;
 
   /* Methods */
 
@@ -54,8 +89,12 @@ private:
 
   void createVulkanInstance();
   std::vector<const char *> getRequiredExtensions();
+  std::vector<const char *> getRequiredDeviceExtensions();
   void setupDebugCallback();
   void pickPhysicalDevice();
   void createLogicalDevice();
   void createSurface();
+  void createSwapChain();
+
+  static void framebufferSizeCallback(GLFWwindow *window, int width, int height);
 };
\ No newline at end of file
@@ -0,0 +1,383 @@
+#include "DeviceScore.h"
+#include "Trace.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+DeviceCalibrationCache::DeviceCalibrationCache(const char *path)
+    : m_path(path)
+{
+    FILE *file = fopen(path, "r");
+    if (file == nullptr)
+    {
+        return;
+    }
+
+    Entry entry;
+    while (fscanf(file, "%x %x %x %lf", &entry.vendorId, &entry.deviceId, &entry.driverVersion, &entry.gbps) == 4)
+    {
+        m_entries.push_back(entry);
+    }
+    fclose(file);
+}
+
+double DeviceCalibrationCache::find(VkPhysicalDevice physicalDevice) const
+{
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+
+    for (const Entry &entry : m_entries)
+    {
+        if (entry.vendorId == properties.vendorID && entry.deviceId == properties.deviceID && entry.driverVersion == properties.driverVersion)
+        {
+            return entry.gbps;
+        }
+    }
+
+    return -1.0;
+}
+
+void DeviceCalibrationCache::store(VkPhysicalDevice physicalDevice, double gbps)
+{
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+
+    // A new driver gets measured again; its old result goes
+    m_entries.erase(
+        std::remove_if(m_entries.begin(), m_entries.end(), [&](const Entry &entry) {
+            return entry.vendorId == properties.vendorID && entry.deviceId == properties.deviceID;
+        }),
+        m_entries.end());
+    m_entries.push_back({ properties.vendorID, properties.deviceID, properties.driverVersion, gbps });
+}
+
+void DeviceCalibrationCache::save() const
+{
+    FILE *file = fopen(m_path.c_str(), "w");
+    if (file == nullptr)
+    {
+        printf("Cannot write device calibration cache %s\n", m_path.c_str());
+        return;
+    }
+
+    for (const Entry &entry : m_entries)
+    {
+        fprintf(file, "%08x %08x %08x %.3f\n", entry.vendorId, entry.deviceId, entry.driverVersion, entry.gbps);
+    }
+    fclose(file);
+}
+
+double scorePhysicalDevice(VkPhysicalDevice physicalDevice, const std::vector<const char *> &optionalExtensions)
+{
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+
+    VkPhysicalDeviceFeatures features;
+    vkGetPhysicalDeviceFeatures(physicalDevice, &features);
+
+    VkPhysicalDeviceMemoryProperties memoryProperties;
+    vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+
+    // Tiers far enough apart that nothing below can reorder them
+    double score = 0.0;
+    switch (properties.deviceType)
+    {
+    case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU:
+        score += 4000.0;
+        break;
+    case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU:
+        score += 3000.0;
+        break;
+    case VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU:
+        score += 2000.0;
+        break;
+    case VK_PHYSICAL_DEVICE_TYPE_CPU:
+        score += 1000.0;
+        break;
+    default:
+        break;
+    }
+
+    // Up to 400 for the largest device-local heap, 25 per GiB
+    VkDeviceSize deviceLocalBytes = 0;
+    for (uint32_t idx = 0; idx < memoryProperties.memoryHeapCount; ++idx)
+    {
+        if (memoryProperties.memoryHeaps[idx].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT)
+        {
+            deviceLocalBytes = std::max(deviceLocalBytes, memoryProperties.memoryHeaps[idx].size);
+        }
+    }
+    score += std::min(25.0 * deviceLocalBytes / (1024.0 * 1024.0 * 1024.0), 400.0);
+
+    // Up to 200 for limits that track the size of the hardware
+    score += std::min(properties.limits.maxImageDimension2D / 16384.0, 1.0) * 50.0;
+    score += std::min(properties.limits.maxComputeSharedMemorySize / 65536.0, 1.0) * 50.0;
+    score += std::min(properties.limits.maxComputeWorkGroupInvocations / 1024.0, 1.0) * 50.0;
+    score += std::min(properties.limits.maxBoundDescriptorSets / 32.0, 1.0) * 50.0;
+
+    // 20 for each feature the demos use
+    const VkBool32 usefulFeatures[] = {
+        features.samplerAnisotropy,
+        features.textureCompressionBC,
+        features.multiDrawIndirect,
+        features.drawIndirectFirstInstance,
+        features.shaderSampledImageArrayDynamicIndexing,
+        features.fillModeNonSolid,
+        features.pipelineStatisticsQuery,
+    };
+    for (VkBool32 feature : usefulFeatures)
+    {
+        score += feature ? 20.0 : 0.0;
+    }
+
+    // 10 for each optional extension
+    uint32_t extensionCount;
+    vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &extensionCount, nullptr);
+    std::vector<VkExtensionProperties> extensions(extensionCount);
+    vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &extensionCount, extensions.data());
+    for (const char *optionalExtension : optionalExtensions)
+    {
+        for (const VkExtensionProperties &extension : extensions)
+        {
+            if (strcmp(optionalExtension, extension.extensionName) == 0)
+            {
+                score += 10.0;
+                break;
+            }
+        }
+    }
+
+    return score;
+}
+
+double calibratePhysicalDevice(VkPhysicalDevice physicalDevice)
+{
+    TRACE_ZONE("calibratePhysicalDevice");
+    const VkDeviceSize BUFFER_SIZE = 64ull * 1024 * 1024;
+    const uint32_t FILLS = 8;
+
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+
+    VkPhysicalDeviceMemoryProperties memoryProperties;
+    vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+
+    // Any family that can do graphics or compute can fill buffers; it must also time them
+    uint32_t queueFamilyCount;
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, nullptr);
+    std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, queueFamilies.data());
+
+    int queueFamily = -1;
+    for (uint32_t idx = 0; idx < queueFamilyCount && queueFamily == -1; ++idx)
+    {
+        if ((queueFamilies[idx].queueFlags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT)) && queueFamilies[idx].timestampValidBits > 0)
+        {
+            queueFamily = static_cast<int>(idx);
+        }
+    }
+    if (queueFamily == -1 || properties.limits.timestampPeriod <= 0.0f)
+    {
+        return -1.0;
+    }
+
+    float queuePriority = 1.0f;
+    VkDeviceQueueCreateInfo queueCreateInfo = {};
+    queueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+    queueCreateInfo.queueFamilyIndex = queueFamily;
+    queueCreateInfo.queueCount = 1;
+    queueCreateInfo.pQueuePriorities = &queuePriority;
+
+    VkDeviceCreateInfo deviceCreateInfo = {};
+    deviceCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+    deviceCreateInfo.queueCreateInfoCount = 1;
+    deviceCreateInfo.pQueueCreateInfos = &queueCreateInfo;
+
+    VkDevice device;
+    if (vkCreateDevice(physicalDevice, &deviceCreateInfo, nullptr, &device) != VK_SUCCESS)
+    {
+        return -1.0;
+    }
+
+    VkQueue queue;
+    vkGetDeviceQueue(device, queueFamily, 0, &queue);
+
+    VkBuffer buffer = VK_NULL_HANDLE;
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    VkCommandPool commandPool = VK_NULL_HANDLE;
+    VkQueryPool queryPool = VK_NULL_HANDLE;
+    VkFence fence = VK_NULL_HANDLE;
+    double gbps = -1.0;
+
+    // Each step only runs if everything before it worked; cleanup handles the rest
+    VkBufferCreateInfo bufferCreateInfo = {};
+    bufferCreateInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferCreateInfo.size = BUFFER_SIZE;
+    bufferCreateInfo.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+    bufferCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    bool ok = vkCreateBuffer(device, &bufferCreateInfo, nullptr, &buffer) == VK_SUCCESS;
+
+    if (ok)
+    {
+        VkMemoryRequirements requirements;
+        vkGetBufferMemoryRequirements(device, buffer, &requirements);
+
+        VkMemoryAllocateInfo allocateInfo = {};
+        allocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+        allocateInfo.allocationSize = requirements.size;
+        allocateInfo.memoryTypeIndex = UINT32_MAX;
+        for (uint32_t idx = 0; idx < memoryProperties.memoryTypeCount; ++idx)
+        {
+            if ((requirements.memoryTypeBits & (1u << idx)) &&
+                (memoryProperties.memoryTypes[idx].propertyFlags & VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT))
+            {
+                allocateInfo.memoryTypeIndex = idx;
+                break;
+            }
+        }
+
+        ok = allocateInfo.memoryTypeIndex != UINT32_MAX &&
+             vkAllocateMemory(device, &allocateInfo, nullptr, &memory) == VK_SUCCESS &&
+             vkBindBufferMemory(device, buffer, memory, 0) == VK_SUCCESS;
+    }
+
+    VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+    if (ok)
+    {
+        VkCommandPoolCreateInfo commandPoolCreateInfo = {};
+        commandPoolCreateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+        commandPoolCreateInfo.queueFamilyIndex = queueFamily;
+
+        VkCommandBufferAllocateInfo commandBufferAllocateInfo = {};
+        commandBufferAllocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        commandBufferAllocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        commandBufferAllocateInfo.commandBufferCount = 1;
+
+        VkQueryPoolCreateInfo queryPoolCreateInfo = {};
+        queryPoolCreateInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+        queryPoolCreateInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+        queryPoolCreateInfo.queryCount = 2;
+
+        VkFenceCreateInfo fenceCreateInfo = {};
+        fenceCreateInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+
+        ok = vkCreateCommandPool(device, &commandPoolCreateInfo, nullptr, &commandPool) == VK_SUCCESS &&
+             (commandBufferAllocateInfo.commandPool = commandPool,
+              vkAllocateCommandBuffers(device, &commandBufferAllocateInfo, &commandBuffer) == VK_SUCCESS) &&
+             vkCreateQueryPool(device, &queryPoolCreateInfo, nullptr, &queryPool) == VK_SUCCESS &&
+             vkCreateFence(device, &fenceCreateInfo, nullptr, &fence) == VK_SUCCESS;
+    }
+
+    if (ok)
+    {
+        VkCommandBufferBeginInfo beginInfo = {};
+        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        vkBeginCommandBuffer(commandBuffer, &beginInfo);
+
+        // One untimed fill first, so first-touch costs stay out of the result
+        vkCmdResetQueryPool(commandBuffer, queryPool, 0, 2);
+        vkCmdFillBuffer(commandBuffer, buffer, 0, VK_WHOLE_SIZE, 0);
+
+        VkMemoryBarrier barrier = {};
+        barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+        vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, queryPool, 0);
+        for (uint32_t fill = 0; fill < FILLS; ++fill)
+        {
+            vkCmdFillBuffer(commandBuffer, buffer, 0, VK_WHOLE_SIZE, fill);
+            vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+        }
+        vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, queryPool, 1);
+        vkEndCommandBuffer(commandBuffer);
+
+        VkSubmitInfo submitInfo = {};
+        submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        submitInfo.commandBufferCount = 1;
+        submitInfo.pCommandBuffers = &commandBuffer;
+
+        uint64_t timestamps[2];
+        bool done = vkQueueSubmit(queue, 1, &submitInfo, fence) == VK_SUCCESS &&
+                    vkWaitForFences(device, 1, &fence, VK_TRUE, 10ull * 1000 * 1000 * 1000) == VK_SUCCESS;
+        uint64_t fenceNs = TRACE_NOW();
+        if (done &&
+            vkGetQueryPoolResults(device, queryPool, 0, 2, sizeof(timestamps), timestamps, sizeof(uint64_t),
+                                  VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT) == VK_SUCCESS)
+        {
+            uint32_t validBits = queueFamilies[queueFamily].timestampValidBits;
+            uint64_t mask = validBits >= 64 ? ~0ull : (1ull << validBits) - 1;
+            double nanoseconds = ((timestamps[1] - timestamps[0]) & mask) * (double)properties.limits.timestampPeriod;
+            if (nanoseconds > 0.0)
+            {
+                gbps = (double)BUFFER_SIZE * FILLS / nanoseconds;
+
+                // The device clock has its own origin; the fills ended before the fence wait returned
+                TRACE_GPU_ZONE("calibration fills", fenceNs - (uint64_t)nanoseconds, fenceNs);
+            }
+        }
+    }
+
+    vkDeviceWaitIdle(device);
+    vkDestroyFence(device, fence, nullptr);
+    vkDestroyQueryPool(device, queryPool, nullptr);
+    vkDestroyCommandPool(device, commandPool, nullptr);
+    vkDestroyBuffer(device, buffer, nullptr);
+    vkFreeMemory(device, memory, nullptr);
+    vkDestroyDevice(device, nullptr);
+
+    return gbps;
+}
+
+void rankDeviceScores(std::vector<DeviceScore> &scores)
+{
+    // Measured speed only counts when every candidate has been measured;
+    // comparing one measured device against guesses would mean nothing
+    double fastest = 0.0;
+    bool allCalibrated = true;
+    for (const DeviceScore &score : scores)
+    {
+        if (score.suitable)
+        {
+            fastest = std::max(fastest, score.calibratedGBps);
+            allCalibrated = allCalibrated && score.calibratedGBps > 0.0;
+        }
+    }
+
+    for (DeviceScore &score : scores)
+    {
+        score.score = score.staticScore;
+        if (allCalibrated && fastest > 0.0)
+        {
+            score.score += 10000.0 * score.calibratedGBps / fastest;
+        }
+    }
+
+    std::stable_sort(scores.begin(), scores.end(), [](const DeviceScore &a, const DeviceScore &b) {
+        if (a.suitable != b.suitable)
+        {
+            return a.suitable;
+        }
+        return a.score > b.score;
+    });
+}
+
+int findOverriddenDevice(const std::vector<DeviceScore> &scores, const char *deviceOverride)
+{
+    char *end = nullptr;
+    unsigned long index = strtoul(deviceOverride, &end, 10);
+    bool isIndex = end != deviceOverride && *end == '\0';
+
+    for (size_t idx = 0; idx < scores.size(); ++idx)
+    {
+        if (isIndex ? scores[idx].index == index : scores[idx].name.find(deviceOverride) != std::string::npos)
+        {
+            return static_cast<int>(idx);
+        }
+    }
+
+    return -1;
+}
\ No newline at end of file
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <string>
+#include <vector>
+
+// How a physical device ranks for this app.  Type dominates the static part
+// (discrete over integrated over virtual over CPU); device-local memory,
+// limits, features and optional extensions break ties within a type.  A
+// calibration result, when there is one for every candidate, outweighs all
+// of it, so hybrid machines land on the device that is actually fastest.
+struct DeviceScore
+{
+    VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
+    uint32_t index = 0;  // In enumeration order
+    std::string name;
+    bool suitable = false;
+    double staticScore = 0.0;
+    double calibratedGBps = -1.0;  // Negative when not calibrated
+    double score = 0.0;
+};
+
+// Calibration results, one line per device and driver, in a text file
+class DeviceCalibrationCache
+{
+public:
+    explicit DeviceCalibrationCache(const char *path);
+
+    // Negative if this device and driver have not been calibrated
+    double find(VkPhysicalDevice physicalDevice) const;
+    void store(VkPhysicalDevice physicalDevice, double gbps);
+    void save() const;
+
+private:
+    struct Entry
+    {
+        uint32_t vendorId;
+        uint32_t deviceId;
+        uint32_t driverVersion;
+        double gbps;
+    };
+
+    std::string m_path;
+    std::vector<Entry> m_entries;
+};
+
+double scorePhysicalDevice(VkPhysicalDevice physicalDevice, const std::vector<const char *> &optionalExtensions);
+
+// Fill bandwidth of device-local memory in GB/s, timed on the GPU; negative
+// if the device cannot run the measurement
+double calibratePhysicalDevice(VkPhysicalDevice physicalDevice);
+
+// Orders scores best first and fills in DeviceScore::score
+void rankDeviceScores(std::vector<DeviceScore> &scores);
+
+// The device an override names: its index in enumeration order, or a
+// case-sensitive part of its name.  -1 if none matches.
+int findOverriddenDevice(const std::vector<DeviceScore> &scores, const char *deviceOverride);
\ No newline at end of file
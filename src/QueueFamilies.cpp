@@ -3,29 +3,53 @@
 QueueFamilyIndicies findQueueFamilies(VkPhysicalDevice physicalDevice, VkSurfaceKHR surface)
 {
     QueueFamilyIndicies queueFamilyIndicies;
-    
+
     uint32_t queueFamilyPropertyCount;
     vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyPropertyCount, nullptr);
 
     std::vector<VkQueueFamilyProperties> queueFamilyProperties(queueFamilyPropertyCount);
     vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyPropertyCount, queueFamilyProperties.data());
 
+    queueFamilyIndicies.queueCounts.resize(queueFamilyPropertyCount);
+
+    // The first family of each kind wins; drivers list the most capable first
     for (int idx = 0; idx < queueFamilyPropertyCount; ++idx)
     {
         VkQueueFamilyProperties properties = queueFamilyProperties[idx];
+        queueFamilyIndicies.queueCounts[idx] = properties.queueCount;
 
         if (properties.queueCount > 0)
         {
-            if (properties.queueFlags & VK_QUEUE_GRAPHICS_BIT)
+            bool isGraphics = (properties.queueFlags & VK_QUEUE_GRAPHICS_BIT) != 0;
+            bool isCompute = (properties.queueFlags & VK_QUEUE_COMPUTE_BIT) != 0;
+
+            if (isGraphics && queueFamilyIndicies.graphics == -1)
+            {
+                queueFamilyIndicies.graphics = idx;
+            }
+
+            if (isCompute && !isGraphics && queueFamilyIndicies.compute == -1)
             {
-                queueFamilyIndicies.graphics = idx;                
+                queueFamilyIndicies.compute = idx;
             }
 
-            VkBool32 presentSupport = false;
-            vkGetPhysicalDeviceSurfaceSupportKHR(physicalDevice, idx, surface, &presentSupport);
-            if (presentSupport)
+            // Graphics and compute families can transfer too, but a family that
+            // only transfers is usually a DMA engine of its own
+            if ((properties.queueFlags & VK_QUEUE_TRANSFER_BIT) && !isGraphics && !isCompute && queueFamilyIndicies.transfer == -1)
             {
-                queueFamilyIndicies.present = idx;
+                queueFamilyIndicies.transfer = idx;
+            }
+
+            // Without a surface (headless) there is nothing to present to.
+            // Presenting from the graphics family saves an ownership transfer.
+            if (surface != VK_NULL_HANDLE)
+            {
+                VkBool32 presentSupport = false;
+                vkGetPhysicalDeviceSurfaceSupportKHR(physicalDevice, idx, surface, &presentSupport);
+                if (presentSupport && (queueFamilyIndicies.present == -1 || (isGraphics && idx == queueFamilyIndicies.graphics)))
+                {
+                    queueFamilyIndicies.present = idx;
+                }
             }
         }
     }
@@ -33,9 +57,84 @@ QueueFamilyIndicies findQueueFamilies(VkPhysicalDevice physicalDevice, VkSurface
     return queueFamilyIndicies;
 }
 
-bool areAllQueueFamiliesFound(QueueFamilyIndicies &queueFamilyIndicies)
+bool areAllQueueFamiliesFound(QueueFamilyIndicies &queueFamilyIndicies, bool requirePresent)
 {
     return
         queueFamilyIndicies.graphics != -1 &&
-        queueFamilyIndicies.present != -1;
+        (!requirePresent || queueFamilyIndicies.present != -1);
+}
+
+// Takes the next queue of family if it has one left
+static bool takeQueue(QueueAssignment &assignment, const QueueFamilyIndicies &queueFamilyIndicies, int family, float priority, QueueSlot &slot)
+{
+    if (family == -1)
+    {
+        return false;
+    }
+
+    size_t position = 0;
+    while (position < assignment.families.size() && assignment.families[position] != family)
+    {
+        ++position;
+    }
+    if (position == assignment.families.size())
+    {
+        assignment.families.push_back(family);
+        assignment.priorities.push_back({});
+    }
+
+    std::vector<float> &priorities = assignment.priorities[position];
+    if (priorities.size() >= queueFamilyIndicies.queueCounts[family])
+    {
+        return false;
+    }
+
+    slot.family = family;
+    slot.index = static_cast<uint32_t>(priorities.size());
+    priorities.push_back(priority);
+    return true;
+}
+
+QueueAssignment assignQueues(const QueueFamilyIndicies &queueFamilyIndicies, bool requirePresent, const QueuePriorities &queuePriorities)
+{
+    QueueAssignment assignment;
+
+    takeQueue(assignment, queueFamilyIndicies, queueFamilyIndicies.graphics, queuePriorities.graphics, assignment.graphics);
+
+    if (requirePresent)
+    {
+        if (queueFamilyIndicies.present == queueFamilyIndicies.graphics)
+        {
+            assignment.present = assignment.graphics;
+        }
+        else
+        {
+            takeQueue(assignment, queueFamilyIndicies, queueFamilyIndicies.present, queuePriorities.graphics, assignment.present);
+        }
+    }
+
+    if (!takeQueue(assignment, queueFamilyIndicies, queueFamilyIndicies.compute, queuePriorities.compute, assignment.compute) &&
+        !takeQueue(assignment, queueFamilyIndicies, queueFamilyIndicies.graphics, queuePriorities.compute, assignment.compute))
+    {
+        assignment.compute = assignment.graphics;
+    }
+
+    if (!takeQueue(assignment, queueFamilyIndicies, queueFamilyIndicies.transfer, queuePriorities.transfer, assignment.transfer) &&
+        !takeQueue(assignment, queueFamilyIndicies, queueFamilyIndicies.compute, queuePriorities.transfer, assignment.transfer) &&
+        !takeQueue(assignment, queueFamilyIndicies, queueFamilyIndicies.graphics, queuePriorities.transfer, assignment.transfer))
+    {
+        assignment.transfer = assignment.compute;
+    }
+
+    // takeQueue may have listed a family it then found full
+    for (size_t position = assignment.families.size(); position-- > 0;)
+    {
+        if (assignment.priorities[position].empty())
+        {
+            assignment.families.erase(assignment.families.begin() + position);
+            assignment.priorities.erase(assignment.priorities.begin() + position);
+        }
+    }
+
+    return assignment;
 }
\ No newline at end of file
@@ -8,7 +8,48 @@ struct QueueFamilyIndicies
 {
     int graphics = -1;
     int present = -1;
+
+    // Families without graphics, so work there can overlap graphics work;
+    // -1 when the device has none
+    int compute = -1;   // Compute, and no graphics
+    int transfer = -1;  // Transfer only
+
+    // Queues available in each family, by family index
+    std::vector<uint32_t> queueCounts;
+};
+
+// Where one kind of work is submitted
+struct QueueSlot
+{
+    int family = -1;
+    uint32_t index = 0;
+};
+
+struct QueuePriorities
+{
+    float graphics = 1.0f;
+    float compute = 0.5f;
+    float transfer = 0.25f;
+};
+
+// A queue for each kind of work, each taken from the first family in its
+// fallback order that still has a spare queue.  Compute: its dedicated
+// family, then the graphics family; failing both it shares the graphics
+// queue.  Transfer: its dedicated family, then the compute family, then the
+// graphics family; failing all three it shares the compute queue, which may
+// itself be the graphics queue.
+struct QueueAssignment
+{
+    QueueSlot graphics;
+    QueueSlot present;
+    QueueSlot compute;
+    QueueSlot transfer;
+
+    // The queues to create in each family used, priorities in queue index order
+    std::vector<int> families;
+    std::vector<std::vector<float>> priorities;
 };
 
 QueueFamilyIndicies findQueueFamilies(VkPhysicalDevice physicalDevice, VkSurfaceKHR vkSurface);
-bool areAllQueueFamiliesFound(QueueFamilyIndicies &queueFamilyIndicies);
\ No newline at end of file
+bool areAllQueueFamiliesFound(QueueFamilyIndicies &queueFamilyIndicies, bool requirePresent);
+QueueAssignment assignQueues(const QueueFamilyIndicies &queueFamilyIndicies, bool requirePresent, const QueuePriorities &queuePriorities);
\ No newline at end of file
@@ -1,4 +1,9 @@
 #include "SwapChain.h"
+#include "Trace.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <stdexcept>
 
 SwapChainSupportDetails queySwapChainSupport(VkPhysicalDevice physicalDevice, VkSurfaceKHR surface)
 {
@@ -14,5 +19,326 @@ SwapChainSupportDetails queySwapChainSupport(VkPhysicalDevice physicalDevice, Vk
         vkGetPhysicalDeviceSurfaceFormatsKHR(physicalDevice, surface, &formatCount, swapChainSupportDetails.formats.data());
     }
 
+    uint32_t presentModeCount;
+    vkGetPhysicalDeviceSurfacePresentModesKHR(physicalDevice, surface, &presentModeCount, nullptr);
+    if (presentModeCount != 0)
+    {
+        swapChainSupportDetails.presentModes.resize(presentModeCount);
+        vkGetPhysicalDeviceSurfacePresentModesKHR(physicalDevice, surface, &presentModeCount, swapChainSupportDetails.presentModes.data());
+    }
+
     return swapChainSupportDetails;
+}
+
+const char *presentPolicyName(PresentPolicy policy)
+{
+    switch (policy)
+    {
+    case PresentPolicy::LowLatency:
+        return "low latency";
+    case PresentPolicy::PowerSaving:
+        return "power saving";
+    case PresentPolicy::Benchmark:
+        return "benchmark";
+    }
+
+    return "unknown";
+}
+
+const char *presentModeName(VkPresentModeKHR presentMode)
+{
+    switch (presentMode)
+    {
+    case VK_PRESENT_MODE_IMMEDIATE_KHR:
+        return "immediate";
+    case VK_PRESENT_MODE_MAILBOX_KHR:
+        return "mailbox";
+    case VK_PRESENT_MODE_FIFO_KHR:
+        return "fifo";
+    case VK_PRESENT_MODE_FIFO_RELAXED_KHR:
+        return "fifo relaxed";
+    default:
+        return "unknown";
+    }
+}
+
+VkPresentModeKHR choosePresentMode(const std::vector<VkPresentModeKHR> &presentModes, PresentPolicy policy)
+{
+    std::vector<VkPresentModeKHR> preferred;
+    switch (policy)
+    {
+    case PresentPolicy::LowLatency:
+        // Immediate is as quick but tears; still better than waiting in FIFO
+        preferred = { VK_PRESENT_MODE_MAILBOX_KHR, VK_PRESENT_MODE_IMMEDIATE_KHR };
+        break;
+    case PresentPolicy::PowerSaving:
+        break;
+    case PresentPolicy::Benchmark:
+        preferred = { VK_PRESENT_MODE_IMMEDIATE_KHR, VK_PRESENT_MODE_MAILBOX_KHR };
+        break;
+    }
+
+    for (VkPresentModeKHR presentMode : preferred)
+    {
+        if (std::find(presentModes.begin(), presentModes.end(), presentMode) != presentModes.end())
+        {
+            return presentMode;
+        }
+    }
+
+    return VK_PRESENT_MODE_FIFO_KHR;
+}
+
+uint32_t chooseImageCount(const VkSurfaceCapabilitiesKHR &capabilities, VkPresentModeKHR presentMode)
+{
+    // FIFO with the minimum is plain double buffering on most drivers, the
+    // least memory and the fewest frames rendered ahead.  Mailbox and
+    // immediate need one more so there is always a free image to render
+    // into while one is displayed and another waits.
+    uint32_t imageCount = capabilities.minImageCount;
+    if (presentMode == VK_PRESENT_MODE_MAILBOX_KHR || presentMode == VK_PRESENT_MODE_IMMEDIATE_KHR)
+    {
+        imageCount = std::max(imageCount + 1, 3u);
+    }
+
+    // 0 means no limit
+    if (capabilities.maxImageCount > 0)
+    {
+        imageCount = std::min(imageCount, capabilities.maxImageCount);
+    }
+
+    return imageCount;
+}
+
+VkSurfaceFormatKHR chooseSurfaceFormat(const std::vector<VkSurfaceFormatKHR> &formats)
+{
+    // A single undefined format means the surface takes anything
+    if (formats.size() == 1 && formats[0].format == VK_FORMAT_UNDEFINED)
+    {
+        return { VK_FORMAT_B8G8R8A8_UNORM, VK_COLOR_SPACE_SRGB_NONLINEAR_KHR };
+    }
+
+    for (const VkSurfaceFormatKHR &format : formats)
+    {
+        if (format.format == VK_FORMAT_B8G8R8A8_UNORM && format.colorSpace == VK_COLOR_SPACE_SRGB_NONLINEAR_KHR)
+        {
+            return format;
+        }
+    }
+
+    return formats[0];
+}
+
+VkExtent2D chooseExtent(const VkSurfaceCapabilitiesKHR &capabilities, VkExtent2D requested)
+{
+    // The surface decides, unless it says the app does
+    if (capabilities.currentExtent.width != UINT32_MAX)
+    {
+        return capabilities.currentExtent;
+    }
+
+    VkExtent2D extent;
+    extent.width = std::max(capabilities.minImageExtent.width, std::min(capabilities.maxImageExtent.width, requested.width));
+    extent.height = std::max(capabilities.minImageExtent.height, std::min(capabilities.maxImageExtent.height, requested.height));
+    return extent;
+}
+
+SwapChain::SwapChain(VkPhysicalDevice physicalDevice, VkDevice device, VkSurfaceKHR surface, const QueueAssignment &queueAssignment, PresentPolicy policy)
+    : m_physicalDevice(physicalDevice)
+    , m_device(device)
+    , m_surface(surface)
+    , m_queueAssignment(queueAssignment)
+    , m_policy(policy)
+{
+}
+
+SwapChain::~SwapChain()
+{
+    destroyImageViews();
+    vkDestroySwapchainKHR(m_device, m_swapChain, nullptr);
+}
+
+void SwapChain::create(VkExtent2D requested)
+{
+    TRACE_ZONE("SwapChain::create");
+    m_requested = requested;
+
+    SwapChainSupportDetails support = queySwapChainSupport(m_physicalDevice, m_surface);
+    if (support.formats.empty() || support.presentModes.empty())
+    {
+        throw std::runtime_error("Surface has no formats or present modes");
+    }
+
+    VkExtent2D extent = chooseExtent(support.capabilities, requested);
+    if (extent.width == 0 || extent.height == 0)
+    {
+        // Minimized; there is nothing to present to until the window comes back
+        m_stale = true;
+        return;
+    }
+
+    m_surfaceFormat = chooseSurfaceFormat(support.formats);
+    m_presentMode = choosePresentMode(support.presentModes, m_policy);
+    m_minImageCount = support.capabilities.minImageCount;
+    m_extent = extent;
+
+    VkSwapchainCreateInfoKHR swapChainCreateInfo = {};
+    swapChainCreateInfo.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
+    swapChainCreateInfo.surface = m_surface;
+    swapChainCreateInfo.minImageCount = chooseImageCount(support.capabilities, m_presentMode);
+    swapChainCreateInfo.imageFormat = m_surfaceFormat.format;
+    swapChainCreateInfo.imageColorSpace = m_surfaceFormat.colorSpace;
+    swapChainCreateInfo.imageExtent = m_extent;
+    swapChainCreateInfo.imageArrayLayers = 1;
+    swapChainCreateInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+    swapChainCreateInfo.preTransform = support.capabilities.currentTransform;
+    swapChainCreateInfo.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
+    swapChainCreateInfo.presentMode = m_presentMode;
+    swapChainCreateInfo.clipped = VK_TRUE;
+    swapChainCreateInfo.oldSwapchain = m_swapChain;
+
+    // Rendered on one family and presented on another: share the images
+    // rather than transfer ownership every frame
+    uint32_t queueFamilyIndices[] = {
+        static_cast<uint32_t>(m_queueAssignment.graphics.family),
+        static_cast<uint32_t>(m_queueAssignment.present.family)
+    };
+    if (m_queueAssignment.graphics.family != m_queueAssignment.present.family)
+    {
+        swapChainCreateInfo.imageSharingMode = VK_SHARING_MODE_CONCURRENT;
+        swapChainCreateInfo.queueFamilyIndexCount = 2;
+        swapChainCreateInfo.pQueueFamilyIndices = queueFamilyIndices;
+    }
+    else
+    {
+        swapChainCreateInfo.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    }
+
+    VkSwapchainKHR swapChain;
+    if (vkCreateSwapchainKHR(m_device, &swapChainCreateInfo, nullptr, &swapChain) != VK_SUCCESS)
+    {
+        throw std::runtime_error("Failed to create swap chain");
+    }
+
+    // The old images may still be on their way to the display
+    if (m_swapChain != VK_NULL_HANDLE)
+    {
+        vkDeviceWaitIdle(m_device);
+        destroyImageViews();
+        vkDestroySwapchainKHR(m_device, m_swapChain, nullptr);
+    }
+    m_swapChain = swapChain;
+    m_stale = false;
+
+    uint32_t swapChainImageCount;
+    vkGetSwapchainImagesKHR(m_device, m_swapChain, &swapChainImageCount, nullptr);
+    m_images.resize(swapChainImageCount);
+    vkGetSwapchainImagesKHR(m_device, m_swapChain, &swapChainImageCount, m_images.data());
+
+    m_imageViews.resize(swapChainImageCount);
+    for (uint32_t idx = 0; idx < swapChainImageCount; ++idx)
+    {
+        VkImageViewCreateInfo imageViewCreateInfo = {};
+        imageViewCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+        imageViewCreateInfo.image = m_images[idx];
+        imageViewCreateInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+        imageViewCreateInfo.format = m_surfaceFormat.format;
+        imageViewCreateInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        imageViewCreateInfo.subresourceRange.levelCount = 1;
+        imageViewCreateInfo.subresourceRange.layerCount = 1;
+
+        if (vkCreateImageView(m_device, &imageViewCreateInfo, nullptr, &m_imageViews[idx]) != VK_SUCCESS)
+        {
+            throw std::runtime_error("Failed to create swap chain image view");
+        }
+    }
+
+    printf("SwapChain: %ux%u, %s for %s, %u images (asked for %u), %u acquirable at once, %u frames queued at most\n",
+           m_extent.width, m_extent.height, presentModeName(m_presentMode), presentPolicyName(m_policy), imageCount(),
+           swapChainCreateInfo.minImageCount, acquirableImages(), queueDepth());
+}
+
+void SwapChain::resize(VkExtent2D requested)
+{
+    m_requested = requested;
+    m_stale = true;
+}
+
+bool SwapChain::acquireNextImage(VkSemaphore signalSemaphore, uint32_t &imageIndex)
+{
+    if (m_stale)
+    {
+        create(m_requested);
+        if (m_stale)
+        {
+            return false;
+        }
+    }
+
+    VkResult result = vkAcquireNextImageKHR(m_device, m_swapChain, UINT64_MAX, signalSemaphore, VK_NULL_HANDLE, &imageIndex);
+    if (result == VK_ERROR_OUT_OF_DATE_KHR)
+    {
+        // Nothing was signalled; try again next frame with a new swapchain
+        create(m_requested);
+        return false;
+    }
+    if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR)
+    {
+        throw std::runtime_error("Failed to acquire swap chain image");
+    }
+
+    // Suboptimal still presents; recreate after this frame
+    m_stale = result == VK_SUBOPTIMAL_KHR;
+    return true;
+}
+
+void SwapChain::present(VkQueue queue, VkSemaphore waitSemaphore, uint32_t imageIndex)
+{
+    VkPresentInfoKHR presentInfo = {};
+    presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+    presentInfo.waitSemaphoreCount = waitSemaphore != VK_NULL_HANDLE ? 1 : 0;
+    presentInfo.pWaitSemaphores = &waitSemaphore;
+    presentInfo.swapchainCount = 1;
+    presentInfo.pSwapchains = &m_swapChain;
+    presentInfo.pImageIndices = &imageIndex;
+
+    VkResult result = vkQueuePresentKHR(queue, &presentInfo);
+    if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR)
+    {
+        m_stale = true;
+    }
+    else if (result != VK_SUCCESS)
+    {
+        throw std::runtime_error("Failed to present swap chain image");
+    }
+}
+
+uint32_t SwapChain::acquirableImages() const
+{
+    // The presentation engine keeps minImageCount - 1 for itself
+    return imageCount() >= m_minImageCount ? imageCount() - m_minImageCount + 1 : 1;
+}
+
+uint32_t SwapChain::queueDepth() const
+{
+    switch (m_presentMode)
+    {
+    case VK_PRESENT_MODE_IMMEDIATE_KHR:
+        return 0;
+    case VK_PRESENT_MODE_MAILBOX_KHR:
+        return 1;
+    default:
+        // Every image but the one on screen can wait in the FIFO
+        return imageCount() > 0 ? imageCount() - 1 : 0;
+    }
+}
+
+void SwapChain::destroyImageViews()
+{
+    for (VkImageView imageView : m_imageViews)
+    {
+        vkDestroyImageView(m_device, imageView, nullptr);
+    }
+    m_imageViews.clear();
+    m_images.clear();
 }
\ No newline at end of file
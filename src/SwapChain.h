@@ -4,6 +4,8 @@
 
 #include <vector>
 
+#include "QueueFamilies.h"
+
 struct SwapChainSupportDetails
 {
     VkSurfaceCapabilitiesKHR capabilities;
@@ -13,3 +15,77 @@ struct SwapChainSupportDetails
 
 SwapChainSupportDetails queySwapChainSupport(VkPhysicalDevice physicalDevice, VkSurfaceKHR surface);
 
+// What presentation is tuned for
+enum class PresentPolicy
+{
+    LowLatency,  // Mailbox: newest frame wins, rendering never waits on vblank
+    PowerSaving, // FIFO: vsync'd, as few images as the surface allows
+    Benchmark    // Immediate: no vsync, frame rate is only bound by the GPU
+};
+
+const char *presentPolicyName(PresentPolicy policy);
+const char *presentModeName(VkPresentModeKHR presentMode);
+
+// Falls back towards FIFO, which every surface supports
+VkPresentModeKHR choosePresentMode(const std::vector<VkPresentModeKHR> &presentModes, PresentPolicy policy);
+uint32_t chooseImageCount(const VkSurfaceCapabilitiesKHR &capabilities, VkPresentModeKHR presentMode);
+VkSurfaceFormatKHR chooseSurfaceFormat(const std::vector<VkSurfaceFormatKHR> &formats);
+VkExtent2D chooseExtent(const VkSurfaceCapabilitiesKHR &capabilities, VkExtent2D requested);
+
+class SwapChain
+{
+public:
+    SwapChain(VkPhysicalDevice physicalDevice, VkDevice device, VkSurfaceKHR surface, const QueueAssignment &queueAssignment, PresentPolicy policy);
+    ~SwapChain();
+
+    SwapChain(const SwapChain &) = delete;
+    SwapChain &operator=(const SwapChain &) = delete;
+
+    // Builds the swapchain, replacing the current one if there is one.
+    // requested is used when the surface leaves the size to the app.
+    void create(VkExtent2D requested);
+
+    // The window changed size; the swapchain follows on the next acquire
+    void resize(VkExtent2D requested);
+
+    // Both recreate the swapchain when it no longer matches the surface.
+    // acquireNextImage returns false if there is no image this time (out of
+    // date, or a zero-sized window); the caller skips the frame.
+    bool acquireNextImage(VkSemaphore signalSemaphore, uint32_t &imageIndex);
+    void present(VkQueue queue, VkSemaphore waitSemaphore, uint32_t imageIndex);
+
+    VkSwapchainKHR handle() const { return m_swapChain; }
+    VkFormat format() const { return m_surfaceFormat.format; }
+    VkExtent2D extent() const { return m_extent; }
+    VkPresentModeKHR presentMode() const { return m_presentMode; }
+    const std::vector<VkImage> &images() const { return m_images; }
+    const std::vector<VkImageView> &imageViews() const { return m_imageViews; }
+
+    // What the driver actually gave, which may be more images than asked for
+    uint32_t imageCount() const { return static_cast<uint32_t>(m_images.size()); }
+
+    // Images the app can hold acquired at the same time without blocking
+    uint32_t acquirableImages() const;
+
+    // Finished frames that can wait for the display; each adds a refresh of latency
+    uint32_t queueDepth() const;
+
+private:
+    void destroyImageViews();
+
+    VkPhysicalDevice m_physicalDevice;
+    VkDevice m_device;
+    VkSurfaceKHR m_surface;
+    QueueAssignment m_queueAssignment;
+    PresentPolicy m_policy;
+
+    VkSwapchainKHR m_swapChain = VK_NULL_HANDLE;
+    VkSurfaceFormatKHR m_surfaceFormat = {};
+    VkPresentModeKHR m_presentMode = VK_PRESENT_MODE_FIFO_KHR;
+    VkExtent2D m_extent = {};
+    VkExtent2D m_requested = {};
+    uint32_t m_minImageCount = 0;
+    bool m_stale = false;
+    std::vector<VkImage> m_images;
+    std::vector<VkImageView> m_imageViews;
+};
\ No newline at end of file
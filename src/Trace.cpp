@@ -0,0 +1,103 @@
+#include "Trace.h"
+
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace
+{
+    struct Event
+    {
+        const char *name;
+        uint64_t beginNs;
+        uint64_t endNs;
+    };
+
+    struct Track
+    {
+        uint32_t id;
+        const char *name;
+        std::vector<Event> events;
+    };
+
+    std::chrono::steady_clock::time_point g_epoch = std::chrono::steady_clock::now();
+    std::mutex g_tracksMutex;
+    std::vector<std::unique_ptr<Track>> g_tracks;
+
+    // Registration is the only locked step; a track lives until exit
+    Track *addTrack(const char *name)
+    {
+        std::lock_guard<std::mutex> lock(g_tracksMutex);
+        g_tracks.emplace_back(new Track{ static_cast<uint32_t>(g_tracks.size()) + 1, name, {} });
+        g_tracks.back()->events.reserve(4096);
+        return g_tracks.back().get();
+    }
+
+    Track &localTrack()
+    {
+        thread_local Track *track = addTrack(nullptr);
+        return *track;
+    }
+
+    Track &gpuTrack()
+    {
+        static Track *track = addTrack("GPU");
+        return *track;
+    }
+}
+
+uint64_t Trace::now()
+{
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - g_epoch).count());
+}
+
+void Trace::nameThread(const char *name)
+{
+    localTrack().name = name;
+}
+
+void Trace::addZone(const char *name, uint64_t beginNs, uint64_t endNs)
+{
+    localTrack().events.push_back({ name, beginNs, endNs });
+}
+
+void Trace::addGpuZone(const char *name, uint64_t beginNs, uint64_t endNs)
+{
+    // Any thread may report GPU work
+    Track &track = gpuTrack();
+    std::lock_guard<std::mutex> lock(g_tracksMutex);
+    track.events.push_back({ name, beginNs, endNs });
+}
+
+bool Trace::write(const char *path)
+{
+#ifndef APP_TRACE
+    printf("Not writing %s: tracing is compiled out, build with -DAPP_TRACE\n", path);
+    return false;
+#else
+    FILE *file = fopen(path, "w");
+    if (file == nullptr)
+    {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(g_tracksMutex);
+    fprintf(file, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n");
+    for (size_t idx = 0; idx < g_tracks.size(); ++idx)
+    {
+        const Track &track = *g_tracks[idx];
+        fprintf(file, "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %u, \"args\": {\"name\": \"%s\"}}",
+                idx == 0 ? "" : ",\n", track.id, track.name != nullptr ? track.name : "thread");
+        for (const Event &event : track.events)
+        {
+            fprintf(file, ",\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %u, \"ts\": %.3f, \"dur\": %.3f}", event.name, track.id,
+                    event.beginNs / 1e3, (event.endNs - event.beginNs) / 1e3);
+        }
+    }
+    fprintf(file, "\n]}\n");
+    fclose(file);
+    return true;
+#endif
+}
\ No newline at end of file
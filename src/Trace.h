@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstdint>
+
+// Scoped trace zones, exported as Chrome trace-event JSON (chrome://tracing or
+// ui.perfetto.dev).  TRACE_ZONE("name") times the rest of the enclosing scope
+// in nanoseconds; each thread appends to its own buffer without locking.
+// Names are kept by pointer and must be string literals.  Zones measured on
+// the GPU go on a track of their own once converted to Trace::now() time.
+//
+// All of it compiles away unless APP_TRACE is defined.
+namespace Trace
+{
+    // Nanoseconds since the first call
+    uint64_t now();
+
+    void nameThread(const char *name);
+    void addZone(const char *name, uint64_t beginNs, uint64_t endNs);
+    void addGpuZone(const char *name, uint64_t beginNs, uint64_t endNs);
+
+    // Only once no other thread records zones; false if nothing was written
+    bool write(const char *path);
+
+    class Zone
+    {
+    public:
+        explicit Zone(const char *name)
+            : m_name(name)
+            , m_beginNs(now())
+        {
+        }
+
+        ~Zone()
+        {
+            addZone(m_name, m_beginNs, now());
+        }
+
+        Zone(const Zone &) = delete;
+        Zone &operator=(const Zone &) = delete;
+
+    private:
+        const char *m_name;
+        uint64_t m_beginNs;
+    };
+}
+
+#ifdef APP_TRACE
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+#define TRACE_ZONE(name) Trace::Zone TRACE_CONCAT(traceZone, __LINE__)(name)
+#define TRACE_THREAD(name) Trace::nameThread(name)
+#define TRACE_GPU_ZONE(name, beginNs, endNs) Trace::addGpuZone(name, beginNs, endNs)
+#define TRACE_NOW() Trace::now()
+#else
+#define TRACE_ZONE(name) ((void)0)
+#define TRACE_THREAD(name) ((void)0)
+#define TRACE_GPU_ZONE(name, beginNs, endNs) ((void)sizeof(beginNs), (void)sizeof(endNs))
+#define TRACE_NOW() ((uint64_t)0)
+#endif
\ No newline at end of file
@@ -0,0 +1,222 @@
+#include "ValidationLog.h"
+#include "Trace.h"
+
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+
+namespace
+{
+    uint64_t nowMilliseconds()
+    {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count());
+    }
+
+    // Copies and hashes (FNV-1a) in one pass, truncating to the buffer
+    uint64_t copyAndHash(char *dst, size_t size, const char *src, uint64_t hash)
+    {
+        size_t i = 0;
+        if (src != nullptr)
+        {
+            for (; i + 1 < size && src[i] != '\0'; ++i)
+            {
+                dst[i] = src[i];
+                hash = (hash ^ static_cast<uint8_t>(src[i])) * 0x100000001b3ull;
+            }
+        }
+        dst[i] = '\0';
+        return hash;
+    }
+
+    const char *severityName(VkDebugReportFlagsEXT flags)
+    {
+        if (flags & VK_DEBUG_REPORT_ERROR_BIT_EXT)
+        {
+            return "error";
+        }
+        if (flags & VK_DEBUG_REPORT_WARNING_BIT_EXT)
+        {
+            return "warning";
+        }
+        if (flags & VK_DEBUG_REPORT_PERFORMANCE_WARNING_BIT_EXT)
+        {
+            return "performance";
+        }
+        if (flags & VK_DEBUG_REPORT_DEBUG_BIT_EXT)
+        {
+            return "debug";
+        }
+        return "info";
+    }
+}
+
+ValidationLog::ValidationLog(const char *path)
+    : m_path(path)
+    , m_slots(new Slot[CAPACITY])
+{
+    m_file = fopen(path, "w");
+    if (m_file == nullptr)
+    {
+        throw std::runtime_error("Failed to open the validation log");
+    }
+
+    for (uint32_t i = 0; i < CAPACITY; ++i)
+    {
+        m_slots[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    m_drainer = std::thread(&ValidationLog::drainLoop, this);
+}
+
+ValidationLog::~ValidationLog()
+{
+    m_stop.store(true, std::memory_order_release);
+    m_drainer.join();
+
+    writeSummary();
+    fclose(m_file);
+}
+
+bool ValidationLog::push(VkDebugReportFlagsEXT flags, int32_t code, const char *layerPrefix, const char *message)
+{
+    // Claim a position; a slot is free once the drainer has moved its
+    // sequence a whole lap ahead
+    uint64_t position = m_head.load(std::memory_order_relaxed);
+    Slot *slot;
+    for (;;)
+    {
+        slot = &m_slots[position & (CAPACITY - 1)];
+        int64_t lag = static_cast<int64_t>(slot->sequence.load(std::memory_order_acquire) - position);
+        if (lag == 0)
+        {
+            if (m_head.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+            {
+                break;
+            }
+        }
+        else if (lag < 0)
+        {
+            // Full: the drainer has not caught up
+            m_dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        else
+        {
+            position = m_head.load(std::memory_order_relaxed);
+        }
+    }
+
+    slot->flags = flags;
+    slot->code = code;
+    // Keyed on everything write() prints, so only identical lines count as
+    // repeats; hashing the prefix's terminator keeps it apart from the message
+    uint64_t hash = 0xcbf29ce484222325ull ^ (static_cast<uint64_t>(flags) << 32 | static_cast<uint32_t>(code));
+    hash = copyAndHash(slot->prefix, sizeof(slot->prefix), layerPrefix, hash) * 0x100000001b3ull;
+    slot->hash = copyAndHash(slot->message, sizeof(slot->message), message, hash);
+    slot->sequence.store(position + 1, std::memory_order_release);
+    return true;
+}
+
+VKAPI_ATTR VkBool32 VKAPI_CALL ValidationLog::debugCallback(
+    VkDebugReportFlagsEXT flags,
+    VkDebugReportObjectTypeEXT objType,
+    uint64_t obj,
+    size_t location,
+    int32_t code,
+    const char *layerPrefix,
+    const char *msg,
+    void *userData)
+{
+    static_cast<ValidationLog *>(userData)->push(flags, code, layerPrefix, msg);
+    return VK_FALSE;
+}
+
+void ValidationLog::drainLoop()
+{
+    TRACE_THREAD("validation log");
+    while (!m_stop.load(std::memory_order_acquire))
+    {
+        if (!drain())
+        {
+            reportRepeats(false, nowMilliseconds());
+            std::this_thread::sleep_for(std::chrono::milliseconds(DRAIN_INTERVAL_MS));
+        }
+    }
+
+    // Whatever was pushed before the callback went away
+    while (drain())
+    {
+    }
+    reportRepeats(true, nowMilliseconds());
+}
+
+bool ValidationLog::drain()
+{
+    Slot &slot = m_slots[m_tail & (CAPACITY - 1)];
+    if (slot.sequence.load(std::memory_order_acquire) != m_tail + 1)
+    {
+        return false;
+    }
+
+    write(slot, nowMilliseconds());
+
+    slot.sequence.store(m_tail + CAPACITY, std::memory_order_release);
+    ++m_tail;
+    return true;
+}
+
+void ValidationLog::write(const Slot &slot, uint64_t nowMs)
+{
+    Repeats &repeats = m_repeats[slot.hash];
+    ++repeats.total;
+    if (repeats.total > 1)
+    {
+        ++repeats.unreported;
+        return;
+    }
+
+    repeats.lastReportMs = nowMs;
+    repeats.code = slot.code;
+    fprintf(m_file, "[%s] %s (code %d, #%016llx): %s\n", severityName(slot.flags), slot.prefix, slot.code,
+            static_cast<unsigned long long>(slot.hash), slot.message);
+    ++m_written;
+}
+
+void ValidationLog::reportRepeats(bool all, uint64_t nowMs)
+{
+    for (auto &entry : m_repeats)
+    {
+        Repeats &repeats = entry.second;
+        if (repeats.unreported == 0 || (!all && nowMs - repeats.lastReportMs < REPEAT_INTERVAL_MS))
+        {
+            continue;
+        }
+
+        fprintf(m_file, "[repeat] #%016llx (code %d) x%llu, %llu in total\n", static_cast<unsigned long long>(entry.first),
+                repeats.code, static_cast<unsigned long long>(repeats.unreported), static_cast<unsigned long long>(repeats.total));
+        repeats.unreported = 0;
+        repeats.lastReportMs = nowMs;
+    }
+
+    // Only called when the ring is empty, so this is off the busy path
+    fflush(m_file);
+}
+
+void ValidationLog::writeSummary()
+{
+    uint64_t total = 0;
+    for (const auto &entry : m_repeats)
+    {
+        total += entry.second.total;
+    }
+    uint64_t dropped = m_dropped.load(std::memory_order_relaxed);
+
+    fprintf(m_file, "%llu messages, %llu distinct, %llu dropped\n", static_cast<unsigned long long>(total),
+            static_cast<unsigned long long>(m_written), static_cast<unsigned long long>(dropped));
+    if (total > 0 || dropped > 0)
+    {
+        printf("Validation layer: %llu messages (%llu distinct, %llu dropped), see %s\n", static_cast<unsigned long long>(total),
+               static_cast<unsigned long long>(m_written), static_cast<unsigned long long>(dropped), m_path);
+    }
+}
\ No newline at end of file
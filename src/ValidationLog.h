@@ -0,0 +1,88 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <thread>
+#include <unordered_map>
+
+// Collects validation messages off the threads that raise them.  The debug
+// callback only copies the message into a bounded lock-free ring (many
+// producers, one consumer) and returns; a background thread drains it into a
+// file.  Messages are deduplicated by hash: the first occurrence is written in
+// full, repeats are counted and reported at most once per REPEAT_INTERVAL_MS.
+// When the ring is full the message is dropped and counted rather than making
+// the driver thread wait.
+class ValidationLog
+{
+public:
+    explicit ValidationLog(const char *path);
+    ~ValidationLog();
+
+    ValidationLog(const ValidationLog &) = delete;
+    ValidationLog &operator=(const ValidationLog &) = delete;
+
+    // Safe from any thread; never blocks or allocates.  Returns false if the
+    // message had to be dropped.
+    bool push(VkDebugReportFlagsEXT flags, int32_t code, const char *layerPrefix, const char *message);
+
+    static VKAPI_ATTR VkBool32 VKAPI_CALL debugCallback(
+        VkDebugReportFlagsEXT flags,
+        VkDebugReportObjectTypeEXT objType,
+        uint64_t obj,
+        size_t location,
+        int32_t code,
+        const char *layerPrefix,
+        const char *msg,
+        void *userData);
+
+private:
+    static const uint32_t CAPACITY = 1024;          // Power of two
+    static const size_t MESSAGE_SIZE = 1024;        // Longer messages are truncated
+    static const size_t PREFIX_SIZE = 32;
+    static const uint32_t REPEAT_INTERVAL_MS = 1000;
+    static const uint32_t DRAIN_INTERVAL_MS = 2;
+
+    struct Slot
+    {
+        // Equal to the push position when free, position + 1 once written
+        std::atomic<uint64_t> sequence;
+        uint64_t hash;
+        VkDebugReportFlagsEXT flags;
+        int32_t code;
+        char prefix[PREFIX_SIZE];
+        char message[MESSAGE_SIZE];
+    };
+
+    struct Repeats
+    {
+        uint64_t total = 0;
+        uint64_t unreported = 0;  // Seen since the last line written for it
+        uint64_t lastReportMs = 0;
+        int32_t code = 0;
+    };
+
+    void drainLoop();
+    bool drain();
+    void write(const Slot &slot, uint64_t nowMs);
+    void reportRepeats(bool all, uint64_t nowMs);
+    void writeSummary();
+
+    const char *m_path;
+    std::unique_ptr<Slot[]> m_slots;
+
+    // Producers and the drainer keep to separate cache lines
+    std::atomic<uint64_t> m_head{ 0 };  // Next position to push
+    std::atomic<uint64_t> m_dropped{ 0 };
+    char m_padding[64];
+    uint64_t m_tail = 0;  // Next position to drain, drainer only
+
+    FILE *m_file = nullptr;
+    std::unordered_map<uint64_t, Repeats> m_repeats;
+    uint64_t m_written = 0;
+    std::atomic<bool> m_stop{ false };
+    std::thread m_drainer;
+};
\ No newline at end of file
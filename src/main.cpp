@@ -2,13 +2,58 @@
 #include <stdexcept>
 #include <functional>
 #include <cstdlib>
+#include <cstring>
 
 #include "App.h"
 
-int main()
+int main(int argc, char **argv)
 {
-    App app;
+    bool headless = false;
+    const char *deviceOverride = nullptr;
+    bool calibrate = false;
+    PresentPolicy presentPolicy = PresentPolicy::LowLatency;
+    const char *tracePath = nullptr;
+    for (int idx = 1; idx < argc; ++idx)
+    {
+        if (strcmp(argv[idx], "--headless") == 0)
+        {
+            headless = true;
+        }
+        else if (strcmp(argv[idx], "--device") == 0 && idx + 1 < argc)
+        {
+            // An index in enumeration order or part of the device name
+            deviceOverride = argv[++idx];
+        }
+        else if (strcmp(argv[idx], "--trace") == 0 && idx + 1 < argc)
+        {
+            tracePath = argv[++idx];
+        }
+        else if (strcmp(argv[idx], "--calibrate") == 0)
+        {
+            calibrate = true;
+        }
+        else if (strcmp(argv[idx], "--present") == 0 && idx + 1 < argc)
+        {
+            ++idx;
+            if (strcmp(argv[idx], "power") == 0)
+            {
+                presentPolicy = PresentPolicy::PowerSaving;
+            }
+            else if (strcmp(argv[idx], "benchmark") == 0)
+            {
+                presentPolicy = PresentPolicy::Benchmark;
+            }
+            else
+            {
+                presentPolicy = PresentPolicy::LowLatency;
+            }
+        }
+    }
+
+    TRACE_THREAD("main");
+    App app(headless, deviceOverride, calibrate, presentPolicy);
 
+    int status = EXIT_SUCCESS;
     try
     {
         app.run();
@@ -16,8 +61,14 @@ int main()
     catch (const std::runtime_error &e)
     {
         std::cerr << e.what() << std::endl;
-        return EXIT_FAILURE;
+        status = EXIT_FAILURE;
+    }
+
+    // Also after a failure: the trace shows how far startup got
+    if (tracePath != nullptr && Trace::write(tracePath))
+    {
+        printf("Trace written to %s\n", tracePath);
     }
 
-    return EXIT_SUCCESS;
+    return status;
 }
\ No newline at end of file